@@ -0,0 +1,38 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec3 inColor;
+
+struct Object {
+    vec2 offset;
+    vec2 scale;
+    vec4 bounds;
+    uint textureIndex;
+    uint samplerIndex;
+};
+
+// Storage buffer table of the descriptor heap
+layout(std430, set = 0, binding = 2) readonly buffer Objects {
+    Object objects[];
+} buffers[];
+
+layout(push_constant) uniform Draw {
+    uint objects;
+} draw;
+
+layout(location = 0) out vec3 color;
+layout(location = 1) out vec2 uv;
+layout(location = 2) flat out uint textureIndex;
+layout(location = 3) flat out uint samplerIndex;
+
+void main() {
+    // Culling points firstInstance of every surviving draw at its object
+    Object object = buffers[draw.objects].objects[gl_InstanceIndex];
+
+    gl_Position = vec4(inPosition * object.scale + object.offset, 0, 1);
+    color = inColor;
+    uv = inPosition + 0.5;
+    textureIndex = object.textureIndex;
+    samplerIndex = object.samplerIndex;
+}
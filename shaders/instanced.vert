@@ -0,0 +1,24 @@
+#version 450
+
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec3 inColor;
+
+// Per instance, written into the frame's part of the instance ring
+layout(location = 2) in vec2 instanceOffset;
+layout(location = 3) in vec2 instanceScale;
+layout(location = 4) in vec4 instanceColor;
+layout(location = 5) in uint instanceTexture;
+layout(location = 6) in uint instanceSampler;
+
+layout(location = 0) out vec3 color;
+layout(location = 1) out vec2 uv;
+layout(location = 2) flat out uint textureIndex;
+layout(location = 3) flat out uint samplerIndex;
+
+void main() {
+    gl_Position = vec4(inPosition * instanceScale + instanceOffset, 0, 1);
+    color = inColor * instanceColor.rgb;
+    uv = inPosition + 0.5;
+    textureIndex = instanceTexture;
+    samplerIndex = instanceSampler;
+}
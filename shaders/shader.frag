@@ -1,8 +1,52 @@
 #version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+// Texture, sampler and storage buffer tables of the descriptor heap
+layout(set = 0, binding = 0) uniform texture2D textures[];
+layout(set = 0, binding = 1) uniform sampler samplers[];
+layout(std430, set = 0, binding = 2) buffer Words {
+    uint words[];
+} buffers[];
+
+// Heap buffers of the frame's texture streaming tables, after the vertex shader's object
+layout(push_constant) uniform Streaming {
+    layout(offset = 24) uint residency;
+    uint feedback;
+} streaming;
 
 layout(location = 0) in vec3 color;
+layout(location = 1) in vec2 uv;
+layout(location = 2) flat in uint textureIndex;
+layout(location = 3) flat in uint samplerIndex;
+
 layout(location = 0) out vec4 outColor;
 
+// Off for the flat variant drawn while the textured one compiles, which then reads neither the heap nor the
+// streaming tables
+layout(constant_id = 0) const bool TEXTURED = true;
+// Darkens the color in eight steps, lets the bench scenes draw with any number of distinct pipelines
+layout(constant_id = 1) const uint SHADE = 0;
+
 void main() {
-    outColor = vec4(color, 1);
+    if (!TEXTURED) {
+        outColor = vec4(0.5, 0.5, 0.5, 1);
+        return;
+    }
+
+    // Heap slot of the texture's resident image and the mip level that image starts at
+    uint slot = buffers[streaming.residency].words[2 * textureIndex];
+    uint firstLevel = buffers[streaming.residency].words[2 * textureIndex + 1];
+
+    // Indirect draws of different materials may share a subgroup
+    vec4 texel = texture(sampler2D(textures[nonuniformEXT(slot)], samplers[nonuniformEXT(samplerIndex)]), uv);
+    outColor = vec4(color * texel.rgb * (1.0 - float(SHADE % 8u) / 16.0), 1);
+
+    // Queried by the whole quad, the derivatives are undefined inside the per block branch below
+    float lod = textureQueryLod(sampler2D(textures[nonuniformEXT(slot)], samplers[nonuniformEXT(samplerIndex)]), uv).y;
+
+    // One pixel of every 8x8 block reports the finest level it wants, which keeps the atomics cheap and still
+    // catches every texture bigger than a few pixels on screen
+    if ((uint(gl_FragCoord.x) & 7u) == 0u && (uint(gl_FragCoord.y) & 7u) == 0u) {
+        atomicMin(buffers[streaming.feedback].words[textureIndex], firstLevel + uint(max(lod, 0.0)));
+    }
 }
@@ -1,20 +1,24 @@
 #version 450
 
-layout(location = 0) out vec3 color;
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec3 inColor;
 
-vec3 colors[3] = {
-    vec3(1, 0, 0),
-    vec3(0, 1, 0),
-    vec3(0, 0, 1)
-};
+layout(push_constant) uniform Object {
+    vec2 offset;
+    vec2 scale;
+    uint textureIndex;
+    uint samplerIndex;
+} object;
 
-vec2 positions[3] = {
-    vec2(0.0, -0.5),
-    vec2(0.5, 0.5),
-    vec2(-0.5, 0.5)
-};
+layout(location = 0) out vec3 color;
+layout(location = 1) out vec2 uv;
+layout(location = 2) flat out uint textureIndex;
+layout(location = 3) flat out uint samplerIndex;
 
 void main() {
-    gl_Position = vec4(positions[gl_VertexIndex], 0, 1);
-    color = colors[gl_VertexIndex];
-}
\ No newline at end of file
+    gl_Position = vec4(inPosition * object.scale + object.offset, 0, 1);
+    color = inColor;
+    uv = inPosition + 0.5;
+    textureIndex = object.textureIndex;
+    samplerIndex = object.samplerIndex;
+}
@@ -0,0 +1,175 @@
+//
+// Created by m4tex on 17/10/26.
+//
+
+#include "AppConfig.h"
+
+//std
+#include <stdexcept>
+#include <algorithm>
+#include <thread>
+
+namespace m4x {
+    namespace {
+        uint32_t parseCount(const std::string& option, const char* value) {
+            try {
+                return static_cast<uint32_t>(std::stoul(value));
+            } catch (const std::exception&) {
+                throw std::runtime_error("Invalid value for " + option + ": " + value);
+            }
+        }
+
+        float parseFactor(const std::string& option, const char* value) {
+            try {
+                float factor = std::stof(value);
+                if (factor > 0.0f) {
+                    return factor;
+                }
+            } catch (const std::exception&) {}
+
+            throw std::runtime_error("Invalid value for " + option + ": " + value);
+        }
+
+        BenchScene parseBenchScene(const std::string& option, const std::string& value) {
+            if (value == "triangles") {
+                return BenchScene::Triangles;
+            } else if (value == "draws") {
+                return BenchScene::Draws;
+            } else if (value == "pipelines") {
+                return BenchScene::Pipelines;
+            } else if (value == "uploads") {
+                return BenchScene::Uploads;
+            }
+
+            throw std::runtime_error("Invalid value for " + option + ": " + value);
+        }
+
+        PresentPolicy parsePresentPolicy(const std::string& option, const std::string& value) {
+            if (value == "fifo") {
+                return PresentPolicy::Fifo;
+            } else if (value == "fifo_relaxed") {
+                return PresentPolicy::FifoRelaxed;
+            } else if (value == "mailbox") {
+                return PresentPolicy::Mailbox;
+            } else if (value == "immediate") {
+                return PresentPolicy::Immediate;
+            }
+
+            throw std::runtime_error("Invalid value for " + option + ": " + value);
+        }
+    }
+
+    AppConfig AppConfig::FromArgs(int argc, char** argv) {
+        AppConfig config{};
+
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+
+            // Every option except the flags takes a value
+            auto next = [&]() -> const char* {
+                if (i + 1 >= argc) {
+                    throw std::runtime_error("Missing value for " + arg);
+                }
+                return argv[++i];
+            };
+
+            if (arg == "--headless") {
+                config.headless = true;
+            } else if (arg == "--device") {
+                config.device = next();
+            } else if (arg == "--frames") {
+                config.frameCount = parseCount(arg, next());
+            } else if (arg == "--frames-in-flight") {
+                config.framesInFlight = std::max(parseCount(arg, next()), 1u);
+            } else if (arg == "--width") {
+                config.width = std::max(parseCount(arg, next()), 1u);
+            } else if (arg == "--height") {
+                config.height = std::max(parseCount(arg, next()), 1u);
+            } else if (arg == "--output") {
+                config.outputDirectory = next();
+            } else if (arg == "--pipeline-cache") {
+                config.pipelineCacheDirectory = next();
+            } else if (arg == "--threads") {
+                config.recordingThreads = parseCount(arg, next());
+            } else if (arg == "--objects") {
+                config.objectCount = std::max(parseCount(arg, next()), 1u);
+            } else if (arg == "--materials") {
+                config.materialCount = std::max(parseCount(arg, next()), 1u);
+            } else if (arg == "--texture-pack") {
+                config.texturePack = next();
+            } else if (arg == "--texture-budget") {
+                config.textureBudget = parseCount(arg, next());
+            } else if (arg == "--bench-recording") {
+                config.benchmarkRecording = true;
+            } else if (arg == "--gpu-driven") {
+                config.gpuDriven = true;
+            } else if (arg == "--bench-gpu-driven") {
+                config.benchmarkGpuDriven = true;
+                config.gpuDriven = true;
+            } else if (arg == "--instanced") {
+                config.instanced = true;
+            } else if (arg == "--bench-instancing") {
+                config.benchmarkInstancing = true;
+                config.instanced = true;
+            } else if (arg == "--serial-queues") {
+                config.serialQueues = true;
+            } else if (arg == "--bench-async-queues") {
+                config.benchmarkAsyncQueues = true;
+                config.gpuDriven = true;
+            } else if (arg == "--bench-compute") {
+                config.benchmarkCompute = true;
+            } else if (arg == "--legacy-render-pass") {
+                config.legacyRenderPass = true;
+            } else if (arg == "--post-passes") {
+                config.postPasses = parseCount(arg, next());
+            } else if (arg == "--zoom") {
+                config.zoom = parseFactor(arg, next());
+            } else if (arg == "--present") {
+                config.presentPolicy = parsePresentPolicy(arg, next());
+            } else if (arg == "--max-lead") {
+                config.maxFrameLead = parseCount(arg, next());
+            } else if (arg == "--low-latency") {
+                config.lowLatency = true;
+            } else if (arg == "--profile-cpu") {
+                config.profileCpu = true;
+            } else if (arg == "--cpu-trace") {
+                config.cpuTraceFile = next();
+                config.profileCpu = true;
+            } else if (arg == "--profile-gpu") {
+                config.profileGpu = true;
+            } else if (arg == "--gpu-trace") {
+                config.gpuTraceFile = next();
+                config.profileGpu = true;
+            } else if (arg == "--scene") {
+                config.benchScene = parseBenchScene(arg, next());
+            } else if (arg == "--scene-size") {
+                config.benchSize = std::max(parseCount(arg, next()), 1u);
+            } else if (arg == "--warmup") {
+                config.warmupFrames = parseCount(arg, next());
+            } else if (arg == "--report") {
+                config.reportFile = next();
+            } else {
+                throw std::runtime_error("Unknown option: " + arg);
+            }
+        }
+
+        // Nothing may be queued behind the frame whose input was just sampled
+        if (config.lowLatency) {
+            config.maxFrameLead = 1;
+        }
+
+        // The scenes are drawn by the regular paths, only scaled
+        if (config.benchScene == BenchScene::Draws || config.benchScene == BenchScene::Pipelines) {
+            config.objectCount = config.benchSize;
+        }
+        if (config.benchScene == BenchScene::Pipelines) {
+            config.instanced = true;
+        }
+
+        if (config.recordingThreads == 0) {
+            config.recordingThreads = std::max(std::thread::hardware_concurrency(), 1u);
+        }
+
+        return config;
+    }
+} // m4x
@@ -0,0 +1,236 @@
+/** @file */
+
+//
+// Created by m4tex on 17/10/26.
+//
+
+#pragma once
+
+// std
+#include <cstdint>
+#include <string>
+
+namespace m4x {
+    /**
+     * Default depth of the frames in flight ring
+     */
+    const uint32_t DEFAULT_FRAMES_IN_FLIGHT = 2;
+
+    /**
+     * How finished frames reach the screen, maps onto the Vulkan present modes
+     */
+    enum class PresentPolicy {
+        // Waits for the vertical blank, no tearing
+        Fifo,
+        // Like Fifo, but a late frame is shown right away and may tear
+        FifoRelaxed,
+        // Replaces the queued frame with the newest one, no tearing and no waiting
+        Mailbox,
+        // Shows every frame right away and tears
+        Immediate
+    };
+
+    /**
+     * Synthetic scenes of the m4xbench runs, each scaled by AppConfig::benchSize
+     */
+    enum class BenchScene {
+        None,
+        // One draw of a mesh with that many triangles
+        Triangles,
+        // That many objects, each its own draw
+        Draws,
+        // That many objects drawn instanced, each with its own specialization of the pipeline
+        Pipelines,
+        // That many bytes uploaded through the upload queue every frame
+        Uploads
+    };
+
+    /**
+     * Runtime options of the application, filled in from the command line
+     */
+    struct AppConfig {
+        uint32_t framesInFlight = DEFAULT_FRAMES_IN_FLIGHT;
+        uint32_t width          = 800;
+        uint32_t height         = 800;
+
+        /**
+         * GPU to use, an enumeration index or part of its name. Empty uses M4X_DEVICE or the best scoring one.
+         */
+        std::string device;
+
+        /**
+         * Renders into offscreen images without GLFW or a swapchain
+         */
+        bool headless = false;
+
+        /**
+         * How many frames a headless run renders before exiting
+         */
+        uint32_t frameCount = 300;
+
+        /**
+         * Directory headless frames get written to as .ppm files, kept in memory if empty
+         */
+        std::string outputDirectory;
+
+        /**
+         * Directory the pipeline cache blob is loaded from and saved to
+         */
+        std::string pipelineCacheDirectory = "cache";
+
+        /**
+         * Threads recording the secondary command buffers, 0 picks one per hardware thread
+         */
+        uint32_t recordingThreads = 0;
+
+        /**
+         * Amount of mesh copies drawn every frame, laid out in a grid
+         */
+        uint32_t objectCount = 1;
+
+        /**
+         * Amount of textured materials the objects cycle through, all of them drawn from the descriptor heap
+         */
+        uint32_t materialCount = 4;
+
+        /**
+         * Texture pack the materials stream from, generated when it's missing or holds a different amount
+         */
+        std::string texturePack = "cache/materials.m4xt";
+
+        /**
+         * Megabytes the streamed textures may take, 0 follows VK_EXT_memory_budget
+         */
+        uint32_t textureBudget = 0;
+
+        /**
+         * Repeats the headless run for every recording thread count from 1 up to recordingThreads
+         */
+        bool benchmarkRecording = false;
+
+        /**
+         * Culls and builds the draws on the GPU and draws them indirectly instead of recording every object
+         */
+        bool gpuDriven = false;
+
+        /**
+         * Repeats the headless GPU driven run for 1k to 1M objects and reports the CPU cost per frame
+         */
+        bool benchmarkGpuDriven = false;
+
+        /**
+         * Groups the objects by pipeline and mesh and draws every group instanced, their placement written into
+         * a per frame instance ring. GPU driven rendering takes precedence.
+         */
+        bool instanced = false;
+
+        /**
+         * Repeats the headless instanced run with the objects split into more and more draws and reports the
+         * frame time per draw call count
+         */
+        bool benchmarkInstancing = false;
+
+        /**
+         * Keeps culling and uploads on the graphics queue even when the device has dedicated compute and
+         * transfer families
+         */
+        bool serialQueues = false;
+
+        /**
+         * Repeats the headless GPU driven run with streaming uploads, once on the graphics queue alone and
+         * once on the async compute and transfer queues, and reports the gain from the overlap
+         */
+        bool benchmarkAsyncQueues = false;
+
+        /**
+         * Sums a large buffer with the reduce.comp compute jobs, once batched into a single submission and once
+         * submitted job by job, and reports the throughput of both
+         */
+        bool benchmarkCompute = false;
+
+        /**
+         * Renders through a VkRenderPass and framebuffers even when the device supports dynamic rendering
+         */
+        bool legacyRenderPass = false;
+
+        /**
+         * Headless frames get copied through this many transient images of the render graph before the
+         * readback, which loads the graph's barriers and memory aliasing without changing the output
+         */
+        uint32_t postPasses = 0;
+
+        /**
+         * Magnification of the object grid, anything above 1 pushes objects out of view
+         */
+        float zoom = 1.0f;
+
+        /**
+         * Present mode of the swapchain, the nearest supported one is used if it isn't available
+         */
+        PresentPolicy presentPolicy = PresentPolicy::Fifo;
+
+        /**
+         * Frames the CPU may run ahead of the GPU, 0 allows the whole frames in flight ring
+         */
+        uint32_t maxFrameLead = 0;
+
+        /**
+         * Waits for the previous frame before starting the next and samples the input only right before
+         * recording, trading throughput for latency
+         */
+        bool lowLatency = false;
+
+        /**
+         * Traces the phases of every frame on the CPU, needs a build with M4X_CPU_TRACE
+         */
+        bool profileCpu = false;
+
+        /**
+         * File the CPU scopes of every thread are written to as a Chrome trace, also turns on profileCpu
+         */
+        std::string cpuTraceFile;
+
+        /**
+         * Times every pass on the GPU with timestamp queries and gathers pipeline statistics
+         */
+        bool profileGpu = false;
+
+        /**
+         * Gathers the pipeline statistics of profileGpu, without them the passes only get timestamps
+         */
+        bool profileGpuStatistics = true;
+
+        /**
+         * File the GPU passes are written to as a Chrome trace, also turns on profileGpu
+         */
+        std::string gpuTraceFile;
+
+        /**
+         * Scene a headless run renders and reports on instead of the usual output, see m4xbench
+         */
+        BenchScene benchScene = BenchScene::None;
+
+        /**
+         * Triangles, draws, pipelines or upload bytes of the bench scene
+         */
+        uint32_t benchSize = 1000;
+
+        /**
+         * Frames rendered before the bench scene is measured
+         */
+        uint32_t warmupFrames = 30;
+
+        /**
+         * File the bench scene report is written to as JSON
+         */
+        std::string reportFile = "bench.json";
+
+        /**
+         * Parses the command line
+         * @param argc [in] Argument count as passed to main
+         * @param argv [in] Arguments as passed to main
+         * @return The parsed configuration, defaults for anything not given
+         */
+        static AppConfig FromArgs(int argc, char** argv);
+    };
+} // m4x
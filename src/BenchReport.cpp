@@ -0,0 +1,97 @@
+//
+// Created by m4tex on 17/10/26.
+//
+
+#include "BenchReport.h"
+
+//std
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <numeric>
+#include <stdexcept>
+
+namespace m4x {
+    namespace {
+        // Nearest rank on the sorted samples
+        double percentile(const std::vector<double>& sorted, double fraction) {
+            if (sorted.empty()) {
+                return 0.0;
+            }
+            return sorted[static_cast<size_t>(fraction * static_cast<double>(sorted.size() - 1))];
+        }
+
+        std::string escapeJson(const std::string& text) {
+            std::string escaped;
+            for (char c : text) {
+                if (c == '"' || c == '\\') {
+                    escaped += '\\';
+                }
+                escaped += c;
+            }
+            return escaped;
+        }
+    }
+
+    void BenchReport::writeJson(std::ostream& out) const {
+        std::vector<double> sorted = cpuFrameMs;
+        std::sort(sorted.begin(), sorted.end());
+        double mean = sorted.empty() ? 0.0 : std::accumulate(sorted.begin(), sorted.end(), 0.0) /
+                                             static_cast<double>(sorted.size());
+
+        out << std::fixed << std::setprecision(4);
+        out << "{\n";
+        out << "  \"scene\": \"" << escapeJson(scene) << "\",\n";
+        out << "  \"size\": " << size << ",\n";
+        out << "  \"device\": \"" << escapeJson(device) << "\",\n";
+        out << "  \"extent\": [" << extent.width << ", " << extent.height << "],\n";
+        out << "  \"frames\": " << cpuFrameMs.size() << ",\n";
+        out << "  \"warmupFrames\": " << warmupFrames << ",\n";
+
+        out << "  \"startupMs\": {";
+        for (size_t i = 0; i < startup.size(); ++i) {
+            out << (i == 0 ? "\n" : ",\n") << "    \"" << escapeJson(startup[i].name) << "\": " << startup[i].ms;
+        }
+        out << "\n  },\n";
+
+        out << "  \"cpuFrameMs\": {\"mean\": " << mean << ", \"p50\": " << percentile(sorted, 0.50)
+            << ", \"p90\": " << percentile(sorted, 0.90) << ", \"p99\": " << percentile(sorted, 0.99)
+            << ", \"max\": " << (sorted.empty() ? 0.0 : sorted.back()) << "},\n";
+        out << "  \"cpuRecordMs\": " << recordMs << ",\n";
+
+        out << "  \"gpuMs\": {";
+        for (size_t i = 0; i < gpuPasses.size(); ++i) {
+            const PassTiming& pass = gpuPasses[i];
+            out << (i == 0 ? "\n" : ",\n") << "    \"" << escapeJson(pass.name) << "\": {\"samples\": "
+                << pass.samples << ", \"p50\": " << pass.p50Ms << ", \"p99\": " << pass.p99Ms << ", \"max\": "
+                << pass.maxMs << "}";
+        }
+        out << "\n  },\n";
+
+        out << "  \"memory\": [";
+        for (size_t i = 0; i < memory.size(); ++i) {
+            const HeapStats& heap = memory[i];
+            out << (i == 0 ? "\n" : ",\n") << "    {\"heap\": " << heap.heapIndex << ", \"size\": " << heap.heapSize
+                << ", \"reserved\": " << heap.reservedBytes << ", \"used\": " << heap.usedBytes << ", \"requested\": "
+                << heap.requestedBytes << ", \"allocations\": " << heap.allocationCount << "}";
+        }
+        out << "\n  ]\n";
+        out << "}" << std::defaultfloat << std::endl;
+    }
+
+    void BenchReport::writeJson(const std::filesystem::path& path) const {
+        if (path.has_parent_path()) {
+            std::filesystem::create_directories(path.parent_path());
+        }
+
+        std::ofstream file(path, std::ios::trunc);
+        if (!file) {
+            throw std::runtime_error("Failed to create the bench report " + path.string());
+        }
+
+        writeJson(file);
+        if (!file) {
+            throw std::runtime_error("Failed to write the bench report " + path.string());
+        }
+    }
+} // m4x
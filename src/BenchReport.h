@@ -0,0 +1,64 @@
+/** @file */
+
+//
+// Created by m4tex on 17/10/26.
+//
+
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include "GpuProfiler.h"
+#include "MemoryAllocator.h"
+
+// std
+#include <cstdint>
+#include <filesystem>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace m4x {
+    /**
+     * Time from the previous phase of the startup to the end of this one
+     */
+    struct StartupPhase {
+        std::string name;
+        double      ms = 0.0;
+    };
+
+    /**
+     * Measurements of one run of a bench scene, written as JSON so runs of different commits can be compared by
+     * scripts
+     */
+    struct BenchReport {
+        std::string scene;
+        uint32_t    size         = 0;
+        std::string device;
+        VkExtent2D  extent{};
+        uint32_t    warmupFrames = 0;
+
+        std::vector<StartupPhase> startup;
+        // Wall time of every measured frame, fence wait included
+        std::vector<double> cpuFrameMs;
+        // Average CPU time recording a frame's primary command buffer
+        double recordMs = 0.0;
+        // Empty without timestamp support, percentiles over the last frames of the run
+        std::vector<PassTiming> gpuPasses;
+        // After the run
+        std::vector<HeapStats> memory;
+
+        /**
+         * Writes the report with the percentiles of the frame times
+         * @param out [in] Stream to write the JSON document to
+         */
+        void writeJson(std::ostream& out) const;
+
+        /**
+         * Writes the report into a file, throws if it can't be written
+         * @param path [in] File to write, replaced if it exists
+         */
+        void writeJson(const std::filesystem::path& path) const;
+    };
+} // m4x
@@ -0,0 +1,145 @@
+//
+// Created by m4tex on 17/10/26.
+//
+
+#include "CommandRecorder.h"
+#include "CpuTracer.h"
+
+//std
+#include <stdexcept>
+#include <chrono>
+#include <iomanip>
+
+namespace m4x {
+    void CommandRecorder::create(VkDevice device, uint32_t queueFamily, uint32_t framesInFlight,
+                                 uint32_t workerCount) {
+        this->device = device;
+        jobSystem.create(workerCount);
+
+        VkCommandPoolCreateInfo createInfo{};
+        createInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        // Reset as a whole every frame, individual buffers never are
+        createInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        createInfo.queueFamilyIndex = queueFamily;
+
+        pools.resize(framesInFlight);
+        for (auto& framePools : pools) {
+            framePools.resize(jobSystem.workerCount());
+
+            for (auto& pool : framePools) {
+                if (VK_SUCCESS != vkCreateCommandPool(device, &createInfo, nullptr, &pool.pool)) {
+                    throw std::runtime_error("Failed to create a worker command pool");
+                }
+            }
+        }
+
+        workerStats.assign(jobSystem.workerCount(), {});
+        recordedFrames = 0;
+        recordSeconds = 0.0;
+    }
+
+    void CommandRecorder::destroy() {
+        jobSystem.destroy();
+
+        for (auto& framePools : pools) {
+            for (auto& pool : framePools) {
+                vkDestroyCommandPool(device, pool.pool, nullptr);
+            }
+        }
+
+        pools.clear();
+    }
+
+    void CommandRecorder::beginFrame(uint32_t frame) {
+        for (auto& pool : pools[frame]) {
+            if (pool.used > 0) {
+                vkResetCommandPool(device, pool.pool, 0);
+                pool.used = 0;
+            }
+        }
+    }
+
+    VkCommandBuffer CommandRecorder::nextBuffer(WorkerPool& pool) {
+        if (pool.used == pool.buffers.size()) {
+            VkCommandBufferAllocateInfo allocInfo{};
+            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocInfo.commandPool = pool.pool;
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+            allocInfo.commandBufferCount = 1;
+
+            VkCommandBuffer commandBuffer;
+            if (VK_SUCCESS != vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer)) {
+                throw std::runtime_error("Failed to allocate a secondary command buffer");
+            }
+
+            pool.buffers.push_back(commandBuffer);
+        }
+
+        return pool.buffers[pool.used++];
+    }
+
+    std::vector<VkCommandBuffer> CommandRecorder::record(uint32_t frame,
+                                                         const VkCommandBufferInheritanceInfo& inheritance,
+                                                         uint32_t chunkCount, const RecordFunction& record) {
+        auto start = std::chrono::steady_clock::now();
+
+        std::vector<VkCommandBuffer> commandBuffers(chunkCount);
+        std::vector<JobSystem::Job> jobs;
+
+        for (uint32_t chunk = 0; chunk < chunkCount; ++chunk) {
+            jobs.emplace_back([&, chunk](uint32_t worker) {
+                M4X_TRACE_SCOPE("record chunk");
+                auto jobStart = std::chrono::steady_clock::now();
+
+                // Whichever worker ends up running the chunk records it from its own pool
+                VkCommandBuffer commandBuffer = nextBuffer(pools[frame][worker]);
+
+                VkCommandBufferBeginInfo beginInfo{};
+                beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+                beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT |
+                                  VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+                beginInfo.pInheritanceInfo = &inheritance;
+
+                if (VK_SUCCESS != vkBeginCommandBuffer(commandBuffer, &beginInfo)) {
+                    throw std::runtime_error("Failed to begin a secondary command buffer");
+                }
+
+                record(commandBuffer, chunk);
+
+                if (VK_SUCCESS != vkEndCommandBuffer(commandBuffer)) {
+                    throw std::runtime_error("Failed to record a secondary command buffer");
+                }
+
+                commandBuffers[chunk] = commandBuffer;
+
+                workerStats[worker].recordSeconds +=
+                        std::chrono::duration<double>(std::chrono::steady_clock::now() - jobStart).count();
+                workerStats[worker].chunks++;
+            });
+        }
+
+        jobSystem.run(jobs);
+
+        recordSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        recordedFrames++;
+
+        return commandBuffers;
+    }
+
+    double CommandRecorder::averageRecordMs() const {
+        return recordedFrames > 0 ? recordSeconds * 1000.0 / recordedFrames : 0.0;
+    }
+
+    void CommandRecorder::printStats(std::ostream& out) const {
+        out << "Recording: " << std::fixed << std::setprecision(3) << averageRecordMs() << " ms/frame on "
+            << workerStats.size() << " threads" << std::endl;
+
+        for (size_t i = 0; i < workerStats.size(); ++i) {
+            double perFrame = recordedFrames > 0 ? workerStats[i].recordSeconds * 1000.0 / recordedFrames : 0.0;
+            out << "  thread " << i << ": " << perFrame << " ms/frame, " << workerStats[i].chunks << " chunks"
+                << std::endl;
+        }
+
+        out << std::defaultfloat;
+    }
+} // m4x
@@ -0,0 +1,98 @@
+/** @file */
+
+//
+// Created by m4tex on 17/10/26.
+//
+
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include "JobSystem.h"
+
+// std
+#include <functional>
+#include <ostream>
+#include <vector>
+
+namespace m4x {
+    /**
+     * Records secondary command buffers in parallel on a JobSystem.
+     * Every worker has its own command pool per frame in flight, so pools are never shared between threads
+     * and a frame's pools can be reset as a whole once its fence signaled.
+     */
+    class CommandRecorder {
+    public:
+        /**
+         * Records one chunk of work into a secondary command buffer that has already been begun
+         */
+        using RecordFunction = std::function<void(VkCommandBuffer commandBuffer, uint32_t chunk)>;
+
+        /**
+         * @param device [in] Logical device
+         * @param queueFamily [in] Family of the queue the primary buffers are submitted to
+         * @param framesInFlight [in] Depth of the frames in flight ring
+         * @param workerCount [in] Amount of recording threads
+         */
+        void create(VkDevice device, uint32_t queueFamily, uint32_t framesInFlight, uint32_t workerCount);
+
+        /**
+         * Stops the workers and destroys the pools, nothing recorded may still be executing
+         */
+        void destroy();
+
+        /**
+         * Resets the pools of a frame slot, the slot's previous submission must have completed
+         * @param frame [in] Slot of the frames in flight ring
+         */
+        void beginFrame(uint32_t frame);
+
+        /**
+         * Records chunkCount secondary command buffers in parallel
+         * @param frame [in] Slot passed to beginFrame()
+         * @param inheritance [in] Render pass, subpass and framebuffer the buffers are executed in, or a
+         * VkCommandBufferInheritanceRenderingInfo in pNext for dynamic rendering
+         * @param chunkCount [in] Amount of buffers to record
+         * @param record [in] Called once per chunk from a worker thread
+         * @return The recorded buffers in chunk order, ready for vkCmdExecuteCommands
+         */
+        std::vector<VkCommandBuffer> record(uint32_t frame, const VkCommandBufferInheritanceInfo& inheritance,
+                                            uint32_t chunkCount, const RecordFunction& record);
+
+        [[nodiscard]] uint32_t workerCount() const { return jobSystem.workerCount(); }
+
+        /**
+         * Average wall time of record() and time each thread spent recording, per frame
+         */
+        void printStats(std::ostream& out) const;
+
+        [[nodiscard]] double averageRecordMs() const;
+
+    private:
+        struct WorkerPool {
+            VkCommandPool                pool = VK_NULL_HANDLE;
+            std::vector<VkCommandBuffer> buffers;
+            // Buffers of the pool handed out since the last reset
+            uint32_t                     used = 0;
+        };
+
+        struct WorkerStats {
+            double   recordSeconds = 0.0;
+            uint32_t chunks        = 0;
+        };
+
+        VkDevice device = VK_NULL_HANDLE;
+        JobSystem jobSystem;
+
+        // Indexed [frame][worker]
+        std::vector<std::vector<WorkerPool>> pools;
+        // Only ever touched by the worker it belongs to while recording
+        std::vector<WorkerStats> workerStats;
+
+        uint32_t recordedFrames = 0;
+        double   recordSeconds  = 0.0;
+
+        VkCommandBuffer nextBuffer(WorkerPool& pool);
+    };
+} // m4x
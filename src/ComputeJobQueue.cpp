@@ -0,0 +1,382 @@
+//
+// Created by m4tex on 17/10/26.
+//
+
+#include "ComputeJobQueue.h"
+#include "VkUtils.h"
+
+//std
+#include <stdexcept>
+#include <algorithm>
+#include <array>
+#include <iomanip>
+
+namespace m4x {
+    ComputeBinding ComputeBinding::StorageBuffer(uint32_t binding, const Buffer* buffer, VkDeviceSize offset,
+                                                 VkDeviceSize range) {
+        ComputeBinding result;
+        result.binding = binding;
+        result.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        result.buffer = buffer->buffer;
+        result.offset = offset;
+        result.range = range;
+        return result;
+    }
+
+    ComputeBinding ComputeBinding::StorageImage(uint32_t binding, VkImageView imageView) {
+        ComputeBinding result;
+        result.binding = binding;
+        result.type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        result.imageView = imageView;
+        return result;
+    }
+
+    void ComputeJobQueue::create(VkDevice device, VkPipelineCache pipelineCache, ShaderLibrary& shaderLibrary,
+                                 uint32_t family, VkQueue queue) {
+        this->device = device;
+        this->pipelineCache = pipelineCache;
+        this->shaderLibrary = &shaderLibrary;
+        this->queue = queue;
+
+        VkCommandPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        poolInfo.queueFamilyIndex = family;
+
+        if (VK_SUCCESS != vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool)) {
+            throw std::runtime_error("Failed to create the compute job command pool");
+        }
+
+        timeline = VkUtils::CreateTimelineSemaphore(device);
+        lastValue = 0;
+    }
+
+    void ComputeJobQueue::destroy() {
+        submit();
+        while (retireOldest(true)) {}
+
+        for (auto& batch : batches) {
+            vkDestroyDescriptorPool(device, batch.descriptorPool, nullptr);
+        }
+        batches.clear();
+
+        for (auto& [name, pipeline] : pipelines) {
+            vkDestroyPipeline(device, pipeline->pipeline, nullptr);
+            vkDestroyPipelineLayout(device, pipeline->layout, nullptr);
+        }
+        pipelines.clear();
+
+        vkDestroySemaphore(device, timeline, nullptr);
+        timeline = VK_NULL_HANDLE;
+
+        vkDestroyCommandPool(device, commandPool, nullptr);
+        commandPool = VK_NULL_HANDLE;
+    }
+
+    const ComputePipeline& ComputeJobQueue::pipeline(const std::string& shader) {
+        auto it = pipelines.find(shader);
+        if (it != pipelines.end()) {
+            return *it->second;
+        }
+
+        const ShaderReflection& reflection = shaderLibrary->reflection(shader);
+        if (reflection.stage != VK_SHADER_STAGE_COMPUTE_BIT) {
+            throw std::runtime_error(shader + " isn't a compute shader");
+        }
+        if (reflection.bindings.size() > COMPUTE_MAX_BINDINGS) {
+            throw std::runtime_error(shader + " declares more than " + std::to_string(COMPUTE_MAX_BINDINGS) +
+                                     " bindings");
+        }
+        for (const auto& binding : reflection.bindings) {
+            bool storage = binding.type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER ||
+                           binding.type == VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+            if (binding.set != 0 || binding.count != 1 || !storage) {
+                throw std::runtime_error(shader + " may only declare single storage buffers and images in set 0");
+            }
+        }
+
+        auto computePipeline = std::make_unique<ComputePipeline>();
+        ReflectedLayout reflected = shaderLibrary->createPipelineLayout({ shader });
+        computePipeline->layout = reflected.layout;
+        computePipeline->setLayout = reflected.setLayouts.empty() ? VK_NULL_HANDLE : reflected.setLayouts[0];
+        computePipeline->bindings = reflection.bindings;
+        computePipeline->constantsSize = reflection.pushConstantSize;
+
+        VkComputePipelineCreateInfo pipelineInfo{};
+        pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        pipelineInfo.stage.module = shaderLibrary->load(shader);
+        pipelineInfo.stage.pName = "main";
+        pipelineInfo.layout = computePipeline->layout;
+
+        if (VK_SUCCESS != vkCreateComputePipelines(device, pipelineCache, 1, &pipelineInfo, nullptr,
+                                                   &computePipeline->pipeline)) {
+            vkDestroyPipelineLayout(device, computePipeline->layout, nullptr);
+            throw std::runtime_error("Failed to create the compute pipeline of " + shader);
+        }
+
+        return *pipelines.emplace(shader, std::move(computePipeline)).first->second;
+    }
+
+    uint64_t ComputeJobQueue::dispatch(const ComputePipeline& pipeline, const std::vector<ComputeBinding>& bindings,
+                                       const void* constants, uint32_t constantsSize, glm::uvec3 groups) {
+        if (constantsSize != pipeline.constantsSize) {
+            throw std::runtime_error("Compute job push constants don't match the shader's");
+        }
+        if (bindings.size() != pipeline.bindings.size()) {
+            throw std::runtime_error("Compute job bindings don't match the shader's");
+        }
+
+        std::vector<VkDescriptorBufferInfo> bufferInfos(bindings.size());
+        std::vector<VkDescriptorImageInfo> imageInfos(bindings.size());
+        std::vector<VkWriteDescriptorSet> writes(bindings.size());
+
+        for (size_t i = 0; i < bindings.size(); ++i) {
+            const ComputeBinding& binding = bindings[i];
+            auto declared = std::find_if(pipeline.bindings.begin(), pipeline.bindings.end(),
+                                         [&](const ReflectedBinding& reflected) {
+                                             return reflected.binding == binding.binding;
+                                         });
+            if (declared == pipeline.bindings.end() || declared->type != binding.type) {
+                throw std::runtime_error("Compute job binding " + std::to_string(binding.binding) +
+                                         " doesn't match the shader's");
+            }
+
+            writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            writes[i].dstBinding = binding.binding;
+            writes[i].descriptorCount = 1;
+            writes[i].descriptorType = binding.type;
+            if (binding.type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER) {
+                bufferInfos[i] = { binding.buffer, binding.offset, binding.range };
+                writes[i].pBufferInfo = &bufferInfos[i];
+            } else {
+                imageInfos[i] = { VK_NULL_HANDLE, binding.imageView, VK_IMAGE_LAYOUT_GENERAL };
+                writes[i].pImageInfo = &imageInfos[i];
+            }
+        }
+
+        if (recording && batches[*recording].jobs == COMPUTE_BATCH_JOBS) {
+            submit();
+            jobStats.earlySubmissions++;
+        }
+
+        Batch& batch = currentBatch();
+        vkCmdBindPipeline(batch.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline.pipeline);
+
+        if (pipeline.setLayout != VK_NULL_HANDLE) {
+            VkDescriptorSetAllocateInfo allocInfo{};
+            allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+            allocInfo.descriptorPool = batch.descriptorPool;
+            allocInfo.descriptorSetCount = 1;
+            allocInfo.pSetLayouts = &pipeline.setLayout;
+
+            VkDescriptorSet set;
+            if (VK_SUCCESS != vkAllocateDescriptorSets(device, &allocInfo, &set)) {
+                throw std::runtime_error("Failed to allocate a compute job descriptor set");
+            }
+
+            for (auto& write : writes) {
+                write.dstSet = set;
+            }
+            vkUpdateDescriptorSets(device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+
+            vkCmdBindDescriptorSets(batch.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline.layout, 0, 1, &set,
+                                    0, nullptr);
+        }
+
+        if (constantsSize > 0) {
+            vkCmdPushConstants(batch.commandBuffer, pipeline.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, constantsSize,
+                               constants);
+        }
+
+        vkCmdDispatch(batch.commandBuffer, groups.x, groups.y, groups.z);
+        batch.jobs++;
+        jobStats.jobs++;
+
+        return lastValue + 1;
+    }
+
+    void ComputeJobQueue::barrier() {
+        // Barriers reach back into earlier submissions on the queue, so one at the start of a batch orders it
+        // against the batches submitted before
+        VkMemoryBarrier memoryBarrier{};
+        memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+        vkCmdPipelineBarrier(currentBatch().commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+    }
+
+    uint64_t ComputeJobQueue::submit() {
+        if (!recording) {
+            return lastValue;
+        }
+
+        size_t index = *recording;
+        Batch& batch = batches[index];
+        recording.reset();
+
+        // The results are read through mapped memory once the timeline reaches the value
+        VkMemoryBarrier hostBarrier{};
+        hostBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        hostBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+
+        vkCmdPipelineBarrier(batch.commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0,
+                             1, &hostBarrier, 0, nullptr, 0, nullptr);
+
+        if (VK_SUCCESS != vkEndCommandBuffer(batch.commandBuffer)) {
+            throw std::runtime_error("Failed to record a compute job command buffer");
+        }
+
+        batch.value = ++lastValue;
+
+        VkTimelineSemaphoreSubmitInfo timelineInfo{};
+        timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+        timelineInfo.signalSemaphoreValueCount = 1;
+        timelineInfo.pSignalSemaphoreValues = &batch.value;
+
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.pNext = &timelineInfo;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &batch.commandBuffer;
+        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.pSignalSemaphores = &timeline;
+
+        if (VK_SUCCESS != vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE)) {
+            throw std::runtime_error("Failed to submit a compute job batch");
+        }
+
+        batch.submitted = std::chrono::steady_clock::now();
+        batch.inFlight = true;
+        submitted.push_back(index);
+        jobStats.submissions++;
+
+        return lastValue;
+    }
+
+    bool ComputeJobQueue::completed(uint64_t value) {
+        retireCompleted();
+
+        uint64_t reached = 0;
+        vkGetSemaphoreCounterValue(device, timeline, &reached);
+        return reached >= value;
+    }
+
+    void ComputeJobQueue::wait(uint64_t value) {
+        if (value > lastValue) {
+            submit();
+        }
+
+        VkUtils::WaitTimeline(device, timeline, value);
+        retireCompleted();
+    }
+
+    ComputeJobQueue::Batch& ComputeJobQueue::currentBatch() {
+        if (recording) {
+            return batches[*recording];
+        }
+
+        retireCompleted();
+        size_t index = freeBatch();
+        Batch& batch = batches[index];
+        batch.jobs = 0;
+
+        vkResetCommandBuffer(batch.commandBuffer, 0);
+        vkResetDescriptorPool(device, batch.descriptorPool, 0);
+
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+        if (VK_SUCCESS != vkBeginCommandBuffer(batch.commandBuffer, &beginInfo)) {
+            throw std::runtime_error("Failed to begin a compute job command buffer");
+        }
+
+        recording = index;
+        return batch;
+    }
+
+    size_t ComputeJobQueue::freeBatch() {
+        for (size_t i = 0; i < batches.size(); ++i) {
+            if (!batches[i].inFlight) {
+                return i;
+            }
+        }
+
+        Batch batch{};
+
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = commandPool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = 1;
+
+        if (VK_SUCCESS != vkAllocateCommandBuffers(device, &allocInfo, &batch.commandBuffer)) {
+            throw std::runtime_error("Failed to create a compute job batch");
+        }
+
+        // Room for a set per job with every binding of either type
+        std::array<VkDescriptorPoolSize, 2> poolSizes{};
+        poolSizes[0] = { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, COMPUTE_BATCH_JOBS * COMPUTE_MAX_BINDINGS };
+        poolSizes[1] = { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, COMPUTE_BATCH_JOBS * COMPUTE_MAX_BINDINGS };
+
+        VkDescriptorPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.maxSets = COMPUTE_BATCH_JOBS;
+        poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+        poolInfo.pPoolSizes = poolSizes.data();
+
+        if (VK_SUCCESS != vkCreateDescriptorPool(device, &poolInfo, nullptr, &batch.descriptorPool)) {
+            vkFreeCommandBuffers(device, commandPool, 1, &batch.commandBuffer);
+            throw std::runtime_error("Failed to create a compute job descriptor pool");
+        }
+
+        batches.push_back(batch);
+        return batches.size() - 1;
+    }
+
+    bool ComputeJobQueue::retireOldest(bool wait) {
+        if (submitted.empty()) {
+            return false;
+        }
+
+        Batch& batch = batches[submitted.front()];
+
+        if (wait) {
+            VkUtils::WaitTimeline(device, timeline, batch.value);
+        } else {
+            uint64_t reached = 0;
+            vkGetSemaphoreCounterValue(device, timeline, &reached);
+
+            if (reached < batch.value) {
+                return false;
+            }
+        }
+
+        jobStats.busySeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                                              batch.submitted).count();
+        batch.inFlight = false;
+        submitted.pop_front();
+        return true;
+    }
+
+    void ComputeJobQueue::retireCompleted() {
+        while (retireOldest(false)) {}
+    }
+
+    void ComputeJobQueue::printStats(std::ostream& out) {
+        retireCompleted();
+
+        double jobsPerSubmission = jobStats.submissions > 0 ? static_cast<double>(jobStats.jobs) /
+                                                              static_cast<double>(jobStats.submissions) : 0.0;
+
+        out << "Compute jobs: " << jobStats.jobs << " in " << jobStats.submissions << " submissions ("
+            << jobStats.earlySubmissions << " early), " << std::fixed << std::setprecision(1) << jobsPerSubmission
+            << " jobs per submission, busy " << std::setprecision(2) << jobStats.busySeconds * 1000.0 << " ms"
+            << std::defaultfloat << std::endl;
+    }
+} // m4x
@@ -0,0 +1,208 @@
+/** @file */
+
+//
+// Created by m4tex on 17/10/26.
+//
+
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+
+#include "MemoryAllocator.h"
+#include "ShaderLibrary.h"
+
+// std
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace m4x {
+    /**
+     * Jobs recorded into one submission before it is submitted early
+     */
+    const uint32_t COMPUTE_BATCH_JOBS = 256;
+
+    /**
+     * Descriptors a compute shader may declare, all of them in set 0
+     */
+    const uint32_t COMPUTE_MAX_BINDINGS = 8;
+
+    /**
+     * Resource bound to a binding of a compute job, its type has to match the one the shader declares
+     */
+    struct ComputeBinding {
+        uint32_t         binding   = 0;
+        VkDescriptorType type      = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        VkBuffer         buffer    = VK_NULL_HANDLE;
+        VkDeviceSize     offset    = 0;
+        VkDeviceSize     range     = VK_WHOLE_SIZE;
+        VkImageView      imageView = VK_NULL_HANDLE;
+
+        /**
+         * @param binding [in] Binding number in set 0
+         * @param buffer [in] Buffer created with STORAGE_BUFFER usage
+         * @param offset [in] Start of the bound range, a multiple of minStorageBufferOffsetAlignment
+         * @param range [in] Size of the bound range
+         */
+        static ComputeBinding StorageBuffer(uint32_t binding, const Buffer* buffer, VkDeviceSize offset = 0,
+                                            VkDeviceSize range = VK_WHOLE_SIZE);
+
+        /**
+         * @param binding [in] Binding number in set 0
+         * @param imageView [in] View of an image created with STORAGE usage, in the GENERAL layout while the job runs
+         */
+        static ComputeBinding StorageImage(uint32_t binding, VkImageView imageView);
+    };
+
+    /**
+     * Compute pipeline of a shader along with the interface reflected from it
+     */
+    struct ComputePipeline {
+        VkPipeline            pipeline      = VK_NULL_HANDLE;
+        VkPipelineLayout      layout        = VK_NULL_HANDLE;
+        // Owned by the shader library
+        VkDescriptorSetLayout setLayout     = VK_NULL_HANDLE;
+        std::vector<ReflectedBinding> bindings;
+        uint32_t              constantsSize = 0;
+    };
+
+    struct ComputeJobStats {
+        uint64_t jobs        = 0;
+        uint64_t submissions = 0;
+        // Submissions made because a batch ran full, before submit() was called
+        uint64_t earlySubmissions = 0;
+        // Time between submitting a batch and noticing its completion
+        double   busySeconds = 0.0;
+    };
+
+    /**
+     * Runs compute jobs outside of the frame, for simulations and image processing.
+     * A job is a dispatch of a compute pipeline with its storage buffers and images and push constants. Jobs are
+     * recorded into a batch as they are dispatched and a whole batch goes to the queue in one submission, which
+     * signals the next value of a timeline semaphore. Results are read back asynchronously: every dispatch
+     * returns the value its batch signals, and once completed() reports it reached, host visible buffers the job
+     * wrote are up to date.
+     * Jobs of a batch run in any order and may overlap, barrier() orders the jobs before it against those after.
+     * Only one thread may use it at a time.
+     */
+    class ComputeJobQueue {
+    public:
+        /**
+         * @param device [in] Logical device, the timelineSemaphore feature has to be enabled
+         * @param pipelineCache [in] Cache to compile the pipelines with
+         * @param shaderLibrary [in] Library the shaders are loaded from
+         * @param family [in] Queue family of queue, it has to support compute
+         * @param queue [in] Queue the batches are submitted to
+         */
+        void create(VkDevice device, VkPipelineCache pipelineCache, ShaderLibrary& shaderLibrary, uint32_t family,
+                    VkQueue queue);
+
+        /**
+         * Waits for every submitted batch and destroys the batches and pipelines
+         */
+        void destroy();
+
+        /**
+         * Compute pipeline of a shader, compiled on the first request of its name.
+         * Throws if the shader isn't a compute shader or declares more than set 0 or anything but storage buffers and
+         * images.
+         * @param shader [in] Name of the shader in the shader library's archive
+         * @return Pipeline owned by the queue
+         */
+        const ComputePipeline& pipeline(const std::string& shader);
+
+        /**
+         * Records a job into the current batch, submitting the batch first if it is full.
+         * Throws if the bindings don't match the shader's or the push constants differ in size.
+         * @param pipeline [in] Pipeline returned by pipeline()
+         * @param bindings [in] Resource for every binding the shader declares
+         * @param constants [in] Push constants, nullptr if the shader has none
+         * @param constantsSize [in] Size of the push constants in bytes
+         * @param groups [in] Workgroups to dispatch in each dimension
+         * @return Timeline value the job has completed at
+         */
+        uint64_t dispatch(const ComputePipeline& pipeline, const std::vector<ComputeBinding>& bindings,
+                          const void* constants, uint32_t constantsSize, glm::uvec3 groups);
+
+        template<typename T>
+        uint64_t dispatch(const ComputePipeline& pipeline, const std::vector<ComputeBinding>& bindings,
+                          const T& constants, glm::uvec3 groups) {
+            return dispatch(pipeline, bindings, &constants, sizeof(T), groups);
+        }
+
+        /**
+         * Makes the writes of the jobs dispatched so far visible to the jobs dispatched after
+         */
+        void barrier();
+
+        /**
+         * Submits the current batch, does nothing if it is empty
+         * @return Timeline value every job dispatched so far has completed at, 0 if nothing was ever dispatched
+         */
+        uint64_t submit();
+
+        /**
+         * @return If the batch signaling the value has completed, without blocking
+         */
+        bool completed(uint64_t value);
+
+        /**
+         * Blocks until the batch signaling the value has completed, submitting it if it hasn't been yet
+         */
+        void wait(uint64_t value);
+
+        /**
+         * Timeline semaphore signaled by the batches, other submissions may wait on it
+         */
+        [[nodiscard]] VkSemaphore semaphore() const { return timeline; }
+
+        [[nodiscard]] const ComputeJobStats& stats() const { return jobStats; }
+
+        void printStats(std::ostream& out);
+
+    private:
+        struct Batch {
+            VkCommandBuffer  commandBuffer  = VK_NULL_HANDLE;
+            VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+            uint64_t         value          = 0;
+            uint32_t         jobs           = 0;
+            std::chrono::steady_clock::time_point submitted;
+            bool             inFlight       = false;
+        };
+
+        VkDevice device = VK_NULL_HANDLE;
+        VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+        ShaderLibrary* shaderLibrary = nullptr;
+        VkQueue queue = VK_NULL_HANDLE;
+        VkCommandPool commandPool = VK_NULL_HANDLE;
+
+        VkSemaphore timeline = VK_NULL_HANDLE;
+        // Value signaled by the last submitted batch
+        uint64_t lastValue = 0;
+
+        std::unordered_map<std::string, std::unique_ptr<ComputePipeline>> pipelines;
+
+        std::vector<Batch> batches;
+        // In flight batches, oldest first
+        std::deque<size_t> submitted;
+        // Batch jobs are being recorded into
+        std::optional<size_t> recording;
+
+        ComputeJobStats jobStats;
+
+        /**
+         * Returns the batch being recorded, beginning a free one if there is none
+         */
+        Batch& currentBatch();
+        size_t freeBatch();
+        bool retireOldest(bool wait);
+        void retireCompleted();
+    };
+} // m4x
@@ -0,0 +1,190 @@
+//
+// Created by m4tex on 17/10/26.
+//
+
+#include "CpuTracer.h"
+
+//std
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace m4x {
+    namespace {
+        // Events per thread, the oldest get overwritten beyond that
+        const uint64_t RING_SIZE = 1 << 16;
+
+        struct Event {
+            const char* name;
+            int64_t     startNs;
+            int64_t     endNs;
+            uint64_t    frame;
+        };
+
+        /**
+         * Written only by its own thread, head is released after every event
+         */
+        struct ThreadRing {
+            std::unique_ptr<Event[]> events{ new Event[RING_SIZE] };
+            std::atomic<uint64_t> head{ 0 };
+            std::atomic<const char*> name{ nullptr };
+            uint32_t id = 0;
+        };
+
+        const CpuTracer::Clock::time_point ORIGIN = CpuTracer::Clock::now();
+
+        std::mutex registryMutex;
+        std::vector<std::unique_ptr<ThreadRing>> rings;
+        thread_local ThreadRing* localRing = nullptr;
+
+        ThreadRing& threadRing() {
+            if (!localRing) {
+                // Only once per thread
+                std::lock_guard<std::mutex> lock(registryMutex);
+                rings.push_back(std::make_unique<ThreadRing>());
+                localRing = rings.back().get();
+                localRing->id = static_cast<uint32_t>(rings.size());
+            }
+            return *localRing;
+        }
+
+        int64_t sinceOrigin(CpuTracer::Clock::time_point time) {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(time - ORIGIN).count();
+        }
+
+        /**
+         * Calls fn with every buffered event of a ring, oldest first
+         */
+        template<typename Fn>
+        void forEachEvent(const ThreadRing& ring, Fn fn) {
+            uint64_t head = ring.head.load(std::memory_order_acquire);
+            uint64_t first = head > RING_SIZE ? head - RING_SIZE : 0;
+
+            for (uint64_t i = first; i < head; ++i) {
+                fn(ring.events[i % RING_SIZE]);
+            }
+        }
+    }
+
+    std::atomic<bool> CpuTracer::enabled{ false };
+    std::atomic<uint64_t> CpuTracer::currentFrame{ 0 };
+
+    void CpuTracer::Enable(bool enable) {
+        enabled.store(enable, std::memory_order_relaxed);
+    }
+
+    void CpuTracer::SetFrame(uint64_t frame) {
+        currentFrame.store(frame, std::memory_order_relaxed);
+    }
+
+    void CpuTracer::NameThread(const char* name) {
+        threadRing().name.store(name, std::memory_order_relaxed);
+    }
+
+    void CpuTracer::Record(const char* name, Clock::time_point start, Clock::time_point end, uint64_t frame) {
+        ThreadRing& ring = threadRing();
+        uint64_t head = ring.head.load(std::memory_order_relaxed);
+
+        ring.events[head % RING_SIZE] = { name, sinceOrigin(start), sinceOrigin(end), frame };
+        ring.head.store(head + 1, std::memory_order_release);
+    }
+
+    void CpuTracer::WriteChromeTrace(const std::filesystem::path& path) {
+        std::ofstream file(path, std::ios::trunc);
+        if (!file.is_open()) {
+            std::cerr << "Failed to write CPU trace " << path << std::endl;
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(registryMutex);
+
+        file << "{\"traceEvents\":[\n";
+        file << std::fixed << std::setprecision(3);
+
+        bool first = true;
+        auto separate = [&]() {
+            if (!first) {
+                file << ",\n";
+            }
+            first = false;
+        };
+
+        for (const auto& ring : rings) {
+            const char* name = ring->name.load(std::memory_order_relaxed);
+
+            separate();
+            file << R"({"name":"thread_name","ph":"M","pid":0,"tid":)" << ring->id << R"(,"args":{"name":")"
+                 << (name ? name : "thread " + std::to_string(ring->id)) << "\"}}";
+
+            forEachEvent(*ring, [&](const Event& event) {
+                separate();
+                file << "{\"name\":\"" << event.name << "\",\"cat\":\"cpu\",\"ph\":\"X\",\"pid\":0,\"tid\":"
+                     << ring->id << ",\"ts\":" << static_cast<double>(event.startNs) / 1e3 << ",\"dur\":"
+                     << static_cast<double>(event.endNs - event.startNs) / 1e3 << ",\"args\":{\"frame\":"
+                     << event.frame << "}}";
+            });
+        }
+
+        file << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    }
+
+    void CpuTracer::PrintFrameBreakdown(std::ostream& out) {
+        struct Phase {
+            std::map<uint64_t, int64_t> perFrameNs;
+            int64_t totalNs = 0;
+        };
+
+        std::map<std::string, Phase> phases;
+        std::set<uint64_t> frames;
+
+        {
+            std::lock_guard<std::mutex> lock(registryMutex);
+
+            for (const auto& ring : rings) {
+                const char* name = ring->name.load(std::memory_order_relaxed);
+                if (!name || std::strcmp(name, "main") != 0) {
+                    continue;
+                }
+
+                forEachEvent(*ring, [&](const Event& event) {
+                    Phase& phase = phases[event.name];
+                    phase.perFrameNs[event.frame] += event.endNs - event.startNs;
+                    phase.totalNs += event.endNs - event.startNs;
+                    frames.insert(event.frame);
+                });
+            }
+        }
+
+        if (frames.empty()) {
+            return;
+        }
+
+        std::vector<std::pair<std::string, Phase*>> sorted;
+        for (auto& [name, phase] : phases) {
+            sorted.emplace_back(name, &phase);
+        }
+        std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) {
+            return a.second->totalNs > b.second->totalNs;
+        });
+
+        out << "CPU frame phases over " << frames.size() << " frames:" << std::endl;
+
+        for (const auto& [name, phase] : sorted) {
+            int64_t maxNs = 0;
+            for (const auto& [frame, ns] : phase->perFrameNs) {
+                maxNs = std::max(maxNs, ns);
+            }
+
+            out << "  " << name << ": avg " << std::fixed << std::setprecision(3)
+                << static_cast<double>(phase->totalNs) / 1e6 / static_cast<double>(frames.size()) << " ms, max "
+                << static_cast<double>(maxNs) / 1e6 << " ms" << std::defaultfloat << std::endl;
+        }
+    }
+} // m4x
@@ -0,0 +1,121 @@
+/** @file */
+
+//
+// Created by m4tex on 17/10/26.
+//
+
+#pragma once
+
+// std
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+
+/**
+ * Set by CMake from the M4X_CPU_TRACE option, without it the trace macros expand to nothing
+ */
+#ifndef M4X_CPU_TRACE
+#define M4X_CPU_TRACE 0
+#endif
+
+#if M4X_CPU_TRACE
+#define M4X_TRACE_CONCAT_INNER(a, b) a##b
+#define M4X_TRACE_CONCAT(a, b) M4X_TRACE_CONCAT_INNER(a, b)
+/**
+ * Traces the rest of the enclosing block, the name has to be a string literal
+ */
+#define M4X_TRACE_SCOPE(name) ::m4x::TraceScope M4X_TRACE_CONCAT(traceScope, __LINE__)(name)
+/**
+ * Tags the events that begin from now on with a frame number
+ */
+#define M4X_TRACE_FRAME(frame) ::m4x::CpuTracer::SetFrame(frame)
+/**
+ * Names the calling thread in the trace, the name has to be a string literal
+ */
+#define M4X_TRACE_THREAD(name) ::m4x::CpuTracer::NameThread(name)
+#else
+#define M4X_TRACE_SCOPE(name) ((void)0)
+#define M4X_TRACE_FRAME(frame) ((void)0)
+#define M4X_TRACE_THREAD(name) ((void)0)
+#endif
+
+namespace m4x {
+    /**
+     * CPU scope tracer.
+     * Every thread writes its events into its own fixed size ring, allocated on the thread's first event,
+     * so tracing takes no lock and allocates nothing afterwards. When a ring is full the oldest events are
+     * overwritten. Tracing is off until Enable(), and costs one relaxed load per scope until then.
+     */
+    class CpuTracer {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        /**
+         * Starts or stops recording events
+         */
+        static void Enable(bool enable);
+
+        [[nodiscard]] static bool Enabled() { return enabled.load(std::memory_order_relaxed); }
+
+        static void SetFrame(uint64_t frame);
+
+        static void NameThread(const char* name);
+
+        /**
+         * Appends a finished scope to the calling thread's ring
+         * @param name [in] Scope name, a string literal
+         * @param start [in] Start of the scope
+         * @param end [in] End of the scope
+         * @param frame [in] Frame the scope began in
+         */
+        static void Record(const char* name, Clock::time_point start, Clock::time_point end, uint64_t frame);
+
+        [[nodiscard]] static uint64_t CurrentFrame() { return currentFrame.load(std::memory_order_relaxed); }
+
+        /**
+         * Writes every buffered event in the Chrome trace event format, viewable in chrome://tracing or Perfetto.
+         * No other thread may be tracing meanwhile.
+         * @param path [in] File to write
+         */
+        static void WriteChromeTrace(const std::filesystem::path& path);
+
+        /**
+         * Prints the average and worst time per frame of every scope of the thread named "main".
+         * No other thread may be tracing meanwhile.
+         */
+        static void PrintFrameBreakdown(std::ostream& out);
+
+    private:
+        static std::atomic<bool> enabled;
+        static std::atomic<uint64_t> currentFrame;
+    };
+
+    /**
+     * Records the time between its construction and destruction, use it through M4X_TRACE_SCOPE
+     */
+    class TraceScope {
+    public:
+        explicit TraceScope(const char* name) : name(CpuTracer::Enabled() ? name : nullptr) {
+            if (this->name) {
+                frame = CpuTracer::CurrentFrame();
+                start = CpuTracer::Clock::now();
+            }
+        }
+
+        ~TraceScope() {
+            if (name) {
+                CpuTracer::Record(name, start, CpuTracer::Clock::now(), frame);
+            }
+        }
+
+        TraceScope(const TraceScope&) = delete;
+        TraceScope& operator=(const TraceScope&) = delete;
+
+    private:
+        const char* name;
+        uint64_t frame = 0;
+        CpuTracer::Clock::time_point start;
+    };
+} // m4x
@@ -0,0 +1,144 @@
+//
+// Created by m4tex on 17/10/26.
+//
+
+#include "DeletionQueue.h"
+
+//std
+#include <algorithm>
+#include <iterator>
+#include <utility>
+
+namespace m4x {
+    void DeletionQueue::create(VkDevice device, MemoryAllocator& allocator, uint32_t framesInFlight) {
+        this->device = device;
+        this->allocator = &allocator;
+        this->framesInFlight = std::max(framesInFlight, 1u);
+        currentFrame = 0;
+        deletionStats = {};
+    }
+
+    void DeletionQueue::destroy() {
+        // A destruction may defer another one, so run until nothing is left
+        while (true) {
+            std::vector<Bucket> ready;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                ready.assign(std::make_move_iterator(buckets.begin()), std::make_move_iterator(buckets.end()));
+                buckets.clear();
+            }
+
+            if (ready.empty()) {
+                break;
+            }
+            run(ready);
+        }
+    }
+
+    void DeletionQueue::beginFrame(uint64_t frame) {
+        std::vector<Bucket> ready;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            currentFrame = frame;
+
+            while (!buckets.empty() && buckets.front().frame + framesInFlight <= frame) {
+                ready.push_back(std::move(buckets.front()));
+                buckets.pop_front();
+            }
+        }
+
+        run(ready);
+    }
+
+    void DeletionQueue::defer(std::function<void()> destruction) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (buckets.empty() || buckets.back().frame != currentFrame) {
+            buckets.push_back({ currentFrame, {} });
+        }
+
+        buckets.back().destructions.push_back(std::move(destruction));
+        deletionStats.deferred++;
+        pending++;
+        deletionStats.maxPending = std::max(deletionStats.maxPending, pending);
+    }
+
+    void DeletionQueue::destroyBuffer(Buffer* buffer) {
+        if (buffer == nullptr) {
+            return;
+        }
+        allocator->retireBuffer(buffer);
+        defer([allocator = allocator, buffer]() { allocator->destroyBuffer(buffer); });
+    }
+
+    void DeletionQueue::destroyImage(VkImage image, const Allocation& memory) {
+        defer([device = device, allocator = allocator, image, memory = memory]() mutable {
+            vkDestroyImage(device, image, nullptr);
+            if (memory.memory != VK_NULL_HANDLE) {
+                allocator->free(memory);
+            }
+        });
+    }
+
+    void DeletionQueue::destroyImageView(VkImageView view) {
+        defer([device = device, view]() { vkDestroyImageView(device, view, nullptr); });
+    }
+
+    void DeletionQueue::freeMemory(const Allocation& memory) {
+        if (memory.memory == VK_NULL_HANDLE) {
+            return;
+        }
+        defer([allocator = allocator, memory = memory]() mutable { allocator->free(memory); });
+    }
+
+    void DeletionQueue::destroyPipeline(VkPipeline pipeline) {
+        defer([device = device, pipeline]() { vkDestroyPipeline(device, pipeline, nullptr); });
+    }
+
+    void DeletionQueue::destroyPipelineLayout(VkPipelineLayout layout) {
+        defer([device = device, layout]() { vkDestroyPipelineLayout(device, layout, nullptr); });
+    }
+
+    void DeletionQueue::freeDescriptorSet(VkDescriptorPool pool, VkDescriptorSet set) {
+        defer([device = device, pool, set]() { vkFreeDescriptorSets(device, pool, 1, &set); });
+    }
+
+    void DeletionQueue::destroyFramebuffer(VkFramebuffer framebuffer) {
+        defer([device = device, framebuffer]() { vkDestroyFramebuffer(device, framebuffer, nullptr); });
+    }
+
+    void DeletionQueue::destroySemaphore(VkSemaphore semaphore) {
+        defer([device = device, semaphore]() { vkDestroySemaphore(device, semaphore, nullptr); });
+    }
+
+    void DeletionQueue::destroySwapchain(VkSwapchainKHR swapChain) {
+        defer([device = device, swapChain]() { vkDestroySwapchainKHR(device, swapChain, nullptr); });
+    }
+
+    void DeletionQueue::run(std::vector<Bucket>& ready) {
+        uint64_t destroyed = 0;
+        for (auto& bucket : ready) {
+            for (auto& destruction : bucket.destructions) {
+                destruction();
+            }
+            destroyed += bucket.destructions.size();
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        deletionStats.destroyed += destroyed;
+        deletionStats.batches += ready.size();
+        pending -= destroyed;
+    }
+
+    DeletionStats DeletionQueue::stats() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return deletionStats;
+    }
+
+    void DeletionQueue::printStats(std::ostream& out) const {
+        DeletionStats current = stats();
+
+        out << "Deferred destruction: " << current.destroyed << " of " << current.deferred << " objects destroyed in "
+            << current.batches << " batches, at most " << current.maxPending << " pending" << std::endl;
+    }
+} // m4x
@@ -0,0 +1,122 @@
+/** @file */
+
+//
+// Created by m4tex on 17/10/26.
+//
+
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include "MemoryAllocator.h"
+
+// std
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+namespace m4x {
+    struct DeletionStats {
+        uint64_t deferred   = 0;
+        uint64_t destroyed  = 0;
+        // Buckets run, every one frees all of its objects at once
+        uint64_t batches    = 0;
+        uint64_t maxPending = 0;
+    };
+
+    /**
+     * Destroys objects once the GPU is done with them, without waiting for the device to go idle.
+     * Destructions go into a bucket per frame, which runs once the frame has completed, framesInFlight frames later.
+     * Buckets run in the order they were filled, and the objects of a bucket in the order they were deferred.
+     * Safe to use from any thread, except for create() and destroy().
+     */
+    class DeletionQueue {
+    public:
+        /**
+         * @param device [in] Logical device
+         * @param allocator [in] Allocator buffers and memory deferred to the queue come from
+         * @param framesInFlight [in] Depth of the frames in flight ring
+         */
+        void create(VkDevice device, MemoryAllocator& allocator, uint32_t framesInFlight);
+
+        /**
+         * Runs every pending destruction, the device has to be idle
+         */
+        void destroy();
+
+        /**
+         * Starts a frame and runs the buckets the GPU has passed. Call once the fence of the frame's slot has
+         * signaled, every frame before frame - framesInFlight has completed by then.
+         * @param frame [in] Number of the frame being recorded, later frame buckets are filled for it
+         */
+        void beginFrame(uint64_t frame);
+
+        /**
+         * Defers a destruction, for anything the typed functions don't cover
+         * @param destruction [in] Called once the frame being recorded has completed, on the thread running
+         * beginFrame()
+         */
+        void defer(std::function<void()> destruction);
+
+        void destroyBuffer(Buffer* buffer);
+
+        /**
+         * @param image [in] Image to destroy, VK_NULL_HANDLE to only free the memory
+         * @param memory [in] Memory the image is bound to, freed after it
+         */
+        void destroyImage(VkImage image, const Allocation& memory);
+
+        void destroyImageView(VkImageView view);
+
+        void freeMemory(const Allocation& memory);
+
+        void destroyPipeline(VkPipeline pipeline);
+
+        void destroyPipelineLayout(VkPipelineLayout layout);
+
+        /**
+         * @param pool [in] Pool created with FREE_DESCRIPTOR_SET, it has to outlive the destruction
+         * @param set [in] Set allocated from the pool
+         */
+        void freeDescriptorSet(VkDescriptorPool pool, VkDescriptorSet set);
+
+        void destroyFramebuffer(VkFramebuffer framebuffer);
+
+        void destroySemaphore(VkSemaphore semaphore);
+
+        void destroySwapchain(VkSwapchainKHR swapChain);
+
+        [[nodiscard]] DeletionStats stats() const;
+
+        void printStats(std::ostream& out) const;
+
+    private:
+        struct Bucket {
+            // Frame the bucket waits for
+            uint64_t frame = 0;
+            std::vector<std::function<void()>> destructions;
+        };
+
+        VkDevice         device         = VK_NULL_HANDLE;
+        MemoryAllocator* allocator      = nullptr;
+        uint32_t         framesInFlight = 1;
+
+        // Frame being recorded
+        uint64_t currentFrame = 0;
+        // Oldest first, frame numbers only grow
+        std::deque<Bucket> buckets;
+        uint64_t pending = 0;
+
+        DeletionStats deletionStats;
+
+        mutable std::mutex mutex;
+
+        /**
+         * Runs the buckets and counts them, without the mutex held so a destruction may defer another
+         */
+        void run(std::vector<Bucket>& ready);
+    };
+} // m4x
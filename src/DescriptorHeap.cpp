@@ -0,0 +1,210 @@
+//
+// Created by m4tex on 17/10/26.
+//
+
+#include "DescriptorHeap.h"
+
+//std
+#include <algorithm>
+#include <iomanip>
+#include <stdexcept>
+#include <string>
+
+namespace m4x {
+    namespace {
+        const std::array<VkDescriptorType, 3> TABLE_TYPES = {
+                VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+                VK_DESCRIPTOR_TYPE_SAMPLER,
+                VK_DESCRIPTOR_TYPE_STORAGE_BUFFER
+        };
+
+        const std::array<const char*, 3> TABLE_NAMES = { "textures", "samplers", "buffers" };
+    }
+
+    void DescriptorHeap::create(VkDevice device, DeletionQueue& deletionQueue) {
+        this->device = device;
+        this->deletionQueue = &deletionQueue;
+
+        std::array<uint32_t, 3> capacities = { HEAP_TEXTURE_CAPACITY, HEAP_SAMPLER_CAPACITY, HEAP_BUFFER_CAPACITY };
+
+        std::array<VkDescriptorSetLayoutBinding, 3> bindings{};
+        std::array<VkDescriptorBindingFlags, 3> bindingFlags{};
+        std::array<VkDescriptorPoolSize, 3> poolSizes{};
+
+        for (uint32_t binding = 0; binding < bindings.size(); ++binding) {
+            bindings[binding].binding = binding;
+            bindings[binding].descriptorType = TABLE_TYPES[binding];
+            bindings[binding].descriptorCount = capacities[binding];
+            bindings[binding].stageFlags = VK_SHADER_STAGE_ALL;
+
+            // Slots nothing was written to yet are fine as long as no shader reads them, and slots the frames in
+            // flight don't read can be rewritten while the set is bound
+            bindingFlags[binding] = VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |
+                                    VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT |
+                                    VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
+
+            poolSizes[binding].type = TABLE_TYPES[binding];
+            poolSizes[binding].descriptorCount = capacities[binding];
+
+            tables[binding] = {};
+            tables[binding].capacity = capacities[binding];
+        }
+
+        VkDescriptorSetLayoutBindingFlagsCreateInfo flagsInfo{};
+        flagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+        flagsInfo.bindingCount = static_cast<uint32_t>(bindingFlags.size());
+        flagsInfo.pBindingFlags = bindingFlags.data();
+
+        VkDescriptorSetLayoutCreateInfo layoutInfo{};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.pNext = &flagsInfo;
+        layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+        layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+        layoutInfo.pBindings = bindings.data();
+
+        if (VK_SUCCESS != vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &setLayout)) {
+            throw std::runtime_error("Failed to create the descriptor heap layout");
+        }
+
+        VkDescriptorPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+        poolInfo.maxSets = 1;
+        poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+        poolInfo.pPoolSizes = poolSizes.data();
+
+        if (VK_SUCCESS != vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool)) {
+            throw std::runtime_error("Failed to create the descriptor heap pool");
+        }
+
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = descriptorPool;
+        allocInfo.descriptorSetCount = 1;
+        allocInfo.pSetLayouts = &setLayout;
+
+        if (VK_SUCCESS != vkAllocateDescriptorSets(device, &allocInfo, &set)) {
+            throw std::runtime_error("Failed to allocate the descriptor heap");
+        }
+
+        heapStats = {};
+        heapStats.capacity = capacities;
+        binds = 0;
+        frames = 0;
+    }
+
+    void DescriptorHeap::destroy() {
+        vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+        vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+        descriptorPool = VK_NULL_HANDLE;
+        setLayout = VK_NULL_HANDLE;
+        set = VK_NULL_HANDLE;
+    }
+
+    void DescriptorHeap::beginFrame() {
+        frames++;
+    }
+
+    uint32_t DescriptorHeap::addTexture(VkImageView view, VkImageLayout layout) {
+        uint32_t index = allocate(DescriptorTable::Texture);
+
+        VkDescriptorImageInfo imageInfo{};
+        imageInfo.imageView = view;
+        imageInfo.imageLayout = layout;
+        write(DescriptorTable::Texture, index, &imageInfo, nullptr);
+
+        return index;
+    }
+
+    uint32_t DescriptorHeap::addSampler(VkSampler sampler) {
+        uint32_t index = allocate(DescriptorTable::Sampler);
+
+        VkDescriptorImageInfo imageInfo{};
+        imageInfo.sampler = sampler;
+        write(DescriptorTable::Sampler, index, &imageInfo, nullptr);
+
+        return index;
+    }
+
+    uint32_t DescriptorHeap::addBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range) {
+        uint32_t index = allocate(DescriptorTable::Buffer);
+
+        VkDescriptorBufferInfo bufferInfo{};
+        bufferInfo.buffer = buffer;
+        bufferInfo.offset = offset;
+        bufferInfo.range = range;
+        write(DescriptorTable::Buffer, index, nullptr, &bufferInfo);
+
+        return index;
+    }
+
+    void DescriptorHeap::release(DescriptorTable table, uint32_t index) {
+        if (index == INVALID_DESCRIPTOR) {
+            return;
+        }
+
+        // Freed on the thread running DeletionQueue::beginFrame(), the one using the heap
+        auto binding = static_cast<size_t>(table);
+        deletionQueue->defer([this, binding, index]() {
+            tables[binding].free.push_back(index);
+            heapStats.pendingReleases--;
+        });
+        heapStats.used[binding]--;
+        heapStats.pendingReleases++;
+    }
+
+    uint32_t DescriptorHeap::allocate(DescriptorTable table) {
+        auto binding = static_cast<size_t>(table);
+        Table& slots = tables[binding];
+
+        uint32_t index;
+        if (!slots.free.empty()) {
+            index = slots.free.back();
+            slots.free.pop_back();
+        } else if (slots.highWater < slots.capacity) {
+            index = slots.highWater++;
+        } else {
+            throw std::runtime_error(std::string("The descriptor heap ran out of ") + TABLE_NAMES[binding]);
+        }
+
+        heapStats.used[binding]++;
+        return index;
+    }
+
+    void DescriptorHeap::write(DescriptorTable table, uint32_t index, const VkDescriptorImageInfo* imageInfo,
+                               const VkDescriptorBufferInfo* bufferInfo) {
+        auto binding = static_cast<uint32_t>(table);
+
+        VkWriteDescriptorSet descriptorWrite{};
+        descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrite.dstSet = set;
+        descriptorWrite.dstBinding = binding;
+        descriptorWrite.dstArrayElement = index;
+        descriptorWrite.descriptorCount = 1;
+        descriptorWrite.descriptorType = TABLE_TYPES[binding];
+        descriptorWrite.pImageInfo = imageInfo;
+        descriptorWrite.pBufferInfo = bufferInfo;
+
+        vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+        heapStats.writes++;
+    }
+
+    void DescriptorHeap::bind(VkCommandBuffer commandBuffer, VkPipelineBindPoint bindPoint, VkPipelineLayout layout,
+                              uint32_t setIndex) const {
+        vkCmdBindDescriptorSets(commandBuffer, bindPoint, layout, setIndex, 1, &set, 0, nullptr);
+        binds.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void DescriptorHeap::printStats(std::ostream& out) const {
+        out << "Descriptor heap:";
+        for (size_t i = 0; i < tables.size(); ++i) {
+            out << (i == 0 ? " " : ", ") << heapStats.used[i] << "/" << heapStats.capacity[i] << " "
+                << TABLE_NAMES[i];
+        }
+
+        double bindsPerFrame = static_cast<double>(binds.load()) / static_cast<double>(std::max<uint64_t>(frames, 1));
+        out << ", " << heapStats.pendingReleases << " released slots pending, " << heapStats.writes
+            << " descriptor writes, " << std::fixed << std::setprecision(1)
+            << bindsPerFrame << " binds/frame" << std::defaultfloat << std::endl;
+    }
+} // m4x
@@ -0,0 +1,162 @@
+/** @file */
+
+//
+// Created by m4tex on 17/10/26.
+//
+
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include "DeletionQueue.h"
+
+// std
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+namespace m4x {
+    /**
+     * Index of no descriptor, never handed out by a DescriptorHeap
+     */
+    const uint32_t INVALID_DESCRIPTOR = UINT32_MAX;
+
+    /**
+     * Slots of each table of the heap. Devices with descriptor indexing allow at least 500000 update after bind
+     * descriptors per stage, so these fit anywhere the heap can be created.
+     */
+    const uint32_t HEAP_TEXTURE_CAPACITY = 16384;
+    const uint32_t HEAP_SAMPLER_CAPACITY = 256;
+    const uint32_t HEAP_BUFFER_CAPACITY  = 4096;
+
+    /**
+     * Tables of the heap, each one is a binding of the set
+     */
+    enum class DescriptorTable {
+        // Sampled images at binding 0
+        Texture,
+        // Samplers at binding 1
+        Sampler,
+        // Storage buffers at binding 2
+        Buffer
+    };
+
+    struct DescriptorHeapStats {
+        std::array<uint32_t, 3> used{};
+        std::array<uint32_t, 3> capacity{};
+        uint64_t                writes = 0;
+        // Released slots waiting for the frames that may still read them
+        uint32_t                pendingReleases = 0;
+    };
+
+    /**
+     * Bindless resource heap: a single descriptor set holding every texture, sampler and storage buffer, which
+     * shaders index with the numbers handed out here, passed in push constants or read from buffers.
+     * The set is bound once per command buffer no matter how many resources the draws use. Its bindings are
+     * update after bind and partially bound, so resources come and go while frames using the set are in
+     * flight, and released slots go through the deletion queue so they only get handed out again once the frames
+     * that may have read them completed.
+     */
+    class DescriptorHeap {
+    public:
+        /**
+         * @param device [in] Logical device with the descriptorIndexing capabilities enabled
+         * @param deletionQueue [in] Queue released slots wait in for the frames that may still read them
+         */
+        void create(VkDevice device, DeletionQueue& deletionQueue);
+
+        /**
+         * Destroys the set, its pool and layout. The resources in it are owned by the callers.
+         */
+        void destroy();
+
+        /**
+         * Counts a frame for the binds per frame, call at the start of every frame
+         */
+        void beginFrame();
+
+        /**
+         * @param view [in] View the shaders sample
+         * @param layout [in] Layout the image is in whenever a shader reads it
+         * @return Index into the texture table, throws when it's full
+         */
+        uint32_t addTexture(VkImageView view, VkImageLayout layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+        /**
+         * @return Index into the sampler table, throws when it's full
+         */
+        uint32_t addSampler(VkSampler sampler);
+
+        /**
+         * @param buffer [in] Buffer created with STORAGE_BUFFER usage
+         * @param offset [in] Start of the range the shaders see
+         * @param range [in] Size of the range, VK_WHOLE_SIZE for the rest of the buffer
+         * @return Index into the buffer table, throws when it's full
+         */
+        uint32_t addBuffer(VkBuffer buffer, VkDeviceSize offset = 0, VkDeviceSize range = VK_WHOLE_SIZE);
+
+        /**
+         * Frees a slot, draws recorded from now on must not use it. The slot is reused and the resource may be
+         * destroyed once the frames in flight completed, resources destroyed through the deletion queue after the
+         * release are destroyed after the slot is free.
+         * @param table [in] Table the index was handed out by
+         * @param index [in] Slot to free, INVALID_DESCRIPTOR is ignored
+         */
+        void release(DescriptorTable table, uint32_t index);
+
+        /**
+         * Binds the heap, the only descriptor set bind a command buffer needs for it
+         * @param commandBuffer [in] Command buffer to record into
+         * @param bindPoint [in] Pipeline type the layout belongs to
+         * @param layout [in] Pipeline layout created with layout() at the set index
+         * @param setIndex [in] Index of the heap in the pipeline layout
+         */
+        void bind(VkCommandBuffer commandBuffer, VkPipelineBindPoint bindPoint, VkPipelineLayout layout,
+                  uint32_t setIndex = 0) const;
+
+        [[nodiscard]] VkDescriptorSetLayout layout() const { return setLayout; }
+
+        [[nodiscard]] const DescriptorHeapStats& stats() const { return heapStats; }
+
+        /**
+         * Prints the occupancy of the tables and the binds per frame
+         */
+        void printStats(std::ostream& out) const;
+
+    private:
+        /**
+         * Free list of the slots of a binding
+         */
+        struct Table {
+            uint32_t                 capacity = 0;
+            // Slots below it have been handed out at least once
+            uint32_t                 highWater = 0;
+            std::vector<uint32_t>    free;
+        };
+
+        VkDevice       device        = VK_NULL_HANDLE;
+        DeletionQueue* deletionQueue = nullptr;
+
+        VkDescriptorSetLayout setLayout      = VK_NULL_HANDLE;
+        VkDescriptorPool      descriptorPool = VK_NULL_HANDLE;
+        VkDescriptorSet       set            = VK_NULL_HANDLE;
+
+        std::array<Table, 3> tables;
+
+        DescriptorHeapStats heapStats;
+        // Counted from the recording threads
+        mutable std::atomic<uint64_t> binds{ 0 };
+        uint64_t frames = 0;
+
+        /**
+         * Takes a slot off the free list of a table, or a never used one
+         */
+        uint32_t allocate(DescriptorTable table);
+
+        void write(DescriptorTable table, uint32_t index, const VkDescriptorImageInfo* imageInfo,
+                   const VkDescriptorBufferInfo* bufferInfo);
+    };
+} // m4x
@@ -0,0 +1,71 @@
+//
+// Created by m4tex on 17/10/26.
+//
+
+#include "FramePacer.h"
+
+//std
+#include <algorithm>
+#include <iomanip>
+
+namespace m4x {
+    void FramePacer::create(uint32_t framesInFlight, uint32_t maxLead) {
+        this->framesInFlight = framesInFlight;
+        lead = maxLead == 0 ? framesInFlight : std::min(maxLead, framesInFlight);
+
+        latencies.clear();
+        latencies.reserve(HISTORY_LENGTH);
+        nextLatency = 0;
+        frames = 0;
+        paceWaitMs = 0.0;
+        inputPending = false;
+    }
+
+    uint32_t FramePacer::paceSlot(uint32_t currentFrame) const {
+        // The frame lead frames back, which is the slot's own previous frame without a tighter lead
+        return (currentFrame + framesInFlight - lead) % framesInFlight;
+    }
+
+    void FramePacer::addPaceWait(Clock::duration waited) {
+        paceWaitMs += std::chrono::duration<double, std::milli>(waited).count();
+    }
+
+    void FramePacer::inputSampled() {
+        inputTime = Clock::now();
+        inputPending = true;
+    }
+
+    void FramePacer::presented() {
+        if (!inputPending) {
+            return;
+        }
+        inputPending = false;
+
+        double latency = std::chrono::duration<double, std::milli>(Clock::now() - inputTime).count();
+
+        if (latencies.size() < HISTORY_LENGTH) {
+            latencies.push_back(latency);
+        } else {
+            latencies[nextLatency] = latency;
+        }
+        nextLatency = (nextLatency + 1) % HISTORY_LENGTH;
+        frames++;
+    }
+
+    void FramePacer::printStats(std::ostream& out) const {
+        if (latencies.empty()) {
+            return;
+        }
+
+        std::vector<double> sorted = latencies;
+        std::sort(sorted.begin(), sorted.end());
+
+        double p50 = sorted[(sorted.size() - 1) / 2];
+        double p99 = sorted[(sorted.size() - 1) * 99 / 100];
+
+        out << "Frame pacing: lead " << lead << " of " << framesInFlight << " frames, input to present p50 "
+            << std::fixed << std::setprecision(2) << p50 << " ms, p99 " << p99 << " ms, max " << sorted.back()
+            << " ms, " << paceWaitMs / static_cast<double>(std::max<uint64_t>(frames, 1))
+            << " ms/frame waiting on the lead" << std::defaultfloat << std::endl;
+    }
+} // m4x
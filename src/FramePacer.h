@@ -0,0 +1,73 @@
+/** @file */
+
+//
+// Created by m4tex on 17/10/26.
+//
+
+#pragma once
+
+// std
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+namespace m4x {
+    /**
+     * Limits how many frames the CPU may have queued ahead of the GPU and measures the latency from sampling
+     * the input of a frame to presenting it.
+     * The frames in flight ring bounds the lead already, the pacer can only tighten it. A lead of 1 means a frame
+     * is only started once the previous one finished on the GPU.
+     */
+    class FramePacer {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        /**
+         * @param framesInFlight [in] Depth of the frames in flight ring
+         * @param maxLead [in] Frames the CPU may be ahead, 0 or anything above the ring depth uses the ring depth
+         */
+        void create(uint32_t framesInFlight, uint32_t maxLead);
+
+        /**
+         * Slot of the ring whose fence has to be signaled before the frame in currentFrame may start
+         * @param currentFrame [in] Slot about to be recorded
+         */
+        [[nodiscard]] uint32_t paceSlot(uint32_t currentFrame) const;
+
+        [[nodiscard]] uint32_t maxLead() const { return lead; }
+
+        /**
+         * Adds time the CPU spent blocked to keep the lead
+         */
+        void addPaceWait(Clock::duration waited);
+
+        /**
+         * Marks the moment the input of the frame being built was sampled
+         */
+        void inputSampled();
+
+        /**
+         * Records the latency of the frame that was just handed to vkQueuePresentKHR
+         */
+        void presented();
+
+        void printStats(std::ostream& out) const;
+
+    private:
+        // Latencies of the last frames in milliseconds, allocated once
+        static const size_t HISTORY_LENGTH = 512;
+
+        uint32_t framesInFlight = 1;
+        uint32_t lead = 1;
+
+        Clock::time_point inputTime;
+        bool inputPending = false;
+
+        std::vector<double> latencies;
+        size_t nextLatency = 0;
+        uint64_t frames = 0;
+
+        double paceWaitMs = 0.0;
+    };
+} // m4x
@@ -0,0 +1,281 @@
+//
+// Created by m4tex on 17/10/26.
+//
+
+#include "GpuCulling.h"
+#include "VkUtils.h"
+
+//std
+#include <stdexcept>
+#include <algorithm>
+
+namespace m4x {
+    namespace {
+        const uint32_t CULL_GROUP_SIZE = 64;
+
+        // Matches the push constant block of cull.comp
+        struct CullConstants {
+            FrustumPlanes planes;
+            uint32_t      objectCount;
+            uint32_t      indexCount;
+        };
+    }
+
+    FrustumPlanes GpuCulling::ClipSpacePlanes() {
+        return {
+                glm::vec4(1.0f, 0.0f, 0.0f, 1.0f),
+                glm::vec4(-1.0f, 0.0f, 0.0f, 1.0f),
+                glm::vec4(0.0f, 1.0f, 0.0f, 1.0f),
+                glm::vec4(0.0f, -1.0f, 0.0f, 1.0f)
+        };
+    }
+
+    void GpuCulling::create(VkPhysicalDevice physicalDevice, VkDevice device, VkPipelineCache pipelineCache,
+                            ShaderLibrary& shaderLibrary, uint32_t framesInFlight, bool drawIndirectCount,
+                            const std::vector<uint32_t>& queueFamilies) {
+        this->device = device;
+        this->queueFamilies = queueFamilies;
+        frames.resize(framesInFlight);
+
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        maxComputeGroups = properties.limits.maxComputeWorkGroupCount[0];
+
+        if (drawIndirectCount) {
+            drawIndexedIndirectCount = reinterpret_cast<PFN_vkCmdDrawIndexedIndirectCount>(
+                    vkGetDeviceProcAddr(device, "vkCmdDrawIndexedIndirectCountKHR"));
+        }
+
+        // Objects in, culling output out, laid out as the shader declares them. The vertex shader reads the
+        // objects through the descriptor heap.
+        const ShaderReflection& reflection = shaderLibrary.reflection("cull.comp");
+        if (reflection.bindings.size() != 3 || reflection.pushConstantSize != sizeof(CullConstants)) {
+            throw std::runtime_error("The culling shader doesn't match its CPU side");
+        }
+        for (const auto& binding : reflection.bindings) {
+            if (binding.set != 0 || binding.type != VK_DESCRIPTOR_TYPE_STORAGE_BUFFER) {
+                throw std::runtime_error("The culling shader doesn't match its CPU side");
+            }
+        }
+
+        ReflectedLayout reflected = shaderLibrary.createPipelineLayout({ "cull.comp" });
+        pipelineLayout = reflected.layout;
+        setLayout = reflected.setLayouts[0];
+
+        VkDescriptorPoolSize poolSize{};
+        poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        poolSize.descriptorCount = static_cast<uint32_t>(reflection.bindings.size()) * framesInFlight;
+
+        VkDescriptorPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.maxSets = framesInFlight;
+        poolInfo.poolSizeCount = 1;
+        poolInfo.pPoolSizes = &poolSize;
+
+        if (VK_SUCCESS != vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool)) {
+            throw std::runtime_error("Failed to create the culling descriptor pool");
+        }
+
+        VkShaderModule shaderModule = shaderLibrary.load("cull.comp");
+
+        VkComputePipelineCreateInfo pipelineInfo{};
+        pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        pipelineInfo.stage.module = shaderModule;
+        pipelineInfo.stage.pName = "main";
+        pipelineInfo.layout = pipelineLayout;
+
+        if (VK_SUCCESS != vkCreateComputePipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &pipeline)) {
+            throw std::runtime_error("Failed to create the culling pipeline");
+        }
+    }
+
+    void GpuCulling::destroy(MemoryAllocator& allocator) {
+        destroyObjects(allocator);
+
+        vkDestroyPipeline(device, pipeline, nullptr);
+        vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+        vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+    }
+
+    void GpuCulling::destroyObjects(MemoryAllocator& allocator) {
+        allocator.destroyBuffer(objectStorage);
+        objectStorage = nullptr;
+
+        for (auto& frame : frames) {
+            allocator.destroyBuffer(frame.commands);
+            allocator.destroyBuffer(frame.count);
+            frame = {};
+        }
+
+        if (descriptorPool != VK_NULL_HANDLE) {
+            vkResetDescriptorPool(device, descriptorPool, 0);
+        }
+    }
+
+    void GpuCulling::setObjects(MemoryAllocator& allocator, UploadQueue& uploadQueue, const Mesh& mesh,
+                                const std::vector<DrawObject>& drawObjects) {
+        destroyObjects(allocator);
+
+        objects = static_cast<uint32_t>(drawObjects.size());
+        indexCount = mesh.indices();
+
+        std::vector<GpuObject> gpuObjects(objects);
+        for (uint32_t i = 0; i < objects; ++i) {
+            const DrawObject& object = drawObjects[i];
+            float radius = mesh.boundingRadius() * std::max(object.scale.x, object.scale.y);
+
+            gpuObjects[i].offset = object.offset;
+            gpuObjects[i].scale = object.scale;
+            gpuObjects[i].bounds = glm::vec4(object.offset.x, object.offset.y, radius, 0.0f);
+            gpuObjects[i].texture = object.texture;
+            gpuObjects[i].sampler = object.sampler;
+        }
+
+        // Read by the culling pass and the vertex shader on different queues every frame, so it's shared instead
+        // of going back and forth between them
+        VkDeviceSize objectBytes = sizeof(GpuObject) * gpuObjects.size();
+        objectStorage = allocator.createBuffer(objectBytes,
+                                              VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                              { VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT }, false, queueFamilies);
+        uploadQueue.enqueue(objectStorage, 0, gpuObjects.data(), objectBytes);
+
+        std::vector<VkDescriptorSetLayout> layouts(frames.size(), setLayout);
+        std::vector<VkDescriptorSet> sets(frames.size());
+
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = descriptorPool;
+        allocInfo.descriptorSetCount = static_cast<uint32_t>(sets.size());
+        allocInfo.pSetLayouts = layouts.data();
+
+        if (VK_SUCCESS != vkAllocateDescriptorSets(device, &allocInfo, sets.data())) {
+            throw std::runtime_error("Failed to allocate the culling descriptor sets");
+        }
+
+        for (size_t i = 0; i < frames.size(); ++i) {
+            FrameBuffers& frame = frames[i];
+            VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                                       VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+            frame.commands = allocator.createBuffer(sizeof(VkDrawIndexedIndirectCommand) * objects, usage,
+                                                    { VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT });
+            frame.count = allocator.createBuffer(sizeof(uint32_t), usage, { VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT });
+            frame.set = sets[i];
+
+            std::array<VkDescriptorBufferInfo, 3> bufferInfos{};
+            bufferInfos[0] = { objectStorage->buffer, 0, VK_WHOLE_SIZE };
+            bufferInfos[1] = { frame.commands->buffer, 0, VK_WHOLE_SIZE };
+            bufferInfos[2] = { frame.count->buffer, 0, VK_WHOLE_SIZE };
+
+            std::array<VkWriteDescriptorSet, 3> writes{};
+            for (uint32_t binding = 0; binding < writes.size(); ++binding) {
+                writes[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                writes[binding].dstSet = frame.set;
+                writes[binding].dstBinding = binding;
+                writes[binding].descriptorCount = 1;
+                writes[binding].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                writes[binding].pBufferInfo = &bufferInfos[binding];
+            }
+
+            vkUpdateDescriptorSets(device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+        }
+    }
+
+    void GpuCulling::recordCull(VkCommandBuffer commandBuffer, uint32_t frame, const FrustumPlanes& planes,
+                                uint32_t cullFamily, uint32_t drawFamily) const {
+        const FrameBuffers& buffers = frames[frame];
+
+        vkCmdFillBuffer(commandBuffer, buffers.count->buffer, 0, sizeof(uint32_t), 0);
+
+        // Without a draw count every slot gets drawn, the ones nothing was appended to have to stay empty draws
+        if (drawIndexedIndirectCount == nullptr) {
+            vkCmdFillBuffer(commandBuffer, buffers.commands->buffer, 0, VK_WHOLE_SIZE, 0);
+        }
+
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                             1, &barrier, 0, nullptr, 0, nullptr);
+
+        CullConstants constants{};
+        constants.planes = planes;
+        constants.objectCount = objects;
+        constants.indexCount = indexCount;
+
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &buffers.set,
+                                0, nullptr);
+        vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullConstants),
+                           &constants);
+
+        // Rows of groups once a single dimension runs out, the shader flattens the id again
+        uint32_t groups = (objects + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE;
+        uint32_t groupsX = std::min(groups, maxComputeGroups);
+        uint32_t groupsY = (groups + groupsX - 1) / std::max(groupsX, 1u);
+
+        if (groups > 0) {
+            vkCmdDispatch(commandBuffer, groupsX, groupsY, 1);
+        }
+
+        // The draw reads the buffers on another queue, the semaphore between the two submissions takes over
+        if (cullFamily != drawFamily) {
+            auto releases = ownershipBarriers(frame, cullFamily, drawFamily);
+            for (auto& release : releases) {
+                release.dstAccessMask = 0;
+            }
+
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                 VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr,
+                                 static_cast<uint32_t>(releases.size()), releases.data(), 0, nullptr);
+        }
+    }
+
+    void GpuCulling::recordAcquire(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t cullFamily,
+                                   uint32_t drawFamily) const {
+        auto acquires = ownershipBarriers(frame, cullFamily, drawFamily);
+        for (auto& acquire : acquires) {
+            acquire.srcAccessMask = 0;
+        }
+
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+                             0, 0, nullptr, static_cast<uint32_t>(acquires.size()), acquires.data(), 0, nullptr);
+    }
+
+    std::array<VkBufferMemoryBarrier, 2> GpuCulling::ownershipBarriers(uint32_t frame, uint32_t cullFamily,
+                                                                       uint32_t drawFamily) const {
+        const FrameBuffers& buffers = frames[frame];
+        std::array<VkBufferMemoryBarrier, 2> barriers{};
+
+        // The next culling pass of the slot overwrites both, so they never have to come back to the culling family
+        Buffer* drawBuffers[] = { buffers.commands, buffers.count };
+        for (size_t i = 0; i < barriers.size(); ++i) {
+            barriers[i].sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+            barriers[i].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+            barriers[i].dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+            barriers[i].srcQueueFamilyIndex = cullFamily;
+            barriers[i].dstQueueFamilyIndex = drawFamily;
+            barriers[i].buffer = drawBuffers[i]->buffer;
+            barriers[i].offset = 0;
+            barriers[i].size = VK_WHOLE_SIZE;
+        }
+
+        return barriers;
+    }
+
+    void GpuCulling::recordDraw(VkCommandBuffer commandBuffer, uint32_t frame) const {
+        const FrameBuffers& buffers = frames[frame];
+
+        if (drawIndexedIndirectCount != nullptr) {
+            drawIndexedIndirectCount(commandBuffer, buffers.commands->buffer, 0, buffers.count->buffer, 0, objects,
+                                     sizeof(VkDrawIndexedIndirectCommand));
+        } else {
+            vkCmdDrawIndexedIndirect(commandBuffer, buffers.commands->buffer, 0, objects,
+                                     sizeof(VkDrawIndexedIndirectCommand));
+        }
+    }
+} // m4x
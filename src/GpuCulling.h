@@ -0,0 +1,165 @@
+/** @file */
+
+//
+// Created by m4tex on 17/10/26.
+//
+
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+
+#include "MemoryAllocator.h"
+#include "UploadQueue.h"
+#include "Mesh.h"
+#include "ShaderLibrary.h"
+
+// std
+#include <array>
+#include <vector>
+
+namespace m4x {
+    /**
+     * Object as laid out in the std430 object buffer
+     */
+    struct GpuObject {
+        glm::vec2 offset;
+        glm::vec2 scale;
+        // Bounding circle, center in xy and radius in z
+        glm::vec4 bounds;
+        uint32_t  texture;
+        uint32_t  sampler;
+        uint32_t  padding[2];
+    };
+
+    /**
+     * Planes of the view volume as (normal.xy, unused, distance), a point is inside when dot + distance >= 0.
+     * The renderer is 2D, so the frustum is the four sides of the view rectangle.
+     */
+    using FrustumPlanes = std::array<glm::vec4, 4>;
+
+    /**
+     * GPU driven drawing of many copies of one mesh.
+     * The objects live in a storage buffer, a compute pass tests their bounds against the frustum and
+     * appends a VkDrawIndexedIndirectCommand per survivor, and the frame draws them with a single indirect call.
+     * The culling pass can run on an async compute queue, the draw buffers of its slot then get handed over to
+     * the graphics family.
+     */
+    class GpuCulling {
+    public:
+        /**
+         * Creates the descriptor layout, pool and the culling pipeline
+         * @param physicalDevice [in] Device the logical device was created from
+         * @param device [in] Logical device, multiDrawIndirect and drawIndirectFirstInstance have to be enabled
+         * @param pipelineCache [in] Cache to compile the culling pipeline with
+         * @param shaderLibrary [in] Library the culling shader is loaded from
+         * @param framesInFlight [in] Depth of the frames in flight ring
+         * @param drawIndirectCount [in] If VK_KHR_draw_indirect_count is enabled on the device
+         * @param queueFamilies [in] Families culling and drawing may run on, the object buffer is shared by all
+         */
+        void create(VkPhysicalDevice physicalDevice, VkDevice device, VkPipelineCache pipelineCache,
+                    ShaderLibrary& shaderLibrary, uint32_t framesInFlight, bool drawIndirectCount,
+                    const std::vector<uint32_t>& queueFamilies);
+
+        void destroy(MemoryAllocator& allocator);
+
+        /**
+         * Replaces the objects, the previous ones must not be in use by the GPU anymore
+         * @param allocator [in] Allocator the buffers are created from
+         * @param uploadQueue [in] Queue the object data is uploaded through
+         * @param mesh [in] Mesh every object is a copy of
+         * @param drawObjects [in] Placement of every copy
+         */
+        void setObjects(MemoryAllocator& allocator, UploadQueue& uploadQueue, const Mesh& mesh,
+                        const std::vector<DrawObject>& drawObjects);
+
+        /**
+         * Records the culling pass, outside of a render pass
+         * @param commandBuffer [in] Command buffer to record into
+         * @param frame [in] Slot of the frames in flight ring, every slot has its own draw buffers
+         * @param planes [in] Planes to cull against
+         * @param cullFamily [in] Family of commandBuffer
+         * @param drawFamily [in] Family the draw is recorded on, if it differs the draw buffers are released to it
+         * and recordAcquire() has to precede the draw. On the same family the caller orders the draw after the
+         * pass, the render graph does that from the pass's declared uses.
+         */
+        void recordCull(VkCommandBuffer commandBuffer, uint32_t frame, const FrustumPlanes& planes,
+                        uint32_t cullFamily = VK_QUEUE_FAMILY_IGNORED,
+                        uint32_t drawFamily = VK_QUEUE_FAMILY_IGNORED) const;
+
+        /**
+         * Acquires the draw buffers released by a culling pass on another family, outside of a render pass.
+         * The submission has to wait for the culling submission.
+         * @param commandBuffer [in] Command buffer of drawFamily
+         * @param frame [in] Slot the culling pass was recorded for
+         * @param cullFamily [in] Family the culling pass ran on
+         * @param drawFamily [in] Family of commandBuffer
+         */
+        void recordAcquire(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t cullFamily,
+                           uint32_t drawFamily) const;
+
+        /**
+         * Records the indirect draw of the survivors, the mesh and a pipeline reading objectBuffer() have to be
+         * bound
+         * @param commandBuffer [in] Command buffer inside the render pass
+         * @param frame [in] Slot the culling pass was recorded for
+         */
+        void recordDraw(VkCommandBuffer commandBuffer, uint32_t frame) const;
+
+        /**
+         * Objects as GpuObject, replaced by setObjects(). The vertex shader finds them through the descriptor heap.
+         */
+        [[nodiscard]] VkBuffer objectBuffer() const { return objectStorage->buffer; }
+
+        /**
+         * Indirect draw commands the culling pass of a slot writes
+         */
+        [[nodiscard]] VkBuffer drawCommands(uint32_t frame) const { return frames[frame].commands->buffer; }
+
+        /**
+         * Draw count the culling pass of a slot writes
+         */
+        [[nodiscard]] VkBuffer drawCount(uint32_t frame) const { return frames[frame].count->buffer; }
+
+        [[nodiscard]] uint32_t objectCount() const { return objects; }
+
+        /**
+         * Planes of the whole clip space rectangle
+         */
+        static FrustumPlanes ClipSpacePlanes();
+
+    private:
+        struct FrameBuffers {
+            Buffer*         commands = nullptr;
+            Buffer*         count    = nullptr;
+            VkDescriptorSet set      = VK_NULL_HANDLE;
+        };
+
+        VkDevice device = VK_NULL_HANDLE;
+        uint32_t maxComputeGroups = 0;
+
+        // Reflected from the shader and owned by the shader library
+        VkDescriptorSetLayout setLayout      = VK_NULL_HANDLE;
+        VkDescriptorPool      descriptorPool = VK_NULL_HANDLE;
+        VkPipelineLayout      pipelineLayout = VK_NULL_HANDLE;
+        VkPipeline            pipeline       = VK_NULL_HANDLE;
+
+        PFN_vkCmdDrawIndexedIndirectCount drawIndexedIndirectCount = nullptr;
+
+        std::vector<uint32_t> queueFamilies;
+
+        Buffer*   objectStorage = nullptr;
+        uint32_t  objects       = 0;
+        uint32_t  indexCount    = 0;
+        std::vector<FrameBuffers> frames;
+
+        void destroyObjects(MemoryAllocator& allocator);
+
+        /**
+         * Ownership transfer of the draw buffers of a slot, both halves use the same barriers
+         */
+        [[nodiscard]] std::array<VkBufferMemoryBarrier, 2> ownershipBarriers(uint32_t frame, uint32_t cullFamily,
+                                                                             uint32_t drawFamily) const;
+    };
+} // m4x
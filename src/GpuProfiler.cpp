@@ -0,0 +1,342 @@
+//
+// Created by m4tex on 17/10/26.
+//
+
+#include "GpuProfiler.h"
+#include "VkUtils.h"
+
+//std
+#include <stdexcept>
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+
+namespace m4x {
+    namespace {
+        // Scopes per frame, anything past it isn't profiled
+        const uint32_t MAX_SCOPES = 32;
+        // Frames the percentiles are taken over
+        const size_t HISTORY_LENGTH = 512;
+        // Caps the memory of long runs, later scopes are left out of the trace
+        const size_t MAX_TRACE_EVENTS = 1 << 20;
+
+        const uint32_t NO_SCOPE = UINT32_MAX;
+
+        const char* const STATISTIC_NAMES[PROFILED_STATISTIC_COUNT] = {
+                "vertices", "primitives", "vertex invocations", "clipped primitives", "fragment invocations",
+                "compute invocations"
+        };
+
+        double percentile(std::vector<double> samples, double fraction) {
+            if (samples.empty()) {
+                return 0.0;
+            }
+
+            auto nth = samples.begin() + static_cast<ptrdiff_t>(fraction * static_cast<double>(samples.size() - 1));
+            std::nth_element(samples.begin(), nth, samples.end());
+            return *nth;
+        }
+
+        std::string escapeJson(const std::string& text) {
+            std::string escaped;
+            for (char c : text) {
+                if (c == '"' || c == '\\') {
+                    escaped += '\\';
+                }
+                escaped += c;
+            }
+            return escaped;
+        }
+    }
+
+    GpuProfiler::Scope::Scope(GpuProfiler& profiler, VkCommandBuffer commandBuffer, const char* name, bool statistics)
+            : profiler(profiler), commandBuffer(commandBuffer),
+              index(profiler.beginScope(commandBuffer, name, statistics)) {}
+
+    GpuProfiler::Scope::~Scope() {
+        profiler.endScope(commandBuffer, index);
+    }
+
+    void GpuProfiler::create(VkPhysicalDevice physicalDevice, VkDevice device, uint32_t queueFamily,
+                             uint32_t framesInFlight, bool pipelineStatistics) {
+        this->device = device;
+
+        const DeviceCapabilities& capabilities = VkUtils::QueryDeviceCapabilities(physicalDevice);
+        const VkPhysicalDeviceProperties& properties = capabilities.properties;
+
+        uint32_t validBits = capabilities.queueFamilies[queueFamily].timestampValidBits;
+        timestampsSupported = validBits > 0 && properties.limits.timestampPeriod > 0.0f;
+        statisticsSupported = timestampsSupported && pipelineStatistics;
+
+        if (!timestampsSupported) {
+            std::cerr << "The graphics queue has no timestamps, GPU profiling is disabled" << std::endl;
+            return;
+        }
+
+        timestampPeriod = properties.limits.timestampPeriod;
+        timestampMask = validBits >= 64 ? UINT64_MAX : (1ull << validBits) - 1;
+
+        frames.resize(framesInFlight);
+
+        for (auto& frame : frames) {
+            VkQueryPoolCreateInfo poolInfo{};
+            poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+            poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+            poolInfo.queryCount = MAX_SCOPES * 2;
+
+            if (VK_SUCCESS != vkCreateQueryPool(device, &poolInfo, nullptr, &frame.timestamps)) {
+                throw std::runtime_error("Failed to create a timestamp query pool");
+            }
+
+            if (statisticsSupported) {
+                poolInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+                poolInfo.queryCount = MAX_SCOPES;
+                poolInfo.pipelineStatistics = PROFILED_STATISTICS;
+
+                if (VK_SUCCESS != vkCreateQueryPool(device, &poolInfo, nullptr, &frame.statistics)) {
+                    throw std::runtime_error("Failed to create a pipeline statistics query pool");
+                }
+            }
+
+            frame.scopes.reserve(MAX_SCOPES);
+        }
+    }
+
+    void GpuProfiler::destroy() {
+        for (auto& frame : frames) {
+            vkDestroyQueryPool(device, frame.timestamps, nullptr);
+            vkDestroyQueryPool(device, frame.statistics, nullptr);
+        }
+        frames.clear();
+        timestampsSupported = false;
+        statisticsSupported = false;
+    }
+
+    void GpuProfiler::beginFrame(VkCommandBuffer commandBuffer, uint32_t frame) {
+        if (!timestampsSupported) {
+            return;
+        }
+
+        currentFrame = frame;
+        FrameQueries& queries = frames[frame];
+
+        if (queries.pendingFrame.has_value()) {
+            collect(queries);
+        }
+
+        vkCmdResetQueryPool(commandBuffer, queries.timestamps, 0, MAX_SCOPES * 2);
+        if (statisticsSupported) {
+            vkCmdResetQueryPool(commandBuffer, queries.statistics, 0, MAX_SCOPES);
+        }
+
+        queries.scopes.clear();
+        queries.statisticsCount = 0;
+        queries.pendingFrame = frameNumber++;
+
+        beginScope(commandBuffer, "frame", false);
+    }
+
+    void GpuProfiler::endFrame(VkCommandBuffer commandBuffer) {
+        if (!timestampsSupported) {
+            return;
+        }
+
+        // The frame scope is always the first one
+        endScope(commandBuffer, 0);
+    }
+
+    uint32_t GpuProfiler::beginScope(VkCommandBuffer commandBuffer, const char* name, bool statistics) {
+        if (!timestampsSupported) {
+            return NO_SCOPE;
+        }
+
+        FrameQueries& queries = frames[currentFrame];
+        if (queries.scopes.size() >= MAX_SCOPES) {
+            return NO_SCOPE;
+        }
+
+        auto index = static_cast<uint32_t>(queries.scopes.size());
+        ScopeRecord scope{ name, -1 };
+
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queries.timestamps, index * 2);
+
+        if (statistics && statisticsSupported) {
+            scope.statisticsQuery = static_cast<int32_t>(queries.statisticsCount++);
+            vkCmdBeginQuery(commandBuffer, queries.statistics, scope.statisticsQuery, 0);
+        }
+
+        queries.scopes.push_back(scope);
+        return index;
+    }
+
+    void GpuProfiler::endScope(VkCommandBuffer commandBuffer, uint32_t index) {
+        if (!timestampsSupported || index == NO_SCOPE) {
+            return;
+        }
+
+        FrameQueries& queries = frames[currentFrame];
+        const ScopeRecord& scope = queries.scopes[index];
+
+        if (scope.statisticsQuery >= 0) {
+            vkCmdEndQuery(commandBuffer, queries.statistics, scope.statisticsQuery);
+        }
+
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queries.timestamps, index * 2 + 1);
+    }
+
+    void GpuProfiler::collectPending() {
+        for (auto& queries : frames) {
+            if (queries.pendingFrame.has_value()) {
+                collect(queries);
+            }
+        }
+    }
+
+    VkQueryPipelineStatisticFlags GpuProfiler::inheritedStatistics() const {
+        return statisticsSupported ? PROFILED_STATISTICS : 0;
+    }
+
+    void GpuProfiler::collect(FrameQueries& queries) {
+        uint64_t frame = queries.pendingFrame.value();
+        queries.pendingFrame.reset();
+
+        auto scopeCount = static_cast<uint32_t>(queries.scopes.size());
+        if (scopeCount == 0) {
+            return;
+        }
+
+        // Pairs of value and availability, a scope that never got submitted is simply left out
+        std::vector<uint64_t> timestamps(scopeCount * 2 * 2);
+        VkResult result = vkGetQueryPoolResults(device, queries.timestamps, 0, scopeCount * 2,
+                                                timestamps.size() * sizeof(uint64_t), timestamps.data(),
+                                                2 * sizeof(uint64_t),
+                                                VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+        if (result != VK_SUCCESS && result != VK_NOT_READY) {
+            return;
+        }
+
+        const uint32_t statisticsStride = PROFILED_STATISTIC_COUNT + 1;
+        std::vector<uint64_t> statistics(queries.statisticsCount * statisticsStride);
+        bool statisticsRead = false;
+
+        if (queries.statisticsCount > 0) {
+            result = vkGetQueryPoolResults(device, queries.statistics, 0, queries.statisticsCount,
+                                           statistics.size() * sizeof(uint64_t), statistics.data(),
+                                           statisticsStride * sizeof(uint64_t),
+                                           VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+            statisticsRead = result == VK_SUCCESS || result == VK_NOT_READY;
+        }
+
+        for (uint32_t i = 0; i < scopeCount; ++i) {
+            const ScopeRecord& scope = queries.scopes[i];
+            uint64_t begin = timestamps[i * 4] & timestampMask;
+            uint64_t end = timestamps[i * 4 + 2] & timestampMask;
+
+            if (timestamps[i * 4 + 1] == 0 || timestamps[i * 4 + 3] == 0) {
+                continue;
+            }
+
+            // The counter may have wrapped between the two writes
+            uint64_t ticks = (end - begin) & timestampMask;
+            double milliseconds = static_cast<double>(ticks) * timestampPeriod / 1e6;
+
+            PassHistory& history = passes[scope.name];
+            if (history.samples.size() < HISTORY_LENGTH) {
+                history.samples.push_back(milliseconds);
+            } else {
+                history.samples[history.next] = milliseconds;
+            }
+            history.next = (history.next + 1) % HISTORY_LENGTH;
+            history.maxMs = std::max(history.maxMs, milliseconds);
+
+            if (scope.statisticsQuery >= 0 && statisticsRead) {
+                const uint64_t* values = &statistics[scope.statisticsQuery * statisticsStride];
+                if (values[PROFILED_STATISTIC_COUNT] != 0) {
+                    for (uint32_t s = 0; s < PROFILED_STATISTIC_COUNT; ++s) {
+                        history.statisticsTotal[s] += values[s];
+                    }
+                    history.statisticsFrames++;
+                }
+            }
+
+            if (!traceOrigin.has_value()) {
+                traceOrigin = begin;
+            }
+
+            if (trace.size() < MAX_TRACE_EVENTS) {
+                uint64_t sinceOrigin = (begin - traceOrigin.value()) & timestampMask;
+                trace.push_back({ scope.name, frame, static_cast<double>(sinceOrigin) * timestampPeriod / 1e3,
+                                  milliseconds * 1e3 });
+            }
+        }
+    }
+
+    std::vector<PassTiming> GpuProfiler::passTimings() const {
+        std::vector<PassTiming> timings;
+
+        for (const auto& [name, history] : passes) {
+            PassTiming timing{};
+            timing.name = name;
+            timing.samples = static_cast<uint32_t>(history.samples.size());
+            timing.p50Ms = percentile(history.samples, 0.50);
+            timing.p99Ms = percentile(history.samples, 0.99);
+            timing.maxMs = history.maxMs;
+
+            if (history.statisticsFrames > 0) {
+                std::array<double, PROFILED_STATISTIC_COUNT> averages{};
+                for (uint32_t s = 0; s < PROFILED_STATISTIC_COUNT; ++s) {
+                    averages[s] = static_cast<double>(history.statisticsTotal[s]) /
+                                  static_cast<double>(history.statisticsFrames);
+                }
+                timing.statistics = averages;
+            }
+
+            timings.push_back(timing);
+        }
+
+        return timings;
+    }
+
+    void GpuProfiler::printStats(std::ostream& out) const {
+        if (!timestampsSupported) {
+            return;
+        }
+
+        out << "GPU passes over the last " << HISTORY_LENGTH << " frames:" << std::endl;
+
+        for (const auto& timing : passTimings()) {
+            out << "  " << timing.name << ": p50 " << std::fixed << std::setprecision(3) << timing.p50Ms
+                << " ms, p99 " << timing.p99Ms << " ms, max " << timing.maxMs << " ms" << std::defaultfloat;
+
+            if (timing.statistics.has_value()) {
+                out << std::fixed << std::setprecision(0);
+                for (uint32_t s = 0; s < PROFILED_STATISTIC_COUNT; ++s) {
+                    out << ", " << timing.statistics.value()[s] << " " << STATISTIC_NAMES[s];
+                }
+                out << std::defaultfloat;
+            }
+
+            out << std::endl;
+        }
+    }
+
+    void GpuProfiler::writeChromeTrace(const std::filesystem::path& path) const {
+        std::ofstream file(path, std::ios::trunc);
+        if (!file.is_open()) {
+            std::cerr << "Failed to write GPU trace " << path << std::endl;
+            return;
+        }
+
+        file << "{\"traceEvents\":[\n";
+        file << R"({"name":"thread_name","ph":"M","pid":1,"tid":1,"args":{"name":"GPU"}})";
+
+        file << std::fixed << std::setprecision(3);
+        for (const auto& event : trace) {
+            file << ",\n{\"name\":\"" << escapeJson(event.name) << "\",\"cat\":\"gpu\",\"ph\":\"X\",\"pid\":1,"
+                 << "\"tid\":1,\"ts\":" << event.startUs << ",\"dur\":" << event.durationUs
+                 << ",\"args\":{\"frame\":" << event.frame << "}}";
+        }
+
+        file << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    }
+} // m4x
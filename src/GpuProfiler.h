@@ -0,0 +1,187 @@
+/** @file */
+
+//
+// Created by m4tex on 17/10/26.
+//
+
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+// std
+#include <array>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace m4x {
+    /**
+     * Pipeline statistics gathered by scopes that ask for them, in the order of the query results
+     */
+    const VkQueryPipelineStatisticFlags PROFILED_STATISTICS =
+            VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT |
+            VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT |
+            VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+            VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+            VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT |
+            VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT;
+
+    const uint32_t PROFILED_STATISTIC_COUNT = 6;
+
+    /**
+     * Rolling GPU time of a pass over the last frames
+     */
+    struct PassTiming {
+        std::string name;
+        uint32_t samples = 0;
+        double   p50Ms   = 0.0;
+        double   p99Ms   = 0.0;
+        double   maxMs   = 0.0;
+        // Average per frame over the whole run, only for scopes with statistics
+        std::optional<std::array<double, PROFILED_STATISTIC_COUNT>> statistics;
+    };
+
+    /**
+     * GPU timestamps and pipeline statistics per pass.
+     * Every slot of the frames in flight ring has its own query pools, which are read back when the slot is
+     * recorded again. The slot's fence has been waited on by then, so reading never stalls.
+     * Without create() or on queues without timestamps every call is a no-op.
+     */
+    class GpuProfiler {
+    public:
+        /**
+         * Ends a scope when it goes out of scope
+         */
+        class Scope {
+        public:
+            /**
+             * @param profiler [in] Profiler to write into
+             * @param commandBuffer [in] Primary command buffer, outside of a render pass or around a whole one
+             * @param name [in] Pass name, has to outlive the profiler
+             * @param statistics [in] Also gathers pipeline statistics, such scopes must not nest
+             */
+            Scope(GpuProfiler& profiler, VkCommandBuffer commandBuffer, const char* name, bool statistics = false);
+            ~Scope();
+
+            Scope(const Scope&) = delete;
+            Scope& operator=(const Scope&) = delete;
+
+        private:
+            GpuProfiler& profiler;
+            VkCommandBuffer commandBuffer;
+            uint32_t index;
+        };
+
+        /**
+         * Creates the query pools
+         * @param physicalDevice [in] Device the logical device was created from
+         * @param device [in] Logical device
+         * @param queueFamily [in] Family the profiled command buffers are submitted to
+         * @param framesInFlight [in] Depth of the frames in flight ring
+         * @param pipelineStatistics [in] If the pipelineStatisticsQuery feature is enabled
+         */
+        void create(VkPhysicalDevice physicalDevice, VkDevice device, uint32_t queueFamily, uint32_t framesInFlight,
+                    bool pipelineStatistics);
+
+        void destroy();
+
+        /**
+         * Reads back the results of the slot's previous frame, resets its queries and opens the frame scope.
+         * Has to be recorded before anything else of the frame.
+         * @param commandBuffer [in] Primary command buffer of the frame
+         * @param frame [in] Slot of the frames in flight ring, its fence has to be signaled
+         */
+        void beginFrame(VkCommandBuffer commandBuffer, uint32_t frame);
+
+        /**
+         * Closes the frame scope, has to be recorded after everything else of the frame
+         * @param commandBuffer [in] Primary command buffer of the frame
+         */
+        void endFrame(VkCommandBuffer commandBuffer);
+
+        /**
+         * Reads back the results of every slot that hasn't been read yet, the device has to be idle
+         */
+        void collectPending();
+
+        /**
+         * @return Statistics secondaries executed inside a statistics scope have to inherit
+         */
+        [[nodiscard]] VkQueryPipelineStatisticFlags inheritedStatistics() const;
+
+        [[nodiscard]] bool enabled() const { return timestampsSupported; }
+
+        /**
+         * Percentiles of every pass over the last frames
+         */
+        [[nodiscard]] std::vector<PassTiming> passTimings() const;
+
+        void printStats(std::ostream& out) const;
+
+        /**
+         * Writes every recorded scope as a complete event in the Chrome trace event format,
+         * viewable in chrome://tracing or Perfetto
+         * @param path [in] File to write
+         */
+        void writeChromeTrace(const std::filesystem::path& path) const;
+
+    private:
+        struct ScopeRecord {
+            const char* name;
+            // Index into the statistics pool, -1 without statistics
+            int32_t statisticsQuery;
+        };
+
+        struct FrameQueries {
+            VkQueryPool timestamps = VK_NULL_HANDLE;
+            VkQueryPool statistics = VK_NULL_HANDLE;
+            std::vector<ScopeRecord> scopes;
+            uint32_t statisticsCount = 0;
+            // Frame recorded into the slot whose results are still to be read
+            std::optional<uint64_t> pendingFrame;
+        };
+
+        struct PassHistory {
+            // Ring of the last samples, in milliseconds
+            std::vector<double> samples;
+            size_t next = 0;
+            double maxMs = 0.0;
+            std::array<uint64_t, PROFILED_STATISTIC_COUNT> statisticsTotal{};
+            uint64_t statisticsFrames = 0;
+        };
+
+        struct TraceEvent {
+            const char* name;
+            uint64_t frame;
+            double startUs;
+            double durationUs;
+        };
+
+        VkDevice device = VK_NULL_HANDLE;
+        bool timestampsSupported = false;
+        bool statisticsSupported = false;
+        double timestampPeriod = 1.0;
+        uint64_t timestampMask = 0;
+
+        std::vector<FrameQueries> frames;
+        uint32_t currentFrame = 0;
+        uint64_t frameNumber = 0;
+
+        std::map<std::string, PassHistory> passes;
+        std::vector<TraceEvent> trace;
+        std::optional<uint64_t> traceOrigin;
+
+        uint32_t beginScope(VkCommandBuffer commandBuffer, const char* name, bool statistics);
+
+        void endScope(VkCommandBuffer commandBuffer, uint32_t index);
+
+        /**
+         * Folds the finished frame of a slot into the histories and the trace
+         */
+        void collect(FrameQueries& queries);
+    };
+} // m4x
@@ -0,0 +1,175 @@
+//
+// Created by m4tex on 17/10/26.
+//
+
+#include "InstanceBatcher.h"
+#include "CpuTracer.h"
+
+//std
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <stdexcept>
+
+namespace m4x {
+    size_t InstanceBatcher::GroupKey::Hash::operator()(const GroupKey& key) const {
+        size_t pipeline = std::hash<uint64_t>()(reinterpret_cast<uint64_t>(key.pipeline));
+        return pipeline ^ (std::hash<const Mesh*>()(key.mesh) + 0x9e3779b97f4a7c15ull + (pipeline << 6) +
+                           (pipeline >> 2));
+    }
+
+    void InstanceBatcher::create(MemoryAllocator& allocator, DeletionQueue& deletionQueue, uint32_t framesInFlight) {
+        this->allocator = &allocator;
+        this->deletionQueue = &deletionQueue;
+        this->framesInFlight = framesInFlight;
+    }
+
+    void InstanceBatcher::destroy() {
+        ring.destroy(*allocator);
+        frameInstances = {};
+        capacity = 0;
+        groups.clear();
+        groupIndices.clear();
+        frameBatches.clear();
+    }
+
+    void InstanceBatcher::reserve(uint32_t instances) {
+        if (instances <= capacity) {
+            return;
+        }
+
+        ring.destroy(*deletionQueue);
+
+        capacity = instances;
+        ring.create(*allocator, sizeof(InstanceData) * VkDeviceSize(capacity), framesInFlight,
+                    VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+        frameInstances = {};
+        frameBatches.clear();
+
+        instancingStats.capacity = capacity;
+        instancingStats.ringBytes = ring.size();
+    }
+
+    void InstanceBatcher::begin() {
+        // Groups the previous frame left empty are dropped, the others keep their storage
+        size_t kept = 0;
+        for (size_t i = 0; i < groups.size(); ++i) {
+            if (groups[i].instances.empty()) {
+                continue;
+            }
+            groups[i].instances.clear();
+            if (kept != i) {
+                groups[kept] = std::move(groups[i]);
+            }
+            kept++;
+        }
+
+        if (kept != groups.size()) {
+            groups.resize(kept);
+            groupIndices.clear();
+            for (uint32_t i = 0; i < groups.size(); ++i) {
+                groupIndices.emplace(groups[i].key, i);
+            }
+        }
+        lastGroup = 0;
+    }
+
+    void InstanceBatcher::add(VkPipeline pipeline, const Mesh& mesh, const InstanceData& instance) {
+        GroupKey key{ pipeline, &mesh };
+
+        if (lastGroup >= groups.size() || !(groups[lastGroup].key == key)) {
+            auto [it, added] = groupIndices.try_emplace(key, static_cast<uint32_t>(groups.size()));
+            if (added) {
+                groups.push_back({ key, {} });
+            }
+            lastGroup = it->second;
+        }
+
+        groups[lastGroup].instances.push_back(instance);
+    }
+
+    void InstanceBatcher::build(uint32_t slot) {
+        M4X_TRACE_SCOPE("build instances");
+        auto start = std::chrono::steady_clock::now();
+
+        frameBatches.clear();
+
+        uint32_t instances = 0;
+        for (const auto& group : groups) {
+            instances += static_cast<uint32_t>(group.instances.size());
+        }
+        if (instances > capacity) {
+            throw std::runtime_error("The frame has " + std::to_string(instances) + " instances, the ring holds " +
+                                     std::to_string(capacity));
+        }
+
+        frameInstances = {};
+        if (instances > 0) {
+            ring.beginFrame(slot);
+            frameInstances = ring.allocate(sizeof(InstanceData) * VkDeviceSize(instances), alignof(InstanceData))
+                                 .value();
+        }
+
+        auto* mapped = static_cast<InstanceData*>(frameInstances.mapped);
+        uint32_t groupCount = 0;
+        uint32_t next = 0;
+
+        for (const auto& group : groups) {
+            if (group.instances.empty()) {
+                continue;
+            }
+            groupCount++;
+
+            auto count = static_cast<uint32_t>(group.instances.size());
+            std::memcpy(mapped + next, group.instances.data(), sizeof(InstanceData) * count);
+
+            uint32_t drawSize = maxDrawSize == 0 ? count : maxDrawSize;
+            for (uint32_t first = 0; first < count; first += drawSize) {
+                frameBatches.push_back({ group.key.pipeline, group.key.mesh, next + first,
+                                         std::min(drawSize, count - first) });
+            }
+            next += count;
+        }
+
+        instancingStats.instances = instances;
+        instancingStats.groups = groupCount;
+        instancingStats.draws = static_cast<uint32_t>(frameBatches.size());
+        instancingStats.frames++;
+        instancingStats.buildMs += std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - start).count();
+    }
+
+    void InstanceBatcher::record(VkCommandBuffer commandBuffer) const {
+        if (frameBatches.empty()) {
+            return;
+        }
+
+        vkCmdBindVertexBuffers(commandBuffer, 1, 1, &frameInstances.buffer, &frameInstances.offset);
+
+        VkPipeline boundPipeline = VK_NULL_HANDLE;
+        const Mesh* boundMesh = nullptr;
+
+        for (const auto& batch : frameBatches) {
+            if (batch.pipeline != boundPipeline) {
+                vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, batch.pipeline);
+                boundPipeline = batch.pipeline;
+            }
+            if (batch.mesh != boundMesh) {
+                batch.mesh->bind(commandBuffer);
+                boundMesh = batch.mesh;
+            }
+            batch.mesh->draw(commandBuffer, batch.instanceCount, batch.firstInstance);
+        }
+    }
+
+    void InstanceBatcher::printStats(std::ostream& out) const {
+        const InstancingStats& current = instancingStats;
+
+        out << "Instancing: " << current.instances << " instances in " << current.groups << " groups and "
+            << current.draws << " draws, ring of " << current.capacity << " instances per frame ("
+            << std::fixed << std::setprecision(2) << static_cast<double>(current.ringBytes) / 1e6 << " MB), "
+            << std::setprecision(3) << (current.frames > 0 ? current.buildMs / current.frames : 0.0)
+            << " ms/frame building" << std::defaultfloat << std::endl;
+    }
+} // m4x
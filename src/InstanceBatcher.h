@@ -0,0 +1,150 @@
+/** @file */
+
+//
+// Created by m4tex on 17/10/26.
+//
+
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include "DeletionQueue.h"
+#include "MemoryAllocator.h"
+#include "Mesh.h"
+
+// std
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+namespace m4x {
+    /**
+     * One instanced draw, a run of the frame's instances sharing a pipeline and mesh
+     */
+    struct InstanceBatch {
+        VkPipeline  pipeline      = VK_NULL_HANDLE;
+        const Mesh* mesh          = nullptr;
+        // Element of the frame's part of the ring the draw starts at
+        uint32_t    firstInstance = 0;
+        uint32_t    instanceCount = 0;
+    };
+
+    struct InstancingStats {
+        // Of the last frame built
+        uint32_t     instances     = 0;
+        uint32_t     groups        = 0;
+        uint32_t     draws         = 0;
+        // Instances each frame's part of the ring holds and the size of the whole ring
+        uint32_t     capacity      = 0;
+        VkDeviceSize ringBytes     = 0;
+        uint64_t     frames        = 0;
+        // Summed over the frames, grouping and writing the ring
+        double       buildMs       = 0.0;
+    };
+
+    /**
+     * Draws any number of objects with a handful of instanced draws.
+     * Every frame the objects are added with the pipeline and mesh they are drawn with, build() groups them by the
+     * two and writes each group's InstanceData contiguously into the slot's region of a LinearPool, so every group
+     * becomes one vkCmdDrawIndexed with the group as its instances. The pool holds a region per frame in flight, a
+     * slot's region is only rewritten once the frame that last read it completed.
+     * Groups are drawn in the order their first object was added in, and the objects of a group in theirs.
+     */
+    class InstanceBatcher {
+    public:
+        /**
+         * @param allocator [in] Allocator the ring is created from
+         * @param deletionQueue [in] Queue the rings reserve() outgrows are destroyed through
+         * @param framesInFlight [in] Depth of the frames in flight ring
+         */
+        void create(MemoryAllocator& allocator, DeletionQueue& deletionQueue, uint32_t framesInFlight);
+
+        /**
+         * Destroys the ring, no frame may still read it
+         */
+        void destroy();
+
+        /**
+         * Grows the ring to hold at least this many instances per frame. The old ring goes to the deletion queue,
+         * so frames recorded before may still read it.
+         * @param instances [in] Most instances a frame will add
+         */
+        void reserve(uint32_t instances);
+
+        /**
+         * Splits groups into draws of at most this many instances, 0 for no limit
+         */
+        void setMaxDrawSize(uint32_t instances) { maxDrawSize = instances; }
+
+        /**
+         * Starts a frame, dropping the objects of the previous one
+         */
+        void begin();
+
+        /**
+         * Adds an object to the frame
+         * @param pipeline [in] Pipeline drawing the object, its vertex input has to be VertexInput::MeshInstanced
+         * @param mesh [in] Mesh of the object, has to outlive the frame's recording
+         * @param instance [in] Placement and material of the object
+         */
+        void add(VkPipeline pipeline, const Mesh& mesh, const InstanceData& instance);
+
+        /**
+         * Writes the frame's groups into a slot's region of the pool and makes them its batches. Throws if the
+         * frame has more instances than reserved.
+         * @param slot [in] Slot of the frames in flight ring being recorded, its previous frame has to be complete
+         */
+        void build(uint32_t slot);
+
+        /**
+         * Records the batches of the last build(), binding each pipeline and mesh as they change
+         * @param commandBuffer [in] Command buffer inside a render pass, the descriptor sets and push constants
+         * of the pipelines' layout have to be bound
+         */
+        void record(VkCommandBuffer commandBuffer) const;
+
+        [[nodiscard]] const std::vector<InstanceBatch>& batches() const { return frameBatches; }
+
+        [[nodiscard]] const InstancingStats& stats() const { return instancingStats; }
+
+        void printStats(std::ostream& out) const;
+
+    private:
+        struct GroupKey {
+            VkPipeline  pipeline;
+            const Mesh* mesh;
+
+            bool operator==(const GroupKey& other) const {
+                return pipeline == other.pipeline && mesh == other.mesh;
+            }
+
+            struct Hash {
+                size_t operator()(const GroupKey& key) const;
+            };
+        };
+
+        struct Group {
+            GroupKey                  key;
+            std::vector<InstanceData> instances;
+        };
+
+        MemoryAllocator* allocator      = nullptr;
+        DeletionQueue*   deletionQueue  = nullptr;
+        uint32_t         framesInFlight = 1;
+        uint32_t         capacity       = 0;
+        uint32_t         maxDrawSize    = 0;
+        LinearPool       ring;
+        // Where the last build() put the frame's instances
+        TransientAllocation frameInstances;
+
+        // Kept across frames so their storage is reused, until a frame adds nothing to them
+        std::vector<Group> groups;
+        std::unordered_map<GroupKey, uint32_t, GroupKey::Hash> groupIndices;
+        // Most objects come in runs of the same pipeline and mesh, so the previous group is tried first
+        uint32_t lastGroup = 0;
+
+        std::vector<InstanceBatch> frameBatches;
+        InstancingStats instancingStats;
+    };
+} // m4x
@@ -0,0 +1,130 @@
+//
+// Created by m4tex on 17/10/26.
+//
+
+#include "JobSystem.h"
+#include "CpuTracer.h"
+
+//std
+#include <algorithm>
+
+namespace m4x {
+    void JobSystem::create(uint32_t workerCount) {
+        stopping = false;
+        workerCount = std::max(workerCount, 1u);
+
+        for (uint32_t i = 0; i < workerCount; ++i) {
+            workers.push_back(std::make_unique<Worker>());
+        }
+
+        // Started only once every deque exists, workers steal from each other right away
+        for (uint32_t i = 0; i < workerCount; ++i) {
+            workers[i]->thread = std::thread(&JobSystem::workerLoop, this, i);
+        }
+    }
+
+    void JobSystem::destroy() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+
+        for (auto& worker : workers) {
+            worker->thread.join();
+        }
+
+        workers.clear();
+    }
+
+    void JobSystem::run(std::vector<Job>& jobs) {
+        if (jobs.empty()) {
+            return;
+        }
+
+        remaining = static_cast<uint32_t>(jobs.size());
+        error = nullptr;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            for (size_t i = 0; i < jobs.size(); ++i) {
+                Worker& worker = *workers[i % workers.size()];
+                std::lock_guard<std::mutex> workerLock(worker.mutex);
+                worker.jobs.push_back(std::move(jobs[i]));
+            }
+
+            queued += static_cast<int64_t>(jobs.size());
+        }
+        wake.notify_all();
+
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [this]() { return remaining == 0; });
+        jobs.clear();
+
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    bool JobSystem::take(uint32_t self, Job& job) {
+        {
+            Worker& own = *workers[self];
+            std::lock_guard<std::mutex> lock(own.mutex);
+
+            // Newest first on the own deque, its data is the most likely to still be in cache
+            if (!own.jobs.empty()) {
+                job = std::move(own.jobs.back());
+                own.jobs.pop_back();
+                queued--;
+                return true;
+            }
+        }
+
+        for (size_t i = 1; i < workers.size(); ++i) {
+            Worker& victim = *workers[(self + i) % workers.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+
+            if (!victim.jobs.empty()) {
+                job = std::move(victim.jobs.front());
+                victim.jobs.pop_front();
+                queued--;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void JobSystem::workerLoop(uint32_t self) {
+        M4X_TRACE_THREAD("job worker");
+
+        while (true) {
+            Job job;
+
+            if (take(self, job)) {
+                try {
+                    job(self);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (!error) {
+                        error = std::current_exception();
+                    }
+                }
+
+                if (remaining.fetch_sub(1) == 1) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    finished.notify_all();
+                }
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this]() { return stopping || queued > 0; });
+
+            if (stopping) {
+                return;
+            }
+        }
+    }
+} // m4x
@@ -0,0 +1,74 @@
+/** @file */
+
+//
+// Created by m4tex on 17/10/26.
+//
+
+#pragma once
+
+// std
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace m4x {
+    /**
+     * Fixed pool of worker threads with a job deque each.
+     * Workers take their own jobs newest first and steal the oldest jobs of the others once they run dry.
+     */
+    class JobSystem {
+    public:
+        /**
+         * A job gets the index of the worker running it, for picking per thread resources
+         */
+        using Job = std::function<void(uint32_t worker)>;
+
+        /**
+         * @param workerCount [in] Amount of threads to start, at least one
+         */
+        void create(uint32_t workerCount);
+
+        /**
+         * Stops and joins the workers, no run() may be in progress
+         */
+        void destroy();
+
+        /**
+         * Spreads the jobs over the workers and blocks until all of them finished.
+         * The first exception thrown by a job is rethrown here.
+         * @param jobs [in] Jobs to run, in no particular order
+         */
+        void run(std::vector<Job>& jobs);
+
+        [[nodiscard]] uint32_t workerCount() const { return static_cast<uint32_t>(workers.size()); }
+
+    private:
+        struct Worker {
+            std::mutex      mutex;
+            std::deque<Job> jobs;
+            std::thread     thread;
+        };
+
+        std::vector<std::unique_ptr<Worker>> workers;
+
+        std::mutex              mutex;
+        std::condition_variable wake;
+        std::condition_variable finished;
+        bool                    stopping = false;
+
+        // Jobs pushed but not taken yet, can dip below zero while a run() is still pushing
+        std::atomic<int64_t>  queued{0};
+        std::atomic<uint32_t> remaining{0};
+        std::exception_ptr    error;
+
+        bool take(uint32_t self, Job& job);
+
+        void workerLoop(uint32_t self);
+    };
+} // m4x
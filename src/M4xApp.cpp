@@ -3,12 +3,153 @@
 //
 
 #include <stdexcept>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <utility>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include <thread>
 #include "M4xApp.h"
 
 
 namespace m4x {
+    namespace {
+        VkPresentModeKHR toPresentMode(PresentPolicy policy) {
+            switch (policy) {
+                case PresentPolicy::FifoRelaxed: return VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+                case PresentPolicy::Mailbox:     return VK_PRESENT_MODE_MAILBOX_KHR;
+                case PresentPolicy::Immediate:   return VK_PRESENT_MODE_IMMEDIATE_KHR;
+                default:                         return VK_PRESENT_MODE_FIFO_KHR;
+            }
+        }
+
+        const char* presentModeName(VkPresentModeKHR presentMode) {
+            switch (presentMode) {
+                case VK_PRESENT_MODE_FIFO_RELAXED_KHR: return "fifo_relaxed";
+                case VK_PRESENT_MODE_MAILBOX_KHR:      return "mailbox";
+                case VK_PRESENT_MODE_IMMEDIATE_KHR:    return "immediate";
+                default:                               return "fifo";
+            }
+        }
+
+        /**
+         * Copies a whole color image into another of the same size and format
+         */
+        void recordCopy(VkCommandBuffer commandBuffer, VkImage source, VkImage destination, VkExtent2D extent) {
+            VkImageCopy region{};
+            region.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+            region.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+            region.extent = { extent.width, extent.height, 1 };
+
+            vkCmdCopyImage(commandBuffer, source, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, destination,
+                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+        }
+
+        /**
+         * Checkerboard of white and a fully saturated hue with its whole mip chain, the hues of the materials
+         * spread evenly around the color wheel
+         */
+        TextureSource generateMaterial(uint32_t material, uint32_t materialCount) {
+            float hue = static_cast<float>(material) / static_cast<float>(materialCount) * 6.0f;
+            uint32_t tint = 0xff000000;
+            for (uint32_t channel = 0; channel < 3; ++channel) {
+                float distance = std::fabs(std::fmod(hue + 4.0f * static_cast<float>(channel), 6.0f) - 3.0f);
+                float value = std::clamp(distance - 1.0f, 0.0f, 1.0f);
+                tint |= static_cast<uint32_t>(value * 255.0f + 0.5f) << (8 * channel);
+            }
+
+            TextureSource source;
+            source.width = MATERIAL_TEXTURE_SIZE;
+            source.height = MATERIAL_TEXTURE_SIZE;
+
+            std::vector<uint32_t> texels(source.width * source.height);
+            for (uint32_t y = 0; y < source.height; ++y) {
+                for (uint32_t x = 0; x < source.width; ++x) {
+                    bool white = (x / MATERIAL_CHECKER_SIZE + y / MATERIAL_CHECKER_SIZE) % 2 == 0;
+                    texels[y * source.width + x] = white ? 0xffffffff : tint;
+                }
+            }
+            source.levels.push_back(std::move(texels));
+
+            // Every level averages 2x2 texels of the previous one
+            for (uint32_t size = MATERIAL_TEXTURE_SIZE / 2; size >= 1; size /= 2) {
+                const std::vector<uint32_t>& previous = source.levels.back();
+                std::vector<uint32_t> level(size * size);
+
+                for (uint32_t y = 0; y < size; ++y) {
+                    for (uint32_t x = 0; x < size; ++x) {
+                        uint32_t texel = 0;
+                        for (uint32_t channel = 0; channel < 4; ++channel) {
+                            uint32_t sum = 0;
+                            for (uint32_t corner = 0; corner < 4; ++corner) {
+                                uint32_t sourceX = 2 * x + corner % 2;
+                                uint32_t sourceY = 2 * y + corner / 2;
+                                sum += (previous[sourceY * size * 2 + sourceX] >> (8 * channel)) & 0xff;
+                            }
+                            texel |= ((sum + 2) / 4) << (8 * channel);
+                        }
+                        level[y * size + x] = texel;
+                    }
+                }
+
+                source.levels.push_back(std::move(level));
+            }
+
+            return source;
+        }
+
+        /**
+         * Tiles the same quad as the regular mesh with a grid of triangles, colored by their position
+         */
+        void generateGrid(uint32_t triangles, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices) {
+            auto cells = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(triangles) / 2.0)));
+            float step = 1.0f / static_cast<float>(cells);
+
+            vertices.clear();
+            indices.clear();
+            for (uint32_t y = 0; y <= cells; ++y) {
+                for (uint32_t x = 0; x <= cells; ++x) {
+                    float u = static_cast<float>(x) * step;
+                    float v = static_cast<float>(y) * step;
+                    vertices.push_back({ { u - 0.5f, v - 0.5f }, { u, v, 1.0f - u } });
+                }
+            }
+
+            // Row by row, the last cell may only get one of its triangles
+            for (uint32_t triangle = 0; triangle < triangles; ++triangle) {
+                uint32_t cell = triangle / 2;
+                uint32_t corner = (cell / cells) * (cells + 1) + cell % cells;
+                if (triangle % 2 == 0) {
+                    indices.insert(indices.end(), { corner, corner + 1, corner + cells + 2 });
+                } else {
+                    indices.insert(indices.end(), { corner + cells + 2, corner + cells + 1, corner });
+                }
+            }
+        }
+    }
+
+    M4xApp::M4xApp(const AppConfig& config) : config(config) {
+        this->config.framesInFlight = std::max(config.framesInFlight, 1u);
+    }
+
     void M4xApp::run() {
-        createWindow();
+        M4X_TRACE_THREAD("main");
+        CpuTracer::Enable(config.profileCpu);
+        startupMark = std::chrono::steady_clock::now();
+
+#if !M4X_CPU_TRACE
+        if (config.profileCpu) {
+            std::cerr << "CPU tracing is compiled out, configure with -DM4X_CPU_TRACE=ON" << std::endl;
+        }
+#endif
+
+        if (!config.headless) {
+            createWindow();
+        }
         initVulkan();
         mainLoop();
         cleanup();
@@ -20,66 +161,344 @@ namespace m4x {
         }
 
         glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-        glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+        glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
 
-        window = glfwCreateWindow(800, 800, "M4X dev build", nullptr, nullptr);
+        window = glfwCreateWindow(static_cast<int>(config.width), static_cast<int>(config.height),
+                                  "M4X dev build", nullptr, nullptr);
 
         if(!window) {
             throw std::runtime_error("Failed to create window.");
         }
+
+        glfwSetWindowUserPointer(window, this);
+        glfwSetFramebufferSizeCallback(window, framebufferResizeCallback);
+    }
+
+    void M4xApp::framebufferResizeCallback(GLFWwindow* window, int width, int height) {
+        auto app = static_cast<M4xApp*>(glfwGetWindowUserPointer(window));
+        app->swapChainOutdated = true;
     }
 
     void M4xApp::initVulkan() {
-        if(GLFW_FALSE == glfwVulkanSupported()) {
+        if(!config.headless && GLFW_FALSE == glfwVulkanSupported()) {
             throw std::runtime_error("Device doesn't support Vulkan.");
         }
 
-        VkUtils::CreateVkInstance(&instance);
-        createSurface();
-        VkUtils::PickPhysicalDevice(instance, surface, &physicalDevice);
+        VkUtils::CreateVkInstance(&instance, config.headless);
+
+        // Headless runs have no surface, which also drops the presenting requirements
+        if (!config.headless) {
+            createSurface();
+        }
+        markStartup("instance");
+
+        VkUtils::PickPhysicalDevice(instance, surface, config.device, &physicalDevice);
 
         queueFamilyIndices = VkUtils::FindQueueFamilies(physicalDevice, surface);
-        VkUtils::CreateLogicalDevice(physicalDevice, queueFamilyIndices, &device);
+
+        std::vector<const char*> extensions = VkUtils::RequiredDeviceExtensions(surface);
+        VkPhysicalDeviceFeatures features{};
+        VkPhysicalDeviceVulkan12Features vulkan12Features{};
+        vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+        selectDeviceFeatures(extensions, features, vulkan12Features);
+
+        VkPhysicalDeviceSynchronization2Features synchronization2Features{};
+        synchronization2Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES;
+        VkPhysicalDeviceDynamicRenderingFeatures dynamicRenderingFeatures{};
+        dynamicRenderingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES;
+
+        if (dynamicRendering) {
+            synchronization2Features.synchronization2 = VK_TRUE;
+            dynamicRenderingFeatures.dynamicRendering = VK_TRUE;
+            dynamicRenderingFeatures.pNext = &synchronization2Features;
+            vulkan12Features.pNext = &dynamicRenderingFeatures;
+        }
+
+        VkUtils::CreateLogicalDevice(physicalDevice, queueFamilyIndices, extensions, features, &vulkan12Features,
+                                     &device);
+
+        // The instance targets 1.2, so the promoted commands come from the extensions
+        if (dynamicRendering) {
+            cmdBeginRendering = reinterpret_cast<PFN_vkCmdBeginRenderingKHR>(
+                    vkGetDeviceProcAddr(device, "vkCmdBeginRenderingKHR"));
+            cmdEndRendering = reinterpret_cast<PFN_vkCmdEndRenderingKHR>(
+                    vkGetDeviceProcAddr(device, "vkCmdEndRenderingKHR"));
+            cmdPipelineBarrier2 = reinterpret_cast<PFN_vkCmdPipelineBarrier2KHR>(
+                    vkGetDeviceProcAddr(device, "vkCmdPipelineBarrier2KHR"));
+        }
 
         getDeviceQueues();
-        createSwapChain();
+        markStartup("device");
+        allocator.create(physicalDevice, device);
+        deletionQueue.create(device, allocator, config.framesInFlight);
+        renderGraph.create(device, allocator, deletionQueue, cmdPipelineBarrier2);
+        descriptorHeap.create(device, deletionQueue);
+
+        if (config.headless) {
+            createOffscreenTarget();
+        } else {
+            createSwapChain();
+        }
+
+        pipelineCache.create(physicalDevice, device, config.pipelineCacheDirectory);
+        shaderLibrary.create(device);
+        shaderLibrary.openArchive("../shaders/shaders.m4xs");
+        pipelineManager.create(device, pipelineCache, shaderLibrary, PIPELINE_COMPILE_THREADS);
+        pipelineManager.loadDescriptions("../shaders/pipelines.txt");
+        markStartup("shaders");
+
+        if (config.gpuDriven) {
+            std::vector<uint32_t> cullFamilies = { queueFamilyIndices.graphicsFamily.value() };
+            if (queueFamilyIndices.computeFamily.has_value()) {
+                cullFamilies.push_back(queueFamilyIndices.computeFamily.value());
+            }
+
+            gpuCulling.create(physicalDevice, device, pipelineCache.handle(), shaderLibrary, config.framesInFlight,
+                              drawIndirectCount, cullFamilies);
+        }
+
+        if (!config.serialQueues && queueFamilyIndices.computeFamily.has_value()) {
+            computeJobs.create(device, pipelineCache.handle(), shaderLibrary, queueFamilyIndices.computeFamily.value(),
+                               computeQueue);
+        } else {
+            computeJobs.create(device, pipelineCache.handle(), shaderLibrary, queueFamilyIndices.graphicsFamily.value(),
+                               graphicsQueue);
+        }
+
+        createRenderPass();
+        createPipelineLayout();
         createPipeline();
+        markStartup("fallback pipeline");
         createFramebuffers();
         createCommandPool();
-        createCommandBuffer();
+        createCommandBuffers();
+        commandRecorder.create(device, queueFamilyIndices.graphicsFamily.value(), config.framesInFlight,
+                               config.recordingThreads);
+
+        if (config.profileGpu) {
+            gpuProfiler.create(physicalDevice, device, queueFamilyIndices.graphicsFamily.value(),
+                               config.framesInFlight, pipelineStatistics);
+        }
+
         createSyncObjects();
+        framePacer.create(config.framesInFlight, config.maxFrameLead);
+        createUploadQueue();
+        markStartup("frame resources");
+        createMaterials();
+        markStartup("materials");
+        instanceBatcher.create(allocator, deletionQueue, config.framesInFlight);
+        createMesh();
+        markStartup("scene");
+    }
+
+    void M4xApp::selectDeviceFeatures(std::vector<const char*>& extensions, VkPhysicalDeviceFeatures& features,
+                                      VkPhysicalDeviceVulkan12Features& vulkan12Features) {
+        const VkPhysicalDeviceFeatures& supported = VkUtils::QueryDeviceCapabilities(physicalDevice).features;
+
+        // Orders the uploads and the async culling pass with the frames, device picking made sure it's there
+        vulkan12Features.timelineSemaphore = VK_TRUE;
+
+        // The descriptor heap, also made sure of by device picking
+        features.shaderSampledImageArrayDynamicIndexing = VK_TRUE;
+        features.shaderStorageBufferArrayDynamicIndexing = VK_TRUE;
+        vulkan12Features.runtimeDescriptorArray = VK_TRUE;
+        vulkan12Features.descriptorBindingPartiallyBound = VK_TRUE;
+        vulkan12Features.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+        vulkan12Features.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+        vulkan12Features.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+        vulkan12Features.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+
+        // The fragment shader reports the mip levels it samples to the texture streamer, device picking made
+        // sure of it as well
+        features.fragmentStoresAndAtomics = VK_TRUE;
+
+        // Without it the streamer assumes half of the device local memory is its own
+        memoryBudget = VkUtils::SupportsDeviceExtension(physicalDevice, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+        if (memoryBudget) {
+            extensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+        }
+
+        // No render pass or framebuffer objects to rebuild when the attachments change
+        dynamicRendering = !config.legacyRenderPass &&
+                           VkUtils::QueryDeviceCapabilities(physicalDevice).dynamicRendering;
+        if (dynamicRendering) {
+            extensions.push_back(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME);
+            extensions.push_back(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME);
+        }
+        std::cout << "Rendering with " << (dynamicRendering ? "dynamic rendering" : "render pass objects")
+                  << std::endl;
+
+        // Profiling still gets the timestamps without it
+        if (config.profileGpu && config.profileGpuStatistics && supported.pipelineStatisticsQuery) {
+            features.pipelineStatisticsQuery = VK_TRUE;
+            pipelineStatistics = true;
+
+            // Lets a statistics query stay active while the secondaries execute, without it the passes recorded
+            // into secondaries only get timestamps
+            if (supported.inheritedQueries) {
+                features.inheritedQueries = VK_TRUE;
+                inheritedQueries = true;
+            }
+        }
+
+        if (!config.gpuDriven) {
+            return;
+        }
+
+        // Every survivor is its own draw, with firstInstance pointing at its object
+        if (!supported.multiDrawIndirect || !supported.drawIndirectFirstInstance) {
+            throw std::runtime_error("GPU driven rendering needs multiDrawIndirect and drawIndirectFirstInstance");
+        }
+
+        features.multiDrawIndirect = VK_TRUE;
+        features.drawIndirectFirstInstance = VK_TRUE;
+
+        // Without it all slots get drawn, the culled ones as zero instance draws
+        drawIndirectCount = VkUtils::SupportsDeviceExtension(physicalDevice, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+        if (drawIndirectCount) {
+            extensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+        }
     }
 
     void M4xApp::mainLoop() {
-        while(!glfwWindowShouldClose(window)) {
-            glfwPollEvents();
-            drawFrame();
+        // Headless frames are written out and timed, so none of them may use the fallback
+        if (config.headless) {
+            pipelineManager.get(pipelineKey);
+            markStartup("pipeline");
         }
 
-        vkDeviceWaitIdle(device);
+        if (config.headless && config.benchScene != BenchScene::None) {
+            runBenchScene();
+        } else if (config.headless && config.benchmarkCompute) {
+            benchmarkCompute();
+        } else if (config.headless && config.benchmarkAsyncQueues) {
+            benchmarkAsyncQueues();
+        } else if (config.headless && config.benchmarkGpuDriven) {
+            benchmarkGpuDriven();
+        } else if (config.headless && config.benchmarkInstancing) {
+            benchmarkInstancing();
+        } else if (config.headless && config.benchmarkRecording) {
+            benchmarkRecording();
+        } else if (config.headless) {
+            renderHeadless();
+        } else {
+            while(!glfwWindowShouldClose(window)) {
+                // Low latency frames poll right before recording instead
+                if (!config.lowLatency) {
+                    M4X_TRACE_SCOPE("poll events");
+                    glfwPollEvents();
+                    framePacer.inputSampled();
+                }
+
+                // Nothing can be rendered while minimized, sleep until the window changes
+                if (swapChainOutdated && !recreateSwapChain()) {
+                    glfwWaitEvents();
+                    continue;
+                }
+
+                drawFrame();
+            }
+
+            vkDeviceWaitIdle(device);
+            uploadQueue.printStats(std::cout);
+            commandRecorder.printStats(std::cout);
+            shaderLibrary.printStats(std::cout);
+            pipelineManager.printStats(std::cout);
+            renderGraph.printStats(std::cout);
+            descriptorHeap.printStats(std::cout);
+            textureStreamer.printStats(std::cout);
+            deletionQueue.printStats(std::cout);
+            if (config.instanced) {
+                instanceBatcher.printStats(std::cout);
+            }
+            framePacer.printStats(std::cout);
+        }
+
+        reportProfiles();
+    }
+
+    void M4xApp::reportProfiles() {
+        if (config.profileCpu) {
+            CpuTracer::PrintFrameBreakdown(std::cout);
+
+            if (!config.cpuTraceFile.empty()) {
+                CpuTracer::WriteChromeTrace(config.cpuTraceFile);
+                std::cout << "CPU trace written to " << config.cpuTraceFile << std::endl;
+            }
+        }
+
+        if (config.profileGpu) {
+            // Every mode ends with the device idle, so the last frames of the ring can be read too
+            gpuProfiler.collectPending();
+            gpuProfiler.printStats(std::cout);
+
+            if (!config.gpuTraceFile.empty()) {
+                gpuProfiler.writeChromeTrace(config.gpuTraceFile);
+                std::cout << "GPU trace written to " << config.gpuTraceFile << std::endl;
+            }
+        }
     }
 
 
     void M4xApp::cleanup() {
-        vkDestroySemaphore(device, imageAvailableSemaphore, nullptr);
-        vkDestroySemaphore(device, renderFinishedSemaphore, nullptr);
-        vkDestroyFence(device, inFlightFence, nullptr);
+        for (auto& frame : frames) {
+            vkDestroySemaphore(device, frame.imageAvailableSemaphore, nullptr);
+            vkDestroyFence(device, frame.inFlightFence, nullptr);
+        }
+        vkDestroySemaphore(device, cullTimeline, nullptr);
 
+        for (auto semaphore : renderFinishedSemaphores) {
+            vkDestroySemaphore(device, semaphore, nullptr);
+        }
+
+        commandRecorder.destroy();
+        gpuProfiler.destroy();
         vkDestroyCommandPool(device, commandPool, nullptr);
+        if (computeCommandPool != VK_NULL_HANDLE) {
+            vkDestroyCommandPool(device, computeCommandPool, nullptr);
+        }
 
         for (auto framebuffer : swapChainFramebuffers) {
             vkDestroyFramebuffer(device, framebuffer, nullptr);
         }
 
-        vkDestroyPipeline(device, graphicsPipeline, nullptr);
+        pipelineManager.destroy();
         vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+
+        pipelineCache.save(device);
+        pipelineCache.destroy(device);
         vkDestroyRenderPass(device, renderPass, nullptr);
 
+        if (config.gpuDriven) {
+            gpuCulling.destroy(allocator);
+        }
+        computeJobs.destroy();
+        shaderLibrary.destroy();
+
+        textureStreamer.destroy();
+        vkDestroySampler(device, materialSampler, nullptr);
+        descriptorHeap.destroy();
+
+        renderGraph.destroy();
+        instanceBatcher.destroy();
+        mesh.destroy(allocator);
+        uploadQueue.destroy(allocator);
+        deletionQueue.destroy();
+
+        if (config.headless) {
+            offscreenTarget.destroy(device, allocator);
+            allocator.destroy();
+            vkDestroyDevice(device, nullptr);
+            vkDestroyInstance(instance, nullptr);
+            return;
+        }
+
         for (auto view : swapChainImageViews) {
             vkDestroyImageView(device, view, nullptr);
         }
 
         vkDestroySwapchainKHR(device, swapChain, nullptr);
+        allocator.destroy();
         vkDestroyDevice(device, nullptr);
         vkDestroySurfaceKHR(instance, surface, nullptr);
         vkDestroyInstance(instance, nullptr);
@@ -95,12 +514,16 @@ namespace m4x {
     }
 
     void M4xApp::createSwapChain() {
-        swapChainConfiguration = VkUtils::RetrieveSwapChainConfig(physicalDevice, surface, window);
+        // Falls back to another mode when the surface doesn't support the requested one
+        bool firstSwapChain = swapChain == VK_NULL_HANDLE;
+        swapChainConfiguration = VkUtils::RetrieveSwapChainConfig(physicalDevice, surface, window,
+                                                                  toPresentMode(config.presentPolicy));
 
-        uint32_t imageCount = swapChainConfiguration.capabilities.minImageCount + 1;
+        uint32_t imageCount = VkUtils::SwapChainImageCount(swapChainConfiguration);
 
-        if (swapChainConfiguration.capabilities.maxImageCount > 0 && imageCount > swapChainConfiguration.capabilities.maxImageCount) {
-            imageCount = swapChainConfiguration.capabilities.maxImageCount;
+        if (firstSwapChain) {
+            std::cout << "Present mode " << presentModeName(swapChainConfiguration.presentMode) << ", "
+                      << imageCount << " swapchain images" << std::endl;
         }
 
         // Fill in create info structure for the swapchain
@@ -129,7 +552,8 @@ namespace m4x {
         createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
         createInfo.presentMode = swapChainConfiguration.presentMode;
         createInfo.clipped = VK_TRUE;
-        createInfo.oldSwapchain = VK_NULL_HANDLE;
+        // Lets the presentation engine keep showing the old images until the new ones are ready
+        createInfo.oldSwapchain = swapChain;
 
         if (VK_SUCCESS != vkCreateSwapchainKHR(device, &createInfo, nullptr, &swapChain)) {
             throw std::runtime_error("Failed to create a swapChain.");
@@ -139,7 +563,7 @@ namespace m4x {
 
         uint32_t count = 0;
         vkGetSwapchainImagesKHR(device, swapChain, &count, nullptr);
-        swapChainImages.resize(imageCount);
+        swapChainImages.resize(count);
         vkGetSwapchainImagesKHR(device, swapChain, &count, swapChainImages.data());
 
         VkUtils::CreateImageViews(swapChainImages, device, swapChainConfiguration.surfaceFormat.format, swapChainImageViews);
@@ -170,96 +594,76 @@ namespace m4x {
         }
     }
 
-    void M4xApp::getDeviceQueues() {
-        vkGetDeviceQueue(device, queueFamilyIndices.graphicsFamily.value(), 0, &graphicsQueue);
-        vkGetDeviceQueue(device, queueFamilyIndices.presentFamily.value(), 0, &presentQueue);
-    }
+    bool M4xApp::recreateSwapChain() {
+        int width = 0, height = 0;
+        glfwGetFramebufferSize(window, &width, &height);
 
-    void M4xApp::createPipeline() {
-        auto vertShaderCode = VkUtils::ReadShader("../shaders/vert.spv");
-        auto fragShaderCode = VkUtils::ReadShader("../shaders/frag.spv");
+        if (width == 0 || height == 0) {
+            return false;
+        }
 
-        VkShaderModule vertShaderModule = VkUtils::CreateShaderModule(vertShaderCode, device);
-        VkShaderModule fragShaderModule = VkUtils::CreateShaderModule(fragShaderCode, device);
+        // Frames in flight may still render into and present the old images, so nothing waits for the device
+        for (auto framebuffer : std::exchange(swapChainFramebuffers, {})) {
+            deletionQueue.destroyFramebuffer(framebuffer);
+        }
+        for (auto view : std::exchange(swapChainImageViews, {})) {
+            deletionQueue.destroyImageView(view);
+        }
+        for (auto semaphore : std::exchange(renderFinishedSemaphores, {})) {
+            deletionQueue.destroySemaphore(semaphore);
+        }
+        deletionQueue.destroySwapchain(swapChain);
 
-        VkPipelineShaderStageCreateInfo vertShaderStageInfo{};
-        vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-        vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
+        // The render pass only depends on the format, which stays the same for the surface
+        createSwapChain();
+        createFramebuffers();
+        createImageSyncObjects();
 
-        vertShaderStageInfo.module = vertShaderModule;
-        vertShaderStageInfo.pName = "main";
+        swapChainOutdated = false;
+        return true;
+    }
 
-        VkPipelineShaderStageCreateInfo fragShaderStageInfo{};
-        fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-        fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    void M4xApp::getDeviceQueues() {
+        vkGetDeviceQueue(device, queueFamilyIndices.graphicsFamily.value(), 0, &graphicsQueue);
 
-        fragShaderStageInfo.module = fragShaderModule;
-        fragShaderStageInfo.pName = "main";
+        if (queueFamilyIndices.presentFamily.has_value()) {
+            vkGetDeviceQueue(device, queueFamilyIndices.presentFamily.value(), 0, &presentQueue);
+        }
 
-        VkPipelineShaderStageCreateInfo  shaderStages[] = { vertShaderStageInfo, fragShaderStageInfo };
+        if (queueFamilyIndices.transferFamily.has_value()) {
+            vkGetDeviceQueue(device, queueFamilyIndices.transferFamily.value(), 0, &transferQueue);
+        } else {
+            transferQueue = graphicsQueue;
+        }
 
-        VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
-        vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-        vertexInputInfo.vertexBindingDescriptionCount = 0;
-        vertexInputInfo.pVertexBindingDescriptions = nullptr;
-        vertexInputInfo.vertexAttributeDescriptionCount = 0;
-        vertexInputInfo.pVertexAttributeDescriptions = nullptr;
+        if (queueFamilyIndices.computeFamily.has_value()) {
+            vkGetDeviceQueue(device, queueFamilyIndices.computeFamily.value(), 0, &computeQueue);
+        } else {
+            computeQueue = graphicsQueue;
+        }
 
-        VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
-        inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-        inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-        inputAssembly.primitiveRestartEnable = VK_FALSE;
+        // Only the culling pass uses compute, so the queue is left alone outside of GPU driven mode
+        asyncCompute = !config.serialQueues && config.gpuDriven && queueFamilyIndices.computeFamily.has_value();
+        asyncTransfer = !config.serialQueues && queueFamilyIndices.transferFamily.has_value();
+    }
 
-        VkViewport viewport{};
-        viewport.x = 0.0f;
-        viewport.y = 0.0f;
-        viewport.width = (float) swapChainConfiguration.extent.width;
-        viewport.height = (float) swapChainConfiguration.extent.height;
-        viewport.minDepth = 0.0f;
-        viewport.maxDepth = 1.0f;
+    void M4xApp::createOffscreenTarget() {
+        // Mirrors what createSwapChain provides, so the pipeline and framebuffers don't care about the mode
+        swapChainConfiguration = {};
+        swapChainConfiguration.surfaceFormat = { VK_FORMAT_R8G8B8A8_UNORM, VK_COLOR_SPACE_SRGB_NONLINEAR_KHR };
+        swapChainConfiguration.presentMode = VK_PRESENT_MODE_FIFO_KHR;
+        swapChainConfiguration.extent = { config.width, config.height };
 
-        VkRect2D scissor{};
-        scissor.offset = {0, 0};
-        scissor.extent = swapChainConfiguration.extent;
+        offscreenTarget.create(physicalDevice, device, allocator, swapChainConfiguration.extent,
+                               swapChainConfiguration.surfaceFormat.format, config.framesInFlight);
+
+        pendingReadbacks.assign(config.framesInFlight, std::nullopt);
+        lastFrame.resize(offscreenTarget.frameSize());
+    }
 
-        VkPipelineViewportStateCreateInfo viewportState{};
-        viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-        viewportState.viewportCount = 1;
-        viewportState.pViewports = &viewport;
-        viewportState.scissorCount = 1;
-        viewportState.pScissors = &scissor;
-
-        VkPipelineRasterizationStateCreateInfo rasterizer{};
-        rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-        rasterizer.depthClampEnable = VK_FALSE;
-        rasterizer.rasterizerDiscardEnable = VK_FALSE;
-        rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
-        rasterizer.lineWidth = 1.0f;
-        rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-        rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
-        rasterizer.depthBiasEnable = VK_FALSE;
-
-        VkPipelineMultisampleStateCreateInfo multisample{};
-        multisample.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-        multisample.sampleShadingEnable = VK_FALSE;
-        multisample.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-
-        VkPipelineColorBlendAttachmentState colorBlendAttachment{};
-        colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-        colorBlendAttachment.blendEnable = VK_FALSE;
-
-        VkPipelineColorBlendStateCreateInfo colorBlending{};
-        colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-        colorBlending.logicOpEnable = VK_FALSE;
-        colorBlending.attachmentCount = 1;
-        colorBlending.pAttachments = &colorBlendAttachment;
-
-        VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
-        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-
-        if (VK_SUCCESS != vkCreatePipelineLayout(device, &pipelineLayoutInfo,
-                                                 nullptr, &pipelineLayout)) {
-            throw std::runtime_error("Failed to create pipeline layout");
+    void M4xApp::createRenderPass() {
+        if (dynamicRendering) {
+            return;
         }
 
         VkAttachmentDescription colorAttachment{};
@@ -269,8 +673,9 @@ namespace m4x {
         colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
         colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
         colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-        colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+        // The render graph transitions the target around the pass, for presenting or the headless readback
+        colorAttachment.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
         VkAttachmentReference colorAttachmentRef{};
         colorAttachmentRef.attachment = 0;
@@ -288,48 +693,79 @@ namespace m4x {
         renderPassInfo.subpassCount = 1;
         renderPassInfo.pSubpasses = &subpass;
 
-        VkSubpassDependency dependency{};
-        dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-        dependency.dstSubpass = 0;
-        dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-        dependency.srcAccessMask = 0;
-        dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-        dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-
-        renderPassInfo.dependencyCount = 1;
-        renderPassInfo.pDependencies = &dependency;
-
         if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass)) {
             throw std::runtime_error("Failed to create a render pass");
         }
+    }
 
-        VkGraphicsPipelineCreateInfo pipelineInfo{};
-        pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-        pipelineInfo.stageCount = 2;
-        pipelineInfo.pStages = shaderStages;
-        pipelineInfo.pVertexInputState = &vertexInputInfo;
-        pipelineInfo.pInputAssemblyState = &inputAssembly;
-        pipelineInfo.pViewportState = &viewportState;
-        pipelineInfo.pRasterizationState = &rasterizer;
-        pipelineInfo.pMultisampleState = &multisample;
-        pipelineInfo.pDepthStencilState = nullptr;
-        pipelineInfo.pColorBlendState = &colorBlending;
-        pipelineInfo.pDynamicState = nullptr;
+    void M4xApp::createPipelineLayout() {
+        // Shared by the pipeline and its fallback, so it covers the shaders of both
+        std::string name = scenePipeline();
+        std::vector<std::string> shaders = pipelineManager.shaderNames(name);
+        if (auto fallback = pipelineManager.fallback(name)) {
+            std::vector<std::string> fallbackShaders = pipelineManager.shaderNames(fallback.value());
+            shaders.insert(shaders.end(), fallbackShaders.begin(), fallbackShaders.end());
+        }
 
-        if (VK_SUCCESS != vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &graphicsPipeline)) {
-            throw std::runtime_error("Failed to create a graphics pipeline");
+        // The heap is the only set, whatever the draws read is an index into it. Its tables are runtime sized,
+        // so its layout is provided rather than reflected.
+        ReflectedLayout reflected = shaderLibrary.createPipelineLayout(shaders, { descriptorHeap.layout() });
+        if (reflected.setLayouts.size() != 1) {
+            throw std::runtime_error("The scene shaders may only use the descriptor heap's set");
         }
+        pipelineLayout = reflected.layout;
+    }
 
-        vkDestroyShaderModule(device, vertShaderModule, nullptr);
-        vkDestroyShaderModule(device, fragShaderModule, nullptr);
+    std::string M4xApp::scenePipeline() const {
+        // GPU driven draws read their objects from a storage buffer, instanced ones from the instance ring,
+        // instead of push constants
+        if (config.gpuDriven) {
+            return "mesh_indirect";
+        }
+        return config.instanced ? "mesh_instanced" : "mesh";
+    }
+
+    void M4xApp::createPipeline() {
+        std::string name = scenePipeline();
+        VkFormat format = swapChainConfiguration.surfaceFormat.format;
+        pipelineKey = pipelineManager.key(name, renderPass, format, pipelineLayout);
+
+        auto compileStart = std::chrono::steady_clock::now();
+
+        // Only the fallback is waited for, the first frames draw with it while the real pipeline compiles
+        if (auto fallback = pipelineManager.fallback(name)) {
+            PipelineKey fallbackKey = pipelineManager.key(fallback.value(), renderPass, format, pipelineLayout);
+            pipelineManager.compileAsync({ fallbackKey, pipelineKey });
+            fallbackPipeline = pipelineManager.get(fallbackKey);
+        } else {
+            pipelineManager.compileAsync({ pipelineKey });
+        }
+
+        // Queued behind the scene's own pipeline, the bench scene waits for all of them before its first frame
+        if (config.benchScene == BenchScene::Pipelines && config.instanced && !config.gpuDriven) {
+            for (uint32_t i = 0; i < config.benchSize; ++i) {
+                benchPipelineKeys.push_back(pipelineManager.specialized(pipelineKey, "SHADE=" + std::to_string(i)));
+            }
+            pipelineManager.compileAsync(benchPipelineKeys);
+        }
+
+        double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - compileStart).count();
+        std::cout << "Fallback pipeline creation: " << milliseconds << " ms ("
+                  << (pipelineCache.warm() ? "warm" : "cold") << " cache)" << std::endl;
     }
 
     void M4xApp::createFramebuffers() {
-        swapChainFramebuffers.resize(swapChainImageViews.size());
+        if (dynamicRendering) {
+            return;
+        }
+
+        const auto& views = config.headless ? offscreenTarget.views() : swapChainImageViews;
 
-        for (size_t i = 0; i < swapChainImageViews.size(); ++i) {
+        swapChainFramebuffers.resize(views.size());
+
+        for (size_t i = 0; i < views.size(); ++i) {
             VkImageView attachments[] = {
-                    swapChainImageViews[i]
+                    views[i]
             };
 
             VkFramebufferCreateInfo createInfo{};
@@ -357,20 +793,154 @@ namespace m4x {
         if (VK_SUCCESS != vkCreateCommandPool(device, &createInfo, nullptr, &commandPool)) {
             throw std::runtime_error("Failed to create a command pool");
         }
+
+        // The async queue benchmark switches to the compute queue mid run, so the pool exists whenever it could
+        if (config.gpuDriven && queueFamilyIndices.computeFamily.has_value()) {
+            createInfo.queueFamilyIndex = queueFamilyIndices.computeFamily.value();
+
+            if (VK_SUCCESS != vkCreateCommandPool(device, &createInfo, nullptr, &computeCommandPool)) {
+                throw std::runtime_error("Failed to create the compute command pool");
+            }
+        }
     }
 
-    void M4xApp::createCommandBuffer() {
+    void M4xApp::createCommandBuffers() {
+        frames.resize(config.framesInFlight);
+
+        std::vector<VkCommandBuffer> commandBuffers(config.framesInFlight);
+
         VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
         allocInfo.commandPool = commandPool;
         allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-        allocInfo.commandBufferCount = 1;
+        allocInfo.commandBufferCount = config.framesInFlight;
 
-        if (VK_SUCCESS != vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer)) {
+        if (VK_SUCCESS != vkAllocateCommandBuffers(device, &allocInfo, commandBuffers.data())) {
             throw std::runtime_error("Failed to allocate command buffers");
         }
+
+        for (uint32_t i = 0; i < config.framesInFlight; ++i) {
+            frames[i].commandBuffer = commandBuffers[i];
+        }
+
+        if (computeCommandPool == VK_NULL_HANDLE) {
+            return;
+        }
+
+        allocInfo.commandPool = computeCommandPool;
+
+        if (VK_SUCCESS != vkAllocateCommandBuffers(device, &allocInfo, commandBuffers.data())) {
+            throw std::runtime_error("Failed to allocate compute command buffers");
+        }
+
+        for (uint32_t i = 0; i < config.framesInFlight; ++i) {
+            frames[i].computeCommandBuffer = commandBuffers[i];
+        }
+    }
+
+    void M4xApp::createUploadQueue() {
+        uint32_t graphicsFamily = queueFamilyIndices.graphicsFamily.value();
+
+        if (asyncTransfer) {
+            uploadQueue.create(device, allocator, queueFamilyIndices.transferFamily.value(), graphicsFamily,
+                               transferQueue);
+        } else {
+            uploadQueue.create(device, allocator, graphicsFamily, graphicsFamily, graphicsQueue);
+        }
+    }
+
+    void M4xApp::createMaterials() {
+        VkSamplerCreateInfo samplerInfo{};
+        samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+        samplerInfo.magFilter = VK_FILTER_LINEAR;
+        samplerInfo.minFilter = VK_FILTER_LINEAR;
+        samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+        samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+        samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+        samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+        samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+        if (VK_SUCCESS != vkCreateSampler(device, &samplerInfo, nullptr, &materialSampler)) {
+            throw std::runtime_error("Failed to create the material sampler");
+        }
+        materialSamplerIndex = descriptorHeap.addSampler(materialSampler);
+
+        // A pack that can't be read or was made for another material count gets generated again
+        bool generate = true;
+        try {
+            TexturePack existing;
+            existing.open(config.texturePack);
+            generate = existing.textureCount() != config.materialCount ||
+                       existing.texture(0).width != MATERIAL_TEXTURE_SIZE;
+        } catch (const std::runtime_error&) {
+        }
+
+        if (generate) {
+            std::cout << "Generating the texture pack " << config.texturePack << std::endl;
+
+            std::vector<TextureSource> sources;
+            for (uint32_t i = 0; i < config.materialCount; ++i) {
+                sources.push_back(generateMaterial(i, config.materialCount));
+            }
+            TexturePack::Write(config.texturePack, sources);
+        }
+
+        textureStreamer.create(physicalDevice, device, allocator, uploadQueue, descriptorHeap, deletionQueue,
+                               config.framesInFlight, config.texturePack, memoryBudget,
+                               VkDeviceSize(config.textureBudget) * 1024 * 1024);
+    }
+
+    void M4xApp::createMesh() {
+        std::vector<Vertex> vertices = {
+                {{-0.5f, -0.5f}, {1.0f, 0.0f, 0.0f}},
+                {{0.5f, -0.5f}, {0.0f, 1.0f, 0.0f}},
+                {{0.5f, 0.5f}, {0.0f, 0.0f, 1.0f}},
+                {{-0.5f, 0.5f}, {1.0f, 1.0f, 1.0f}}
+        };
+
+        std::vector<uint32_t> indices = {
+                0, 1, 2, 2, 3, 0
+        };
+
+        if (config.benchScene == BenchScene::Triangles) {
+            generateGrid(config.benchSize, vertices, indices);
+        }
+
+        mesh.create(allocator, uploadQueue, vertices, indices);
+
+        layoutObjects(config.objectCount);
+    }
+
+    void M4xApp::layoutObjects(uint32_t count) {
+        // A single object keeps the quad at its original size, more of them shrink it to half of their cell
+        auto columns = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(count))));
+        float cell = 2.0f / static_cast<float>(columns);
+
+        objects.resize(count);
+        for (uint32_t i = 0; i < count; ++i) {
+            objects[i].offset = { (-1.0f + cell * (static_cast<float>(i % columns) + 0.5f)) * config.zoom,
+                                  (-1.0f + cell * (static_cast<float>(i / columns) + 0.5f)) * config.zoom };
+            objects[i].scale = { cell / 2.0f * config.zoom, cell / 2.0f * config.zoom };
+            objects[i].texture = i % textureStreamer.textureCount();
+            objects[i].sampler = materialSamplerIndex;
+        }
+
+        if (config.instanced && !config.gpuDriven) {
+            instanceBatcher.reserve(count);
+        }
+
+        if (config.gpuDriven) {
+            gpuCulling.setObjects(allocator, uploadQueue, mesh, objects);
+
+            // The previous buffer is gone already, so no frame recorded from now on may read its slot
+            descriptorHeap.release(DescriptorTable::Buffer, objectBufferIndex);
+            objectBufferIndex = descriptorHeap.addBuffer(gpuCulling.objectBuffer());
+        }
     }
 
     void M4xApp::recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
+        auto start = std::chrono::steady_clock::now();
+
         VkCommandBufferBeginInfo beginInfo{};
         beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 
@@ -378,19 +948,281 @@ namespace m4x {
             throw std::runtime_error("Failed to begin a command buffer");
         }
 
+        gpuProfiler.beginFrame(commandBuffer, currentFrame);
+
+        // Fences signal in submission order, so with the slot free every frame up to frameNumber - framesInFlight
+        // has completed
+        deletionQueue.beginFrame(frameNumber);
+
+        // Loads the texture levels the slot's previous frame sampled, which the flush below uploads
+        textureStreamer.update(currentFrame, frameNumber);
+
+        // Everything enqueued since the last frame goes out as one batch before the render pass reads it
+        frames[currentFrame].uploadWait = uploadQueue.flush(commandBuffer);
+        frames[currentFrame].cullWait = 0;
+
+        descriptorHeap.beginFrame();
+        defragmentMemory(commandBuffer);
+
+        // Draws with the fallback until the compile threads publish the pipeline, and skips them without one
+        graphicsPipeline = pipelineManager.request(pipelineKey);
+        if (graphicsPipeline == VK_NULL_HANDLE) {
+            graphicsPipeline = fallbackPipeline;
+        }
+
+        renderGraph.begin();
+
+        VkFormat format = swapChainConfiguration.surfaceFormat.format;
+        GraphResource target;
+        if (config.headless) {
+            // Last read by the readback of the frame that rendered into the image before
+            target = renderGraph.importImage("target", offscreenTarget.image(imageIndex), format,
+                                             { VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                                               VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL });
+        } else {
+            // The submission waits for the acquire at the color attachment output stage
+            target = renderGraph.importImage("swapchain", swapChainImages[imageIndex], format,
+                                             { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0,
+                                               VK_IMAGE_LAYOUT_UNDEFINED });
+            renderGraph.markOutput(target, ResourceUsage::Present);
+        }
+
+        GraphResource drawCommands = 0;
+        GraphResource drawCount = 0;
+        if (config.gpuDriven) {
+            // Last read by the draw of the frame that used the slot before
+            ImportState drawState{ VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0 };
+
+            if (asyncCompute && graphicsPipeline != VK_NULL_HANDLE) {
+                // Culled on the compute queue by submitCull(), which overlaps the graphics work of the previous
+                // frames. The acquire makes the buffers visible to the draw already.
+                frames[currentFrame].cullWait = ++cullValue;
+                gpuCulling.recordAcquire(commandBuffer, currentFrame, queueFamilyIndices.computeFamily.value(),
+                                         queueFamilyIndices.graphicsFamily.value());
+                drawState.access = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+            }
+
+            drawCommands = renderGraph.importBuffer("draw commands", gpuCulling.drawCommands(currentFrame),
+                                                    drawState);
+            drawCount = renderGraph.importBuffer("draw count", gpuCulling.drawCount(currentFrame), drawState);
+        }
+
+        // Culled by the graph along with the draw when there is no pipeline to draw with
+        if (config.gpuDriven && !asyncCompute) {
+            GraphPass cull = renderGraph.addPass("cull", [this](VkCommandBuffer commandBuffer, const RenderGraph&) {
+                GpuProfiler::Scope scope(gpuProfiler, commandBuffer, "cull", true);
+
+                // Recording stays the same handful of commands however many objects there are
+                gpuCulling.recordCull(commandBuffer, currentFrame, GpuCulling::ClipSpacePlanes());
+            });
+
+            for (GraphResource buffer : { drawCommands, drawCount }) {
+                renderGraph.use(cull, buffer, ResourceUsage::TransferDestination);
+                renderGraph.use(cull, buffer, ResourceUsage::StorageWrite);
+            }
+        }
+
+        GraphPass scene = renderGraph.addPass("scene", [this, imageIndex](VkCommandBuffer commandBuffer,
+                                                                          const RenderGraph&) {
+            recordScene(commandBuffer, imageIndex);
+        });
+        renderGraph.use(scene, target, ResourceUsage::ColorAttachment);
+
+        // Reset by the host before the frame, read by it once the frame's fence signals
+        GraphResource feedback = renderGraph.importBuffer("texture feedback",
+                                                          textureStreamer.feedbackBuffer(currentFrame),
+                                                          { VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_WRITE_BIT });
+        renderGraph.use(scene, feedback, ResourceUsage::FragmentStorageWrite);
+        renderGraph.markOutput(feedback, ResourceUsage::HostRead);
+
+        if (config.gpuDriven && graphicsPipeline != VK_NULL_HANDLE) {
+            renderGraph.use(scene, drawCommands, ResourceUsage::IndirectRead);
+            renderGraph.use(scene, drawCount, ResourceUsage::IndirectRead);
+        }
+
+        if (config.headless) {
+            // Every link of the chain only lives across two passes, so all of them fit in the memory of two
+            GraphResource previous = target;
+            for (uint32_t i = 0; i < config.postPasses; ++i) {
+                GraphResource next = renderGraph.createImage("post", { swapChainConfiguration.extent, format, 0 });
+
+                GraphPass post = renderGraph.addPass("post", [this, previous, next](VkCommandBuffer commandBuffer,
+                                                                                    const RenderGraph& graph) {
+                    recordCopy(commandBuffer, graph.image(previous), graph.image(next),
+                               swapChainConfiguration.extent);
+                });
+                renderGraph.use(post, previous, ResourceUsage::TransferSource);
+                renderGraph.use(post, next, ResourceUsage::TransferDestination);
+
+                previous = next;
+            }
+
+            if (previous != target) {
+                GraphPass resolve = renderGraph.addPass("post resolve", [this, previous, target](
+                        VkCommandBuffer commandBuffer, const RenderGraph& graph) {
+                    recordCopy(commandBuffer, graph.image(previous), graph.image(target),
+                               swapChainConfiguration.extent);
+                });
+                renderGraph.use(resolve, previous, ResourceUsage::TransferSource);
+                renderGraph.use(resolve, target, ResourceUsage::TransferDestination);
+            }
+
+            GraphResource readback = renderGraph.importBuffer("readback", offscreenTarget.readback(), {});
+
+            GraphPass copy = renderGraph.addPass("readback", [this, imageIndex](VkCommandBuffer commandBuffer,
+                                                                                const RenderGraph&) {
+                GpuProfiler::Scope scope(gpuProfiler, commandBuffer, "readback");
+                offscreenTarget.recordReadback(commandBuffer, imageIndex);
+            });
+            renderGraph.use(copy, target, ResourceUsage::TransferSource);
+            renderGraph.use(copy, readback, ResourceUsage::TransferDestination);
+
+            // Visible to the host once the frame's fence signals
+            renderGraph.markOutput(readback, ResourceUsage::HostRead);
+        }
+
+        renderGraph.execute(commandBuffer);
+
+        gpuProfiler.endFrame(commandBuffer);
+
+        if (VK_SUCCESS != vkEndCommandBuffer(commandBuffer)) {
+            throw std::runtime_error("Failed to record a command buffer");
+        }
+
+        primaryRecordSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        primaryRecordedFrames++;
+    }
+
+    void M4xApp::recordScene(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
+        // Secondaries may only execute inside a statistics query if they inherit it
+        bool secondaries = graphicsPipeline != VK_NULL_HANDLE && !config.gpuDriven && !config.instanced;
+        GpuProfiler::Scope scope(gpuProfiler, commandBuffer, "render pass", !secondaries || inheritedQueries);
+
+        if (graphicsPipeline == VK_NULL_HANDLE) {
+            beginScene(commandBuffer, imageIndex, false);
+        } else if (config.gpuDriven) {
+            beginScene(commandBuffer, imageIndex, false);
+            bindDrawState(commandBuffer);
+
+            // The vertex shader finds the objects in the heap's buffer table
+            vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0,
+                               sizeof(objectBufferIndex), &objectBufferIndex);
+            gpuCulling.recordDraw(commandBuffer, currentFrame);
+        } else if (config.instanced) {
+            beginScene(commandBuffer, imageIndex, false);
+            bindDrawState(commandBuffer);
+
+            // Every object is written into the frame's part of the ring, grouped into a draw per pipeline and mesh.
+            // The objects keep the colors of the mesh, so they are tinted white.
+            instanceBatcher.begin();
+            for (size_t i = 0; i < objects.size(); ++i) {
+                const DrawObject& object = objects[i];
+                VkPipeline pipeline = benchPipelines.empty() ? graphicsPipeline
+                                                             : benchPipelines[i % benchPipelines.size()];
+                instanceBatcher.add(pipeline, mesh, { object.offset, object.scale, 0xffffffffu, object.texture,
+                                                      object.sampler });
+            }
+            instanceBatcher.build(currentFrame);
+            instanceBatcher.record(commandBuffer);
+        } else {
+            beginScene(commandBuffer, imageIndex, true);
+
+            VkFormat format = swapChainConfiguration.surfaceFormat.format;
+
+            VkCommandBufferInheritanceRenderingInfo renderingInheritance{};
+            renderingInheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO;
+            renderingInheritance.colorAttachmentCount = 1;
+            renderingInheritance.pColorAttachmentFormats = &format;
+            renderingInheritance.depthAttachmentFormat = VK_FORMAT_UNDEFINED;
+            renderingInheritance.stencilAttachmentFormat = VK_FORMAT_UNDEFINED;
+            renderingInheritance.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+            VkCommandBufferInheritanceInfo inheritance{};
+            inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+            if (dynamicRendering) {
+                inheritance.pNext = &renderingInheritance;
+            } else {
+                inheritance.renderPass = renderPass;
+                inheritance.subpass = 0;
+                inheritance.framebuffer = swapChainFramebuffers[imageIndex];
+            }
+            // The render pass scope's statistics query stays active while the secondaries execute
+            inheritance.pipelineStatistics = inheritedQueries ? gpuProfiler.inheritedStatistics() : 0;
+
+            // A few chunks per thread so the workers that finish early have something to steal
+            auto objectCount = static_cast<uint32_t>(objects.size());
+            uint32_t chunkCount = std::min(objectCount, commandRecorder.workerCount() * RECORDING_CHUNKS_PER_THREAD);
+            uint32_t chunkSize = (objectCount + chunkCount - 1) / chunkCount;
+            chunkCount = (objectCount + chunkSize - 1) / chunkSize;
+
+            auto secondaries = commandRecorder.record(
+                    currentFrame, inheritance, chunkCount, [&](VkCommandBuffer secondary, uint32_t chunk) {
+                        uint32_t first = chunk * chunkSize;
+                        recordObjects(secondary, first, std::min(chunkSize, objectCount - first));
+                    });
+
+            vkCmdExecuteCommands(commandBuffer, static_cast<uint32_t>(secondaries.size()), secondaries.data());
+        }
+
+        endScene(commandBuffer);
+    }
+
+    void M4xApp::beginScene(VkCommandBuffer commandBuffer, uint32_t imageIndex, bool secondaries) {
+        VkClearValue clearColor = {{{0.0f, 0.0f, 0.0f, 1.0f}}};
+
+        VkRect2D renderArea{};
+        renderArea.offset = {0, 0};
+        renderArea.extent = swapChainConfiguration.extent;
+
+        if (dynamicRendering) {
+            VkRenderingAttachmentInfo colorAttachment{};
+            colorAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+            colorAttachment.imageView = config.headless ? offscreenTarget.views()[imageIndex]
+                                                        : swapChainImageViews[imageIndex];
+            colorAttachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+            colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+            colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+            colorAttachment.clearValue = clearColor;
+
+            VkRenderingInfo renderingInfo{};
+            renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
+            renderingInfo.flags = secondaries ? VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT : 0;
+            renderingInfo.renderArea = renderArea;
+            renderingInfo.layerCount = 1;
+            renderingInfo.colorAttachmentCount = 1;
+            renderingInfo.pColorAttachments = &colorAttachment;
+
+            cmdBeginRendering(commandBuffer, &renderingInfo);
+            return;
+        }
+
         VkRenderPassBeginInfo renderPassInfo{};
         renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
         renderPassInfo.renderPass = renderPass;
         renderPassInfo.framebuffer = swapChainFramebuffers[imageIndex];
-        renderPassInfo.renderArea.offset = {0, 0};
-        renderPassInfo.renderArea.extent = swapChainConfiguration.extent;
-
-        VkClearValue clearColor = {{{0.0f, 0.0f, 0.0f, 1.0f}}};
+        renderPassInfo.renderArea = renderArea;
         renderPassInfo.clearValueCount = 1;
         renderPassInfo.pClearValues = &clearColor;
 
-        vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+        vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, secondaries ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS
+                                                                         : VK_SUBPASS_CONTENTS_INLINE);
+    }
+
+    void M4xApp::endScene(VkCommandBuffer commandBuffer) {
+        if (dynamicRendering) {
+            cmdEndRendering(commandBuffer);
+        } else {
+            vkCmdEndRenderPass(commandBuffer);
+        }
+    }
+
+    void M4xApp::bindDrawState(VkCommandBuffer commandBuffer) const {
         vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+        descriptorHeap.bind(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout);
+
+        StreamingConstants streaming = textureStreamer.constants(currentFrame);
+        vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(DrawObject),
+                           sizeof(streaming), &streaming);
 
         VkViewport viewport{};
         viewport.x = 0.0f;
@@ -408,47 +1240,118 @@ namespace m4x {
 
         vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
-        vkCmdDraw(commandBuffer, 3, 1, 0, 0);
-        vkCmdEndRenderPass(commandBuffer);
+        mesh.bind(commandBuffer);
+    }
 
-        if (VK_SUCCESS != vkEndCommandBuffer(commandBuffer)) {
-            throw std::runtime_error("Failed to record a command buffer");
+    void M4xApp::recordObjects(VkCommandBuffer commandBuffer, uint32_t first, uint32_t count) const {
+        // Secondary buffers inherit no state, everything is set again per buffer
+        bindDrawState(commandBuffer);
+
+        for (uint32_t i = first; i < first + count; ++i) {
+            vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(DrawObject),
+                               &objects[i]);
+            mesh.draw(commandBuffer);
         }
     }
 
     void M4xApp::drawFrame() {
-        vkWaitForFences(device, 1, &inFlightFence, VK_TRUE, UINT64_MAX);
-        vkResetFences(device, 1, &inFlightFence);
+        FrameData& frame = frames[currentFrame];
+        M4X_TRACE_FRAME(frameNumber);
+
+        // A lead tighter than the ring waits for a more recent frame than the one that used this slot
+        uint32_t paceSlot = framePacer.paceSlot(currentFrame);
+        if (paceSlot != currentFrame) {
+            M4X_TRACE_SCOPE("pace wait");
+            auto waitStart = FramePacer::Clock::now();
+            vkWaitForFences(device, 1, &frames[paceSlot].inFlightFence, VK_TRUE, UINT64_MAX);
+            framePacer.addPaceWait(FramePacer::Clock::now() - waitStart);
+        }
+
+        {
+            M4X_TRACE_SCOPE("fence wait");
+
+            // Only blocks when the CPU is a whole ring ahead of the GPU
+            vkWaitForFences(device, 1, &frame.inFlightFence, VK_TRUE, UINT64_MAX);
+        }
+        commandRecorder.beginFrame(currentFrame);
 
         uint32_t imageIndex;
-        vkAcquireNextImageKHR(device, swapChain, UINT64_MAX, imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
+        VkResult result;
+        {
+            M4X_TRACE_SCOPE("acquire");
+            result = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX, frame.imageAvailableSemaphore,
+                                           VK_NULL_HANDLE, &imageIndex);
+        }
 
-        vkResetCommandBuffer(commandBuffer, 0);
-        recordCommandBuffer(commandBuffer, imageIndex);
+        // Every wait of the frame is behind us now, so the input is as fresh as it gets
+        if (config.lowLatency) {
+            M4X_TRACE_SCOPE("poll events");
+            glfwPollEvents();
+            framePacer.inputSampled();
+        }
 
-        VkSubmitInfo submitInfo{};
-        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        // The semaphore isn't signaled in this case and the fence is still untouched, so just skip the frame
+        if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+            swapChainOutdated = true;
+            return;
+        }
 
-        VkSemaphore waitSemaphores[] = {
-                imageAvailableSemaphore
-        };
+        // Suboptimal still acquired an image, it gets rendered and presented before recreating
+        if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+            throw std::runtime_error("Failed to acquire a swapchain image");
+        }
 
-        VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-        submitInfo.waitSemaphoreCount = 1;
-        submitInfo.pWaitSemaphores = waitSemaphores;
-        submitInfo.pWaitDstStageMask = waitStages;
+        // The image can be handed out again while another slot of the ring is still rendering into it
+        if (imagesInFlight[imageIndex] != VK_NULL_HANDLE) {
+            M4X_TRACE_SCOPE("image fence wait");
+            vkWaitForFences(device, 1, &imagesInFlight[imageIndex], VK_TRUE, UINT64_MAX);
+        }
+        imagesInFlight[imageIndex] = frame.inFlightFence;
+
+        vkResetFences(device, 1, &frame.inFlightFence);
+
+        {
+            M4X_TRACE_SCOPE("record");
+            vkResetCommandBuffer(frame.commandBuffer, 0);
+            recordCommandBuffer(frame.commandBuffer, imageIndex);
+        }
+
+        if (frame.cullWait != 0) {
+            M4X_TRACE_SCOPE("submit cull");
+            submitCull();
+        }
+
+        std::vector<VkSemaphore> waitSemaphores = { frame.imageAvailableSemaphore };
+        std::vector<VkPipelineStageFlags> waitStages = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
+        std::vector<uint64_t> waitValues = { 0 };
+        appendFrameWaits(waitSemaphores, waitStages, waitValues);
+
+        VkTimelineSemaphoreSubmitInfo timelineInfo{};
+        timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+        timelineInfo.waitSemaphoreValueCount = static_cast<uint32_t>(waitValues.size());
+        timelineInfo.pWaitSemaphoreValues = waitValues.data();
+
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.pNext = &timelineInfo;
+        submitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());
+        submitInfo.pWaitSemaphores = waitSemaphores.data();
+        submitInfo.pWaitDstStageMask = waitStages.data();
         submitInfo.commandBufferCount = 1;
-        submitInfo.pCommandBuffers = &commandBuffer;
+        submitInfo.pCommandBuffers = &frame.commandBuffer;
 
         VkSemaphore signalSemaphores[] = {
-                renderFinishedSemaphore
+                renderFinishedSemaphores[imageIndex]
         };
 
         submitInfo.signalSemaphoreCount = 1;
         submitInfo.pSignalSemaphores = signalSemaphores;
 
-        if (VK_SUCCESS != vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFence)) {
-            throw std::runtime_error("Failed to submit draw command buffer");
+        {
+            M4X_TRACE_SCOPE("submit");
+            if (VK_SUCCESS != vkQueueSubmit(graphicsQueue, 1, &submitInfo, frame.inFlightFence)) {
+                throw std::runtime_error("Failed to submit draw command buffer");
+            }
         }
 
         VkPresentInfoKHR presentInfo{};
@@ -464,7 +1367,107 @@ namespace m4x {
         presentInfo.pSwapchains = swapChains;
         presentInfo.pImageIndices = &imageIndex;
 
-        vkQueuePresentKHR(presentQueue, &presentInfo);
+        {
+            M4X_TRACE_SCOPE("present");
+            result = vkQueuePresentKHR(presentQueue, &presentInfo);
+        }
+        framePacer.presented();
+
+        if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
+            swapChainOutdated = true;
+        } else if (result != VK_SUCCESS) {
+            throw std::runtime_error("Failed to present a swapchain image");
+        }
+
+        frameNumber++;
+        currentFrame = (currentFrame + 1) % config.framesInFlight;
+    }
+
+    void M4xApp::submitCull() {
+        FrameData& frame = frames[currentFrame];
+        VkCommandBuffer commandBuffer = frame.computeCommandBuffer;
+        uint32_t computeFamily = queueFamilyIndices.computeFamily.value();
+
+        vkResetCommandBuffer(commandBuffer, 0);
+
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+        if (VK_SUCCESS != vkBeginCommandBuffer(commandBuffer, &beginInfo)) {
+            throw std::runtime_error("Failed to begin a compute command buffer");
+        }
+
+        // The objects are shared with the compute family, but uploads handed over to it get acquired here
+        uint64_t uploadWait = uploadQueue.flush(commandBuffer, computeFamily);
+
+        gpuCulling.recordCull(commandBuffer, currentFrame, GpuCulling::ClipSpacePlanes(), computeFamily,
+                              queueFamilyIndices.graphicsFamily.value());
+
+        if (VK_SUCCESS != vkEndCommandBuffer(commandBuffer)) {
+            throw std::runtime_error("Failed to record a compute command buffer");
+        }
+
+        // The slot's draw buffers were last read by the frame whose fence the CPU waited on, nothing to wait for
+        VkSemaphore waitSemaphore = uploadQueue.semaphore();
+        VkPipelineStageFlags waitStage = UPLOAD_COMPUTE_CONSUMER_STAGES;
+
+        VkTimelineSemaphoreSubmitInfo timelineInfo{};
+        timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+        timelineInfo.waitSemaphoreValueCount = uploadWait != 0 ? 1 : 0;
+        timelineInfo.pWaitSemaphoreValues = &uploadWait;
+        timelineInfo.signalSemaphoreValueCount = 1;
+        timelineInfo.pSignalSemaphoreValues = &frame.cullWait;
+
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.pNext = &timelineInfo;
+        submitInfo.waitSemaphoreCount = uploadWait != 0 ? 1 : 0;
+        submitInfo.pWaitSemaphores = &waitSemaphore;
+        submitInfo.pWaitDstStageMask = &waitStage;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &commandBuffer;
+        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.pSignalSemaphores = &cullTimeline;
+
+        if (VK_SUCCESS != vkQueueSubmit(computeQueue, 1, &submitInfo, VK_NULL_HANDLE)) {
+            throw std::runtime_error("Failed to submit the culling pass");
+        }
+    }
+
+    void M4xApp::defragmentMemory(VkCommandBuffer commandBuffer) {
+        if (defragmentFrame.has_value()) {
+            // Every frame up to frameNumber - framesInFlight has completed
+            if (defragmentFrame.value() + config.framesInFlight > frameNumber) {
+                return;
+            }
+            allocator.finishDefragment();
+            defragmentFrame.reset();
+        }
+
+        // The frame's upload wait covers the transfer stage as well then, the copies may read what was just uploaded
+        frames[currentFrame].defragmentCopies =
+                allocator.defragment(commandBuffer, DEFRAGMENT_MOVES_PER_FRAME, deletionQueue) > 0;
+        if (frames[currentFrame].defragmentCopies) {
+            defragmentFrame = frameNumber;
+        }
+    }
+
+    void M4xApp::appendFrameWaits(std::vector<VkSemaphore>& semaphores, std::vector<VkPipelineStageFlags>& stages,
+                                  std::vector<uint64_t>& values) const {
+        const FrameData& frame = frames[currentFrame];
+
+        if (frame.uploadWait != 0) {
+            semaphores.push_back(uploadQueue.semaphore());
+            stages.push_back(UPLOAD_CONSUMER_STAGES | (frame.defragmentCopies ? VK_PIPELINE_STAGE_TRANSFER_BIT : 0));
+            values.push_back(frame.uploadWait);
+        }
+
+        if (frame.cullWait != 0) {
+            semaphores.push_back(cullTimeline);
+            stages.push_back(VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT);
+            values.push_back(frame.cullWait);
+        }
     }
 
     void M4xApp::createSyncObjects() {
@@ -475,11 +1478,527 @@ namespace m4x {
         fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
         fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 
-        if (VK_SUCCESS != vkCreateSemaphore(device, &semaphoreInfo, nullptr, &imageAvailableSemaphore) ||
-            VK_SUCCESS != vkCreateSemaphore(device, &semaphoreInfo, nullptr, &renderFinishedSemaphore) ||
-            VK_SUCCESS != vkCreateFence(device, &fenceInfo, nullptr, &inFlightFence)) {
-            throw std::runtime_error("Failed to create sync objects");
+        for (auto& frame : frames) {
+            if (VK_SUCCESS != vkCreateSemaphore(device, &semaphoreInfo, nullptr, &frame.imageAvailableSemaphore) ||
+                VK_SUCCESS != vkCreateFence(device, &fenceInfo, nullptr, &frame.inFlightFence)) {
+                throw std::runtime_error("Failed to create sync objects");
+            }
+        }
+
+        cullTimeline = VkUtils::CreateTimelineSemaphore(device);
+
+        createImageSyncObjects();
+    }
+
+    void M4xApp::createImageSyncObjects() {
+        VkSemaphoreCreateInfo semaphoreInfo{};
+        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+        // Present waits on these, so they're tied to the image rather than the frame slot,
+        // otherwise a slot could re-signal a semaphore the presentation engine hasn't consumed yet
+        renderFinishedSemaphores.resize(swapChainImages.size());
+
+        for (auto& semaphore : renderFinishedSemaphores) {
+            if (VK_SUCCESS != vkCreateSemaphore(device, &semaphoreInfo, nullptr, &semaphore)) {
+                throw std::runtime_error("Failed to create sync objects");
+            }
         }
+
+        imagesInFlight.assign(swapChainImages.size(), VK_NULL_HANDLE);
+    }
+
+    void M4xApp::drawOffscreenFrame() {
+        FrameData& frame = frames[currentFrame];
+        M4X_TRACE_FRAME(frameNumber);
+
+        {
+            M4X_TRACE_SCOPE("fence wait");
+            vkWaitForFences(device, 1, &frame.inFlightFence, VK_TRUE, UINT64_MAX);
+        }
+
+        // The slot's previous frame is done, take its pixels before the slot gets recorded into again
+        if (pendingReadbacks[currentFrame].has_value()) {
+            M4X_TRACE_SCOPE("readback");
+            consumeReadback(currentFrame);
+        }
+
+        vkResetFences(device, 1, &frame.inFlightFence);
+        commandRecorder.beginFrame(currentFrame);
+
+        {
+            M4X_TRACE_SCOPE("record");
+
+            // Each slot of the ring renders into its own offscreen image
+            vkResetCommandBuffer(frame.commandBuffer, 0);
+            recordCommandBuffer(frame.commandBuffer, currentFrame);
+        }
+
+        if (frame.cullWait != 0) {
+            M4X_TRACE_SCOPE("submit cull");
+            submitCull();
+        }
+
+        std::vector<VkSemaphore> waitSemaphores;
+        std::vector<VkPipelineStageFlags> waitStages;
+        std::vector<uint64_t> waitValues;
+        appendFrameWaits(waitSemaphores, waitStages, waitValues);
+
+        VkTimelineSemaphoreSubmitInfo timelineInfo{};
+        timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+        timelineInfo.waitSemaphoreValueCount = static_cast<uint32_t>(waitValues.size());
+        timelineInfo.pWaitSemaphoreValues = waitValues.data();
+
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.pNext = &timelineInfo;
+        submitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());
+        submitInfo.pWaitSemaphores = waitSemaphores.data();
+        submitInfo.pWaitDstStageMask = waitStages.data();
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &frame.commandBuffer;
+
+        {
+            M4X_TRACE_SCOPE("submit");
+            if (VK_SUCCESS != vkQueueSubmit(graphicsQueue, 1, &submitInfo, frame.inFlightFence)) {
+                throw std::runtime_error("Failed to submit draw command buffer");
+            }
+        }
+
+        pendingReadbacks[currentFrame] = frameNumber++;
+        currentFrame = (currentFrame + 1) % config.framesInFlight;
+    }
+
+    void M4xApp::consumeReadback(uint32_t slot) {
+        const uint8_t* pixels = offscreenTarget.mappedFrame(device, slot);
+        uint64_t number = pendingReadbacks[slot].value();
+        pendingReadbacks[slot].reset();
+
+        if (config.outputDirectory.empty()) {
+            std::memcpy(lastFrame.data(), pixels, lastFrame.size());
+            return;
+        }
+
+        char name[32];
+        std::snprintf(name, sizeof(name), "frame_%05llu.ppm", static_cast<unsigned long long>(number));
+
+        std::ofstream file(std::filesystem::path(config.outputDirectory) / name, std::ios::binary);
+        if (!file.is_open()) {
+            throw std::runtime_error("Failed to open frame output file");
+        }
+
+        VkExtent2D extent = offscreenTarget.extent();
+        file << "P6\n" << extent.width << " " << extent.height << "\n255\n";
+
+        // PPM has no alpha channel
+        std::vector<uint8_t> row(static_cast<size_t>(extent.width) * 3);
+        for (uint32_t y = 0; y < extent.height; ++y) {
+            const uint8_t* src = pixels + static_cast<size_t>(y) * extent.width * 4;
+            for (uint32_t x = 0; x < extent.width; ++x) {
+                row[x * 3 + 0] = src[x * 4 + 0];
+                row[x * 3 + 1] = src[x * 4 + 1];
+                row[x * 3 + 2] = src[x * 4 + 2];
+            }
+            file.write(reinterpret_cast<const char*>(row.data()), static_cast<std::streamsize>(row.size()));
+        }
+    }
+
+    void M4xApp::renderHeadless() {
+        if (!config.outputDirectory.empty()) {
+            std::filesystem::create_directories(config.outputDirectory);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+
+        for (uint32_t i = 0; i < config.frameCount; ++i) {
+            drawOffscreenFrame();
+        }
+
+        drainReadbacks();
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << "Headless: " << config.frameCount << " frames ("
+                  << swapChainConfiguration.extent.width << "x" << swapChainConfiguration.extent.height << ") in "
+                  << seconds << " s, " << (seconds > 0.0 ? config.frameCount / seconds : 0.0) << " fps written to "
+                  << (config.outputDirectory.empty() ? "memory" : config.outputDirectory) << std::endl;
+        allocator.printStats(std::cout);
+        uploadQueue.printStats(std::cout);
+        commandRecorder.printStats(std::cout);
+        shaderLibrary.printStats(std::cout);
+        pipelineManager.printStats(std::cout);
+        renderGraph.printStats(std::cout);
+        descriptorHeap.printStats(std::cout);
+        textureStreamer.printStats(std::cout);
+        if (config.instanced) {
+            instanceBatcher.printStats(std::cout);
+        }
+
+        vkDeviceWaitIdle(device);
+    }
+
+    void M4xApp::drainReadbacks() {
+        // Every rendered frame has to be accounted for
+        for (uint32_t slot = 0; slot < config.framesInFlight; ++slot) {
+            if (pendingReadbacks[slot].has_value()) {
+                vkWaitForFences(device, 1, &frames[slot].inFlightFence, VK_TRUE, UINT64_MAX);
+                consumeReadback(slot);
+            }
+        }
+    }
+
+    void M4xApp::benchmarkGpuDriven() {
+        std::cout << "GPU driven: " << config.frameCount << " frames per run, "
+                  << (drawIndirectCount ? "vkCmdDrawIndexedIndirectCount" : "vkCmdDrawIndexedIndirect") << std::endl;
+
+        for (uint32_t count : { 1000u, 10000u, 100000u, 1000000u }) {
+            // The object buffers can only be replaced once no frame uses them anymore
+            drainReadbacks();
+            vkDeviceWaitIdle(device);
+
+            layoutObjects(count);
+
+            // Uploading the objects isn't part of the per frame cost
+            drawOffscreenFrame();
+            primaryRecordSeconds = 0.0;
+            primaryRecordedFrames = 0;
+
+            auto start = std::chrono::steady_clock::now();
+
+            for (uint32_t i = 0; i < config.frameCount; ++i) {
+                drawOffscreenFrame();
+            }
+            drainReadbacks();
+
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            double recordMs = primaryRecordedFrames > 0 ? primaryRecordSeconds * 1000.0 / primaryRecordedFrames : 0.0;
+
+            std::cout << "  " << count << " objects: " << std::fixed << std::setprecision(3) << recordMs
+                      << " ms/frame recording, " << std::setprecision(1)
+                      << (seconds > 0.0 ? config.frameCount / seconds : 0.0) << " fps" << std::defaultfloat
+                      << std::endl;
+        }
+
+        vkDeviceWaitIdle(device);
+    }
+
+    void M4xApp::benchmarkInstancing() {
+        // The ring can only grow once no frame reads it anymore
+        drainReadbacks();
+        vkDeviceWaitIdle(device);
+        layoutObjects(INSTANCING_BENCHMARK_OBJECTS);
+
+        std::cout << "Instancing: " << INSTANCING_BENCHMARK_OBJECTS << " objects, " << config.frameCount
+                  << " frames per run" << std::endl;
+
+        double singleDrawMs = 0.0;
+
+        for (uint32_t draws = 1; draws <= INSTANCING_BENCHMARK_OBJECTS; draws *= 10) {
+            instanceBatcher.setMaxDrawSize((INSTANCING_BENCHMARK_OBJECTS + draws - 1) / draws);
+
+            // The first frame of a run pays for the changed batches
+            drawOffscreenFrame();
+            drainReadbacks();
+            primaryRecordSeconds = 0.0;
+            primaryRecordedFrames = 0;
+
+            auto start = std::chrono::steady_clock::now();
+
+            for (uint32_t i = 0; i < config.frameCount; ++i) {
+                drawOffscreenFrame();
+            }
+            drainReadbacks();
+
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            double frameMs = seconds * 1000.0 / std::max(config.frameCount, 1u);
+            double recordMs = primaryRecordedFrames > 0 ? primaryRecordSeconds * 1000.0 / primaryRecordedFrames : 0.0;
+            if (draws == 1) {
+                singleDrawMs = frameMs;
+            }
+
+            std::cout << "  " << instanceBatcher.stats().draws << " draws: " << std::fixed << std::setprecision(3)
+                      << frameMs << " ms/frame, " << recordMs << " ms/frame recording, " << std::setprecision(2)
+                      << (singleDrawMs > 0.0 ? frameMs / singleDrawMs : 0.0) << "x the single draw"
+                      << std::defaultfloat << std::endl;
+        }
+
+        instanceBatcher.setMaxDrawSize(0);
+        instanceBatcher.printStats(std::cout);
+        vkDeviceWaitIdle(device);
+    }
+
+    void M4xApp::runBenchScene() {
+        // Compiled ahead of the frames, as part of the startup
+        for (const auto& key : benchPipelineKeys) {
+            benchPipelines.push_back(pipelineManager.get(key));
+        }
+        if (!benchPipelines.empty()) {
+            markStartup("scene pipelines");
+        }
+
+        // Every slot uploads into its own range, so the frames in flight never overwrite each other's
+        Buffer* uploadTarget = nullptr;
+        std::vector<uint8_t> uploadData;
+        if (config.benchScene == BenchScene::Uploads) {
+            uploadTarget = allocator.createBuffer(VkDeviceSize(config.benchSize) * config.framesInFlight,
+                                                  VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                                  { VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT });
+            uploadData.assign(config.benchSize, 0x5a);
+        }
+
+        auto frame = [&]() {
+            if (uploadTarget) {
+                uploadQueue.enqueue(uploadTarget, VkDeviceSize(config.benchSize) * currentFrame, uploadData.data(),
+                                    uploadData.size());
+            }
+            drawOffscreenFrame();
+        };
+
+        for (uint32_t i = 0; i < config.warmupFrames; ++i) {
+            frame();
+        }
+        drainReadbacks();
+        primaryRecordSeconds = 0.0;
+        primaryRecordedFrames = 0;
+
+        BenchReport report;
+        report.cpuFrameMs.reserve(config.frameCount);
+        for (uint32_t i = 0; i < config.frameCount; ++i) {
+            auto start = std::chrono::steady_clock::now();
+            frame();
+            report.cpuFrameMs.push_back(std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - start).count());
+        }
+        drainReadbacks();
+        vkDeviceWaitIdle(device);
+
+        const char* sceneNames[] = { "none", "triangles", "draws", "pipelines", "uploads" };
+        report.scene = sceneNames[static_cast<size_t>(config.benchScene)];
+        report.size = config.benchSize;
+        report.device = VkUtils::QueryDeviceCapabilities(physicalDevice).properties.deviceName;
+        report.extent = swapChainConfiguration.extent;
+        report.warmupFrames = config.warmupFrames;
+        report.startup = startupPhases;
+        report.recordMs = primaryRecordedFrames > 0 ? primaryRecordSeconds * 1000.0 / primaryRecordedFrames : 0.0;
+
+        gpuProfiler.collectPending();
+        report.gpuPasses = gpuProfiler.passTimings();
+        report.memory = allocator.stats();
+
+        report.writeJson(config.reportFile);
+        std::cout << "Bench scene " << report.scene << " " << report.size << ": " << config.frameCount
+                  << " frames reported to " << config.reportFile << std::endl;
+
+        if (uploadTarget) {
+            allocator.destroyBuffer(uploadTarget);
+        }
+    }
+
+    void M4xApp::markStartup(const char* phase) {
+        auto now = std::chrono::steady_clock::now();
+        startupPhases.push_back({ phase, std::chrono::duration<double, std::milli>(now - startupMark).count() });
+        startupMark = now;
+    }
+
+    void M4xApp::benchmarkCompute() {
+        // Matches the push constant block of reduce.comp
+        struct ReduceConstants {
+            uint32_t first;
+            uint32_t count;
+            uint32_t sum;
+        };
+
+        uint32_t valuesPerJob = COMPUTE_BENCHMARK_VALUES / COMPUTE_BENCHMARK_JOBS;
+        VkDeviceSize valueBytes = sizeof(uint32_t) * VkDeviceSize(COMPUTE_BENCHMARK_VALUES);
+
+        std::cout << "Compute jobs summing " << COMPUTE_BENCHMARK_VALUES << " values in " << COMPUTE_BENCHMARK_JOBS
+                  << " jobs, " << COMPUTE_BENCHMARK_ROUNDS << " rounds" << std::endl;
+
+        // Both stay mapped, the values are written and the sums read back without staging
+        Buffer* values = allocator.createBuffer(valueBytes, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                                { VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT |
+                                                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                                  VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                                  VK_MEMORY_PROPERTY_HOST_COHERENT_BIT });
+        Buffer* sums = allocator.createBuffer(sizeof(uint32_t) * COMPUTE_BENCHMARK_JOBS,
+                                              VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                              { VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                                VK_MEMORY_PROPERTY_HOST_CACHED_BIT |
+                                                VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                                VK_MEMORY_PROPERTY_HOST_COHERENT_BIT });
+
+        auto* valueData = static_cast<uint32_t*>(values->allocation.mapped);
+        auto* sumData = static_cast<uint32_t*>(sums->allocation.mapped);
+        std::vector<uint32_t> expected(COMPUTE_BENCHMARK_JOBS, 0);
+        for (uint32_t i = 0; i < COMPUTE_BENCHMARK_VALUES; ++i) {
+            valueData[i] = i * 2654435761u;
+            expected[i / valuesPerJob] += valueData[i];
+        }
+
+        const ComputePipeline& reduce = computeJobs.pipeline("reduce.comp");
+        std::vector<ComputeBinding> bindings = { ComputeBinding::StorageBuffer(0, values),
+                                                 ComputeBinding::StorageBuffer(1, sums) };
+        // A few groups per job, every invocation sums a run of values before the group folds them
+        auto groups = static_cast<uint32_t>(std::max(valuesPerJob / (256u * 16u), 1u));
+
+        double batchedMs = 0.0;
+
+        for (bool batched : { true, false }) {
+            uint64_t submissions = computeJobs.stats().submissions;
+            auto start = std::chrono::steady_clock::now();
+
+            for (uint32_t round = 0; round < COMPUTE_BENCHMARK_ROUNDS; ++round) {
+                std::memset(sumData, 0, sizeof(uint32_t) * COMPUTE_BENCHMARK_JOBS);
+
+                uint64_t done = 0;
+                for (uint32_t job = 0; job < COMPUTE_BENCHMARK_JOBS; ++job) {
+                    done = computeJobs.dispatch(reduce, bindings, ReduceConstants{ job * valuesPerJob, valuesPerJob,
+                                                                                   job }, { groups, 1, 1 });
+                    if (!batched) {
+                        computeJobs.submit();
+                    }
+                }
+                computeJobs.submit();
+
+                // Polled like a frame would, the thread is free to do other work until the sums are in
+                while (!computeJobs.completed(done)) {
+                    std::this_thread::yield();
+                }
+
+                if (std::memcmp(sumData, expected.data(), sizeof(uint32_t) * COMPUTE_BENCHMARK_JOBS) != 0) {
+                    throw std::runtime_error("The compute job sums don't match the CPU's");
+                }
+            }
+
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            double roundMs = seconds * 1000.0 / COMPUTE_BENCHMARK_ROUNDS;
+            double gigabytes = static_cast<double>(valueBytes) * COMPUTE_BENCHMARK_ROUNDS / 1e9;
+            if (batched) {
+                batchedMs = roundMs;
+            }
+
+            std::cout << "  " << (batched ? "batched" : "submitted per job") << ": " << std::fixed
+                      << std::setprecision(3) << roundMs << " ms/round, " << std::setprecision(2)
+                      << (seconds > 0.0 ? gigabytes / seconds : 0.0) << " GB/s, "
+                      << (computeJobs.stats().submissions - submissions) / COMPUTE_BENCHMARK_ROUNDS
+                      << " submissions/round";
+            if (!batched) {
+                std::cout << ", batching speedup " << std::setprecision(2)
+                          << (batchedMs > 0.0 ? roundMs / batchedMs : 0.0) << "x";
+            }
+            std::cout << std::defaultfloat << std::endl;
+        }
+
+        std::cout << "  sums verified against the CPU" << std::endl;
+
+        allocator.destroyBuffer(sums);
+        allocator.destroyBuffer(values);
+        computeJobs.printStats(std::cout);
+    }
+
+    void M4xApp::benchmarkAsyncQueues() {
+        bool computeFamily = queueFamilyIndices.computeFamily.has_value();
+        bool transferFamily = queueFamilyIndices.transferFamily.has_value();
+
+        std::cout << "Async queues: " << ASYNC_BENCHMARK_OBJECTS << " objects culled and "
+                  << ASYNC_BENCHMARK_STREAM_BYTES / (1024 * 1024) << " MiB streamed per frame, " << config.frameCount
+                  << " frames per run" << std::endl;
+
+        if (!computeFamily && !transferFamily) {
+            std::cout << "  The device has no dedicated compute or transfer family, both runs use the graphics queue"
+                      << std::endl;
+        }
+
+        drainReadbacks();
+        vkDeviceWaitIdle(device);
+        layoutObjects(ASYNC_BENCHMARK_OBJECTS);
+
+        // Stands in for the textures and meshes a streaming system would load, every slot gets its own range
+        Buffer* streamTarget = allocator.createBuffer(ASYNC_BENCHMARK_STREAM_BYTES * config.framesInFlight,
+                                                      VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                                      { VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT });
+        std::vector<uint8_t> streamData(ASYNC_BENCHMARK_STREAM_BYTES, 0x5a);
+
+        double serialMs = 0.0;
+
+        for (bool async : { false, true }) {
+            // The upload queue can only move to another queue once nothing it submitted is pending
+            drainReadbacks();
+            vkDeviceWaitIdle(device);
+
+            asyncCompute = async && computeFamily;
+            if (asyncTransfer != (async && transferFamily)) {
+                uploadQueue.destroy(allocator);
+                asyncTransfer = async && transferFamily;
+                createUploadQueue();
+            }
+
+            // The object upload isn't part of the per frame cost
+            drawOffscreenFrame();
+            drainReadbacks();
+
+            auto start = std::chrono::steady_clock::now();
+
+            for (uint32_t i = 0; i < config.frameCount; ++i) {
+                uploadQueue.enqueue(streamTarget, ASYNC_BENCHMARK_STREAM_BYTES * currentFrame, streamData.data(),
+                                    ASYNC_BENCHMARK_STREAM_BYTES);
+                drawOffscreenFrame();
+            }
+            drainReadbacks();
+
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            double frameMs = seconds * 1000.0 / std::max(config.frameCount, 1u);
+
+            if (!async) {
+                serialMs = frameMs;
+                std::cout << "  graphics queue only: " << std::fixed << std::setprecision(3) << frameMs
+                          << " ms/frame" << std::defaultfloat << std::endl;
+                continue;
+            }
+
+            std::cout << "  " << (asyncCompute ? "async compute" : "graphics compute") << ", "
+                      << (asyncTransfer ? "async transfer" : "graphics transfer") << ": " << std::fixed
+                      << std::setprecision(3) << frameMs << " ms/frame, speedup " << std::setprecision(2)
+                      << (frameMs > 0.0 ? serialMs / frameMs : 0.0) << "x" << std::defaultfloat << std::endl;
+        }
+
+        vkDeviceWaitIdle(device);
+        allocator.destroyBuffer(streamTarget);
+        uploadQueue.printStats(std::cout);
+    }
+
+    void M4xApp::benchmarkRecording() {
+        uint32_t maxThreads = config.recordingThreads;
+        double singleThreadMs = 0.0;
+
+        std::cout << "Recording " << objects.size() << " objects, " << config.frameCount << " frames per run"
+                  << std::endl;
+
+        for (uint32_t threads = 1; threads <= maxThreads; ++threads) {
+            // The pools can only go away once nothing recorded from them is executing
+            drainReadbacks();
+            vkDeviceWaitIdle(device);
+
+            commandRecorder.destroy();
+            commandRecorder.create(device, queueFamilyIndices.graphicsFamily.value(), config.framesInFlight, threads);
+
+            for (uint32_t i = 0; i < config.frameCount; ++i) {
+                drawOffscreenFrame();
+            }
+
+            double recordMs = commandRecorder.averageRecordMs();
+            if (threads == 1) {
+                singleThreadMs = recordMs;
+            }
+
+            std::cout << "  " << threads << " threads: " << std::fixed << std::setprecision(3) << recordMs
+                      << " ms/frame, speedup " << std::setprecision(2)
+                      << (recordMs > 0.0 ? singleThreadMs / recordMs : 0.0) << "x" << std::defaultfloat << std::endl;
+        }
+
+        drainReadbacks();
+        vkDeviceWaitIdle(device);
     }
 
-} // m4x
\ No newline at end of file
+} // m4x
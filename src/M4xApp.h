@@ -9,8 +9,95 @@
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 #include "VkUtils.h"
+#include "AppConfig.h"
+#include "OffscreenTarget.h"
+#include "PipelineCache.h"
+#include "MemoryAllocator.h"
+#include "UploadQueue.h"
+#include "Mesh.h"
+#include "CommandRecorder.h"
+#include "GpuCulling.h"
+#include "PipelineManager.h"
+#include "GpuProfiler.h"
+#include "CpuTracer.h"
+#include "FramePacer.h"
+#include "RenderGraph.h"
+#include "DescriptorHeap.h"
+#include "TextureStreamer.h"
+#include "InstanceBatcher.h"
+#include "BenchReport.h"
+#include "ComputeJobQueue.h"
+#include "DeletionQueue.h"
+
+// std
+#include <chrono>
+#include <optional>
 
 namespace m4x {
+    /**
+     * Chunks of draws handed to the job system per recording thread
+     */
+    const uint32_t RECORDING_CHUNKS_PER_THREAD = 4;
+
+    /**
+     * Background threads compiling pipelines
+     */
+    const uint32_t PIPELINE_COMPILE_THREADS = 2;
+
+    /**
+     * Buffers a frame moves at most when defragmenting memory
+     */
+    const uint32_t DEFRAGMENT_MOVES_PER_FRAME = 4;
+
+    /**
+     * Bytes streamed through the upload queue every frame of the async queue benchmark
+     */
+    const VkDeviceSize ASYNC_BENCHMARK_STREAM_BYTES = 4ull * 1024 * 1024;
+
+    /**
+     * Objects culled every frame of the async queue benchmark
+     */
+    const uint32_t ASYNC_BENCHMARK_OBJECTS = 1000000;
+
+    /**
+     * Objects drawn every frame of the instancing benchmark
+     */
+    const uint32_t INSTANCING_BENCHMARK_OBJECTS = 100000;
+
+    /**
+     * Values summed by every round of the compute benchmark, split evenly between its jobs
+     */
+    const uint32_t COMPUTE_BENCHMARK_VALUES = 16u * 1024 * 1024;
+    const uint32_t COMPUTE_BENCHMARK_JOBS = 1024;
+    const uint32_t COMPUTE_BENCHMARK_ROUNDS = 10;
+
+    /**
+     * Width and height of level 0 of the generated material textures
+     */
+    const uint32_t MATERIAL_TEXTURE_SIZE = 1024;
+
+    /**
+     * Width and height of a checker square of the generated material textures at level 0
+     */
+    const uint32_t MATERIAL_CHECKER_SIZE = 64;
+
+    /**
+     * Resources owned by a single slot of the frames in flight ring
+     */
+    struct FrameData {
+        VkCommandBuffer commandBuffer;
+        VkSemaphore     imageAvailableSemaphore;
+        VkFence         inFlightFence;
+        // Value of the upload timeline the frame's submission waits on, filled while recording
+        uint64_t        uploadWait = 0;
+        // If the frame records defragmentation copies, which have to wait for the uploads too
+        bool            defragmentCopies = false;
+        // Records the culling pass when it runs on the compute queue
+        VkCommandBuffer computeCommandBuffer = VK_NULL_HANDLE;
+        // Value of the culling timeline the frame's draw waits on, 0 when it culls on the graphics queue
+        uint64_t        cullWait = 0;
+    };
+
     /**
      * A class holding all the application's logic.
      * @fn run Runs all the separate functions in order
@@ -21,36 +108,136 @@ namespace m4x {
      */
     class M4xApp {
     public:
+        /**
+         * @param config [in] Runtime options, see AppConfig
+         */
+        explicit M4xApp(const AppConfig& config = {});
+
         void run();
     private:
-        GLFWwindow* window;
+        AppConfig config;
+
+        GLFWwindow* window = nullptr;
 
         VkInstance instance;
-        VkSurfaceKHR surface;
+        VkSurfaceKHR surface = VK_NULL_HANDLE;
         VkPhysicalDevice physicalDevice;
         VkDevice device;
 
         QueueFamilyIndices queueFamilyIndices;
         VkQueue graphicsQueue;
-        VkQueue presentQueue;
+        VkQueue presentQueue = VK_NULL_HANDLE;
+        // The graphics queue when the device has no dedicated transfer family
+        VkQueue transferQueue = VK_NULL_HANDLE;
+        // The graphics queue when the device has no dedicated compute family
+        VkQueue computeQueue = VK_NULL_HANDLE;
+
+        // Culling runs on the compute queue, uploads on the transfer queue. Both need the dedicated family
+        // and can be turned off with --serial-queues.
+        bool asyncCompute = false;
+        bool asyncTransfer = false;
+        VkCommandPool computeCommandPool = VK_NULL_HANDLE;
+        // Signaled by the culling submissions, the draws of the same frame wait on it
+        VkSemaphore cullTimeline = VK_NULL_HANDLE;
+        uint64_t cullValue = 0;
 
         SwapChainConfiguration swapChainConfiguration;
-        VkSwapchainKHR swapChain;
+        VkSwapchainKHR swapChain = VK_NULL_HANDLE;
         std::vector<VkImage> swapChainImages;
         std::vector<VkImageView> swapChainImageViews;
 
+        bool swapChainOutdated = false;
+        // Destroys what the frames in flight may still use, like swapchains replaced by a recreation
+        DeletionQueue deletionQueue;
+
+        MemoryAllocator allocator;
+        UploadQueue uploadQueue;
+        Mesh mesh;
+        std::vector<DrawObject> objects;
+
+        // Only used in instanced mode
+        InstanceBatcher instanceBatcher;
+
+        // Only used in GPU driven mode
+        GpuCulling gpuCulling;
+        bool drawIndirectCount = false;
+
+        // Compute work outside of the frames, on the compute queue unless culling is kept serial
+        ComputeJobQueue computeJobs;
+
+        GpuProfiler gpuProfiler;
+        bool pipelineStatistics = false;
+        bool inheritedQueries = false;
+
+        FramePacer framePacer;
+
+        // Declared again by every frame, recompiled only when the frame's shape changes
+        RenderGraph renderGraph;
+
+        // Every texture, sampler and storage buffer the graphics shaders read, bound once per command buffer
+        DescriptorHeap descriptorHeap;
+        VkSampler materialSampler = VK_NULL_HANDLE;
+        uint32_t materialSamplerIndex = INVALID_DESCRIPTOR;
+        // Heap index of the culling object buffer, GPU driven mode only
+        uint32_t objectBufferIndex = INVALID_DESCRIPTOR;
+
+        // Material textures, their mip levels loaded as the frames sample them
+        TextureStreamer textureStreamer;
+        // Lets the streamer follow the driver's memory budget instead of a fixed share of the heap
+        bool memoryBudget = false;
+
+        // Renders with vkCmdBeginRenderingKHR and synchronization2 barriers when the device has both,
+        // unless --legacy-render-pass asks for render pass objects
+        bool dynamicRendering = false;
+        PFN_vkCmdBeginRenderingKHR cmdBeginRendering = nullptr;
+        PFN_vkCmdEndRenderingKHR cmdEndRendering = nullptr;
+        PFN_vkCmdPipelineBarrier2KHR cmdPipelineBarrier2 = nullptr;
+
+        // CPU time spent recording primary command buffers, for the benchmarks
+        double   primaryRecordSeconds = 0.0;
+        uint32_t primaryRecordedFrames = 0;
+
+        // Phases of run() up to the first frame, for the bench report
+        std::vector<StartupPhase> startupPhases;
+        std::chrono::steady_clock::time_point startupMark;
+
+        // Replaces the swapchain in headless mode
+        OffscreenTarget offscreenTarget;
+        // Frame number whose readback is pending in each slot of the ring
+        std::vector<std::optional<uint64_t>> pendingReadbacks;
+        std::vector<uint8_t> lastFrame;
+        uint64_t frameNumber = 0;
+        // Frame that recorded the copies of the buffers being moved
+        std::optional<uint64_t> defragmentFrame;
+
+        PipelineCache pipelineCache;
+        // Every shader module and its reflection, mapped from the shader archive and shared by content
+        ShaderLibrary shaderLibrary;
+        PipelineManager pipelineManager;
         VkPipelineLayout pipelineLayout;
-        VkRenderPass renderPass;
-        VkPipeline graphicsPipeline;
+        // VK_NULL_HANDLE with dynamic rendering, as are the framebuffers
+        VkRenderPass renderPass = VK_NULL_HANDLE;
+        PipelineKey pipelineKey;
+        // Owned by the pipeline manager. Drawn with while pipelineKey compiles, VK_NULL_HANDLE skips those draws.
+        VkPipeline fallbackPipeline = VK_NULL_HANDLE;
+        // Pipeline the frame being recorded draws with
+        VkPipeline graphicsPipeline = VK_NULL_HANDLE;
+        // Specializations of the instanced pipeline the pipelines bench scene cycles its objects through
+        std::vector<PipelineKey> benchPipelineKeys;
+        std::vector<VkPipeline> benchPipelines;
 
         std::vector<VkFramebuffer> swapChainFramebuffers;
 
         VkCommandPool commandPool;
-        VkCommandBuffer commandBuffer;
+        // Secondary command buffers of the render pass, recorded in parallel
+        CommandRecorder commandRecorder;
+
+        uint32_t currentFrame = 0;
+        std::vector<FrameData> frames;
 
-        VkSemaphore imageAvailableSemaphore;
-        VkSemaphore renderFinishedSemaphore;
-        VkFence inFlightFence;
+        // Indexed by swapchain image
+        std::vector<VkSemaphore> renderFinishedSemaphores;
+        std::vector<VkFence> imagesInFlight;
 
         void createWindow();
         void initVulkan();
@@ -62,27 +249,218 @@ namespace m4x {
         void getDeviceQueues();
 
         /**
-         * Creates a swap chain, also creates an image view for each image in the swap chain
+         * Creates a swap chain, also creates an image view for each image in the swap chain.
+         * An existing swap chain is passed on as oldSwapchain.
          */
         void createSwapChain();
 
         /**
-         * Creates a pipeline and populates the class with its layout and render pass
+         * Replaces the swap chain, its image views and framebuffers after a surface change.
+         * The old ones are retired and destroyed once the frames in flight using them complete.
+         * @return False if the window is minimized and nothing was recreated
+         */
+        bool recreateSwapChain();
+
+        static void framebufferResizeCallback(GLFWwindow* window, int width, int height);
+
+        /**
+         * Creates the render pass drawing into the swapchain or offscreen images
+         */
+        void createRenderPass();
+
+        /**
+         * Creates the pipeline layout shared by the graphics pipelines from the reflection of their shaders
+         */
+        void createPipelineLayout();
+
+        /**
+         * @return Name of the description the scene is drawn with in the current mode
+         */
+        [[nodiscard]] std::string scenePipeline() const;
+
+        /**
+         * Builds the fallback pipeline and queues the pipeline of the current mode
          */
         void createPipeline();
 
+        /**
+         * Creates the offscreen images and readback buffer used instead of a swapchain in headless mode
+         */
+        void createOffscreenTarget();
+
         void createFramebuffers();
 
         void createCommandPool();
 
-        void createCommandBuffer();
+        /**
+         * Allocates one primary command buffer per frame in flight
+         */
+        void createCommandBuffers();
+
+        /**
+         * Creates the upload queue on the dedicated transfer family if asyncTransfer is on
+         */
+        void createUploadQueue();
+
+        /**
+         * Picks the optional device extensions and features the configuration needs
+         * @param extensions [in, out] Required extensions, optional ones get appended
+         * @param features [out] Features to enable
+         * @param vulkan12Features [out] Vulkan 1.2 features to enable
+         */
+        void selectDeviceFeatures(std::vector<const char*>& extensions, VkPhysicalDeviceFeatures& features,
+                                  VkPhysicalDeviceVulkan12Features& vulkan12Features);
+
+        /**
+         * Generates the material texture pack unless it exists already, starts streaming from it and adds the
+         * material sampler to the descriptor heap
+         */
+        void createMaterials();
+
+        /**
+         * Creates the mesh and lays its copies out in a grid
+         */
+        void createMesh();
+
+        /**
+         * Lays out a grid of objects filling the view, scaled by the configured zoom, cycling through the materials
+         * @param count [in] Amount of objects
+         */
+        void layoutObjects(uint32_t count);
 
+        /**
+         * Records the primary command buffer. The frame is declared as render graph passes, which place the
+         * barriers between them, the draws themselves are recorded on the worker threads.
+         */
         void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex);
 
+        /**
+         * Records the render pass drawing the objects, the render graph has transitioned the target already
+         */
+        void recordScene(VkCommandBuffer commandBuffer, uint32_t imageIndex);
+
+        /**
+         * Begins rendering into the target with a cleared color attachment, through the render pass or dynamic
+         * rendering
+         * @param commandBuffer [in] Primary command buffer
+         * @param imageIndex [in] Target image
+         * @param secondaries [in] If the draws come from secondary command buffers
+         */
+        void beginScene(VkCommandBuffer commandBuffer, uint32_t imageIndex, bool secondaries);
+
+        void endScene(VkCommandBuffer commandBuffer);
+
+        /**
+         * Binds the pipeline, the descriptor heap, the mesh and sets the dynamic state every draw needs
+         */
+        void bindDrawState(VkCommandBuffer commandBuffer) const;
+
+        /**
+         * Records the draws of a range of objects into a secondary command buffer
+         */
+        void recordObjects(VkCommandBuffer commandBuffer, uint32_t first, uint32_t count) const;
+
+        /**
+         * Records and submits the culling pass of the current frame on the compute queue, has to be submitted
+         * before the frame's graphics submission
+         */
+        void submitCull();
+
+        /**
+         * Adds the timeline waits of the current frame on its uploads and its culling pass
+         * @param semaphores [in, out] Wait semaphores of the submission
+         * @param stages [in, out] Stages waiting on them
+         * @param values [in, out] Timeline values, ignored for the binary semaphores already in the list
+         */
+        void appendFrameWaits(std::vector<VkSemaphore>& semaphores, std::vector<VkPipelineStageFlags>& stages,
+                              std::vector<uint64_t>& values) const;
+
+        /**
+         * Switches the moved buffers over once the frame copying them completed, then starts moving the next few
+         * buffers out of the emptiest blocks. Has to be recorded outside of a render pass, after the upload flush.
+         * @param commandBuffer [in] Primary command buffer of the current frame
+         */
+        void defragmentMemory(VkCommandBuffer commandBuffer);
+
+        /**
+         * Records and submits the current frame of the ring, the CPU only waits when it laps the GPU
+         */
         void drawFrame();
 
+        /**
+         * Creates the per frame semaphores and fences
+         */
         void createSyncObjects();
 
+        /**
+         * Creates the render finished semaphores and resets the in flight fences of the current swapchain images
+         */
+        void createImageSyncObjects();
+
+        /**
+         * Headless counterpart of drawFrame, renders into an offscreen image and queues its readback
+         */
+        void drawOffscreenFrame();
+
+        /**
+         * Copies a completed readback out of the staging pool, to disk if an output directory is set
+         * @param slot [in] Slot of the ring whose readback finished
+         */
+        void consumeReadback(uint32_t slot);
+
+        /**
+         * Renders the configured amount of frames headless and reports the throughput
+         */
+        void renderHeadless();
+
+        /**
+         * Waits for every frame of the ring and consumes its readback
+         */
+        void drainReadbacks();
+
+        /**
+         * Runs the headless frames once per recording thread count and reports how recording scales
+         */
+        void benchmarkRecording();
+
+        /**
+         * Runs the headless frames in GPU driven mode for growing object counts and reports the CPU cost
+         */
+        void benchmarkGpuDriven();
+
+        /**
+         * Runs the headless GPU driven frames with streaming uploads with and without the async queues
+         */
+        void benchmarkAsyncQueues();
+
+        /**
+         * Runs the headless instanced frames with the objects split into 1 up to one draw per object and reports
+         * the cost of the draw calls
+         */
+        void benchmarkInstancing();
+
+        /**
+         * Sums a buffer with many small compute jobs, batched and submitted one by one, and checks the sums
+         */
+        void benchmarkCompute();
+
+        /**
+         * Renders the bench scene's warmup and measured frames headless and writes the report
+         */
+        void runBenchScene();
+
+        /**
+         * Ends a phase of the startup, it began where the previous one ended
+         * @param phase [in] Name of the phase in the bench report
+         */
+        void markStartup(const char* phase);
+
+        /**
+         * Prints the CPU frame phases and GPU passes and writes their traces, for the profilers that are on.
+         * Both traces tag their events with the frame number, so the two timelines can be lined up.
+         */
+        void reportProfiles();
+
         /**
          * Main loop of the app
          */
@@ -0,0 +1,125 @@
+//
+// Created by m4tex on 17/10/26.
+//
+
+#include "MappedFile.h"
+
+//std
+#include <stdexcept>
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace m4x {
+    MappedFile::~MappedFile() {
+        close();
+    }
+
+    MappedFile::MappedFile(MappedFile&& other) noexcept {
+        *this = std::move(other);
+    }
+
+    MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+        if (this != &other) {
+            close();
+            std::swap(mapping, other.mapping);
+            std::swap(length, other.length);
+#ifdef _WIN32
+            std::swap(fileHandle, other.fileHandle);
+            std::swap(mappingHandle, other.mappingHandle);
+#endif
+        }
+        return *this;
+    }
+
+    void MappedFile::open(const std::filesystem::path& path) {
+        close();
+
+        auto fail = [&]() {
+            close();
+            throw std::runtime_error("Failed to map " + path.string());
+        };
+
+#ifdef _WIN32
+        fileHandle = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                 FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (fileHandle == INVALID_HANDLE_VALUE) {
+            fileHandle = nullptr;
+            fail();
+        }
+
+        LARGE_INTEGER fileSize{};
+        if (!GetFileSizeEx(fileHandle, &fileSize)) {
+            fail();
+        }
+        length = static_cast<size_t>(fileSize.QuadPart);
+
+        // Empty files can't be mapped
+        if (length == 0) {
+            fail();
+        }
+
+        mappingHandle = CreateFileMappingW(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mappingHandle == nullptr) {
+            fail();
+        }
+
+        mapping = MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+        if (mapping == nullptr) {
+            fail();
+        }
+#else
+        int descriptor = ::open(path.c_str(), O_RDONLY);
+        if (descriptor < 0) {
+            fail();
+        }
+
+        struct stat status{};
+        if (fstat(descriptor, &status) != 0 || status.st_size == 0) {
+            ::close(descriptor);
+            fail();
+        }
+        length = static_cast<size_t>(status.st_size);
+
+        void* address = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, descriptor, 0);
+        // The mapping keeps its own reference to the file
+        ::close(descriptor);
+
+        if (address == MAP_FAILED) {
+            fail();
+        }
+        mapping = address;
+#endif
+    }
+
+    void MappedFile::close() {
+#ifdef _WIN32
+        if (mapping != nullptr) {
+            UnmapViewOfFile(mapping);
+        }
+        if (mappingHandle != nullptr) {
+            CloseHandle(mappingHandle);
+        }
+        if (fileHandle != nullptr) {
+            CloseHandle(fileHandle);
+        }
+        fileHandle = nullptr;
+        mappingHandle = nullptr;
+#else
+        if (mapping != nullptr) {
+            munmap(mapping, length);
+        }
+#endif
+        mapping = nullptr;
+        length = 0;
+    }
+} // m4x
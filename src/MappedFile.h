@@ -0,0 +1,51 @@
+/** @file */
+
+//
+// Created by m4tex on 17/10/26.
+//
+
+#pragma once
+
+// std
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+namespace m4x {
+    /**
+     * Read only memory mapping of a whole file. The pages are loaded by the OS on first touch, so opening a big
+     * file costs nothing until its contents are read, and any thread may read the mapping.
+     */
+    class MappedFile {
+    public:
+        MappedFile() = default;
+        ~MappedFile();
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+        MappedFile(MappedFile&& other) noexcept;
+        MappedFile& operator=(MappedFile&& other) noexcept;
+
+        /**
+         * Maps a file, replacing the current mapping
+         * @param path [in] File to map, throws if it can't be opened or is empty
+         */
+        void open(const std::filesystem::path& path);
+
+        void close();
+
+        [[nodiscard]] bool isOpen() const { return mapping != nullptr; }
+
+        [[nodiscard]] const uint8_t* data() const { return static_cast<const uint8_t*>(mapping); }
+
+        [[nodiscard]] size_t size() const { return length; }
+
+    private:
+        void*  mapping = nullptr;
+        size_t length  = 0;
+#ifdef _WIN32
+        void*  fileHandle    = nullptr;
+        void*  mappingHandle = nullptr;
+#endif
+    };
+} // m4x
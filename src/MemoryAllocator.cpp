@@ -0,0 +1,642 @@
+//
+// Created by m4tex on 17/10/26.
+//
+
+#include "MemoryAllocator.h"
+#include "DeletionQueue.h"
+
+//std
+#include <stdexcept>
+#include <algorithm>
+#include <iomanip>
+
+namespace m4x {
+    namespace {
+        VkDeviceSize floorPowerOfTwo(VkDeviceSize value) {
+            VkDeviceSize result = 1;
+            while (result * 2 <= value) {
+                result *= 2;
+            }
+            return result;
+        }
+
+        double mebibytes(VkDeviceSize bytes) {
+            return static_cast<double>(bytes) / (1024.0 * 1024.0);
+        }
+
+        void setSharing(VkBufferCreateInfo& bufferInfo, const Buffer& buffer) {
+            if (buffer.concurrent()) {
+                bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+                bufferInfo.queueFamilyIndexCount = static_cast<uint32_t>(buffer.queueFamilies.size());
+                bufferInfo.pQueueFamilyIndices = buffer.queueFamilies.data();
+            } else {
+                bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            }
+        }
+    }
+
+    BuddyBlock::BuddyBlock(VkDeviceMemory memory, VkDeviceSize size, void* mapped)
+            : deviceMemory(memory), blockSize(size), mappedData(mapped) {
+        while ((MIN_NODE_SIZE << maxOrder) < blockSize) {
+            maxOrder++;
+        }
+
+        freeLists.resize(maxOrder + 1);
+        freeLists[maxOrder].insert(0);
+    }
+
+    std::optional<VkDeviceSize> BuddyBlock::allocate(VkDeviceSize size, VkDeviceSize alignment) {
+        // Nodes are aligned to their own size, so rounding up to the alignment is enough
+        VkDeviceSize needed = std::max({ size, alignment, MIN_NODE_SIZE });
+
+        uint32_t order = 0;
+        while ((MIN_NODE_SIZE << order) < needed) {
+            order++;
+        }
+
+        if (order > maxOrder) {
+            return std::nullopt;
+        }
+
+        uint32_t available = order;
+        while (available <= maxOrder && freeLists[available].empty()) {
+            available++;
+        }
+
+        if (available > maxOrder) {
+            return std::nullopt;
+        }
+
+        VkDeviceSize offset = *freeLists[available].begin();
+        freeLists[available].erase(freeLists[available].begin());
+
+        // Split down to the requested order, the upper halves go back on the free lists
+        while (available > order) {
+            available--;
+            freeLists[available].insert(offset + (MIN_NODE_SIZE << available));
+        }
+
+        allocatedOrders[offset] = order;
+        usedBytes += MIN_NODE_SIZE << order;
+
+        return offset;
+    }
+
+    void BuddyBlock::free(VkDeviceSize offset) {
+        auto it = allocatedOrders.find(offset);
+        if (it == allocatedOrders.end()) {
+            throw std::runtime_error("Freeing an offset the block never handed out");
+        }
+
+        uint32_t order = it->second;
+        allocatedOrders.erase(it);
+        usedBytes -= MIN_NODE_SIZE << order;
+
+        while (order < maxOrder) {
+            VkDeviceSize buddy = offset ^ (MIN_NODE_SIZE << order);
+            auto buddyIt = freeLists[order].find(buddy);
+
+            if (buddyIt == freeLists[order].end()) {
+                break;
+            }
+
+            freeLists[order].erase(buddyIt);
+            offset = std::min(offset, buddy);
+            order++;
+        }
+
+        freeLists[order].insert(offset);
+    }
+
+    VkDeviceSize BuddyBlock::largestFree() const {
+        for (uint32_t order = maxOrder + 1; order-- > 0;) {
+            if (!freeLists[order].empty()) {
+                return MIN_NODE_SIZE << order;
+            }
+        }
+        return 0;
+    }
+
+    void MemoryAllocator::create(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize blockSize) {
+        this->device = device;
+        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &properties);
+
+        // Small heaps get smaller blocks so a single block can't take a big share of them
+        heapBlockSizes.resize(properties.memoryHeapCount);
+        for (uint32_t i = 0; i < properties.memoryHeapCount; ++i) {
+            VkDeviceSize limit = floorPowerOfTwo(std::max<VkDeviceSize>(properties.memoryHeaps[i].size / 8,
+                                                                        BuddyBlock::MIN_NODE_SIZE));
+            heapBlockSizes[i] = std::min(floorPowerOfTwo(blockSize), limit);
+        }
+
+        pools.resize(properties.memoryTypeCount * 2);
+        for (uint32_t i = 0; i < pools.size(); ++i) {
+            pools[i].memoryType = i / 2;
+        }
+    }
+
+    void MemoryAllocator::destroy() {
+        for (auto& move : pendingMoves) {
+            vkDestroyBuffer(device, move.newBuffer, nullptr);
+        }
+        pendingMoves.clear();
+
+        for (auto buffer : buffers) {
+            vkDestroyBuffer(device, buffer->buffer, nullptr);
+            delete buffer;
+        }
+        buffers.clear();
+
+        for (auto& pool : pools) {
+            for (auto& block : pool.blocks) {
+                vkFreeMemory(device, block->memory(), nullptr);
+            }
+            pool.blocks.clear();
+        }
+
+        for (auto& [memory, allocation] : dedicated) {
+            vkFreeMemory(device, memory, nullptr);
+        }
+        dedicated.clear();
+    }
+
+    std::optional<uint32_t> MemoryAllocator::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags flags) const {
+        for (uint32_t i = 0; i < properties.memoryTypeCount; ++i) {
+            if ((typeFilter & (1u << i)) && (properties.memoryTypes[i].propertyFlags & flags) == flags) {
+                return i;
+            }
+        }
+        return std::nullopt;
+    }
+
+    void* MemoryAllocator::mapMemory(uint32_t memoryType, VkDeviceMemory memory) const {
+        if (!(properties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)) {
+            return nullptr;
+        }
+
+        void* data;
+        if (VK_SUCCESS != vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, &data)) {
+            throw std::runtime_error("Failed to map device memory");
+        }
+        return data;
+    }
+
+    BuddyBlock* MemoryAllocator::createBlock(uint32_t memoryType) {
+        VkDeviceSize size = heapBlockSizes[properties.memoryTypes[memoryType].heapIndex];
+
+        VkMemoryAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocInfo.allocationSize = size;
+        allocInfo.memoryTypeIndex = memoryType;
+
+        VkDeviceMemory memory;
+        if (VK_SUCCESS != vkAllocateMemory(device, &allocInfo, nullptr, &memory)) {
+            return nullptr;
+        }
+
+        return new BuddyBlock(memory, size, mapMemory(memoryType, memory));
+    }
+
+    std::optional<Allocation> MemoryAllocator::allocateFromPool(uint32_t poolIndex,
+                                                                const VkMemoryRequirements& requirements,
+                                                                const BuddyBlock* exclude) {
+        Pool& pool = pools[poolIndex];
+
+        // Fullest blocks first, which leaves the emptier ones a chance to drain and be released
+        std::vector<BuddyBlock*> candidates;
+        for (auto& block : pool.blocks) {
+            if (block.get() != exclude) {
+                candidates.push_back(block.get());
+            }
+        }
+        std::sort(candidates.begin(), candidates.end(),
+                  [](const BuddyBlock* a, const BuddyBlock* b) { return a->used() > b->used(); });
+
+        for (auto block : candidates) {
+            auto offset = block->allocate(requirements.size, requirements.alignment);
+
+            if (offset.has_value()) {
+                Allocation allocation{};
+                allocation.memory = block->memory();
+                allocation.offset = offset.value();
+                allocation.size = requirements.size;
+                allocation.mapped = block->mapped() ? static_cast<char*>(block->mapped()) + offset.value() : nullptr;
+                allocation.memoryType = pool.memoryType;
+                allocation.block = block;
+                allocation.pool = poolIndex;
+                return allocation;
+            }
+        }
+
+        return std::nullopt;
+    }
+
+    std::optional<Allocation> MemoryAllocator::allocateDedicated(uint32_t memoryType, VkDeviceSize size) {
+        VkMemoryAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocInfo.allocationSize = size;
+        allocInfo.memoryTypeIndex = memoryType;
+
+        VkDeviceMemory memory;
+        if (VK_SUCCESS != vkAllocateMemory(device, &allocInfo, nullptr, &memory)) {
+            return std::nullopt;
+        }
+
+        Allocation allocation{};
+        allocation.memory = memory;
+        allocation.size = size;
+        allocation.mapped = mapMemory(memoryType, memory);
+        allocation.memoryType = memoryType;
+
+        dedicated[memory] = allocation;
+        return allocation;
+    }
+
+    Allocation MemoryAllocator::allocate(const VkMemoryRequirements& requirements,
+                                         const std::vector<VkMemoryPropertyFlags>& wanted, ResourceKind kind) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        for (auto flags : wanted) {
+            auto memoryType = findMemoryType(requirements.memoryTypeBits, flags);
+            if (!memoryType.has_value()) {
+                continue;
+            }
+
+            VkDeviceSize blockSize = heapBlockSizes[properties.memoryTypes[memoryType.value()].heapIndex];
+
+            if (requirements.size > blockSize / 2) {
+                auto allocation = allocateDedicated(memoryType.value(), requirements.size);
+                if (!allocation.has_value()) {
+                    // Heap is exhausted, try the next preference
+                    continue;
+                }
+                return allocation.value();
+            }
+
+            uint32_t poolIndex = memoryType.value() * 2 + (kind == ResourceKind::Optimal ? 1 : 0);
+
+            auto allocation = allocateFromPool(poolIndex, requirements);
+            if (allocation.has_value()) {
+                return allocation.value();
+            }
+
+            BuddyBlock* block = createBlock(memoryType.value());
+            if (block == nullptr) {
+                // Heap is exhausted, try the next preference
+                continue;
+            }
+            pools[poolIndex].blocks.emplace_back(block);
+
+            allocation = allocateFromPool(poolIndex, requirements);
+            if (allocation.has_value()) {
+                return allocation.value();
+            }
+        }
+
+        throw std::runtime_error("Failed to allocate device memory");
+    }
+
+    void MemoryAllocator::free(Allocation& allocation) {
+        std::lock_guard<std::mutex> lock(mutex);
+        freeLocked(allocation);
+    }
+
+    void MemoryAllocator::freeLocked(Allocation& allocation) {
+        if (allocation.memory == VK_NULL_HANDLE) {
+            return;
+        }
+
+        if (allocation.block == nullptr) {
+            dedicated.erase(allocation.memory);
+            vkFreeMemory(device, allocation.memory, nullptr);
+            allocation = {};
+            return;
+        }
+
+        BuddyBlock* block = allocation.block;
+        block->free(allocation.offset);
+
+        // Keep one block around per pool so alternating allocations don't thrash vkAllocateMemory
+        Pool& pool = pools[allocation.pool];
+        if (block->empty() && pool.blocks.size() > 1) {
+            vkFreeMemory(device, block->memory(), nullptr);
+            pool.blocks.erase(std::find_if(pool.blocks.begin(), pool.blocks.end(),
+                                           [block](const auto& b) { return b.get() == block; }));
+        }
+
+        allocation = {};
+    }
+
+    Allocation MemoryAllocator::bindImage(VkImage image, VkMemoryPropertyFlags flags) {
+        VkMemoryRequirements requirements;
+        vkGetImageMemoryRequirements(device, image, &requirements);
+
+        Allocation allocation = allocate(requirements, { flags }, ResourceKind::Optimal);
+
+        if (VK_SUCCESS != vkBindImageMemory(device, image, allocation.memory, allocation.offset)) {
+            free(allocation);
+            throw std::runtime_error("Failed to bind image memory");
+        }
+
+        return allocation;
+    }
+
+    Buffer* MemoryAllocator::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
+                                          const std::vector<VkMemoryPropertyFlags>& flags, bool movable,
+                                          const std::vector<uint32_t>& queueFamilies) {
+        if (movable) {
+            usage |= VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        }
+
+        VkBufferCreateInfo bufferInfo{};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size = size;
+        bufferInfo.usage = usage;
+
+        auto buffer = new Buffer{};
+        buffer->size = size;
+        buffer->usage = usage;
+        buffer->movable = movable;
+
+        // Concurrent sharing needs at least two distinct families
+        std::vector<uint32_t> families = queueFamilies;
+        std::sort(families.begin(), families.end());
+        families.erase(std::unique(families.begin(), families.end()), families.end());
+        if (families.size() > 1) {
+            buffer->queueFamilies = std::move(families);
+        }
+
+        setSharing(bufferInfo, *buffer);
+
+        if (VK_SUCCESS != vkCreateBuffer(device, &bufferInfo, nullptr, &buffer->buffer)) {
+            delete buffer;
+            throw std::runtime_error("Failed to create a buffer");
+        }
+
+        VkMemoryRequirements requirements;
+        vkGetBufferMemoryRequirements(device, buffer->buffer, &requirements);
+
+        try {
+            buffer->allocation = allocate(requirements, flags, ResourceKind::Linear);
+        } catch (...) {
+            vkDestroyBuffer(device, buffer->buffer, nullptr);
+            delete buffer;
+            throw;
+        }
+
+        vkBindBufferMemory(device, buffer->buffer, buffer->allocation.memory, buffer->allocation.offset);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        buffers.insert(buffer);
+        return buffer;
+    }
+
+    void MemoryAllocator::destroyBuffer(Buffer* buffer) {
+        if (buffer == nullptr) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        // A buffer that's mid move drops its new location as well
+        auto move = std::find_if(pendingMoves.begin(), pendingMoves.end(),
+                                 [buffer](const Move& m) { return m.buffer == buffer; });
+        if (move != pendingMoves.end()) {
+            moveDeletionQueue->defer([device = device, newBuffer = move->newBuffer]() {
+                vkDestroyBuffer(device, newBuffer, nullptr);
+            });
+            moveDeletionQueue->freeMemory(move->newAllocation);
+            pendingMoves.erase(move);
+        }
+
+        vkDestroyBuffer(device, buffer->buffer, nullptr);
+        freeLocked(buffer->allocation);
+
+        buffers.erase(buffer);
+        delete buffer;
+    }
+
+    void MemoryAllocator::retireBuffer(Buffer* buffer) {
+        std::lock_guard<std::mutex> lock(mutex);
+        buffer->retired = true;
+    }
+
+    uint32_t MemoryAllocator::defragment(VkCommandBuffer commandBuffer, uint32_t maxMoves,
+                                         DeletionQueue& deletionQueue) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (!pendingMoves.empty()) {
+            return 0;
+        }
+        moveDeletionQueue = &deletionQueue;
+
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+        // Only recorded once there is something to copy, a pass that moves nothing leaves the command buffer alone
+        auto recordCopy = [&](VkBuffer source, VkBuffer destination, VkDeviceSize size) {
+            if (pendingMoves.empty()) {
+                vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                     0, 1, &barrier, 0, nullptr, 0, nullptr);
+            }
+
+            VkBufferCopy region{};
+            region.size = size;
+            vkCmdCopyBuffer(commandBuffer, source, destination, 1, &region);
+        };
+
+        for (uint32_t poolIndex = 0; poolIndex < pools.size() && pendingMoves.size() < maxMoves; ++poolIndex) {
+            Pool& pool = pools[poolIndex];
+
+            if (pool.blocks.size() < 2) {
+                continue;
+            }
+
+            // Drain the emptiest block that has something we're allowed to move
+            const BuddyBlock* source = nullptr;
+            for (auto& block : pool.blocks) {
+                bool hasMovable = std::any_of(buffers.begin(), buffers.end(), [&](const Buffer* b) {
+                    return b->movable && !b->retired && b->allocation.block == block.get();
+                });
+
+                if (hasMovable && (source == nullptr || block->used() < source->used())) {
+                    source = block.get();
+                }
+            }
+
+            if (source == nullptr) {
+                continue;
+            }
+
+            for (auto buffer : buffers) {
+                if (pendingMoves.size() >= maxMoves) {
+                    break;
+                }
+
+                if (!buffer->movable || buffer->retired || buffer->allocation.block != source) {
+                    continue;
+                }
+
+                VkBufferCreateInfo bufferInfo{};
+                bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+                bufferInfo.size = buffer->size;
+                bufferInfo.usage = buffer->usage;
+                setSharing(bufferInfo, *buffer);
+
+                VkBuffer newBuffer;
+                if (VK_SUCCESS != vkCreateBuffer(device, &bufferInfo, nullptr, &newBuffer)) {
+                    throw std::runtime_error("Failed to create a buffer");
+                }
+
+                VkMemoryRequirements requirements;
+                vkGetBufferMemoryRequirements(device, newBuffer, &requirements);
+
+                auto allocation = allocateFromPool(poolIndex, requirements, source);
+                if (!allocation.has_value()) {
+                    vkDestroyBuffer(device, newBuffer, nullptr);
+                    continue;
+                }
+
+                vkBindBufferMemory(device, newBuffer, allocation->memory, allocation->offset);
+
+                recordCopy(buffer->buffer, newBuffer, buffer->size);
+                pendingMoves.push_back({ buffer, newBuffer, allocation.value() });
+            }
+        }
+
+        if (pendingMoves.empty()) {
+            return 0;
+        }
+
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0,
+                             1, &barrier, 0, nullptr, 0, nullptr);
+
+        return static_cast<uint32_t>(pendingMoves.size());
+    }
+
+    void MemoryAllocator::finishDefragment() {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        for (auto& move : pendingMoves) {
+            moveDeletionQueue->defer([device = device, buffer = move.buffer->buffer]() {
+                vkDestroyBuffer(device, buffer, nullptr);
+            });
+            moveDeletionQueue->freeMemory(move.buffer->allocation);
+
+            move.buffer->buffer = move.newBuffer;
+            move.buffer->allocation = move.newAllocation;
+        }
+
+        movedBuffers += pendingMoves.size();
+        pendingMoves.clear();
+    }
+
+    std::vector<HeapStats> MemoryAllocator::stats() const {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        std::vector<HeapStats> heaps(properties.memoryHeapCount);
+        std::vector<VkDeviceSize> freeBytes(properties.memoryHeapCount, 0);
+        std::vector<VkDeviceSize> largestFree(properties.memoryHeapCount, 0);
+
+        for (uint32_t i = 0; i < properties.memoryHeapCount; ++i) {
+            heaps[i].heapIndex = i;
+            heaps[i].heapSize = properties.memoryHeaps[i].size;
+        }
+
+        for (const auto& pool : pools) {
+            uint32_t heap = properties.memoryTypes[pool.memoryType].heapIndex;
+
+            for (const auto& block : pool.blocks) {
+                heaps[heap].blockCount++;
+                heaps[heap].reservedBytes += block->size();
+                heaps[heap].usedBytes += block->used();
+                heaps[heap].allocationCount += static_cast<uint32_t>(block->allocationCount());
+
+                freeBytes[heap] += block->size() - block->used();
+                largestFree[heap] = std::max(largestFree[heap], block->largestFree());
+            }
+        }
+
+        for (const auto& [memory, allocation] : dedicated) {
+            uint32_t heap = properties.memoryTypes[allocation.memoryType].heapIndex;
+            heaps[heap].reservedBytes += allocation.size;
+            heaps[heap].usedBytes += allocation.size;
+            heaps[heap].requestedBytes += allocation.size;
+            heaps[heap].allocationCount++;
+        }
+
+        for (const auto buffer : buffers) {
+            if (buffer->allocation.block != nullptr) {
+                heaps[properties.memoryTypes[buffer->allocation.memoryType].heapIndex].requestedBytes += buffer->size;
+            }
+        }
+
+        for (uint32_t i = 0; i < properties.memoryHeapCount; ++i) {
+            if (freeBytes[i] > 0) {
+                heaps[i].fragmentation = 1.0f - static_cast<float>(largestFree[i]) / static_cast<float>(freeBytes[i]);
+            }
+        }
+
+        return heaps;
+    }
+
+    void MemoryAllocator::printStats(std::ostream& out) const {
+        for (const auto& heap : stats()) {
+            out << "Heap " << heap.heapIndex << " (" << std::fixed << std::setprecision(1) << mebibytes(heap.heapSize)
+                << " MiB): " << heap.blockCount << " blocks, " << mebibytes(heap.reservedBytes) << " MiB reserved, "
+                << mebibytes(heap.usedBytes) << " MiB used in " << heap.allocationCount << " allocations, "
+                << std::setprecision(2) << "fragmentation " << heap.fragmentation << std::defaultfloat << std::endl;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        out << "Defragmentation moved " << movedBuffers << " buffers" << std::endl;
+    }
+
+    void LinearPool::create(MemoryAllocator& allocator, VkDeviceSize frameCapacity, uint32_t frameCount,
+                            VkBufferUsageFlags usage) {
+        this->frameCapacity = frameCapacity;
+
+        buffer = allocator.createBuffer(frameCapacity * frameCount, usage,
+                                        { VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT });
+        frameBegin = 0;
+        head = 0;
+    }
+
+    void LinearPool::destroy(MemoryAllocator& allocator) {
+        allocator.destroyBuffer(buffer);
+        buffer = nullptr;
+    }
+
+    void LinearPool::destroy(DeletionQueue& deletionQueue) {
+        deletionQueue.destroyBuffer(buffer);
+        buffer = nullptr;
+    }
+
+    void LinearPool::beginFrame(uint32_t frameIndex) {
+        frameBegin = frameCapacity * frameIndex;
+        head = frameBegin;
+    }
+
+    std::optional<TransientAllocation> LinearPool::allocate(VkDeviceSize size, VkDeviceSize alignment) {
+        VkDeviceSize offset = (head + alignment - 1) / alignment * alignment;
+
+        if (offset + size > frameBegin + frameCapacity) {
+            return std::nullopt;
+        }
+
+        head = offset + size;
+
+        TransientAllocation allocation{};
+        allocation.buffer = buffer->buffer;
+        allocation.offset = offset;
+        allocation.mapped = static_cast<char*>(buffer->allocation.mapped) + offset;
+        return allocation;
+    }
+} // m4x
@@ -0,0 +1,324 @@
+/** @file */
+
+//
+// Created by m4tex on 17/10/26.
+//
+
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+// std
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace m4x {
+    class BuddyBlock;
+    class DeletionQueue;
+
+    /**
+     * Default size of the device memory blocks allocations are carved out of
+     */
+    const VkDeviceSize DEFAULT_MEMORY_BLOCK_SIZE = 64ull * 1024 * 1024;
+
+    /**
+     * Linear and optimal resources are kept in separate pools so bufferImageGranularity never applies
+     */
+    enum class ResourceKind {
+        Linear,
+        Optimal
+    };
+
+    /**
+     * A range of device memory handed out by MemoryAllocator
+     */
+    struct Allocation {
+        VkDeviceMemory memory     = VK_NULL_HANDLE;
+        VkDeviceSize   offset     = 0;
+        VkDeviceSize   size       = 0;
+        // Points at offset if the memory is host visible
+        void*          mapped     = nullptr;
+        uint32_t       memoryType = 0;
+
+        // nullptr for dedicated allocations
+        BuddyBlock*    block      = nullptr;
+        uint32_t       pool       = 0;
+    };
+
+    /**
+     * A buffer together with the memory it's bound to.
+     * Movable buffers may get a new handle and allocation from a defragmentation pass,
+     * so their users have to read buffer again after MemoryAllocator::finishDefragment() and must not keep it in
+     * descriptors.
+     */
+    struct Buffer {
+        VkBuffer            buffer = VK_NULL_HANDLE;
+        Allocation          allocation;
+        VkDeviceSize        size   = 0;
+        VkBufferUsageFlags  usage  = 0;
+        bool                movable = false;
+        // Handed to a DeletionQueue, defragmentation leaves it where it is
+        bool                retired = false;
+        // Queue families the buffer is shared between, empty when a single family owns it at a time
+        std::vector<uint32_t> queueFamilies;
+
+        [[nodiscard]] bool concurrent() const { return !queueFamilies.empty(); }
+    };
+
+    /**
+     * Usage of a single memory heap
+     */
+    struct HeapStats {
+        uint32_t     heapIndex       = 0;
+        VkDeviceSize heapSize        = 0;
+        uint32_t     blockCount      = 0;
+        // Memory allocated from Vulkan, blocks and dedicated allocations
+        VkDeviceSize reservedBytes   = 0;
+        // Bytes of the blocks and dedicated allocations in use, including buddy rounding
+        VkDeviceSize usedBytes       = 0;
+        // Bytes actually requested by the resources
+        VkDeviceSize requestedBytes  = 0;
+        uint32_t     allocationCount = 0;
+        // 0 when all free block memory is one contiguous range, towards 1 the more it's split up
+        float        fragmentation   = 0.0f;
+    };
+
+    /**
+     * Power of two sized device memory block split with a buddy allocator
+     */
+    class BuddyBlock {
+    public:
+        static const VkDeviceSize MIN_NODE_SIZE = 256;
+
+        BuddyBlock(VkDeviceMemory memory, VkDeviceSize size, void* mapped);
+
+        /**
+         * @param size [in] Bytes needed
+         * @param alignment [in] Required alignment of the offset
+         * @return Offset into the block, empty if it doesn't fit
+         */
+        std::optional<VkDeviceSize> allocate(VkDeviceSize size, VkDeviceSize alignment);
+
+        /**
+         * Frees a node and merges it with its free buddies
+         * @param offset [in] Offset returned by allocate()
+         */
+        void free(VkDeviceSize offset);
+
+        [[nodiscard]] VkDeviceMemory memory() const { return deviceMemory; }
+        [[nodiscard]] VkDeviceSize size() const { return blockSize; }
+        [[nodiscard]] VkDeviceSize used() const { return usedBytes; }
+        [[nodiscard]] void* mapped() const { return mappedData; }
+        [[nodiscard]] bool empty() const { return allocatedOrders.empty(); }
+        [[nodiscard]] size_t allocationCount() const { return allocatedOrders.size(); }
+        [[nodiscard]] VkDeviceSize largestFree() const;
+
+    private:
+        VkDeviceMemory deviceMemory;
+        VkDeviceSize   blockSize;
+        void*          mappedData;
+        VkDeviceSize   usedBytes = 0;
+        uint32_t       maxOrder  = 0;
+
+        // Free node offsets per order, order 0 being MIN_NODE_SIZE
+        std::vector<std::set<VkDeviceSize>> freeLists;
+        std::unordered_map<VkDeviceSize, uint32_t> allocatedOrders;
+    };
+
+    /**
+     * Sub-allocating GPU memory allocator.
+     * Allocations come out of large blocks per memory type and resource kind, anything bigger than half a block
+     * gets its own dedicated vkAllocateMemory. Host visible blocks stay mapped for their whole lifetime.
+     */
+    class MemoryAllocator {
+    public:
+        /**
+         * @param physicalDevice [in] Device to read the memory types and heaps from
+         * @param device [in] Logical device
+         * @param blockSize [in] Preferred block size, reduced for small heaps
+         */
+        void create(VkPhysicalDevice physicalDevice, VkDevice device,
+                    VkDeviceSize blockSize = DEFAULT_MEMORY_BLOCK_SIZE);
+
+        /**
+         * Frees every block, all allocations have to be released beforehand
+         */
+        void destroy();
+
+        /**
+         * @param requirements [in] Requirements of the resource
+         * @param properties [in] Wanted memory properties, ordered by preference
+         * @param kind [in] Whether the memory will back a linear or an optimal resource
+         * @return The allocation, throws if no memory type matches or memory ran out
+         */
+        Allocation allocate(const VkMemoryRequirements& requirements,
+                            const std::vector<VkMemoryPropertyFlags>& properties, ResourceKind kind);
+
+        /**
+         * Releases an allocation and resets it
+         */
+        void free(Allocation& allocation);
+
+        /**
+         * Allocates memory for an optimal tiling image and binds it
+         */
+        Allocation bindImage(VkImage image, VkMemoryPropertyFlags properties);
+
+        /**
+         * Creates a buffer bound to memory from the allocator
+         * @param size [in] Size of the buffer in bytes
+         * @param usage [in] Buffer usage, TRANSFER_SRC and TRANSFER_DST get added for movable buffers
+         * @param properties [in] Wanted memory properties, ordered by preference
+         * @param movable [in] If a defragmentation pass is allowed to move the buffer
+         * @param queueFamilies [in] Families using the buffer without ownership transfers, duplicates are ignored
+         * and less than two distinct ones create an exclusive buffer
+         * @return The buffer, owned by the allocator until destroyBuffer()
+         */
+        Buffer* createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
+                             const std::vector<VkMemoryPropertyFlags>& properties, bool movable = false,
+                             const std::vector<uint32_t>& queueFamilies = {});
+
+        /**
+         * Destroys a buffer right away. A move of the buffer that hasn't finished is cancelled, the location it
+         * was being copied to goes to the deletion queue of the pass since the copy may still be running.
+         */
+        void destroyBuffer(Buffer* buffer);
+
+        /**
+         * Keeps a buffer whose destruction was deferred out of defragmentation, DeletionQueue::destroyBuffer()
+         * calls it
+         */
+        void retireBuffer(Buffer* buffer);
+
+        /**
+         * Records copies moving movable buffers out of the emptiest block of each pool into fuller ones.
+         * Run it incrementally, a few moves per frame.
+         * @param commandBuffer [in] Command buffer to record the copies into
+         * @param maxMoves [in] Upper bound on the buffers moved by this pass
+         * @param deletionQueue [in] Queue the locations left behind by the pass are destroyed through
+         * @return Amount of buffers being moved
+         */
+        uint32_t defragment(VkCommandBuffer commandBuffer, uint32_t maxMoves, DeletionQueue& deletionQueue);
+
+        /**
+         * Swaps the moved buffers over to their new location and hands the old ones to the deletion queue, frames
+         * recorded before the swap may still read them.
+         * Call once the copies recorded by defragment() have completed.
+         */
+        void finishDefragment();
+
+        [[nodiscard]] std::vector<HeapStats> stats() const;
+
+        void printStats(std::ostream& out) const;
+
+        [[nodiscard]] const VkPhysicalDeviceMemoryProperties& memoryProperties() const { return properties; }
+
+    private:
+        struct Pool {
+            uint32_t memoryType;
+            std::vector<std::unique_ptr<BuddyBlock>> blocks;
+        };
+
+        struct Move {
+            Buffer*    buffer;
+            VkBuffer   newBuffer;
+            Allocation newAllocation;
+        };
+
+        VkDevice device = VK_NULL_HANDLE;
+        VkPhysicalDeviceMemoryProperties properties{};
+        std::vector<VkDeviceSize> heapBlockSizes;
+
+        // Two pools per memory type, indexed memoryType * 2 + kind
+        std::vector<Pool> pools;
+        std::map<VkDeviceMemory, Allocation> dedicated;
+        std::unordered_set<Buffer*> buffers;
+        std::vector<Move> pendingMoves;
+        // Queue of the pass that recorded the pending moves
+        DeletionQueue* moveDeletionQueue = nullptr;
+        uint64_t movedBuffers = 0;
+
+        mutable std::mutex mutex;
+
+        std::optional<uint32_t> findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags flags) const;
+
+        std::optional<Allocation> allocateFromPool(uint32_t poolIndex, const VkMemoryRequirements& requirements,
+                                                   const BuddyBlock* exclude = nullptr);
+
+        /**
+         * @return The allocation, empty if the heap is out of memory
+         */
+        std::optional<Allocation> allocateDedicated(uint32_t memoryType, VkDeviceSize size);
+
+        BuddyBlock* createBlock(uint32_t memoryType);
+
+        void freeLocked(Allocation& allocation);
+
+        void* mapMemory(uint32_t memoryType, VkDeviceMemory memory) const;
+    };
+
+    /**
+     * An allocation out of a LinearPool, valid until the same frame slot begins again
+     */
+    struct TransientAllocation {
+        VkBuffer     buffer = VK_NULL_HANDLE;
+        VkDeviceSize offset = 0;
+        void*        mapped = nullptr;
+    };
+
+    /**
+     * Host visible bump allocator for per-frame transient data.
+     * The buffer is split into one region per frame in flight and a region is reset when its frame begins again.
+     * It's device local where the host can write it directly, the GPU reads such data about once anyway.
+     */
+    class LinearPool {
+    public:
+        /**
+         * @param allocator [in] Allocator the buffer is created from
+         * @param frameCapacity [in] Bytes each frame can allocate
+         * @param frameCount [in] Depth of the frames in flight ring
+         * @param usage [in] Usage of the buffer, for everything allocated from it
+         */
+        void create(MemoryAllocator& allocator, VkDeviceSize frameCapacity, uint32_t frameCount,
+                    VkBufferUsageFlags usage);
+
+        void destroy(MemoryAllocator& allocator);
+
+        /**
+         * Destroys the buffer once the frame being recorded has completed, the frames before may still read it
+         */
+        void destroy(DeletionQueue& deletionQueue);
+
+        /**
+         * Resets the region of the frame, the frame's previous submission must have completed
+         * @param frameIndex [in] Slot of the frames in flight ring
+         */
+        void beginFrame(uint32_t frameIndex);
+
+        /**
+         * @return The allocation, empty if the frame's region is full
+         */
+        std::optional<TransientAllocation> allocate(VkDeviceSize size, VkDeviceSize alignment);
+
+        [[nodiscard]] VkDeviceSize frameUsed() const { return head - frameBegin; }
+
+        /**
+         * Size of the whole buffer, every frame's region
+         */
+        [[nodiscard]] VkDeviceSize size() const { return buffer ? buffer->size : 0; }
+
+    private:
+        Buffer*      buffer        = nullptr;
+        VkDeviceSize frameCapacity = 0;
+        VkDeviceSize frameBegin    = 0;
+        VkDeviceSize head          = 0;
+    };
+} // m4x
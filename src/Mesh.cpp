@@ -0,0 +1,121 @@
+//
+// Created by m4tex on 17/10/26.
+//
+
+#include "Mesh.h"
+
+//std
+#include <cstddef>
+#include <algorithm>
+#include <cmath>
+
+namespace m4x {
+    VkVertexInputBindingDescription Vertex::BindingDescription() {
+        VkVertexInputBindingDescription bindingDescription{};
+        bindingDescription.binding = 0;
+        bindingDescription.stride = sizeof(Vertex);
+        bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+        return bindingDescription;
+    }
+
+    std::array<VkVertexInputAttributeDescription, 2> Vertex::AttributeDescriptions() {
+        std::array<VkVertexInputAttributeDescription, 2> attributeDescriptions{};
+
+        attributeDescriptions[0].binding = 0;
+        attributeDescriptions[0].location = 0;
+        attributeDescriptions[0].format = VK_FORMAT_R32G32_SFLOAT;
+        attributeDescriptions[0].offset = offsetof(Vertex, position);
+
+        attributeDescriptions[1].binding = 0;
+        attributeDescriptions[1].location = 1;
+        attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
+        attributeDescriptions[1].offset = offsetof(Vertex, color);
+
+        return attributeDescriptions;
+    }
+
+    VkVertexInputBindingDescription InstanceData::BindingDescription() {
+        VkVertexInputBindingDescription bindingDescription{};
+        bindingDescription.binding = 1;
+        bindingDescription.stride = sizeof(InstanceData);
+        bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+
+        return bindingDescription;
+    }
+
+    std::array<VkVertexInputAttributeDescription, 5> InstanceData::AttributeDescriptions() {
+        std::array<VkVertexInputAttributeDescription, 5> attributeDescriptions{};
+
+        // After the locations of Vertex
+        attributeDescriptions[0].binding = 1;
+        attributeDescriptions[0].location = 2;
+        attributeDescriptions[0].format = VK_FORMAT_R32G32_SFLOAT;
+        attributeDescriptions[0].offset = offsetof(InstanceData, offset);
+
+        attributeDescriptions[1].binding = 1;
+        attributeDescriptions[1].location = 3;
+        attributeDescriptions[1].format = VK_FORMAT_R32G32_SFLOAT;
+        attributeDescriptions[1].offset = offsetof(InstanceData, scale);
+
+        attributeDescriptions[2].binding = 1;
+        attributeDescriptions[2].location = 4;
+        attributeDescriptions[2].format = VK_FORMAT_R8G8B8A8_UNORM;
+        attributeDescriptions[2].offset = offsetof(InstanceData, color);
+
+        attributeDescriptions[3].binding = 1;
+        attributeDescriptions[3].location = 5;
+        attributeDescriptions[3].format = VK_FORMAT_R32_UINT;
+        attributeDescriptions[3].offset = offsetof(InstanceData, texture);
+
+        attributeDescriptions[4].binding = 1;
+        attributeDescriptions[4].location = 6;
+        attributeDescriptions[4].format = VK_FORMAT_R32_UINT;
+        attributeDescriptions[4].offset = offsetof(InstanceData, sampler);
+
+        return attributeDescriptions;
+    }
+
+    void Mesh::create(MemoryAllocator& allocator, UploadQueue& uploadQueue, const std::vector<Vertex>& vertices,
+                      const std::vector<uint32_t>& indices) {
+        VkDeviceSize vertexBytes = sizeof(Vertex) * vertices.size();
+        VkDeviceSize indexBytes = sizeof(uint32_t) * indices.size();
+
+        // Movable since bind() reads the handles anew every time
+        vertexBuffer = allocator.createBuffer(vertexBytes,
+                                              VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                              { VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT }, true);
+        indexBuffer = allocator.createBuffer(indexBytes,
+                                             VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                             { VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT }, true);
+        indexCount = static_cast<uint32_t>(indices.size());
+
+        radius = 0.0f;
+        for (const auto& vertex : vertices) {
+            radius = std::max(radius, std::sqrt(vertex.position.x * vertex.position.x +
+                                                vertex.position.y * vertex.position.y));
+        }
+
+        uploadQueue.enqueue(vertexBuffer, 0, vertices.data(), vertexBytes);
+        uploadQueue.enqueue(indexBuffer, 0, indices.data(), indexBytes);
+    }
+
+    void Mesh::destroy(MemoryAllocator& allocator) {
+        allocator.destroyBuffer(vertexBuffer);
+        allocator.destroyBuffer(indexBuffer);
+        vertexBuffer = nullptr;
+        indexBuffer = nullptr;
+    }
+
+    void Mesh::bind(VkCommandBuffer commandBuffer) const {
+        VkBuffer vertexBuffers[] = { vertexBuffer->buffer };
+        VkDeviceSize offsets[] = { 0 };
+
+        vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+        vkCmdBindIndexBuffer(commandBuffer, indexBuffer->buffer, 0, VK_INDEX_TYPE_UINT32);
+    }
+
+    void Mesh::draw(VkCommandBuffer commandBuffer, uint32_t instanceCount, uint32_t firstInstance) const {
+        vkCmdDrawIndexed(commandBuffer, indexCount, instanceCount, 0, 0, firstInstance);
+    }
+} // m4x
@@ -0,0 +1,104 @@
+/** @file */
+
+//
+// Created by m4tex on 17/10/26.
+//
+
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+
+#include "MemoryAllocator.h"
+#include "UploadQueue.h"
+
+// std
+#include <array>
+#include <vector>
+
+namespace m4x {
+    /**
+     * Vertex layout of every mesh, a single interleaved binding
+     */
+    struct Vertex {
+        glm::vec2 position;
+        glm::vec3 color;
+
+        static VkVertexInputBindingDescription BindingDescription();
+        static std::array<VkVertexInputAttributeDescription, 2> AttributeDescriptions();
+    };
+
+    /**
+     * Placement and material of a single copy of a mesh, pushed to the vertex shader or read from the object buffer
+     */
+    struct DrawObject {
+        glm::vec2 offset;
+        glm::vec2 scale;
+        // Descriptor heap indices of the material
+        uint32_t  texture;
+        uint32_t  sampler;
+    };
+
+    /**
+     * Per instance vertex input of instanced draws, the second binding next to the mesh's Vertex binding
+     */
+    struct InstanceData {
+        glm::vec2 offset;
+        glm::vec2 scale;
+        // RGBA8, multiplies the vertex colors
+        uint32_t  color;
+        // Descriptor heap indices of the material
+        uint32_t  texture;
+        uint32_t  sampler;
+
+        static VkVertexInputBindingDescription BindingDescription();
+        static std::array<VkVertexInputAttributeDescription, 5> AttributeDescriptions();
+    };
+
+    /**
+     * Indexed mesh with its vertex and index buffers in device local memory, which defragmentation may move
+     */
+    class Mesh {
+    public:
+        /**
+         * Creates the buffers and schedules their contents on the upload queue,
+         * the mesh can be drawn by any frame recorded after the next UploadQueue::flush()
+         * @param allocator [in] Allocator the buffers are created from
+         * @param uploadQueue [in] Queue the contents are uploaded through
+         * @param vertices [in] Vertices of the mesh
+         * @param indices [in] Triangle list indices into vertices
+         */
+        void create(MemoryAllocator& allocator, UploadQueue& uploadQueue, const std::vector<Vertex>& vertices,
+                    const std::vector<uint32_t>& indices);
+
+        void destroy(MemoryAllocator& allocator);
+
+        /**
+         * Binds the vertex and index buffers
+         * @param commandBuffer [in] Command buffer to record into
+         */
+        void bind(VkCommandBuffer commandBuffer) const;
+
+        /**
+         * Records an indexed draw of the whole mesh, the mesh has to be bound
+         * @param commandBuffer [in] Command buffer inside a render pass with a compatible pipeline bound
+         * @param instanceCount [in] Copies drawn, each reading the next element of the per instance binding
+         * @param firstInstance [in] Element of the per instance binding the first copy reads
+         */
+        void draw(VkCommandBuffer commandBuffer, uint32_t instanceCount = 1, uint32_t firstInstance = 0) const;
+
+        [[nodiscard]] uint32_t indices() const { return indexCount; }
+
+        /**
+         * Distance of the farthest vertex from the origin, before any DrawObject scale
+         */
+        [[nodiscard]] float boundingRadius() const { return radius; }
+
+    private:
+        Buffer*  vertexBuffer = nullptr;
+        Buffer*  indexBuffer  = nullptr;
+        uint32_t indexCount   = 0;
+        float    radius       = 0.0f;
+    };
+} // m4x
@@ -0,0 +1,90 @@
+//
+// Created by m4tex on 17/10/26.
+//
+
+#include "OffscreenTarget.h"
+#include "VkUtils.h"
+
+namespace m4x {
+    void OffscreenTarget::create(VkPhysicalDevice physicalDevice, VkDevice device, MemoryAllocator& allocator,
+                                 VkExtent2D extent, VkFormat format, uint32_t imageCount) {
+        imageExtent = extent;
+
+        images.resize(imageCount);
+        imageMemory.resize(imageCount);
+        imageViews.resize(imageCount);
+
+        for (uint32_t i = 0; i < imageCount; ++i) {
+            images[i] = VkUtils::CreateImage(device, extent, format,
+                                             VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+                                             VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+            imageMemory[i] = allocator.bindImage(images[i], VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+            imageViews[i] = VkUtils::CreateImageView(device, images[i], format);
+        }
+
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+        VkDeviceSize atom = properties.limits.nonCoherentAtomSize;
+        frameBytes = static_cast<VkDeviceSize>(extent.width) * extent.height * 4;
+        slotStride = (frameBytes + atom - 1) / atom * atom;
+
+        // Cached memory makes the CPU reads fast, coherent is the fallback every implementation has
+        readbackBuffer = allocator.createBuffer(
+                slotStride * imageCount, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                { VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT,
+                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT });
+
+        const auto& memoryProperties = allocator.memoryProperties();
+        coherent = memoryProperties.memoryTypes[readbackBuffer->allocation.memoryType].propertyFlags &
+                   VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+        mapped = static_cast<uint8_t*>(readbackBuffer->allocation.mapped);
+    }
+
+    void OffscreenTarget::destroy(VkDevice device, MemoryAllocator& allocator) {
+        allocator.destroyBuffer(readbackBuffer);
+        readbackBuffer = nullptr;
+
+        for (size_t i = 0; i < images.size(); ++i) {
+            vkDestroyImageView(device, imageViews[i], nullptr);
+            vkDestroyImage(device, images[i], nullptr);
+            allocator.free(imageMemory[i]);
+        }
+
+        images.clear();
+        imageMemory.clear();
+        imageViews.clear();
+        mapped = nullptr;
+    }
+
+    void OffscreenTarget::recordReadback(VkCommandBuffer commandBuffer, uint32_t index) const {
+        VkBufferImageCopy region{};
+        region.bufferOffset = slotStride * index;
+        region.bufferRowLength = 0;
+        region.bufferImageHeight = 0;
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = 0;
+        region.imageSubresource.baseArrayLayer = 0;
+        region.imageSubresource.layerCount = 1;
+        region.imageOffset = {0, 0, 0};
+        region.imageExtent = { imageExtent.width, imageExtent.height, 1 };
+
+        vkCmdCopyImageToBuffer(commandBuffer, images[index], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                               readbackBuffer->buffer, 1, &region);
+    }
+
+    const uint8_t* OffscreenTarget::mappedFrame(VkDevice device, uint32_t index) const {
+        if (!coherent) {
+            // The buffer lives inside a larger block, so the range is relative to the block's memory
+            VkMappedMemoryRange range{};
+            range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+            range.memory = readbackBuffer->allocation.memory;
+            range.offset = readbackBuffer->allocation.offset + slotStride * index;
+            range.size = slotStride;
+
+            vkInvalidateMappedMemoryRanges(device, 1, &range);
+        }
+
+        return mapped + slotStride * index;
+    }
+} // m4x
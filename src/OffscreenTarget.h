@@ -0,0 +1,81 @@
+/** @file */
+
+//
+// Created by m4tex on 17/10/26.
+//
+
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include "MemoryAllocator.h"
+
+// std
+#include <vector>
+
+namespace m4x {
+    /**
+     * Stand-in for the swapchain when rendering headless.
+     * Holds one device local color image per frame in flight and a single persistently mapped
+     * staging buffer split into as many slots, so every frame in flight reads back into its own slot.
+     */
+    class OffscreenTarget {
+    public:
+        /**
+         * Creates the images, their views and the readback pool
+         * @param physicalDevice [in] Device to read the limits from
+         * @param device [in] Logical device
+         * @param allocator [in] Allocator the images and the readback buffer get their memory from
+         * @param extent [in] Size of every image
+         * @param format [in] Color format of every image, must be 4 bytes per pixel
+         * @param imageCount [in] Amount of images, usually the frames in flight
+         */
+        void create(VkPhysicalDevice physicalDevice, VkDevice device, MemoryAllocator& allocator, VkExtent2D extent,
+                    VkFormat format, uint32_t imageCount);
+
+        /**
+         * Destroys everything created by create()
+         * @param device [in] Logical device
+         * @param allocator [in] Allocator passed to create()
+         */
+        void destroy(VkDevice device, MemoryAllocator& allocator);
+
+        /**
+         * Records a copy of the image into its readback slot, the image has to be in TRANSFER_SRC_OPTIMAL.
+         * The copy still has to be made visible to the host, with a barrier on readback().
+         * @param commandBuffer [in] Command buffer to record into
+         * @param index [in] Image to copy
+         */
+        void recordReadback(VkCommandBuffer commandBuffer, uint32_t index) const;
+
+        /**
+         * Gets the pixels of a finished readback, the submission that recorded it must have completed
+         * @param device [in] Logical device
+         * @param index [in] Image the readback was recorded for
+         * @return Tightly packed rows of the image, valid until the slot is recorded into again
+         */
+        const uint8_t* mappedFrame(VkDevice device, uint32_t index) const;
+
+        [[nodiscard]] VkImage image(uint32_t index) const { return images[index]; }
+        [[nodiscard]] const std::vector<VkImageView>& views() const { return imageViews; }
+        [[nodiscard]] VkBuffer readback() const { return readbackBuffer->buffer; }
+        [[nodiscard]] VkDeviceSize frameSize() const { return frameBytes; }
+        [[nodiscard]] VkExtent2D extent() const { return imageExtent; }
+
+    private:
+        VkExtent2D imageExtent{};
+
+        std::vector<VkImage>     images;
+        std::vector<Allocation>  imageMemory;
+        std::vector<VkImageView> imageViews;
+
+        Buffer*  readbackBuffer = nullptr;
+        uint8_t* mapped         = nullptr;
+        bool     coherent       = false;
+
+        VkDeviceSize frameBytes = 0;
+        // Slots are aligned to nonCoherentAtomSize so each one can be invalidated on its own
+        VkDeviceSize slotStride = 0;
+    };
+} // m4x
@@ -0,0 +1,213 @@
+//
+// Created by m4tex on 17/10/26.
+//
+
+#include "PipelineCache.h"
+
+//std
+#include <stdexcept>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+namespace m4x {
+    namespace {
+        const uint32_t BLOB_MAGIC   = 0x4D345043; // "M4PC"
+        const uint32_t BLOB_VERSION = 1;
+
+        /**
+         * Prefix of the file on disk, the Vulkan cache data follows right after it
+         */
+        struct BlobHeader {
+            uint32_t magic;
+            uint32_t version;
+            uint32_t vendorID;
+            uint32_t deviceID;
+            uint32_t driverVersion;
+            uint8_t  pipelineCacheUUID[VK_UUID_SIZE];
+            uint64_t dataSize;
+            uint64_t checksum;
+        };
+
+        uint64_t fnv1a(const char* data, size_t size) {
+            uint64_t hash = 0xcbf29ce484222325ull;
+            for (size_t i = 0; i < size; ++i) {
+                hash ^= static_cast<uint8_t>(data[i]);
+                hash *= 0x100000001b3ull;
+            }
+            return hash;
+        }
+    }
+
+    void PipelineCache::create(VkPhysicalDevice physicalDevice, VkDevice device, const std::filesystem::path& directory) {
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+        path = directory / ("pipeline_cache_" + std::to_string(properties.vendorID) + "_" +
+                            std::to_string(properties.deviceID) + ".bin");
+
+        std::vector<char> data = load();
+        loaded = !data.empty();
+
+        VkPipelineCacheCreateInfo createInfo{};
+        createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+        createInfo.initialDataSize = data.size();
+        createInfo.pInitialData = data.empty() ? nullptr : data.data();
+
+        VkResult result = vkCreatePipelineCache(device, &createInfo, nullptr, &cache);
+
+        // Drivers may still refuse data that passed our checks, an empty cache is always fine
+        if (VK_SUCCESS != result && loaded) {
+            loaded = false;
+            createInfo.initialDataSize = 0;
+            createInfo.pInitialData = nullptr;
+            result = vkCreatePipelineCache(device, &createInfo, nullptr, &cache);
+        }
+
+        if (VK_SUCCESS != result) {
+            throw std::runtime_error("Failed to create a pipeline cache");
+        }
+    }
+
+    void PipelineCache::destroy(VkDevice device) {
+        vkDestroyPipelineCache(device, cache, nullptr);
+        cache = VK_NULL_HANDLE;
+    }
+
+    std::vector<char> PipelineCache::load() const {
+        std::ifstream file(path, std::ios::ate | std::ios::binary);
+
+        if (!file.is_open()) {
+            return {};
+        }
+
+        auto fileSize = static_cast<size_t>(file.tellg());
+        if (fileSize < sizeof(BlobHeader) + sizeof(VkPipelineCacheHeaderVersionOne)) {
+            return {};
+        }
+
+        BlobHeader header{};
+        file.seekg(0);
+        file.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+        if (header.magic != BLOB_MAGIC || header.version != BLOB_VERSION ||
+            header.vendorID != properties.vendorID || header.deviceID != properties.deviceID ||
+            header.driverVersion != properties.driverVersion ||
+            std::memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0 ||
+            header.dataSize != fileSize - sizeof(BlobHeader)) {
+            std::cerr << "Pipeline cache " << path << " is stale, starting cold" << std::endl;
+            return {};
+        }
+
+        std::vector<char> data(header.dataSize);
+        file.read(data.data(), static_cast<std::streamsize>(data.size()));
+
+        if (!file || fnv1a(data.data(), data.size()) != header.checksum) {
+            std::cerr << "Pipeline cache " << path << " is corrupt, starting cold" << std::endl;
+            return {};
+        }
+
+        // The driver's own header has to agree as well
+        VkPipelineCacheHeaderVersionOne vkHeader{};
+        std::memcpy(&vkHeader, data.data(), sizeof(vkHeader));
+
+        if (vkHeader.headerSize < sizeof(vkHeader) ||
+            vkHeader.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE ||
+            vkHeader.vendorID != properties.vendorID || vkHeader.deviceID != properties.deviceID ||
+            std::memcmp(vkHeader.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+            std::cerr << "Pipeline cache " << path << " doesn't match the device, starting cold" << std::endl;
+            return {};
+        }
+
+        return data;
+    }
+
+    void PipelineCache::save(VkDevice device) {
+        std::vector<char> data = contents(device);
+        if (data.empty()) {
+            return;
+        }
+
+        BlobHeader header{};
+        header.magic = BLOB_MAGIC;
+        header.version = BLOB_VERSION;
+        header.vendorID = properties.vendorID;
+        header.deviceID = properties.deviceID;
+        header.driverVersion = properties.driverVersion;
+        std::memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+        header.dataSize = data.size();
+        header.checksum = fnv1a(data.data(), data.size());
+
+        std::filesystem::create_directories(path.parent_path());
+
+        std::filesystem::path temporary = path;
+        temporary += ".tmp";
+
+        {
+            std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+            if (!file.is_open()) {
+                std::cerr << "Failed to write pipeline cache " << temporary << std::endl;
+                return;
+            }
+
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            file.write(data.data(), static_cast<std::streamsize>(data.size()));
+
+            if (!file.flush()) {
+                std::cerr << "Failed to write pipeline cache " << temporary << std::endl;
+                return;
+            }
+        }
+
+        std::error_code error;
+        std::filesystem::rename(temporary, path, error);
+
+        if (error) {
+            std::cerr << "Failed to replace pipeline cache " << path << ": " << error.message() << std::endl;
+            std::filesystem::remove(temporary, error);
+        }
+    }
+
+    VkPipelineCache PipelineCache::createWorkerCache(VkDevice device) const {
+        // Seeded with everything compiled so far, so a warm cache also warms the workers
+        std::vector<char> data = contents(device);
+
+        VkPipelineCacheCreateInfo createInfo{};
+        createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+        createInfo.initialDataSize = data.size();
+        createInfo.pInitialData = data.data();
+
+        VkPipelineCache workerCache;
+        if (VK_SUCCESS != vkCreatePipelineCache(device, &createInfo, nullptr, &workerCache)) {
+            throw std::runtime_error("Failed to create a worker pipeline cache");
+        }
+
+        return workerCache;
+    }
+
+    std::vector<char> PipelineCache::contents(VkDevice device) const {
+        size_t size = 0;
+        if (VK_SUCCESS != vkGetPipelineCacheData(device, cache, &size, nullptr) || size == 0) {
+            return {};
+        }
+
+        std::vector<char> data(size);
+        if (VK_SUCCESS != vkGetPipelineCacheData(device, cache, &size, data.data())) {
+            return {};
+        }
+        data.resize(size);
+        return data;
+    }
+
+    void PipelineCache::merge(VkDevice device, VkPipelineCache workerCache) {
+        {
+            std::lock_guard<std::mutex> lock(mergeMutex);
+
+            if (VK_SUCCESS != vkMergePipelineCaches(device, cache, 1, &workerCache)) {
+                std::cerr << "Failed to merge a worker pipeline cache" << std::endl;
+            }
+        }
+
+        vkDestroyPipelineCache(device, workerCache, nullptr);
+    }
+} // m4x
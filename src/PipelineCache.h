@@ -0,0 +1,87 @@
+/** @file */
+
+//
+// Created by m4tex on 17/10/26.
+//
+
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+// std
+#include <filesystem>
+#include <mutex>
+#include <vector>
+
+namespace m4x {
+    /**
+     * On-disk VkPipelineCache.
+     * The blob is stored per vendor and device, and is prefixed with our own header holding the driver version,
+     * pipeline cache UUID and a checksum. A blob that doesn't match the running device or fails the checksum
+     * is ignored and the cache starts out empty.
+     */
+    class PipelineCache {
+    public:
+        /**
+         * Loads the blob for the device and creates the cache from it
+         * @param physicalDevice [in] Device the blob has to match
+         * @param device [in] Logical device
+         * @param directory [in] Directory the blob is kept in
+         */
+        void create(VkPhysicalDevice physicalDevice, VkDevice device, const std::filesystem::path& directory);
+
+        /**
+         * Destroys the cache without saving it
+         * @param device [in] Logical device
+         */
+        void destroy(VkDevice device);
+
+        /**
+         * Writes the cache to a temporary file and renames it over the blob, so a crash never leaves a torn file
+         * @param device [in] Logical device
+         */
+        void save(VkDevice device);
+
+        /**
+         * Creates a cache for a worker thread to compile into, seeded with the contents of this one.
+         * Hand it back with merge().
+         * @param device [in] Logical device
+         * @return The worker cache
+         */
+        VkPipelineCache createWorkerCache(VkDevice device) const;
+
+        /**
+         * Merges a worker cache into this one and destroys the worker cache.
+         * Merging is serialized, but pipelines must not be created from handle() while a merge runs.
+         * @param device [in] Logical device
+         * @param workerCache [in] Cache created with CreateWorkerCache
+         */
+        void merge(VkDevice device, VkPipelineCache workerCache);
+
+        [[nodiscard]] VkPipelineCache handle() const { return cache; }
+
+        /**
+         * @return If a valid blob was loaded at creation
+         */
+        [[nodiscard]] bool warm() const { return loaded; }
+
+    private:
+        VkPipelineCache cache = VK_NULL_HANDLE;
+        VkPhysicalDeviceProperties properties{};
+        std::filesystem::path path;
+        bool loaded = false;
+        std::mutex mergeMutex;
+
+        /**
+         * Reads and validates the blob on disk
+         * @return Vulkan cache data, empty if the blob is missing, stale or corrupt
+         */
+        std::vector<char> load() const;
+
+        /**
+         * @return Current Vulkan cache data, empty if it can't be read
+         */
+        std::vector<char> contents(VkDevice device) const;
+    };
+} // m4x
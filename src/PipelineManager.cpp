@@ -0,0 +1,698 @@
+//
+// Created by m4tex on 17/10/26.
+//
+
+#include "PipelineManager.h"
+#include "VkUtils.h"
+#include "Mesh.h"
+#include "CpuTracer.h"
+
+//std
+#include <stdexcept>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+
+namespace m4x {
+    namespace {
+        void fnv1a(uint64_t& hash, uint64_t value, size_t bytes) {
+            for (size_t i = 0; i < bytes; ++i) {
+                hash ^= (value >> (i * 8)) & 0xff;
+                hash *= 0x100000001b3ull;
+            }
+        }
+
+        std::string trim(const std::string& text) {
+            size_t first = text.find_first_not_of(" \t\r");
+            if (first == std::string::npos) {
+                return "";
+            }
+            size_t last = text.find_last_not_of(" \t\r");
+            return text.substr(first, last - first + 1);
+        }
+
+        const std::unordered_map<std::string, uint8_t> TOPOLOGIES = {
+                { "point_list",     VK_PRIMITIVE_TOPOLOGY_POINT_LIST },
+                { "line_list",      VK_PRIMITIVE_TOPOLOGY_LINE_LIST },
+                { "line_strip",     VK_PRIMITIVE_TOPOLOGY_LINE_STRIP },
+                { "triangle_list",  VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST },
+                { "triangle_strip", VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP },
+                { "triangle_fan",   VK_PRIMITIVE_TOPOLOGY_TRIANGLE_FAN },
+        };
+
+        const std::unordered_map<std::string, uint8_t> POLYGON_MODES = {
+                { "fill",  VK_POLYGON_MODE_FILL },
+                { "line",  VK_POLYGON_MODE_LINE },
+                { "point", VK_POLYGON_MODE_POINT },
+        };
+
+        const std::unordered_map<std::string, uint8_t> CULL_MODES = {
+                { "none",  VK_CULL_MODE_NONE },
+                { "front", VK_CULL_MODE_FRONT_BIT },
+                { "back",  VK_CULL_MODE_BACK_BIT },
+                { "both",  VK_CULL_MODE_FRONT_AND_BACK },
+        };
+
+        const std::unordered_map<std::string, uint8_t> FRONT_FACES = {
+                { "clockwise",         VK_FRONT_FACE_CLOCKWISE },
+                { "counter_clockwise", VK_FRONT_FACE_COUNTER_CLOCKWISE },
+        };
+
+        const std::unordered_map<std::string, uint8_t> BLEND_MODES = {
+                { "opaque",   static_cast<uint8_t>(BlendMode::Opaque) },
+                { "alpha",    static_cast<uint8_t>(BlendMode::Alpha) },
+                { "additive", static_cast<uint8_t>(BlendMode::Additive) },
+        };
+
+        const std::unordered_map<std::string, uint8_t> VERTEX_INPUTS = {
+                { "none", static_cast<uint8_t>(VertexInput::None) },
+                { "mesh", static_cast<uint8_t>(VertexInput::Mesh) },
+                { "mesh_instanced", static_cast<uint8_t>(VertexInput::MeshInstanced) },
+        };
+
+        /**
+         * Fixed function state of one pipeline, kept together so the create info can point into it
+         */
+        struct PipelineState {
+            std::array<VkPipelineShaderStageCreateInfo, 2> stages{};
+            std::array<VkSpecializationInfo, 2> specialization{};
+            std::array<std::vector<VkSpecializationMapEntry>, 2> specializationEntries;
+            std::array<std::vector<uint32_t>, 2> specializationData;
+            std::array<VkVertexInputBindingDescription, 2> bindings{};
+            std::vector<VkVertexInputAttributeDescription> attributes;
+            VkPipelineVertexInputStateCreateInfo vertexInput{};
+            VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
+            VkPipelineViewportStateCreateInfo viewport{};
+            VkPipelineRasterizationStateCreateInfo rasterizer{};
+            VkPipelineMultisampleStateCreateInfo multisample{};
+            VkPipelineColorBlendAttachmentState blendAttachment{};
+            VkPipelineColorBlendStateCreateInfo colorBlending{};
+            VkPipelineDynamicStateCreateInfo dynamicState{};
+            VkFormat colorFormat = VK_FORMAT_UNDEFINED;
+            VkPipelineRenderingCreateInfo rendering{};
+        };
+
+        // Set when recording, so pipelines survive swapchain recreation
+        const VkDynamicState DYNAMIC_STATES[] = {
+                VK_DYNAMIC_STATE_VIEWPORT,
+                VK_DYNAMIC_STATE_SCISSOR
+        };
+
+        VkGraphicsPipelineCreateInfo fillPipelineInfo(const PipelineKey& key, VkShaderModule vertexShader,
+                                                      VkShaderModule fragmentShader, PipelineState& state) {
+            state.stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+            state.stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+            state.stages[0].module = vertexShader;
+            state.stages[0].pName = "main";
+
+            state.stages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+            state.stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+            state.stages[1].module = fragmentShader;
+            state.stages[1].pName = "main";
+
+            state.vertexInput.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+            if (key.vertexInput != VertexInput::None) {
+                auto vertexAttributes = Vertex::AttributeDescriptions();
+                state.bindings[0] = Vertex::BindingDescription();
+                state.attributes.assign(vertexAttributes.begin(), vertexAttributes.end());
+                state.vertexInput.vertexBindingDescriptionCount = 1;
+            }
+            if (key.vertexInput == VertexInput::MeshInstanced) {
+                auto instanceAttributes = InstanceData::AttributeDescriptions();
+                state.bindings[1] = InstanceData::BindingDescription();
+                state.attributes.insert(state.attributes.end(), instanceAttributes.begin(), instanceAttributes.end());
+                state.vertexInput.vertexBindingDescriptionCount = 2;
+            }
+            state.vertexInput.pVertexBindingDescriptions = state.bindings.data();
+            state.vertexInput.vertexAttributeDescriptionCount = static_cast<uint32_t>(state.attributes.size());
+            state.vertexInput.pVertexAttributeDescriptions = state.attributes.data();
+
+            state.inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+            state.inputAssembly.topology = static_cast<VkPrimitiveTopology>(key.topology);
+            state.inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+            state.viewport.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+            state.viewport.viewportCount = 1;
+            state.viewport.scissorCount = 1;
+
+            state.rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+            state.rasterizer.depthClampEnable = VK_FALSE;
+            state.rasterizer.rasterizerDiscardEnable = VK_FALSE;
+            state.rasterizer.polygonMode = static_cast<VkPolygonMode>(key.polygonMode);
+            state.rasterizer.lineWidth = 1.0f;
+            state.rasterizer.cullMode = key.cullMode;
+            state.rasterizer.frontFace = static_cast<VkFrontFace>(key.frontFace);
+            state.rasterizer.depthBiasEnable = VK_FALSE;
+
+            state.multisample.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+            state.multisample.sampleShadingEnable = VK_FALSE;
+            state.multisample.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+            state.blendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+                                                   VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+            state.blendAttachment.blendEnable = key.blend == BlendMode::Opaque ? VK_FALSE : VK_TRUE;
+            state.blendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
+            state.blendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
+            if (key.blend == BlendMode::Alpha) {
+                state.blendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+                state.blendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+                state.blendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+                state.blendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+            } else if (key.blend == BlendMode::Additive) {
+                state.blendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+                state.blendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
+                state.blendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+                state.blendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+            }
+
+            state.colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+            state.colorBlending.logicOpEnable = VK_FALSE;
+            state.colorBlending.attachmentCount = 1;
+            state.colorBlending.pAttachments = &state.blendAttachment;
+
+            state.dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+            state.dynamicState.dynamicStateCount = 2;
+            state.dynamicState.pDynamicStates = DYNAMIC_STATES;
+
+            VkGraphicsPipelineCreateInfo pipelineInfo{};
+            pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+            pipelineInfo.stageCount = static_cast<uint32_t>(state.stages.size());
+            pipelineInfo.pStages = state.stages.data();
+            pipelineInfo.pVertexInputState = &state.vertexInput;
+            pipelineInfo.pInputAssemblyState = &state.inputAssembly;
+            pipelineInfo.pViewportState = &state.viewport;
+            pipelineInfo.pRasterizationState = &state.rasterizer;
+            pipelineInfo.pMultisampleState = &state.multisample;
+            pipelineInfo.pDepthStencilState = nullptr;
+            pipelineInfo.pColorBlendState = &state.colorBlending;
+            pipelineInfo.pDynamicState = &state.dynamicState;
+            pipelineInfo.layout = key.layout;
+            pipelineInfo.renderPass = key.renderPass;
+            pipelineInfo.subpass = key.subpass;
+
+            // Dynamic rendering only needs the attachment formats
+            if (key.renderPass == VK_NULL_HANDLE) {
+                state.colorFormat = key.colorFormat;
+
+                state.rendering.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO;
+                state.rendering.colorAttachmentCount = 1;
+                state.rendering.pColorAttachmentFormats = &state.colorFormat;
+                state.rendering.depthAttachmentFormat = VK_FORMAT_UNDEFINED;
+                state.rendering.stencilAttachmentFormat = VK_FORMAT_UNDEFINED;
+
+                pipelineInfo.pNext = &state.rendering;
+            }
+
+            return pipelineInfo;
+        }
+
+        /**
+         * Points the stages at the values of the constants each one declares, every constant has to be declared by
+         * at least one of them
+         */
+        void specialize(const std::vector<std::pair<std::string, uint32_t>>& constants,
+                        const std::array<const ShaderReflection*, 2>& reflections, PipelineState& state) {
+            for (const auto& [name, bits] : constants) {
+                bool numeric = name.find_first_not_of("0123456789") == std::string::npos;
+                bool declared = false;
+
+                for (size_t stage = 0; stage < reflections.size(); ++stage) {
+                    for (const auto& constant : reflections[stage]->specConstants) {
+                        if (numeric ? std::to_string(constant.id) != name : constant.name != name) {
+                            continue;
+                        }
+
+                        // Every constant is 4 bytes, booleans included
+                        auto& data = state.specializationData[stage];
+                        state.specializationEntries[stage].push_back(
+                                { constant.id, static_cast<uint32_t>(data.size() * sizeof(uint32_t)),
+                                  sizeof(uint32_t) });
+                        data.push_back(bits);
+                        declared = true;
+                    }
+                }
+
+                if (!declared) {
+                    throw std::runtime_error("No shader of the pipeline declares the specialization constant " + name);
+                }
+            }
+
+            for (size_t stage = 0; stage < reflections.size(); ++stage) {
+                if (state.specializationEntries[stage].empty()) {
+                    continue;
+                }
+
+                VkSpecializationInfo& info = state.specialization[stage];
+                info.mapEntryCount = static_cast<uint32_t>(state.specializationEntries[stage].size());
+                info.pMapEntries = state.specializationEntries[stage].data();
+                info.dataSize = state.specializationData[stage].size() * sizeof(uint32_t);
+                info.pData = state.specializationData[stage].data();
+                state.stages[stage].pSpecializationInfo = &info;
+            }
+        }
+    }
+
+    bool PipelineKey::operator==(const PipelineKey& other) const {
+        return renderPass == other.renderPass && colorFormat == other.colorFormat && layout == other.layout &&
+               vertexShader == other.vertexShader && fragmentShader == other.fragmentShader &&
+               specialization == other.specialization && subpass == other.subpass &&
+               vertexInput == other.vertexInput && topology == other.topology && polygonMode == other.polygonMode &&
+               cullMode == other.cullMode && frontFace == other.frontFace && blend == other.blend;
+    }
+
+    size_t PipelineKey::Hash::operator()(const PipelineKey& key) const {
+        // Field by field, the padding of the struct is undefined
+        uint64_t hash = 0xcbf29ce484222325ull;
+        fnv1a(hash, reinterpret_cast<uint64_t>(key.renderPass), sizeof(uint64_t));
+        fnv1a(hash, static_cast<uint64_t>(key.colorFormat), sizeof(uint32_t));
+        fnv1a(hash, reinterpret_cast<uint64_t>(key.layout), sizeof(uint64_t));
+        fnv1a(hash, key.vertexShader, sizeof(key.vertexShader));
+        fnv1a(hash, key.fragmentShader, sizeof(key.fragmentShader));
+        fnv1a(hash, key.specialization, sizeof(key.specialization));
+        fnv1a(hash, key.subpass, 1);
+        fnv1a(hash, static_cast<uint8_t>(key.vertexInput), 1);
+        fnv1a(hash, key.topology, 1);
+        fnv1a(hash, key.polygonMode, 1);
+        fnv1a(hash, key.cullMode, 1);
+        fnv1a(hash, key.frontFace, 1);
+        fnv1a(hash, static_cast<uint8_t>(key.blend), 1);
+        return static_cast<size_t>(hash);
+    }
+
+    void PipelineManager::create(VkDevice device, PipelineCache& pipelineCache, ShaderLibrary& shaderLibrary,
+                                 uint32_t threadCount) {
+        this->device = device;
+        this->cache = &pipelineCache;
+        this->shaderLibrary = &shaderLibrary;
+        stopping = false;
+
+        for (uint32_t i = 0; i < std::max(threadCount, 1u); ++i) {
+            threadCaches.push_back(pipelineCache.createWorkerCache(device));
+        }
+        for (uint32_t i = 0; i < threadCaches.size(); ++i) {
+            threads.emplace_back(&PipelineManager::compileThread, this, i);
+        }
+    }
+
+    void PipelineManager::destroy() {
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            stopping = true;
+            queue.clear();
+        }
+        queueChanged.notify_all();
+
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        threads.clear();
+
+        for (auto threadCache : threadCaches) {
+            cache->merge(device, threadCache);
+        }
+        threadCaches.clear();
+
+        for (auto& [key, entry] : pipelines) {
+            vkDestroyPipeline(device, entry->pipeline, nullptr);
+        }
+        pipelines.clear();
+
+        shaders.clear();
+        shaderIds.clear();
+        specializations.clear();
+        specializationIds.clear();
+        descriptions.clear();
+        fallbacks.clear();
+    }
+
+    void PipelineManager::loadDescriptions(const std::filesystem::path& path) {
+        std::ifstream file(path);
+        if (!file) {
+            throw std::runtime_error("Failed to open the pipeline descriptions " + path.string());
+        }
+
+        PipelineKey* description = nullptr;
+        std::string section;
+        std::string line;
+
+        for (uint32_t lineNumber = 1; std::getline(file, line); ++lineNumber) {
+            auto fail = [&](const std::string& message) {
+                throw std::runtime_error(path.string() + ":" + std::to_string(lineNumber) + ": " + message);
+            };
+
+            line = trim(line.substr(0, line.find('#')));
+            if (line.empty()) {
+                continue;
+            }
+
+            if (line.front() == '[') {
+                if (line.back() != ']' || line.size() < 3) {
+                    fail("Malformed section header");
+                }
+                section = trim(line.substr(1, line.size() - 2));
+                description = &descriptions[section];
+                *description = PipelineKey{};
+                fallbacks.erase(section);
+                continue;
+            }
+
+            size_t equals = line.find('=');
+            if (equals == std::string::npos) {
+                fail("Expected field = value");
+            }
+            if (!description) {
+                fail("Field outside of a [pipeline] section");
+            }
+
+            std::string field = trim(line.substr(0, equals));
+            std::string value = trim(line.substr(equals + 1));
+
+            auto lookup = [&](const std::unordered_map<std::string, uint8_t>& table) {
+                auto it = table.find(value);
+                if (it == table.end()) {
+                    fail("Unknown " + field + " '" + value + "'");
+                }
+                return it->second;
+            };
+
+            if (field == "vertex") {
+                description->vertexShader = shader(value);
+            } else if (field == "fragment") {
+                description->fragmentShader = shader(value);
+            } else if (field == "specialize") {
+                try {
+                    description->specialization = specialization(value);
+                } catch (const std::runtime_error& error) {
+                    fail(error.what());
+                }
+            } else if (field == "vertex_input") {
+                description->vertexInput = static_cast<VertexInput>(lookup(VERTEX_INPUTS));
+            } else if (field == "topology") {
+                description->topology = lookup(TOPOLOGIES);
+            } else if (field == "polygon") {
+                description->polygonMode = lookup(POLYGON_MODES);
+            } else if (field == "cull") {
+                description->cullMode = lookup(CULL_MODES);
+            } else if (field == "front_face") {
+                description->frontFace = lookup(FRONT_FACES);
+            } else if (field == "blend") {
+                description->blend = static_cast<BlendMode>(lookup(BLEND_MODES));
+            } else if (field == "fallback") {
+                fallbacks[section] = value;
+            } else {
+                fail("Unknown field '" + field + "'");
+            }
+        }
+
+        for (const auto& [name, key] : descriptions) {
+            if (key.vertexShader == 0 || key.fragmentShader == 0) {
+                throw std::runtime_error(path.string() + ": Pipeline '" + name + "' needs a vertex and fragment shader");
+            }
+        }
+
+        for (const auto& [name, fallback] : fallbacks) {
+            if (descriptions.find(fallback) == descriptions.end()) {
+                throw std::runtime_error(path.string() + ": Fallback '" + fallback + "' of '" + name +
+                                         "' isn't described");
+            }
+        }
+    }
+
+    uint16_t PipelineManager::shader(const std::string& name) {
+        auto it = shaderIds.find(name);
+        if (it != shaderIds.end()) {
+            return it->second;
+        }
+
+        if (shaders.size() >= std::numeric_limits<uint16_t>::max()) {
+            throw std::runtime_error("Too many shaders");
+        }
+
+        shaders.emplace_back().name = name;
+        auto id = static_cast<uint16_t>(shaders.size());
+        shaderIds.emplace(name, id);
+        return id;
+    }
+
+    std::vector<std::string> PipelineManager::shaderNames(const std::string& name) const {
+        auto it = descriptions.find(name);
+        if (it == descriptions.end()) {
+            throw std::runtime_error("No pipeline description named " + name);
+        }
+
+        return { shaders[it->second.vertexShader - 1].name, shaders[it->second.fragmentShader - 1].name };
+    }
+
+    uint16_t PipelineManager::specialization(const std::string& text) {
+        Specialization constants;
+
+        std::istringstream stream(text);
+        std::string assignment;
+        while (std::getline(stream, assignment, ',')) {
+            size_t equals = assignment.find('=');
+            std::string name = trim(assignment.substr(0, equals));
+            std::string value = equals == std::string::npos ? "" : trim(assignment.substr(equals + 1));
+            if (name.empty() || value.empty()) {
+                throw std::runtime_error("Expected specialization constant = value in '" + text + "'");
+            }
+
+            uint32_t bits;
+            if (value == "true" || value == "false") {
+                bits = value == "true" ? 1 : 0;
+            } else {
+                size_t parsed = 0;
+                long long number = 0;
+                try {
+                    number = std::stoll(value, &parsed, 0);
+                } catch (const std::exception&) {
+                    parsed = 0;
+                }
+                if (parsed != value.size()) {
+                    throw std::runtime_error("Specialization constant " + name + " isn't true, false or an integer");
+                }
+                bits = static_cast<uint32_t>(number);
+            }
+            constants.emplace_back(name, bits);
+        }
+
+        // Sorted, so the order they are written in doesn't make them different variants
+        std::sort(constants.begin(), constants.end());
+        std::string canonical;
+        for (const auto& [name, bits] : constants) {
+            canonical += name + "=" + std::to_string(bits) + ",";
+        }
+
+        auto it = specializationIds.find(canonical);
+        if (it != specializationIds.end()) {
+            return it->second;
+        }
+
+        if (specializations.size() >= std::numeric_limits<uint16_t>::max()) {
+            throw std::runtime_error("Too many specializations");
+        }
+
+        specializations.push_back(std::move(constants));
+        auto id = static_cast<uint16_t>(specializations.size());
+        specializationIds.emplace(canonical, id);
+        return id;
+    }
+
+    PipelineKey PipelineManager::key(const std::string& name, VkRenderPass renderPass, VkFormat colorFormat,
+                                     VkPipelineLayout layout) const {
+        auto it = descriptions.find(name);
+        if (it == descriptions.end()) {
+            throw std::runtime_error("No pipeline description named " + name);
+        }
+
+        PipelineKey key = it->second;
+        key.renderPass = renderPass;
+        // Render pass compatibility already covers the formats
+        key.colorFormat = renderPass == VK_NULL_HANDLE ? colorFormat : VK_FORMAT_UNDEFINED;
+        key.layout = layout;
+        return key;
+    }
+
+    PipelineKey PipelineManager::specialized(PipelineKey key, const std::string& constants) {
+        key.specialization = specialization(constants);
+        return key;
+    }
+
+    std::optional<std::string> PipelineManager::fallback(const std::string& name) const {
+        auto it = fallbacks.find(name);
+        if (it == fallbacks.end()) {
+            return std::nullopt;
+        }
+        return it->second;
+    }
+
+    PipelineManager::Entry& PipelineManager::entry(const PipelineKey& key) {
+        auto it = pipelines.find(key);
+        if (it != pipelines.end()) {
+            return *it->second;
+        }
+
+        if (key.specialization > specializations.size()) {
+            throw std::runtime_error("Pipeline key with an invalid specialization id");
+        }
+
+        CompileJob job{ key, nullptr, &shaderById(key.vertexShader), &shaderById(key.fragmentShader),
+                        key.specialization == 0 ? nullptr : &specializations[key.specialization - 1] };
+        job.entry = pipelines.emplace(key, std::make_unique<Entry>()).first->second.get();
+        misses++;
+
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            queue.push_back(job);
+        }
+        queueChanged.notify_one();
+
+        maxQueueDepth = std::max(maxQueueDepth, ++queueDepth);
+        return *job.entry;
+    }
+
+    VkPipeline PipelineManager::request(const PipelineKey& key) {
+        Entry& found = entry(key);
+
+        if (found.state.load(std::memory_order_acquire) != EntryState::Ready) {
+            notReady++;
+            return VK_NULL_HANDLE;
+        }
+
+        hits++;
+        return found.pipeline;
+    }
+
+    VkPipeline PipelineManager::get(const PipelineKey& key) {
+        Entry& found = entry(key);
+
+        if (found.state.load(std::memory_order_acquire) == EntryState::Queued) {
+            auto stallStart = std::chrono::steady_clock::now();
+
+            std::unique_lock<std::mutex> lock(finishedMutex);
+            finished.wait(lock, [&] { return found.state.load(std::memory_order_acquire) != EntryState::Queued; });
+
+            maxStallMs = std::max(maxStallMs, std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - stallStart).count());
+        } else {
+            hits++;
+        }
+
+        if (found.state.load(std::memory_order_acquire) == EntryState::Failed) {
+            throw std::runtime_error(found.error);
+        }
+        return found.pipeline;
+    }
+
+    void PipelineManager::compileAsync(const std::vector<PipelineKey>& keys) {
+        for (const auto& key : keys) {
+            entry(key);
+        }
+    }
+
+    void PipelineManager::compileThread(uint32_t index) {
+        M4X_TRACE_THREAD("pipeline compiler");
+
+        while (true) {
+            CompileJob job{};
+            {
+                std::unique_lock<std::mutex> lock(queueMutex);
+                queueChanged.wait(lock, [&] { return stopping || !queue.empty(); });
+
+                if (stopping) {
+                    return;
+                }
+
+                job = queue.front();
+                queue.pop_front();
+            }
+
+            compile(job, threadCaches[index]);
+            queueDepth--;
+
+            // Taking the lock orders the notification after a waiter's check of the state
+            {
+                std::lock_guard<std::mutex> lock(finishedMutex);
+            }
+            finished.notify_all();
+        }
+    }
+
+    void PipelineManager::compile(const CompileJob& job, VkPipelineCache threadCache) {
+        M4X_TRACE_SCOPE("compile pipeline");
+        auto compileStart = std::chrono::steady_clock::now();
+
+        try {
+            for (Shader* shader : { job.vertexShader, job.fragmentShader }) {
+                std::call_once(shader->created, [&] {
+                    shader->module = shaderLibrary->load(shader->name);
+                });
+            }
+
+            PipelineState state{};
+            VkGraphicsPipelineCreateInfo pipelineInfo = fillPipelineInfo(job.key, job.vertexShader->module,
+                                                                         job.fragmentShader->module, state);
+
+            if (job.specialization) {
+                specialize(*job.specialization, { &shaderLibrary->reflection(job.vertexShader->name),
+                                                  &shaderLibrary->reflection(job.fragmentShader->name) }, state);
+            }
+
+            if (VK_SUCCESS != vkCreateGraphicsPipelines(device, threadCache, 1, &pipelineInfo, nullptr,
+                                                        &job.entry->pipeline)) {
+                throw std::runtime_error("Failed to create a graphics pipeline");
+            }
+
+            job.entry->compileMs = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - compileStart).count();
+            job.entry->state.store(EntryState::Ready, std::memory_order_release);
+        } catch (const std::exception& exception) {
+            job.entry->pipeline = VK_NULL_HANDLE;
+            job.entry->error = exception.what();
+            job.entry->state.store(EntryState::Failed, std::memory_order_release);
+        }
+    }
+
+    PipelineManager::Shader& PipelineManager::shaderById(uint16_t id) {
+        if (id == 0 || id > shaders.size()) {
+            throw std::runtime_error("Pipeline key with an invalid shader id");
+        }
+        return shaders[id - 1];
+    }
+
+    PipelineManagerStats PipelineManager::stats() const {
+        PipelineManagerStats stats{};
+
+        for (const auto& [key, entry] : pipelines) {
+            if (entry->state.load(std::memory_order_acquire) == EntryState::Ready) {
+                stats.pipelines++;
+                stats.compileMs += entry->compileMs;
+            }
+        }
+        for (const auto& shader : shaders) {
+            stats.shaders += shader.module.load() != VK_NULL_HANDLE ? 1 : 0;
+        }
+
+        stats.hits = hits;
+        stats.misses = misses;
+        stats.notReady = notReady;
+        stats.queueDepth = queueDepth.load();
+        stats.maxQueueDepth = maxQueueDepth;
+        stats.maxStallMs = maxStallMs;
+        return stats;
+    }
+
+    void PipelineManager::printStats(std::ostream& out) const {
+        PipelineManagerStats current = stats();
+
+        out << "Pipelines: " << current.pipelines << " from " << descriptions.size() << " descriptions on "
+            << threads.size() << " compile threads, " << current.shaders << " shader modules, " << current.hits
+            << " ready lookups, " << current.notReady << " not ready, " << current.misses << " compiled in "
+            << std::fixed << std::setprecision(2) << current.compileMs << " ms, queue depth " << current.queueDepth
+            << " (max " << current.maxQueueDepth << "), worst stall " << current.maxStallMs << " ms"
+            << std::defaultfloat << std::endl;
+    }
+} // m4x
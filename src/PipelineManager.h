@@ -0,0 +1,287 @@
+/** @file */
+
+//
+// Created by m4tex on 17/10/26.
+//
+
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include "PipelineCache.h"
+#include "ShaderLibrary.h"
+
+// std
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace m4x {
+    /**
+     * Vertex buffers a pipeline reads
+     */
+    enum class VertexInput : uint8_t {
+        // No vertex buffers, the vertex shader generates its positions
+        None,
+        // A single binding of Vertex
+        Mesh,
+        // Vertex per vertex and InstanceData per instance
+        MeshInstanced
+    };
+
+    enum class BlendMode : uint8_t {
+        Opaque,
+        // Source over destination by source alpha
+        Alpha,
+        Additive
+    };
+
+    /**
+     * Everything that tells two graphics pipelines apart, small enough to be hashed and compared on every lookup.
+     * Viewport and scissor are always dynamic, so the key is independent of the framebuffer size.
+     * Shaders are ids handed out by PipelineManager::shader(), specialization ids index the interned specialization
+     * constant values of the descriptions, zero keeps the shaders' defaults.
+     * Without a render pass the pipeline is built for dynamic rendering into colorFormat, so every pass rendering
+     * into the same format shares it.
+     */
+    struct PipelineKey {
+        VkRenderPass     renderPass     = VK_NULL_HANDLE;
+        VkFormat         colorFormat    = VK_FORMAT_UNDEFINED;
+        VkPipelineLayout layout         = VK_NULL_HANDLE;
+        uint16_t         vertexShader   = 0;
+        uint16_t         fragmentShader = 0;
+        uint16_t         specialization = 0;
+        uint8_t          subpass        = 0;
+        VertexInput      vertexInput    = VertexInput::Mesh;
+        uint8_t          topology       = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+        uint8_t          polygonMode    = VK_POLYGON_MODE_FILL;
+        uint8_t          cullMode       = VK_CULL_MODE_BACK_BIT;
+        uint8_t          frontFace      = VK_FRONT_FACE_CLOCKWISE;
+        BlendMode        blend          = BlendMode::Opaque;
+
+        bool operator==(const PipelineKey& other) const;
+        bool operator!=(const PipelineKey& other) const { return !(*this == other); }
+
+        struct Hash {
+            size_t operator()(const PipelineKey& key) const;
+        };
+    };
+
+    struct PipelineManagerStats {
+        uint32_t pipelines     = 0;
+        uint32_t shaders       = 0;
+        // Lookups answered with a ready pipeline, those that queued a compile and those that found it still compiling
+        uint64_t hits          = 0;
+        uint64_t misses        = 0;
+        uint64_t notReady      = 0;
+        uint32_t queueDepth    = 0;
+        uint32_t maxQueueDepth = 0;
+        // Summed over the compile threads
+        double   compileMs     = 0.0;
+        // Longest the render thread blocked in get()
+        double   maxStallMs    = 0.0;
+    };
+
+    /**
+     * Owns every graphics pipeline of the app, their shader modules belong to the ShaderLibrary.
+     * Pipelines are looked up by their PipelineKey, so any number of materials sharing a state share one
+     * VkPipeline and are compiled once. Named descriptions can be loaded from a text file, a section per pipeline:
+     *
+     *     [mesh]
+     *     vertex = shader.vert
+     *     fragment = shader.frag
+     *     specialize = TEXTURED=true, 3=16
+     *     cull = back
+     *     fallback = mesh_flat
+     *
+     * Shaders are named as in the ShaderLibrary's archive, fields left out keep the PipelineKey defaults.
+     * Specialization constants are set by name or SpecId to true, false or an integer, each variant is its own
+     * pipeline with the branches on them compiled away.
+     *
+     * Compilation runs on background threads, each with its own VkPipelineCache that is merged into the
+     * PipelineCache on destroy(). Finished pipelines are published through an atomic per entry, so the render
+     * thread polls them with request() without taking a lock. Only the render thread may call the other functions.
+     */
+    class PipelineManager {
+    public:
+        /**
+         * Starts the compile threads
+         * @param device [in] Logical device
+         * @param pipelineCache [in] Cache the compile threads start from and merge back into
+         * @param shaderLibrary [in] Library the shader modules are loaded from and owned by
+         * @param threadCount [in] Amount of compile threads
+         */
+        void create(VkDevice device, PipelineCache& pipelineCache, ShaderLibrary& shaderLibrary,
+                    uint32_t threadCount);
+
+        /**
+         * Drops the queued compiles, joins the threads, merges their caches and destroys every pipeline, none of
+         * them may be in use by the GPU anymore
+         */
+        void destroy();
+
+        /**
+         * Parses a description file and adds its pipelines, compiles nothing yet
+         * @param path [in] Description file
+         */
+        void loadDescriptions(const std::filesystem::path& path);
+
+        /**
+         * Interns a shader name, the module is only created once a pipeline using it is built
+         * @param name [in] Name of the shader in the ShaderLibrary's archive
+         * @return Id of the shader for a PipelineKey
+         */
+        uint16_t shader(const std::string& name);
+
+        /**
+         * @param name [in] Section name in the description file
+         * @return Names of the vertex and fragment shader of the description
+         */
+        [[nodiscard]] std::vector<std::string> shaderNames(const std::string& name) const;
+
+        /**
+         * Completes a loaded description into a key
+         * @param name [in] Section name in the description file
+         * @param renderPass [in] Render pass the pipeline is used in, VK_NULL_HANDLE for dynamic rendering
+         * @param colorFormat [in] Format of the color attachment, only part of the key with dynamic rendering
+         * @param layout [in] Layout matching the shaders' push constants and descriptor sets
+         */
+        [[nodiscard]] PipelineKey key(const std::string& name, VkRenderPass renderPass, VkFormat colorFormat,
+                                      VkPipelineLayout layout) const;
+
+        /**
+         * Replaces the specialization of a key, throws if the constants are malformed
+         * @param key [in] Key to specialize, usually completed by key()
+         * @param constants [in] Values as in a specialize field, NAME=value[, ...]
+         */
+        [[nodiscard]] PipelineKey specialized(PipelineKey key, const std::string& constants);
+
+        /**
+         * @param name [in] Section name in the description file
+         * @return Name of the description to draw with while this one compiles, if it has one
+         */
+        [[nodiscard]] std::optional<std::string> fallback(const std::string& name) const;
+
+        /**
+         * Returns the pipeline of a state without ever blocking, queueing its compile on the first request
+         * @param key [in] State of the pipeline
+         * @return The pipeline, VK_NULL_HANDLE while it is compiling or if it failed to compile
+         */
+        VkPipeline request(const PipelineKey& key);
+
+        /**
+         * Returns the pipeline of a state, blocking until it is compiled
+         * @param key [in] State of the pipeline
+         */
+        VkPipeline get(const PipelineKey& key);
+
+        /**
+         * Queues the compile of every key that isn't known yet, in order
+         * @param keys [in] States to compile, duplicates are fine
+         */
+        void compileAsync(const std::vector<PipelineKey>& keys);
+
+        [[nodiscard]] PipelineManagerStats stats() const;
+
+        void printStats(std::ostream& out) const;
+
+    private:
+        enum class EntryState : uint8_t {
+            Queued,
+            Ready,
+            Failed
+        };
+
+        /**
+         * Written by a compile thread once, the state is released after the pipeline and error are set
+         */
+        struct Entry {
+            std::atomic<EntryState> state{ EntryState::Queued };
+            VkPipeline  pipeline  = VK_NULL_HANDLE;
+            double      compileMs = 0.0;
+            std::string error;
+        };
+
+        /**
+         * The module is looked up by the first compile thread that needs it
+         */
+        struct Shader {
+            std::string name;
+            std::once_flag created;
+            std::atomic<VkShaderModule> module{ VK_NULL_HANDLE };
+        };
+
+        /**
+         * Constant values of a specialization, each constant named or given by its SpecId
+         */
+        using Specialization = std::vector<std::pair<std::string, uint32_t>>;
+
+        struct CompileJob {
+            PipelineKey           key;
+            Entry*                entry;
+            Shader*               vertexShader;
+            Shader*               fragmentShader;
+            const Specialization* specialization;
+        };
+
+        VkDevice device = VK_NULL_HANDLE;
+        PipelineCache* cache = nullptr;
+        ShaderLibrary* shaderLibrary = nullptr;
+
+        // Shader ids are indices into this plus one, zero means no shader. A deque, so the compile threads can
+        // keep pointers to its elements while new shaders are added.
+        std::deque<Shader> shaders;
+        std::unordered_map<std::string, uint16_t> shaderIds;
+        // Specialization ids are indices into this plus one, keyed by their text so equal ones share an id
+        std::deque<Specialization> specializations;
+        std::unordered_map<std::string, uint16_t> specializationIds;
+
+        std::unordered_map<std::string, PipelineKey> descriptions;
+        std::unordered_map<std::string, std::string> fallbacks;
+        std::unordered_map<PipelineKey, std::unique_ptr<Entry>, PipelineKey::Hash> pipelines;
+
+        std::vector<std::thread> threads;
+        std::vector<VkPipelineCache> threadCaches;
+        std::deque<CompileJob> queue;
+        std::mutex queueMutex;
+        std::condition_variable queueChanged;
+        bool stopping = false;
+
+        // Notified whenever a compile finishes, only get() waits on it
+        std::mutex finishedMutex;
+        std::condition_variable finished;
+        std::atomic<uint32_t> queueDepth{ 0 };
+
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t notReady = 0;
+        uint32_t maxQueueDepth = 0;
+        double maxStallMs = 0.0;
+
+        /**
+         * Looks the key up, queueing its compile if it is unknown
+         */
+        Entry& entry(const PipelineKey& key);
+
+        Shader& shaderById(uint16_t id);
+
+        /**
+         * Parses and interns the value of a specialize field, throws if it's malformed
+         */
+        uint16_t specialization(const std::string& text);
+
+        void compileThread(uint32_t index);
+
+        void compile(const CompileJob& job, VkPipelineCache threadCache);
+    };
+} // m4x
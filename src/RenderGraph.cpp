@@ -0,0 +1,694 @@
+//
+// Created by m4tex on 17/10/26.
+//
+
+#include "RenderGraph.h"
+#include "VkUtils.h"
+
+//std
+#include <algorithm>
+#include <iomanip>
+#include <stdexcept>
+#include <string>
+
+namespace m4x {
+    namespace {
+        struct UsageInfo {
+            VkPipelineStageFlags stages;
+            VkAccessFlags        access;
+            VkImageLayout        layout;
+            // Whether the previous contents matter, an image that isn't read gets transitioned from UNDEFINED
+            bool                 reads;
+            bool                 writes;
+        };
+
+        UsageInfo usageInfo(ResourceUsage usage) {
+            switch (usage) {
+                case ResourceUsage::ColorAttachment:
+                    return { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                             VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+                             VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, false, true };
+                case ResourceUsage::TransferSource:
+                    return { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+                             VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, true, false };
+                case ResourceUsage::TransferDestination:
+                    return { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                             VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, false, true };
+                case ResourceUsage::StorageRead:
+                    return { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+                             VK_IMAGE_LAYOUT_GENERAL, true, false };
+                case ResourceUsage::StorageWrite:
+                    return { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+                             VK_IMAGE_LAYOUT_GENERAL, true, true };
+                case ResourceUsage::IndirectRead:
+                    return { VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+                             VK_IMAGE_LAYOUT_GENERAL, true, false };
+                case ResourceUsage::FragmentStorageWrite:
+                    return { VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+                             VK_IMAGE_LAYOUT_GENERAL, true, true };
+                case ResourceUsage::Present:
+                    return { VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, true, false };
+                default:
+                    return { VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT, VK_IMAGE_LAYOUT_GENERAL, true, false };
+            }
+        }
+
+        VkImageUsageFlags imageUsage(ResourceUsage usage) {
+            switch (usage) {
+                case ResourceUsage::ColorAttachment:      return VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+                case ResourceUsage::TransferSource:       return VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+                case ResourceUsage::TransferDestination:  return VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+                case ResourceUsage::StorageRead:
+                case ResourceUsage::StorageWrite:
+                case ResourceUsage::FragmentStorageWrite: return VK_IMAGE_USAGE_STORAGE_BIT;
+                default:                                  return 0;
+            }
+        }
+
+        VkImageAspectFlags aspectOf(VkFormat format) {
+            switch (format) {
+                case VK_FORMAT_D16_UNORM:
+                case VK_FORMAT_X8_D24_UNORM_PACK32:
+                case VK_FORMAT_D32_SFLOAT:         return VK_IMAGE_ASPECT_DEPTH_BIT;
+                case VK_FORMAT_S8_UINT:            return VK_IMAGE_ASPECT_STENCIL_BIT;
+                case VK_FORMAT_D16_UNORM_S8_UINT:
+                case VK_FORMAT_D24_UNORM_S8_UINT:
+                case VK_FORMAT_D32_SFLOAT_S8_UINT: return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+                default:                           return VK_IMAGE_ASPECT_COLOR_BIT;
+            }
+        }
+
+        /**
+         * What the graph knows about a resource at some point of the frame while compiling
+         */
+        struct TrackedState {
+            VkImageLayout        layout        = VK_IMAGE_LAYOUT_UNDEFINED;
+            // Last write or layout transition
+            VkPipelineStageFlags writeStages   = 0;
+            VkAccessFlags        writeAccess   = 0;
+            // Reads since then, a write has to wait for them
+            VkPipelineStageFlags readStages    = 0;
+            // Stages and accesses the last write is visible to already
+            VkPipelineStageFlags visibleStages = 0;
+            VkAccessFlags        visibleAccess = 0;
+        };
+
+        VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+            return (value + alignment - 1) / alignment * alignment;
+        }
+
+        double mebibytes(VkDeviceSize bytes) {
+            return static_cast<double>(bytes) / (1024.0 * 1024.0);
+        }
+    }
+
+    void RenderGraph::create(VkDevice device, MemoryAllocator& allocator, DeletionQueue& deletionQueue,
+                             PFN_vkCmdPipelineBarrier2KHR pipelineBarrier2) {
+        this->device = device;
+        this->allocator = &allocator;
+        this->deletionQueue = &deletionQueue;
+        this->pipelineBarrier2 = pipelineBarrier2;
+        graphStats = {};
+    }
+
+    void RenderGraph::destroy() {
+        retireTransients();
+
+        resources.clear();
+        passes.clear();
+        compiledTopology.clear();
+        compiledPasses.clear();
+        finalBarriers = {};
+    }
+
+    void RenderGraph::begin() {
+        resources.clear();
+        passes.clear();
+    }
+
+    GraphResource RenderGraph::importImage(const char* name, VkImage image, VkFormat format,
+                                           const ImportState& state) {
+        Resource resource{ name, ResourceType::ImportedImage };
+        resource.image = image;
+        resource.format = format;
+        resource.state = state;
+
+        resources.push_back(resource);
+        return static_cast<GraphResource>(resources.size() - 1);
+    }
+
+    GraphResource RenderGraph::importBuffer(const char* name, VkBuffer buffer, const ImportState& state) {
+        Resource resource{ name, ResourceType::ImportedBuffer };
+        resource.buffer = buffer;
+        resource.state = state;
+
+        resources.push_back(resource);
+        return static_cast<GraphResource>(resources.size() - 1);
+    }
+
+    GraphResource RenderGraph::createImage(const char* name, const TransientImageInfo& info) {
+        Resource resource{ name, ResourceType::TransientImage };
+        resource.format = info.format;
+        resource.transient = info;
+
+        resources.push_back(resource);
+        return static_cast<GraphResource>(resources.size() - 1);
+    }
+
+    GraphPass RenderGraph::addPass(const char* name, Record record) {
+        passes.push_back({ name, std::move(record), {} });
+        return static_cast<GraphPass>(passes.size() - 1);
+    }
+
+    void RenderGraph::use(GraphPass pass, GraphResource resource, ResourceUsage usage) {
+        passes[pass].uses.push_back({ resource, usage });
+    }
+
+    void RenderGraph::markOutput(GraphResource resource, ResourceUsage finalUsage) {
+        resources[resource].output = true;
+        resources[resource].finalUsage = finalUsage;
+    }
+
+    void RenderGraph::execute(VkCommandBuffer commandBuffer) {
+        topology(declaredTopology);
+        if (graphStats.compiles == 0 || declaredTopology != compiledTopology) {
+            std::swap(compiledTopology, declaredTopology);
+            compile();
+        }
+
+        for (const auto& compiledPass : compiledPasses) {
+            recordBarriers(commandBuffer, compiledPass.barriers);
+            passes[compiledPass.pass].record(commandBuffer, *this);
+        }
+        recordBarriers(commandBuffer, finalBarriers);
+
+        graphStats.executions++;
+        graphStats.totalBarriers += graphStats.barriers;
+    }
+
+    VkImage RenderGraph::image(GraphResource resource) const {
+        if (resources[resource].type == ResourceType::TransientImage) {
+            return transients[resource].image;
+        }
+        return resources[resource].image;
+    }
+
+    VkImageView RenderGraph::view(GraphResource resource) const {
+        return transients[resource].view;
+    }
+
+    VkBuffer RenderGraph::buffer(GraphResource resource) const {
+        return resources[resource].buffer;
+    }
+
+    void RenderGraph::printStats(std::ostream& out) const {
+        if (graphStats.executions == 0) {
+            return;
+        }
+
+        out << "Render graph: " << graphStats.passes - graphStats.culledPasses << " of " << graphStats.passes
+            << " passes live, " << graphStats.barriers << " barriers in " << graphStats.barrierBatches
+            << " batches per frame, " << graphStats.compiles << " compiles over " << graphStats.executions
+            << " frames, " << graphStats.transientImages << " transient images in " << std::fixed
+            << std::setprecision(1) << mebibytes(graphStats.transientBytes) << " MiB aliased from "
+            << mebibytes(graphStats.unaliasedBytes) << " MiB, peak " << mebibytes(graphStats.peakTransientBytes)
+            << " MiB" << std::defaultfloat << std::endl;
+    }
+
+    void RenderGraph::topology(std::vector<uint64_t>& out) const {
+        out.clear();
+
+        for (const auto& resource : resources) {
+            out.push_back(static_cast<uint64_t>(resource.type));
+            out.push_back(resource.output ? static_cast<uint64_t>(resource.finalUsage) + 1 : 0);
+
+            if (resource.type == ResourceType::TransientImage) {
+                out.push_back(resource.format);
+                out.push_back(static_cast<uint64_t>(resource.transient.extent.width) << 32 |
+                              resource.transient.extent.height);
+                out.push_back(resource.transient.usage);
+            } else {
+                out.push_back(resource.state.stages);
+                out.push_back(resource.state.access);
+                out.push_back(resource.state.layout);
+            }
+        }
+
+        for (const auto& pass : passes) {
+            out.push_back(~0ull);
+            for (const auto& use : pass.uses) {
+                out.push_back(static_cast<uint64_t>(use.resource) << 32 | static_cast<uint64_t>(use.usage));
+            }
+        }
+    }
+
+    void RenderGraph::compile() {
+        // Uses of every pass merged per resource
+        std::vector<std::vector<std::pair<GraphResource, UsageInfo>>> merged(passes.size());
+        for (size_t p = 0; p < passes.size(); ++p) {
+            for (const auto& use : passes[p].uses) {
+                UsageInfo info = usageInfo(use.usage);
+
+                auto existing = std::find_if(merged[p].begin(), merged[p].end(), [&](const auto& entry) {
+                    return entry.first == use.resource;
+                });
+                if (existing == merged[p].end()) {
+                    merged[p].emplace_back(use.resource, info);
+                    continue;
+                }
+
+                if (resources[use.resource].type != ResourceType::ImportedBuffer &&
+                    existing->second.layout != info.layout) {
+                    throw std::runtime_error(std::string("Render graph pass ") + passes[p].name + " uses " +
+                                             resources[use.resource].name + " in two layouts");
+                }
+
+                existing->second.stages |= info.stages;
+                existing->second.access |= info.access;
+                existing->second.reads |= info.reads;
+                existing->second.writes |= info.writes;
+            }
+        }
+
+        std::vector<bool> live = livePasses();
+
+        retireTransients();
+        allocateTransients(live);
+
+        std::vector<TrackedState> states(resources.size());
+        for (size_t r = 0; r < resources.size(); ++r) {
+            if (resources[r].type == ResourceType::TransientImage) {
+                continue;
+            }
+
+            states[r].layout = resources[r].state.layout;
+            states[r].writeStages = resources[r].state.stages;
+            states[r].writeAccess = resources[r].state.access;
+            states[r].visibleStages = resources[r].state.stages;
+            states[r].visibleAccess = resources[r].state.access;
+        }
+
+        // A transient starts out waiting on every use of the memory it shares, by earlier passes of the frame
+        // and by the previous frame alike
+        for (size_t r = 0; r < resources.size(); ++r) {
+            if (transients[r].image == VK_NULL_HANDLE) {
+                continue;
+            }
+
+            for (size_t other = 0; other < resources.size(); ++other) {
+                if (transients[other].image == VK_NULL_HANDLE || transients[other].group != transients[r].group) {
+                    continue;
+                }
+
+                if (transients[r].offset >= transients[other].offset + transients[other].size ||
+                    transients[other].offset >= transients[r].offset + transients[r].size) {
+                    continue;
+                }
+
+                for (size_t p = 0; p < passes.size(); ++p) {
+                    for (const auto& [resource, info] : merged[p]) {
+                        if (live[p] && resource == other) {
+                            states[r].writeStages |= info.stages;
+                            states[r].writeAccess |= info.writes ? info.access : 0;
+                        }
+                    }
+                }
+            }
+        }
+
+        auto transition = [&](GraphResource resource, const UsageInfo& info, BarrierBatch& batch) {
+            TrackedState& state = states[resource];
+            bool isImage = resources[resource].type != ResourceType::ImportedBuffer;
+            bool layoutChange = isImage && info.layout != state.layout;
+
+            VkPipelineStageFlags srcStages = 0;
+            VkAccessFlags srcAccess = 0;
+            bool needed;
+
+            if (info.writes || layoutChange) {
+                // Write after write and write after read, transitions count as writes
+                srcStages = state.writeStages | state.readStages;
+                srcAccess = state.writeAccess;
+                needed = layoutChange || srcAccess != 0 || (srcStages & ~VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT) != 0;
+            } else {
+                // Read after write, once per stage and access the write wasn't made visible to yet
+                srcStages = state.writeStages;
+                srcAccess = state.writeAccess;
+                needed = state.writeStages != 0 &&
+                         ((info.stages & ~state.visibleStages) != 0 || (info.access & ~state.visibleAccess) != 0);
+            }
+
+            if (needed) {
+                batch.srcStages |= srcStages;
+                batch.dstStages |= info.stages;
+                batch.barriers.push_back({ resource, srcStages, info.stages, srcAccess, info.access,
+                                           isImage && info.reads ? state.layout : VK_IMAGE_LAYOUT_UNDEFINED,
+                                           isImage ? info.layout : VK_IMAGE_LAYOUT_UNDEFINED });
+            }
+
+            if (info.writes || layoutChange) {
+                state.layout = isImage ? info.layout : state.layout;
+                state.writeStages = info.stages;
+                state.writeAccess = info.writes ? info.access : 0;
+                state.readStages = 0;
+                state.visibleStages = info.writes ? 0 : info.stages;
+                state.visibleAccess = info.writes ? 0 : info.access;
+            } else {
+                state.readStages |= info.stages;
+                if (needed) {
+                    state.visibleStages |= info.stages;
+                    state.visibleAccess |= info.access;
+                }
+            }
+        };
+
+        compiledPasses.clear();
+        finalBarriers = {};
+        graphStats.passes = static_cast<uint32_t>(passes.size());
+        graphStats.culledPasses = 0;
+
+        for (size_t p = 0; p < passes.size(); ++p) {
+            if (!live[p]) {
+                graphStats.culledPasses++;
+                continue;
+            }
+
+            CompiledPass compiled{ static_cast<GraphPass>(p) };
+            for (const auto& [resource, info] : merged[p]) {
+                transition(resource, info, compiled.barriers);
+            }
+            compiledPasses.push_back(std::move(compiled));
+        }
+
+        for (size_t r = 0; r < resources.size(); ++r) {
+            if (resources[r].output) {
+                transition(static_cast<GraphResource>(r), usageInfo(resources[r].finalUsage), finalBarriers);
+            }
+        }
+
+        graphStats.barriers = static_cast<uint32_t>(finalBarriers.barriers.size());
+        graphStats.barrierBatches = finalBarriers.barriers.empty() ? 0 : 1;
+        for (const auto& compiled : compiledPasses) {
+            graphStats.barriers += static_cast<uint32_t>(compiled.barriers.barriers.size());
+            graphStats.barrierBatches += compiled.barriers.barriers.empty() ? 0 : 1;
+        }
+
+        graphStats.compiles++;
+    }
+
+    std::vector<bool> RenderGraph::livePasses() const {
+        std::vector<bool> live(passes.size(), false);
+        std::vector<bool> needed(resources.size(), false);
+
+        for (size_t r = 0; r < resources.size(); ++r) {
+            needed[r] = resources[r].output;
+        }
+
+        // Backwards, a pass is live if a later live pass or the output needs something it writes
+        for (size_t p = passes.size(); p-- > 0;) {
+            for (const auto& use : passes[p].uses) {
+                if (usageInfo(use.usage).writes && needed[use.resource]) {
+                    live[p] = true;
+                }
+            }
+
+            if (!live[p]) {
+                continue;
+            }
+
+            // Whatever the pass overwrites doesn't need the earlier writers anymore, unless the pass reads it too
+            for (const auto& use : passes[p].uses) {
+                UsageInfo info = usageInfo(use.usage);
+                if (info.writes && !info.reads) {
+                    needed[use.resource] = false;
+                }
+            }
+            for (const auto& use : passes[p].uses) {
+                if (usageInfo(use.usage).reads) {
+                    needed[use.resource] = true;
+                }
+            }
+        }
+
+        return live;
+    }
+
+    void RenderGraph::allocateTransients(const std::vector<bool>& live) {
+        struct Lifetime {
+            GraphResource        resource;
+            VkMemoryRequirements requirements;
+            size_t               first;
+            size_t               last;
+        };
+
+        transients.assign(resources.size(), {});
+
+        std::vector<size_t> first(resources.size(), passes.size());
+        std::vector<size_t> last(resources.size(), 0);
+        std::vector<VkImageUsageFlags> usages(resources.size(), 0);
+
+        for (size_t p = 0; p < passes.size(); ++p) {
+            if (!live[p]) {
+                continue;
+            }
+
+            for (const auto& use : passes[p].uses) {
+                first[use.resource] = std::min(first[use.resource], p);
+                last[use.resource] = std::max(last[use.resource], p);
+                usages[use.resource] |= imageUsage(use.usage);
+            }
+        }
+
+        std::vector<Lifetime> lifetimes;
+        graphStats.unaliasedBytes = 0;
+
+        for (size_t r = 0; r < resources.size(); ++r) {
+            const Resource& resource = resources[r];
+            if (resource.type != ResourceType::TransientImage || first[r] == passes.size()) {
+                continue;
+            }
+
+            transients[r].image = VkUtils::CreateImage(device, resource.transient.extent, resource.format,
+                                                       resource.transient.usage | usages[r]);
+
+            Lifetime lifetime{ static_cast<GraphResource>(r) };
+            vkGetImageMemoryRequirements(device, transients[r].image, &lifetime.requirements);
+            transients[r].size = lifetime.requirements.size;
+            lifetime.first = first[r];
+            // Outputs stay alive until the end of the frame
+            lifetime.last = resource.output ? passes.size() : last[r];
+
+            lifetimes.push_back(lifetime);
+            graphStats.unaliasedBytes += lifetime.requirements.size;
+        }
+
+        // Biggest first, each at the lowest offset no image alive at the same time overlaps
+        std::sort(lifetimes.begin(), lifetimes.end(), [](const Lifetime& a, const Lifetime& b) {
+            return a.requirements.size > b.requirements.size;
+        });
+
+        std::vector<VkMemoryRequirements> groups;
+        std::vector<std::vector<const Lifetime*>> placed;
+
+        for (const auto& lifetime : lifetimes) {
+            TransientImage& transient = transients[lifetime.resource];
+
+            auto group = std::find_if(groups.begin(), groups.end(), [&](const VkMemoryRequirements& candidate) {
+                return candidate.memoryTypeBits == lifetime.requirements.memoryTypeBits;
+            });
+            transient.group = static_cast<uint32_t>(group - groups.begin());
+            if (group == groups.end()) {
+                groups.push_back({ 0, 1, lifetime.requirements.memoryTypeBits });
+                placed.emplace_back();
+            }
+
+            std::vector<const Lifetime*> overlapping;
+            std::vector<VkDeviceSize> offsets = { 0 };
+            for (const Lifetime* other : placed[transient.group]) {
+                if (other->first <= lifetime.last && lifetime.first <= other->last) {
+                    overlapping.push_back(other);
+                    offsets.push_back(alignUp(transients[other->resource].offset + transients[other->resource].size,
+                                              lifetime.requirements.alignment));
+                }
+            }
+            std::sort(offsets.begin(), offsets.end());
+
+            for (VkDeviceSize offset : offsets) {
+                bool fits = std::none_of(overlapping.begin(), overlapping.end(), [&](const Lifetime* other) {
+                    VkDeviceSize otherOffset = transients[other->resource].offset;
+                    return offset < otherOffset + other->requirements.size &&
+                           otherOffset < offset + lifetime.requirements.size;
+                });
+
+                if (fits) {
+                    transient.offset = offset;
+                    break;
+                }
+            }
+
+            VkMemoryRequirements& requirements = groups[transient.group];
+            requirements.size = std::max(requirements.size, transient.offset + lifetime.requirements.size);
+            requirements.alignment = std::max(requirements.alignment, lifetime.requirements.alignment);
+            placed[transient.group].push_back(&lifetime);
+        }
+
+        graphStats.transientImages = static_cast<uint32_t>(lifetimes.size());
+        graphStats.transientBytes = 0;
+
+        for (const auto& requirements : groups) {
+            transientMemory.push_back(allocator->allocate(requirements, { VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT },
+                                                          ResourceKind::Optimal));
+            graphStats.transientBytes += requirements.size;
+        }
+        graphStats.peakTransientBytes = std::max(graphStats.peakTransientBytes, graphStats.transientBytes);
+
+        for (const auto& lifetime : lifetimes) {
+            TransientImage& transient = transients[lifetime.resource];
+            const Allocation& memory = transientMemory[transient.group];
+
+            if (VK_SUCCESS != vkBindImageMemory(device, transient.image, memory.memory,
+                                                memory.offset + transient.offset)) {
+                throw std::runtime_error("Failed to bind a transient image");
+            }
+            transient.view = VkUtils::CreateImageView(device, transient.image, resources[lifetime.resource].format);
+        }
+    }
+
+    void RenderGraph::retireTransients() {
+        // The images alias the group allocations, so the memory goes after all of them
+        for (const auto& transient : transients) {
+            if (transient.image != VK_NULL_HANDLE) {
+                deletionQueue->destroyImageView(transient.view);
+                deletionQueue->destroyImage(transient.image, {});
+            }
+        }
+        for (const auto& memory : transientMemory) {
+            deletionQueue->freeMemory(memory);
+        }
+
+        transients.clear();
+        transientMemory.clear();
+    }
+
+    void RenderGraph::recordBarriers(VkCommandBuffer commandBuffer, const BarrierBatch& batch) {
+        if (batch.barriers.empty()) {
+            return;
+        }
+
+        if (pipelineBarrier2) {
+            recordBarriers2(commandBuffer, batch);
+            return;
+        }
+
+        imageBarriers.clear();
+        bufferBarriers.clear();
+
+        for (const auto& barrier : batch.barriers) {
+            const Resource& resource = resources[barrier.resource];
+
+            if (resource.type == ResourceType::ImportedBuffer) {
+                VkBufferMemoryBarrier bufferBarrier{};
+                bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+                bufferBarrier.srcAccessMask = barrier.srcAccess;
+                bufferBarrier.dstAccessMask = barrier.dstAccess;
+                bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                bufferBarrier.buffer = resource.buffer;
+                bufferBarrier.offset = 0;
+                bufferBarrier.size = VK_WHOLE_SIZE;
+
+                bufferBarriers.push_back(bufferBarrier);
+                continue;
+            }
+
+            VkImageMemoryBarrier imageBarrier{};
+            imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            imageBarrier.srcAccessMask = barrier.srcAccess;
+            imageBarrier.dstAccessMask = barrier.dstAccess;
+            imageBarrier.oldLayout = barrier.oldLayout;
+            imageBarrier.newLayout = barrier.newLayout;
+            imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            imageBarrier.image = image(barrier.resource);
+            imageBarrier.subresourceRange.aspectMask = aspectOf(resource.format);
+            imageBarrier.subresourceRange.baseMipLevel = 0;
+            imageBarrier.subresourceRange.levelCount = 1;
+            imageBarrier.subresourceRange.baseArrayLayer = 0;
+            imageBarrier.subresourceRange.layerCount = 1;
+
+            imageBarriers.push_back(imageBarrier);
+        }
+
+        // Nothing to wait for, the barrier is only there for the layout transition
+        VkPipelineStageFlags srcStages = batch.srcStages;
+        if (srcStages == 0) {
+            srcStages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+        }
+
+        vkCmdPipelineBarrier(commandBuffer, srcStages, batch.dstStages, 0, 0, nullptr,
+                             static_cast<uint32_t>(bufferBarriers.size()), bufferBarriers.data(),
+                             static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+    }
+
+    void RenderGraph::recordBarriers2(VkCommandBuffer commandBuffer, const BarrierBatch& batch) {
+        imageBarriers2.clear();
+        bufferBarriers2.clear();
+
+        // The legacy stage and access bits have the same values in the 64 bit flags. Nothing to wait for is NONE.
+        auto srcStages = [](VkPipelineStageFlags stages) -> VkPipelineStageFlags2 {
+            return stages & ~VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+        };
+        auto dstStages = [](VkPipelineStageFlags stages) -> VkPipelineStageFlags2 {
+            return stages & ~VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+        };
+
+        for (const auto& barrier : batch.barriers) {
+            const Resource& resource = resources[barrier.resource];
+
+            if (resource.type == ResourceType::ImportedBuffer) {
+                VkBufferMemoryBarrier2 bufferBarrier{};
+                bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2;
+                bufferBarrier.srcStageMask = srcStages(barrier.srcStages);
+                bufferBarrier.srcAccessMask = barrier.srcAccess;
+                bufferBarrier.dstStageMask = dstStages(barrier.dstStages);
+                bufferBarrier.dstAccessMask = barrier.dstAccess;
+                bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                bufferBarrier.buffer = resource.buffer;
+                bufferBarrier.offset = 0;
+                bufferBarrier.size = VK_WHOLE_SIZE;
+
+                bufferBarriers2.push_back(bufferBarrier);
+                continue;
+            }
+
+            VkImageMemoryBarrier2 imageBarrier{};
+            imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+            imageBarrier.srcStageMask = srcStages(barrier.srcStages);
+            imageBarrier.srcAccessMask = barrier.srcAccess;
+            imageBarrier.dstStageMask = dstStages(barrier.dstStages);
+            imageBarrier.dstAccessMask = barrier.dstAccess;
+            imageBarrier.oldLayout = barrier.oldLayout;
+            imageBarrier.newLayout = barrier.newLayout;
+            imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            imageBarrier.image = image(barrier.resource);
+            imageBarrier.subresourceRange.aspectMask = aspectOf(resource.format);
+            imageBarrier.subresourceRange.baseMipLevel = 0;
+            imageBarrier.subresourceRange.levelCount = 1;
+            imageBarrier.subresourceRange.baseArrayLayer = 0;
+            imageBarrier.subresourceRange.layerCount = 1;
+
+            imageBarriers2.push_back(imageBarrier);
+        }
+
+        VkDependencyInfo dependencyInfo{};
+        dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+        dependencyInfo.bufferMemoryBarrierCount = static_cast<uint32_t>(bufferBarriers2.size());
+        dependencyInfo.pBufferMemoryBarriers = bufferBarriers2.data();
+        dependencyInfo.imageMemoryBarrierCount = static_cast<uint32_t>(imageBarriers2.size());
+        dependencyInfo.pImageMemoryBarriers = imageBarriers2.data();
+
+        pipelineBarrier2(commandBuffer, &dependencyInfo);
+    }
+} // m4x
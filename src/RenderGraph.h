@@ -0,0 +1,305 @@
+/** @file */
+
+//
+// Created by m4tex on 17/10/26.
+//
+
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include "MemoryAllocator.h"
+#include "DeletionQueue.h"
+
+// std
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <vector>
+
+namespace m4x {
+    /**
+     * Handle of a resource declared on a RenderGraph, valid until the next begin()
+     */
+    using GraphResource = uint32_t;
+
+    /**
+     * Handle of a pass declared on a RenderGraph, valid until the next begin()
+     */
+    using GraphPass = uint32_t;
+
+    /**
+     * How a pass touches a resource. Each usage implies the stages, accesses and image layout the graph
+     * synchronizes against.
+     */
+    enum class ResourceUsage {
+        // Written by a render pass that clears it, the previous contents are discarded
+        ColorAttachment,
+        TransferSource,
+        // Overwritten by a copy, blit, clear or fill
+        TransferDestination,
+        // Read by a compute shader
+        StorageRead,
+        // Read and written by a compute shader
+        StorageWrite,
+        IndirectRead,
+        // Read and written by a fragment shader, atomics included
+        FragmentStorageWrite,
+        // Final usages of outputs only
+        Present,
+        HostRead
+    };
+
+    /**
+     * Last use of an imported resource before the graph runs
+     */
+    struct ImportState {
+        VkPipelineStageFlags stages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+        VkAccessFlags        access = 0;
+        VkImageLayout        layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    };
+
+    /**
+     * Image the graph creates and owns, its memory may be shared with other transients that are never alive
+     * at the same time
+     */
+    struct TransientImageInfo {
+        VkExtent2D        extent{};
+        VkFormat          format = VK_FORMAT_UNDEFINED;
+        VkImageUsageFlags usage  = 0;
+    };
+
+    struct RenderGraphStats {
+        uint64_t     compiles         = 0;
+        uint64_t     executions       = 0;
+        uint32_t     passes           = 0;
+        uint32_t     culledPasses     = 0;
+        // Image and buffer barriers of one execution of the compiled graph
+        uint32_t     barriers         = 0;
+        // vkCmdPipelineBarrier calls the barriers are batched into
+        uint32_t     barrierBatches   = 0;
+        uint64_t     totalBarriers    = 0;
+        uint32_t     transientImages  = 0;
+        VkDeviceSize transientBytes   = 0;
+        // What the transients would take without aliasing
+        VkDeviceSize unaliasedBytes   = 0;
+        // Largest transientBytes of any compile
+        VkDeviceSize peakTransientBytes = 0;
+    };
+
+    /**
+     * Frame graph that derives the synchronization of a frame from what its passes declare.
+     * Every frame declares its resources and passes again between begin() and execute(). Passes that
+     * contribute nothing to a resource marked as output are culled, and the remaining ones get their barriers and
+     * layout transitions placed right before them, batched into one vkCmdPipelineBarrier per pass.
+     * Transient images whose lifetimes don't overlap share memory. The compiled result is kept as long as the
+     * declared topology stays the same, so a steady frame only rebinds the imported handles.
+     * With VK_KHR_synchronization2 every barrier carries its own stages instead of the union of its batch.
+     */
+    class RenderGraph {
+    public:
+        /**
+         * Records a pass, the graph has placed the pass's barriers already
+         */
+        using Record = std::function<void(VkCommandBuffer commandBuffer, const RenderGraph& graph)>;
+
+        /**
+         * @param device [in] Logical device
+         * @param allocator [in] Allocator the transient images get their memory from
+         * @param deletionQueue [in] Queue the transient images replaced by a recompile are destroyed through
+         * @param pipelineBarrier2 [in] vkCmdPipelineBarrier2KHR if synchronization2 is enabled, nullptr records
+         * vkCmdPipelineBarrier
+         */
+        void create(VkDevice device, MemoryAllocator& allocator, DeletionQueue& deletionQueue,
+                    PFN_vkCmdPipelineBarrier2KHR pipelineBarrier2 = nullptr);
+
+        /**
+         * Hands the transient images to the deletion queue, which has to be destroyed after
+         */
+        void destroy();
+
+        /**
+         * Starts declaring a frame, the handles of the previous frame become invalid
+         */
+        void begin();
+
+        /**
+         * @param name [in] Name for the statistics, a string literal
+         * @param image [in] Image owned by someone else, single mip and layer
+         * @param format [in] Format of the image
+         * @param state [in] How the image was last used before this frame
+         */
+        GraphResource importImage(const char* name, VkImage image, VkFormat format, const ImportState& state);
+
+        /**
+         * @param name [in] Name for the statistics, a string literal
+         * @param buffer [in] Buffer owned by someone else, synchronized as a whole
+         * @param state [in] How the buffer was last used before this frame, the layout is ignored
+         */
+        GraphResource importBuffer(const char* name, VkBuffer buffer, const ImportState& state);
+
+        /**
+         * Declares an image that only lives within the frame. The usages of its passes get added to info.usage.
+         * @param name [in] Name for the statistics, a string literal
+         * @param info [in] Description of the image
+         */
+        GraphResource createImage(const char* name, const TransientImageInfo& info);
+
+        /**
+         * @param name [in] Name for the statistics, a string literal
+         * @param record [in] Records the pass, only called if the pass isn't culled
+         */
+        GraphPass addPass(const char* name, Record record);
+
+        /**
+         * Declares that a pass uses a resource. A pass may use a resource in several ways as long as they agree
+         * on the image layout.
+         */
+        void use(GraphPass pass, GraphResource resource, ResourceUsage usage);
+
+        /**
+         * Keeps the passes writing a resource alive and transitions it to its final usage at the end of the frame
+         */
+        void markOutput(GraphResource resource, ResourceUsage finalUsage);
+
+        /**
+         * Compiles the declared frame unless the topology matches the last compile and records it
+         * @param commandBuffer [in] Command buffer outside of a render pass
+         */
+        void execute(VkCommandBuffer commandBuffer);
+
+        /**
+         * Image of a resource, for transients only valid inside the record callbacks
+         */
+        [[nodiscard]] VkImage image(GraphResource resource) const;
+
+        /**
+         * View of a transient image
+         */
+        [[nodiscard]] VkImageView view(GraphResource resource) const;
+
+        [[nodiscard]] VkBuffer buffer(GraphResource resource) const;
+
+        [[nodiscard]] const RenderGraphStats& stats() const { return graphStats; }
+
+        void printStats(std::ostream& out) const;
+
+    private:
+        enum class ResourceType {
+            ImportedImage,
+            ImportedBuffer,
+            TransientImage
+        };
+
+        struct Resource {
+            const char*        name;
+            ResourceType       type;
+            VkImage            image  = VK_NULL_HANDLE;
+            VkBuffer           buffer = VK_NULL_HANDLE;
+            VkFormat           format = VK_FORMAT_UNDEFINED;
+            ImportState        state;
+            TransientImageInfo transient;
+            bool               output = false;
+            ResourceUsage      finalUsage = ResourceUsage::Present;
+        };
+
+        struct Use {
+            GraphResource resource;
+            ResourceUsage usage;
+        };
+
+        struct Pass {
+            const char*      name;
+            Record           record;
+            std::vector<Use> uses;
+        };
+
+        struct BarrierTemplate {
+            GraphResource        resource;
+            VkPipelineStageFlags srcStages;
+            VkPipelineStageFlags dstStages;
+            VkAccessFlags        srcAccess;
+            VkAccessFlags        dstAccess;
+            VkImageLayout        oldLayout;
+            VkImageLayout        newLayout;
+        };
+
+        /**
+         * Barriers placed before a pass, or at the end of the frame
+         */
+        struct BarrierBatch {
+            VkPipelineStageFlags         srcStages = 0;
+            VkPipelineStageFlags         dstStages = 0;
+            std::vector<BarrierTemplate> barriers;
+        };
+
+        struct CompiledPass {
+            GraphPass    pass;
+            BarrierBatch barriers;
+        };
+
+        struct TransientImage {
+            VkImage      image = VK_NULL_HANDLE;
+            VkImageView  view  = VK_NULL_HANDLE;
+            // Offset into the memory of its group
+            VkDeviceSize offset = 0;
+            VkDeviceSize size   = 0;
+            uint32_t     group  = 0;
+        };
+
+        VkDevice         device    = VK_NULL_HANDLE;
+        MemoryAllocator* allocator = nullptr;
+        DeletionQueue*   deletionQueue = nullptr;
+        PFN_vkCmdPipelineBarrier2KHR pipelineBarrier2 = nullptr;
+
+        // Declaration of the frame being built
+        std::vector<Resource> resources;
+        std::vector<Pass>     passes;
+
+        // Result of the last compile, transients indexed by resource
+        std::vector<uint64_t>       compiledTopology;
+        std::vector<CompiledPass>   compiledPasses;
+        BarrierBatch                finalBarriers;
+        std::vector<TransientImage> transients;
+        // One allocation per group of transients with the same memory type bits
+        std::vector<Allocation>     transientMemory;
+
+        // Reused by every execution
+        std::vector<uint64_t>              declaredTopology;
+        std::vector<VkImageMemoryBarrier>  imageBarriers;
+        std::vector<VkBufferMemoryBarrier> bufferBarriers;
+        std::vector<VkImageMemoryBarrier2>  imageBarriers2;
+        std::vector<VkBufferMemoryBarrier2> bufferBarriers2;
+
+        RenderGraphStats graphStats;
+
+        /**
+         * Writes everything the compiled result depends on into out, handles excluded
+         */
+        void topology(std::vector<uint64_t>& out) const;
+
+        void compile();
+
+        /**
+         * Marks the passes that contribute to an output
+         */
+        [[nodiscard]] std::vector<bool> livePasses() const;
+
+        /**
+         * Creates the transient images of the live passes and packs them into as little memory as their lifetimes
+         * allow
+         * @param live [in] Result of livePasses()
+         */
+        void allocateTransients(const std::vector<bool>& live);
+
+        /**
+         * Hands the transient images and their memory to the deletion queue, executions in flight may still use them
+         */
+        void retireTransients();
+
+        void recordBarriers(VkCommandBuffer commandBuffer, const BarrierBatch& batch);
+
+        void recordBarriers2(VkCommandBuffer commandBuffer, const BarrierBatch& batch);
+    };
+} // m4x
@@ -0,0 +1,242 @@
+//
+// Created by m4tex on 17/10/26.
+//
+
+#include "ShaderArchive.h"
+
+//std
+#include <cstring>
+#include <fstream>
+#include <set>
+#include <stdexcept>
+
+namespace m4x {
+    namespace {
+        const char     ARCHIVE_MAGIC[4] = { 'M', '4', 'X', 'S' };
+        const uint32_t ARCHIVE_VERSION  = 1;
+
+        struct Header {
+            char     magic[4];
+            uint32_t version;
+            uint32_t shaderCount;
+            uint32_t bindingCount;
+            uint32_t specConstantCount;
+            uint32_t stringsSize;
+        };
+
+        struct ShaderEntry {
+            uint32_t nameOffset;
+            uint32_t nameLength;
+            uint64_t codeOffset;
+            uint64_t codeSize;
+            uint32_t stage;
+            uint32_t pushConstantOffset;
+            uint32_t pushConstantSize;
+            // Ranges of the binding and specialization constant tables
+            uint32_t firstBinding;
+            uint32_t bindingCount;
+            uint32_t firstSpecConstant;
+            uint32_t specConstantCount;
+            uint32_t padding;
+        };
+
+        struct BindingEntry {
+            uint32_t set;
+            uint32_t binding;
+            uint32_t type;
+            uint32_t count;
+        };
+
+        struct SpecConstantEntry {
+            uint32_t id;
+            uint32_t defaultValue;
+            uint32_t nameOffset;
+            uint32_t nameLength;
+        };
+
+        uint64_t alignUp(uint64_t value, uint64_t alignment) {
+            return (value + alignment - 1) / alignment * alignment;
+        }
+
+        template<typename T>
+        void writeTable(std::ofstream& file, const std::vector<T>& table) {
+            file.write(reinterpret_cast<const char*>(table.data()),
+                       static_cast<std::streamsize>(sizeof(T) * table.size()));
+        }
+    }
+
+    void ShaderArchive::Write(const std::filesystem::path& path, const std::vector<ShaderSource>& shaders) {
+        std::vector<ShaderEntry> shaderEntries;
+        std::vector<BindingEntry> bindingEntries;
+        std::vector<SpecConstantEntry> specConstantEntries;
+        std::string strings;
+        std::set<std::string> names;
+
+        auto addString = [&](const std::string& string) {
+            auto offset = static_cast<uint32_t>(strings.size());
+            strings += string;
+            return offset;
+        };
+
+        for (const auto& shader : shaders) {
+            if (!names.insert(shader.name).second) {
+                throw std::runtime_error("Shader " + shader.name + " is in the archive twice");
+            }
+
+            ShaderReflection reflection;
+            try {
+                reflection = ReflectSpirv(shader.code.data(), shader.code.size() * sizeof(uint32_t));
+            } catch (const std::runtime_error& error) {
+                throw std::runtime_error(shader.name + ": " + error.what());
+            }
+
+            ShaderEntry entry{};
+            entry.nameOffset = addString(shader.name);
+            entry.nameLength = static_cast<uint32_t>(shader.name.size());
+            entry.codeSize = shader.code.size() * sizeof(uint32_t);
+            entry.stage = reflection.stage;
+            entry.pushConstantOffset = reflection.pushConstantOffset;
+            entry.pushConstantSize = reflection.pushConstantSize;
+            entry.firstBinding = static_cast<uint32_t>(bindingEntries.size());
+            entry.bindingCount = static_cast<uint32_t>(reflection.bindings.size());
+            entry.firstSpecConstant = static_cast<uint32_t>(specConstantEntries.size());
+            entry.specConstantCount = static_cast<uint32_t>(reflection.specConstants.size());
+            shaderEntries.push_back(entry);
+
+            for (const auto& binding : reflection.bindings) {
+                bindingEntries.push_back({ binding.set, binding.binding, static_cast<uint32_t>(binding.type),
+                                           binding.count });
+            }
+            for (const auto& constant : reflection.specConstants) {
+                specConstantEntries.push_back({ constant.id, constant.defaultValue, addString(constant.name),
+                                                static_cast<uint32_t>(constant.name.size()) });
+            }
+        }
+
+        // The code follows the tables, each module 4 byte aligned
+        strings.resize(alignUp(strings.size(), sizeof(uint32_t)), '\0');
+        uint64_t offset = sizeof(Header) + sizeof(ShaderEntry) * shaderEntries.size() +
+                          sizeof(BindingEntry) * bindingEntries.size() +
+                          sizeof(SpecConstantEntry) * specConstantEntries.size() + strings.size();
+        for (auto& entry : shaderEntries) {
+            entry.codeOffset = offset;
+            offset += entry.codeSize;
+        }
+
+        Header header{};
+        std::memcpy(header.magic, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC));
+        header.version = ARCHIVE_VERSION;
+        header.shaderCount = static_cast<uint32_t>(shaderEntries.size());
+        header.bindingCount = static_cast<uint32_t>(bindingEntries.size());
+        header.specConstantCount = static_cast<uint32_t>(specConstantEntries.size());
+        header.stringsSize = static_cast<uint32_t>(strings.size());
+
+        if (path.has_parent_path()) {
+            std::filesystem::create_directories(path.parent_path());
+        }
+
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        if (!file) {
+            throw std::runtime_error("Failed to create the shader archive " + path.string());
+        }
+
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        writeTable(file, shaderEntries);
+        writeTable(file, bindingEntries);
+        writeTable(file, specConstantEntries);
+        file.write(strings.data(), static_cast<std::streamsize>(strings.size()));
+        for (const auto& shader : shaders) {
+            writeTable(file, shader.code);
+        }
+
+        if (!file) {
+            throw std::runtime_error("Failed to write the shader archive " + path.string());
+        }
+    }
+
+    void ShaderArchive::open(const std::filesystem::path& path) {
+        close();
+        file.open(path);
+
+        auto fail = [&](const char* reason) {
+            close();
+            throw std::runtime_error("Invalid shader archive " + path.string() + ": " + reason);
+        };
+
+        if (file.size() < sizeof(Header)) {
+            fail("truncated header");
+        }
+
+        Header header{};
+        std::memcpy(&header, file.data(), sizeof(header));
+        if (std::memcmp(header.magic, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC)) != 0 ||
+            header.version != ARCHIVE_VERSION) {
+            fail("unknown format");
+        }
+
+        uint64_t shadersOffset = sizeof(Header);
+        uint64_t bindingsOffset = shadersOffset + sizeof(ShaderEntry) * uint64_t(header.shaderCount);
+        uint64_t specConstantsOffset = bindingsOffset + sizeof(BindingEntry) * uint64_t(header.bindingCount);
+        uint64_t stringsOffset = specConstantsOffset +
+                                 sizeof(SpecConstantEntry) * uint64_t(header.specConstantCount);
+        if (stringsOffset + header.stringsSize > file.size()) {
+            fail("truncated tables");
+        }
+
+        auto string = [&](uint32_t offset, uint32_t length) {
+            if (uint64_t(offset) + length > header.stringsSize) {
+                fail("string out of bounds");
+            }
+            return std::string(reinterpret_cast<const char*>(file.data() + stringsOffset + offset), length);
+        };
+
+        for (uint32_t i = 0; i < header.shaderCount; ++i) {
+            ShaderEntry entry{};
+            std::memcpy(&entry, file.data() + shadersOffset + sizeof(ShaderEntry) * i, sizeof(entry));
+
+            if (entry.codeOffset % sizeof(uint32_t) != 0 || entry.codeSize % sizeof(uint32_t) != 0 ||
+                entry.codeOffset + entry.codeSize > file.size() ||
+                uint64_t(entry.firstBinding) + entry.bindingCount > header.bindingCount ||
+                uint64_t(entry.firstSpecConstant) + entry.specConstantCount > header.specConstantCount) {
+                fail("shader out of bounds");
+            }
+
+            ArchivedShader shader;
+            shader.code = reinterpret_cast<const uint32_t*>(file.data() + entry.codeOffset);
+            shader.codeSize = entry.codeSize;
+            shader.reflection.stage = static_cast<VkShaderStageFlagBits>(entry.stage);
+            shader.reflection.pushConstantOffset = entry.pushConstantOffset;
+            shader.reflection.pushConstantSize = entry.pushConstantSize;
+
+            for (uint32_t b = 0; b < entry.bindingCount; ++b) {
+                BindingEntry binding{};
+                std::memcpy(&binding, file.data() + bindingsOffset + sizeof(BindingEntry) * (entry.firstBinding + b),
+                            sizeof(binding));
+                shader.reflection.bindings.push_back({ binding.set, binding.binding,
+                                                       static_cast<VkDescriptorType>(binding.type), binding.count,
+                                                       static_cast<VkShaderStageFlags>(entry.stage) });
+            }
+
+            for (uint32_t c = 0; c < entry.specConstantCount; ++c) {
+                SpecConstantEntry constant{};
+                std::memcpy(&constant, file.data() + specConstantsOffset +
+                                       sizeof(SpecConstantEntry) * (entry.firstSpecConstant + c), sizeof(constant));
+                shader.reflection.specConstants.push_back({ constant.id, string(constant.nameOffset,
+                                                                                constant.nameLength),
+                                                            constant.defaultValue });
+            }
+
+            shaders.emplace(string(entry.nameOffset, entry.nameLength), std::move(shader));
+        }
+    }
+
+    void ShaderArchive::close() {
+        file.close();
+        shaders.clear();
+    }
+
+    const ArchivedShader* ShaderArchive::find(const std::string& name) const {
+        auto it = shaders.find(name);
+        return it == shaders.end() ? nullptr : &it->second;
+    }
+} // m4x
@@ -0,0 +1,77 @@
+/** @file */
+
+//
+// Created by m4tex on 17/10/26.
+//
+
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include "MappedFile.h"
+#include "ShaderReflection.h"
+
+// std
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace m4x {
+    /**
+     * Compiled shader to be written into an archive
+     */
+    struct ShaderSource {
+        // Name the engine looks the shader up by, the GLSL file name by convention
+        std::string           name;
+        std::vector<uint32_t> code;
+    };
+
+    /**
+     * Shader stored in an archive, its code points into the mapping
+     */
+    struct ArchivedShader {
+        const uint32_t*  code     = nullptr;
+        size_t           codeSize = 0;
+        ShaderReflection reflection;
+    };
+
+    /**
+     * Every SPIR-V module of the app in one file, along with the reflection of each, read through a memory
+     * mapping. The code of every shader starts 4 byte aligned in the file, so it's handed to Vulkan straight from
+     * the mapping.
+     */
+    class ShaderArchive {
+    public:
+        /**
+         * Reflects the shaders and writes them into a new archive, throws if one isn't valid SPIR-V
+         * @param path [in] File to write, replaced if it exists
+         * @param shaders [in] Shaders of the archive, names have to be unique
+         */
+        static void Write(const std::filesystem::path& path, const std::vector<ShaderSource>& shaders);
+
+        /**
+         * Maps an archive and reads its tables, throws if it isn't one
+         */
+        void open(const std::filesystem::path& path);
+
+        void close();
+
+        [[nodiscard]] bool isOpen() const { return file.isOpen(); }
+
+        /**
+         * @return The shader, nullptr if the archive has none by that name
+         */
+        [[nodiscard]] const ArchivedShader* find(const std::string& name) const;
+
+        [[nodiscard]] size_t shaderCount() const { return shaders.size(); }
+
+        [[nodiscard]] size_t size() const { return file.size(); }
+
+    private:
+        MappedFile file;
+        std::unordered_map<std::string, ArchivedShader> shaders;
+    };
+} // m4x
@@ -0,0 +1,276 @@
+//
+// Created by m4tex on 17/10/26.
+//
+
+#include "ShaderLibrary.h"
+#include "VkUtils.h"
+#include "CpuTracer.h"
+
+//std
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <map>
+#include <stdexcept>
+
+namespace m4x {
+    namespace {
+        const uint32_t SPIRV_MAGIC = 0x07230203;
+
+        // FNV-1a over whole words, SPIR-V is a stream of them anyway
+        uint64_t hashCode(const uint32_t* code, size_t words) {
+            uint64_t hash = 0xcbf29ce484222325ull;
+            for (size_t i = 0; i < words; ++i) {
+                hash ^= code[i];
+                hash *= 0x100000001b3ull;
+            }
+            // The size goes in too, so a prefix never shares a hash with its code by construction
+            hash ^= words;
+            hash *= 0x100000001b3ull;
+            return hash;
+        }
+    }
+
+    void ShaderLibrary::create(VkDevice device) {
+        this->device = device;
+    }
+
+    void ShaderLibrary::destroy() {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        for (auto& [key, cached] : modules) {
+            vkDestroyShaderModule(device, cached.module, nullptr);
+        }
+        for (auto setLayout : setLayouts) {
+            vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+        }
+        modules.clear();
+        names.clear();
+        setLayouts.clear();
+        archive.close();
+    }
+
+    void ShaderLibrary::openArchive(const std::filesystem::path& path) {
+        M4X_TRACE_SCOPE("open shader archive");
+        std::lock_guard<std::mutex> lock(mutex);
+
+        // Modules of the archive being closed keep comparing against a copy of their code
+        for (auto& [key, cached] : modules) {
+            if (cached.owned.empty()) {
+                cached.owned.assign(cached.code, cached.code + key.second / sizeof(uint32_t));
+                cached.code = cached.owned.data();
+            }
+        }
+
+        archive.open(path);
+        names.clear();
+    }
+
+    VkShaderModule ShaderLibrary::load(const std::string& name) {
+        const ArchivedShader* shader = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            auto found = names.find(name);
+            if (found != names.end()) {
+                libraryStats.nameHits++;
+                return found->second;
+            }
+
+            shader = archive.find(name);
+            if (!shader) {
+                throw std::runtime_error("No shader named " + name + " in the archive");
+            }
+        }
+
+        M4X_TRACE_SCOPE("load shader");
+        auto start = std::chrono::steady_clock::now();
+
+        bool created = false;
+        VkShaderModule shaderModule = findOrCreateModule(shader->code, shader->codeSize, true, created);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        names.emplace(name, shaderModule);
+
+        libraryStats.contentHits += created ? 0 : 1;
+        libraryStats.loadMs += std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - start).count();
+        return shaderModule;
+    }
+
+    VkShaderModule ShaderLibrary::load(const uint32_t* code, size_t codeSize) {
+        bool created = false;
+        VkShaderModule shaderModule = findOrCreateModule(code, codeSize, false, created);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        libraryStats.contentHits += created ? 0 : 1;
+        return shaderModule;
+    }
+
+    const ShaderReflection& ShaderLibrary::reflection(const std::string& name) const {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        const ArchivedShader* shader = archive.find(name);
+        if (!shader) {
+            throw std::runtime_error("No shader named " + name + " in the archive");
+        }
+        return shader->reflection;
+    }
+
+    ReflectedLayout ShaderLibrary::createPipelineLayout(const std::vector<std::string>& shaders,
+                                                        const std::vector<VkDescriptorSetLayout>& providedSets) {
+        // Merged over the shaders, a range per stage and the bindings of each set by binding number
+        std::map<VkShaderStageFlagBits, VkPushConstantRange> pushConstantRanges;
+        std::map<uint32_t, std::map<uint32_t, ReflectedBinding>> sets;
+
+        for (const auto& name : shaders) {
+            const ShaderReflection& shader = reflection(name);
+
+            if (shader.pushConstantSize > 0) {
+                auto [it, added] = pushConstantRanges.try_emplace(
+                        shader.stage, VkPushConstantRange{ static_cast<VkShaderStageFlags>(shader.stage),
+                                                           shader.pushConstantOffset, shader.pushConstantSize });
+                if (!added) {
+                    uint32_t end = std::max(it->second.offset + it->second.size,
+                                            shader.pushConstantOffset + shader.pushConstantSize);
+                    it->second.offset = std::min(it->second.offset, shader.pushConstantOffset);
+                    it->second.size = end - it->second.offset;
+                }
+            }
+
+            for (const auto& binding : shader.bindings) {
+                auto [it, added] = sets[binding.set].try_emplace(binding.binding, binding);
+                if (!added) {
+                    if (it->second.type != binding.type || it->second.count != binding.count) {
+                        throw std::runtime_error("Shader " + name + " declares set " + std::to_string(binding.set) +
+                                                 " binding " + std::to_string(binding.binding) +
+                                                 " differently than the other shaders of the layout");
+                    }
+                    it->second.stages |= binding.stages;
+                }
+            }
+        }
+
+        ReflectedLayout reflected;
+        reflected.setLayouts = providedSets;
+
+        uint32_t setCount = sets.empty() ? 0 : sets.rbegin()->first + 1;
+        for (uint32_t set = static_cast<uint32_t>(providedSets.size()); set < setCount; ++set) {
+            std::vector<VkDescriptorSetLayoutBinding> bindings;
+            for (const auto& [number, binding] : sets[set]) {
+                if (binding.count == 0) {
+                    throw std::runtime_error("Set " + std::to_string(set) + " has a runtime sized array, its layout "
+                                             "has to be provided");
+                }
+
+                VkDescriptorSetLayoutBinding layoutBinding{};
+                layoutBinding.binding = number;
+                layoutBinding.descriptorType = binding.type;
+                layoutBinding.descriptorCount = binding.count;
+                layoutBinding.stageFlags = binding.stages;
+                bindings.push_back(layoutBinding);
+            }
+
+            VkDescriptorSetLayoutCreateInfo layoutInfo{};
+            layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+            layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+            layoutInfo.pBindings = bindings.data();
+
+            VkDescriptorSetLayout setLayout;
+            if (VK_SUCCESS != vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &setLayout)) {
+                throw std::runtime_error("Failed to create a reflected descriptor set layout");
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                setLayouts.push_back(setLayout);
+            }
+            reflected.setLayouts.push_back(setLayout);
+        }
+
+        std::vector<VkPushConstantRange> ranges;
+        for (const auto& [stage, range] : pushConstantRanges) {
+            ranges.push_back(range);
+        }
+
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(reflected.setLayouts.size());
+        pipelineLayoutInfo.pSetLayouts = reflected.setLayouts.data();
+        pipelineLayoutInfo.pushConstantRangeCount = static_cast<uint32_t>(ranges.size());
+        pipelineLayoutInfo.pPushConstantRanges = ranges.data();
+
+        if (VK_SUCCESS != vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &reflected.layout)) {
+            throw std::runtime_error("Failed to create a reflected pipeline layout");
+        }
+        return reflected;
+    }
+
+    ShaderLibraryStats ShaderLibrary::stats() const {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        ShaderLibraryStats current = libraryStats;
+        current.modules = static_cast<uint32_t>(modules.size());
+        current.setLayouts = static_cast<uint32_t>(setLayouts.size());
+        current.archiveShaders = static_cast<uint32_t>(archive.shaderCount());
+        current.archiveBytes = archive.size();
+        return current;
+    }
+
+    void ShaderLibrary::printStats(std::ostream& out) const {
+        ShaderLibraryStats current = stats();
+
+        out << "Shaders: " << current.modules << " modules of " << current.archiveShaders << " archived shaders ("
+            << std::fixed << std::setprecision(2) << static_cast<double>(current.archiveBytes) / 1e3 << " kB) in "
+            << current.loadMs << " ms, " << current.nameHits << " name hits, " << current.contentHits
+            << " content hits, " << current.setLayouts << " reflected set layouts" << std::defaultfloat << std::endl;
+    }
+
+    VkShaderModule ShaderLibrary::findOrCreateModule(const uint32_t* code, size_t codeSize, bool archived,
+                                                     bool& created) {
+        if (codeSize < sizeof(uint32_t) || codeSize % sizeof(uint32_t) != 0 || code[0] != SPIRV_MAGIC) {
+            throw std::runtime_error("Invalid SPIR-V");
+        }
+
+        std::pair<uint64_t, size_t> key{ hashCode(code, codeSize / sizeof(uint32_t)), codeSize };
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            VkShaderModule found = findModuleLocked(key, code);
+            if (found != VK_NULL_HANDLE) {
+                created = false;
+                return found;
+            }
+        }
+
+        // Created without the mutex, a thread that loaded the same code meanwhile wins and ours is destroyed
+        VkShaderModule shaderModule = VkUtils::CreateShaderModule(code, codeSize, device);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        VkShaderModule found = findModuleLocked(key, code);
+        if (found != VK_NULL_HANDLE) {
+            vkDestroyShaderModule(device, shaderModule, nullptr);
+            created = false;
+            return found;
+        }
+
+        // Archived code stays mapped until the archive is closed, only code of the caller is copied
+        auto cached = modules.emplace(key, CachedModule{ code, {}, shaderModule });
+        if (!archived) {
+            cached->second.owned.assign(code, code + codeSize / sizeof(uint32_t));
+            cached->second.code = cached->second.owned.data();
+        }
+        created = true;
+        return shaderModule;
+    }
+
+    VkShaderModule ShaderLibrary::findModuleLocked(const std::pair<uint64_t, size_t>& key,
+                                                   const uint32_t* code) const {
+        auto [first, last] = modules.equal_range(key);
+        for (auto it = first; it != last; ++it) {
+            if (std::memcmp(it->second.code, code, key.second) == 0) {
+                return it->second.module;
+            }
+        }
+        return VK_NULL_HANDLE;
+    }
+} // m4x
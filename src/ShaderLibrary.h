@@ -0,0 +1,138 @@
+/** @file */
+
+//
+// Created by m4tex on 17/10/26.
+//
+
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include "ShaderArchive.h"
+
+// std
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace m4x {
+    struct ShaderLibraryStats {
+        uint32_t modules        = 0;
+        uint32_t setLayouts     = 0;
+        // Shaders in the open archive and the size of its mapping, the code is handed to vkCreateShaderModule from it
+        uint32_t archiveShaders = 0;
+        uint64_t archiveBytes   = 0;
+        // Loads answered by the name alone and loads of new names whose code had a module already
+        uint64_t nameHits       = 0;
+        uint64_t contentHits    = 0;
+        double   loadMs         = 0.0;
+    };
+
+    /**
+     * Pipeline layout built from the reflection of its shaders
+     */
+    struct ReflectedLayout {
+        // Owned by the caller
+        VkPipelineLayout layout = VK_NULL_HANDLE;
+        // Layout of every set, index is the set number. Owned by the library unless the caller provided it.
+        std::vector<VkDescriptorSetLayout> setLayouts;
+    };
+
+    /**
+     * Owns every shader module of the app, keyed by a hash and the size of its SPIR-V so identical code shares one
+     * module whatever name or archive it came from. The code is compared in full on a hit, a hash collision just
+     * gets a module of its own.
+     * Shaders are loaded by name from a memory mapped ShaderArchive, the build packs one with the reflection of each
+     * shader. The code is handed to vkCreateShaderModule straight from the mapping, and the reflection builds the
+     * descriptor set and push constant layouts, so they can't drift apart from the shaders.
+     * Safe to use from any thread, except for openArchive() and destroy().
+     */
+    class ShaderLibrary {
+    public:
+        void create(VkDevice device);
+
+        /**
+         * Destroys every module and set layout, none of the pipelines created from them may be building anymore
+         */
+        void destroy();
+
+        /**
+         * Maps the archive the shaders are loaded from by name, throws if it isn't a shader archive
+         * @param path [in] Archive written by ShaderArchive::Write(), the m4xshaders tool of the build
+         */
+        void openArchive(const std::filesystem::path& path);
+
+        /**
+         * Module of an archived shader, created on the first load of the name or of its code
+         * @param name [in] Name of the shader in the archive, throws if there is none
+         * @return Module owned by the library
+         */
+        VkShaderModule load(const std::string& name);
+
+        /**
+         * Module of SPIR-V already in memory, created unless the same code was loaded before
+         * @param code [in] SPIR-V words, only read during the call
+         * @param codeSize [in] Size of the code in bytes, a multiple of 4
+         * @return Module owned by the library
+         */
+        VkShaderModule load(const uint32_t* code, size_t codeSize);
+
+        /**
+         * @param name [in] Name of the shader in the archive, throws if there is none
+         * @return Reflection of the shader, valid until the archive is closed
+         */
+        [[nodiscard]] const ShaderReflection& reflection(const std::string& name) const;
+
+        /**
+         * Creates a pipeline layout covering the interface of every shader, the push constant ranges and bindings
+         * of stages are merged. Bindings that two shaders declare differently throw.
+         * @param shaders [in] Names of the shaders in the archive
+         * @param providedSets [in] Layouts of the first sets, used as they are instead of reflected ones
+         */
+        ReflectedLayout createPipelineLayout(const std::vector<std::string>& shaders,
+                                             const std::vector<VkDescriptorSetLayout>& providedSets = {});
+
+        [[nodiscard]] ShaderLibraryStats stats() const;
+
+        void printStats(std::ostream& out) const;
+
+    private:
+        VkDevice device = VK_NULL_HANDLE;
+
+        struct CachedModule {
+            // Compared against on a hit, points into the archive mapping or at owned
+            const uint32_t*       code;
+            // Copy of code passed in by a caller, empty for archived code
+            std::vector<uint32_t> owned;
+            VkShaderModule        module;
+        };
+
+        // Keyed by the hash and the byte size of the code, codes whose hashes collide share a key
+        std::multimap<std::pair<uint64_t, size_t>, CachedModule> modules;
+        std::unordered_map<std::string, VkShaderModule> names;
+        std::vector<VkDescriptorSetLayout> setLayouts;
+        ShaderArchive archive;
+        ShaderLibraryStats libraryStats;
+
+        mutable std::mutex mutex;
+
+        /**
+         * Looks the code up and creates its module if it's new. The mutex must not be held, it is only taken around
+         * the lookups so compile threads create their modules in parallel.
+         * @param archived [in] If the code lies in the archive mapping, which the cache then points into instead of
+         * copying it
+         */
+        VkShaderModule findOrCreateModule(const uint32_t* code, size_t codeSize, bool archived, bool& created);
+
+        /**
+         * @return Module of exactly this code, VK_NULL_HANDLE if there is none. The mutex has to be held.
+         */
+        VkShaderModule findModuleLocked(const std::pair<uint64_t, size_t>& key, const uint32_t* code) const;
+    };
+} // m4x
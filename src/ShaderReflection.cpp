@@ -0,0 +1,390 @@
+//
+// Created by m4tex on 17/10/26.
+//
+
+#include "ShaderReflection.h"
+
+//std
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace m4x {
+    namespace {
+        const uint32_t SPIRV_MAGIC = 0x07230203;
+        const size_t   SPIRV_HEADER_WORDS = 5;
+
+        // Opcodes
+        const uint32_t OP_NAME                 = 5;
+        const uint32_t OP_ENTRY_POINT          = 15;
+        const uint32_t OP_TYPE_BOOL            = 20;
+        const uint32_t OP_TYPE_INT             = 21;
+        const uint32_t OP_TYPE_FLOAT           = 22;
+        const uint32_t OP_TYPE_VECTOR          = 23;
+        const uint32_t OP_TYPE_MATRIX          = 24;
+        const uint32_t OP_TYPE_IMAGE           = 25;
+        const uint32_t OP_TYPE_SAMPLER         = 26;
+        const uint32_t OP_TYPE_SAMPLED_IMAGE   = 27;
+        const uint32_t OP_TYPE_ARRAY           = 28;
+        const uint32_t OP_TYPE_RUNTIME_ARRAY   = 29;
+        const uint32_t OP_TYPE_STRUCT          = 30;
+        const uint32_t OP_TYPE_POINTER         = 32;
+        const uint32_t OP_CONSTANT             = 43;
+        const uint32_t OP_SPEC_CONSTANT_TRUE   = 48;
+        const uint32_t OP_SPEC_CONSTANT_FALSE  = 49;
+        const uint32_t OP_SPEC_CONSTANT        = 50;
+        const uint32_t OP_VARIABLE             = 59;
+        const uint32_t OP_DECORATE             = 71;
+        const uint32_t OP_MEMBER_DECORATE      = 72;
+
+        // Decorations
+        const uint32_t DECORATION_SPEC_ID        = 1;
+        const uint32_t DECORATION_BUFFER_BLOCK   = 3;
+        const uint32_t DECORATION_ARRAY_STRIDE   = 6;
+        const uint32_t DECORATION_MATRIX_STRIDE  = 7;
+        const uint32_t DECORATION_BINDING        = 33;
+        const uint32_t DECORATION_DESCRIPTOR_SET = 34;
+        const uint32_t DECORATION_OFFSET         = 35;
+
+        // Storage classes
+        const uint32_t STORAGE_UNIFORM_CONSTANT = 0;
+        const uint32_t STORAGE_UNIFORM          = 2;
+        const uint32_t STORAGE_PUSH_CONSTANT    = 9;
+        const uint32_t STORAGE_STORAGE_BUFFER   = 12;
+
+        // Image dimensions
+        const uint32_t DIM_BUFFER        = 5;
+        const uint32_t DIM_SUBPASS_DATA  = 6;
+
+        const uint32_t NONE = std::numeric_limits<uint32_t>::max();
+
+        struct Member {
+            uint32_t offset       = 0;
+            uint32_t matrixStride = 0;
+        };
+
+        /**
+         * Everything an id was declared or decorated with, only the parts the reflection needs
+         */
+        struct Id {
+            uint32_t opcode        = 0;
+            std::vector<uint32_t> operands;
+            std::string name;
+            uint32_t set           = NONE;
+            uint32_t binding       = NONE;
+            uint32_t specId        = NONE;
+            uint32_t arrayStride   = 0;
+            bool     bufferBlock   = false;
+            std::vector<Member> members;
+        };
+
+        class Parser {
+        public:
+            Parser(const uint32_t* code, size_t words) : code(code), words(words) {}
+
+            ShaderReflection parse() {
+                if (words < SPIRV_HEADER_WORDS || code[0] != SPIRV_MAGIC) {
+                    throw std::runtime_error("Not a SPIR-V module");
+                }
+
+                ids.resize(code[3]);
+                bool entryPointFound = false;
+                ShaderReflection reflection;
+
+                for (size_t word = SPIRV_HEADER_WORDS; word < words;) {
+                    uint32_t count = code[word] >> 16;
+                    uint32_t opcode = code[word] & 0xffff;
+                    if (count == 0 || word + count > words) {
+                        throw std::runtime_error("Truncated SPIR-V instruction");
+                    }
+
+                    const uint32_t* operands = code + word + 1;
+                    uint32_t operandCount = count - 1;
+                    word += count;
+
+                    switch (opcode) {
+                        case OP_NAME:
+                            id(operands[0]).name = string(operands + 1, operandCount - 1);
+                            break;
+                        case OP_ENTRY_POINT:
+                            if (!entryPointFound) {
+                                reflection.stage = stage(operands[0]);
+                                entryPointFound = true;
+                            }
+                            break;
+                        case OP_DECORATE:
+                            decorate(id(operands[0]), operands[1], operandCount > 2 ? operands[2] : 0);
+                            break;
+                        case OP_MEMBER_DECORATE: {
+                            Id& structure = id(operands[0]);
+                            if (structure.members.size() <= operands[1]) {
+                                structure.members.resize(operands[1] + 1);
+                            }
+                            if (operands[2] == DECORATION_OFFSET) {
+                                structure.members[operands[1]].offset = operands[3];
+                            } else if (operands[2] == DECORATION_MATRIX_STRIDE) {
+                                structure.members[operands[1]].matrixStride = operands[3];
+                            }
+                            break;
+                        }
+                        case OP_TYPE_BOOL:
+                        case OP_TYPE_INT:
+                        case OP_TYPE_FLOAT:
+                        case OP_TYPE_VECTOR:
+                        case OP_TYPE_MATRIX:
+                        case OP_TYPE_IMAGE:
+                        case OP_TYPE_SAMPLER:
+                        case OP_TYPE_SAMPLED_IMAGE:
+                        case OP_TYPE_ARRAY:
+                        case OP_TYPE_RUNTIME_ARRAY:
+                        case OP_TYPE_STRUCT:
+                        case OP_TYPE_POINTER:
+                            declare(operands[0], opcode, operands + 1, operandCount - 1);
+                            break;
+                        case OP_CONSTANT:
+                        case OP_SPEC_CONSTANT_TRUE:
+                        case OP_SPEC_CONSTANT_FALSE:
+                        case OP_SPEC_CONSTANT:
+                        case OP_VARIABLE:
+                            // Result type first, then the result id
+                            declare(operands[1], opcode, operands + 2, operandCount - 2);
+                            variableTypes.emplace(operands[1], operands[0]);
+                            break;
+                        default:
+                            break;
+                    }
+                }
+
+                if (!entryPointFound) {
+                    throw std::runtime_error("SPIR-V module without an entry point");
+                }
+
+                for (uint32_t i = 0; i < ids.size(); ++i) {
+                    const Id& current = ids[i];
+
+                    if (current.opcode == OP_VARIABLE) {
+                        reflectVariable(i, reflection);
+                    } else if (current.specId != NONE && (current.opcode == OP_SPEC_CONSTANT ||
+                                                          current.opcode == OP_SPEC_CONSTANT_TRUE ||
+                                                          current.opcode == OP_SPEC_CONSTANT_FALSE)) {
+                        ReflectedSpecConstant constant;
+                        constant.id = current.specId;
+                        constant.name = current.name;
+                        constant.defaultValue = current.opcode == OP_SPEC_CONSTANT
+                                                ? (current.operands.empty() ? 0 : current.operands[0])
+                                                : (current.opcode == OP_SPEC_CONSTANT_TRUE ? 1 : 0);
+                        reflection.specConstants.push_back(constant);
+                    }
+                }
+
+                for (auto& binding : reflection.bindings) {
+                    binding.stages = reflection.stage;
+                }
+                std::sort(reflection.bindings.begin(), reflection.bindings.end(),
+                          [](const ReflectedBinding& a, const ReflectedBinding& b) {
+                              return a.set != b.set ? a.set < b.set : a.binding < b.binding;
+                          });
+
+                return reflection;
+            }
+
+        private:
+            const uint32_t* code;
+            size_t words;
+            std::vector<Id> ids;
+            // Result type of every constant and variable
+            std::unordered_map<uint32_t, uint32_t> variableTypes;
+
+            Id& id(uint32_t index) {
+                if (index >= ids.size()) {
+                    throw std::runtime_error("SPIR-V id out of bounds");
+                }
+                return ids[index];
+            }
+
+            static std::string string(const uint32_t* operands, uint32_t count) {
+                std::string result;
+                for (uint32_t i = 0; i < count; ++i) {
+                    for (uint32_t byte = 0; byte < 4; ++byte) {
+                        char character = static_cast<char>((operands[i] >> (8 * byte)) & 0xff);
+                        if (character == '\0') {
+                            return result;
+                        }
+                        result.push_back(character);
+                    }
+                }
+                return result;
+            }
+
+            static VkShaderStageFlagBits stage(uint32_t executionModel) {
+                switch (executionModel) {
+                    case 0: return VK_SHADER_STAGE_VERTEX_BIT;
+                    case 1: return VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT;
+                    case 2: return VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT;
+                    case 3: return VK_SHADER_STAGE_GEOMETRY_BIT;
+                    case 4: return VK_SHADER_STAGE_FRAGMENT_BIT;
+                    case 5: return VK_SHADER_STAGE_COMPUTE_BIT;
+                    default:
+                        throw std::runtime_error("Unsupported SPIR-V execution model");
+                }
+            }
+
+            void declare(uint32_t index, uint32_t opcode, const uint32_t* operands, uint32_t count) {
+                Id& declared = id(index);
+                declared.opcode = opcode;
+                declared.operands.assign(operands, operands + count);
+            }
+
+            static void decorate(Id& target, uint32_t decoration, uint32_t value) {
+                switch (decoration) {
+                    case DECORATION_SPEC_ID:        target.specId = value; break;
+                    case DECORATION_BUFFER_BLOCK:   target.bufferBlock = true; break;
+                    case DECORATION_ARRAY_STRIDE:   target.arrayStride = value; break;
+                    case DECORATION_BINDING:        target.binding = value; break;
+                    case DECORATION_DESCRIPTOR_SET: target.set = value; break;
+                    default: break;
+                }
+            }
+
+            uint32_t constantValue(uint32_t index) {
+                const Id& constant = id(index);
+                if (constant.opcode != OP_CONSTANT && constant.opcode != OP_SPEC_CONSTANT) {
+                    throw std::runtime_error("SPIR-V array length isn't a constant");
+                }
+                return constant.operands.empty() ? 0 : constant.operands[0];
+            }
+
+            /**
+             * Bytes a type takes in an explicitly laid out block
+             */
+            uint32_t typeSize(uint32_t index, uint32_t matrixStride = 0) {
+                const Id& type = id(index);
+                switch (type.opcode) {
+                    case OP_TYPE_BOOL:
+                        return 4;
+                    case OP_TYPE_INT:
+                    case OP_TYPE_FLOAT:
+                        return type.operands[0] / 8;
+                    case OP_TYPE_VECTOR:
+                        return typeSize(type.operands[0]) * type.operands[1];
+                    case OP_TYPE_MATRIX:
+                        return (matrixStride > 0 ? matrixStride : typeSize(type.operands[0])) * type.operands[1];
+                    case OP_TYPE_ARRAY: {
+                        uint32_t stride = type.arrayStride > 0 ? type.arrayStride : typeSize(type.operands[0]);
+                        return stride * constantValue(type.operands[1]);
+                    }
+                    case OP_TYPE_RUNTIME_ARRAY:
+                        return 0;
+                    case OP_TYPE_STRUCT: {
+                        uint32_t size = 0;
+                        for (uint32_t member = 0; member < type.operands.size(); ++member) {
+                            Member layout = member < type.members.size() ? type.members[member] : Member{};
+                            size = std::max(size, layout.offset + typeSize(type.operands[member],
+                                                                           layout.matrixStride));
+                        }
+                        return size;
+                    }
+                    default:
+                        throw std::runtime_error("Unsupported type in a SPIR-V block");
+                }
+            }
+
+            void reflectVariable(uint32_t index, ShaderReflection& reflection) {
+                const Id& variable = ids[index];
+                uint32_t storage = variable.operands[0];
+
+                const Id& pointer = id(variableTypes.at(index));
+                if (pointer.opcode != OP_TYPE_POINTER) {
+                    throw std::runtime_error("SPIR-V variable without a pointer type");
+                }
+                uint32_t typeIndex = pointer.operands[1];
+
+                if (storage == STORAGE_PUSH_CONSTANT) {
+                    const Id& block = id(typeIndex);
+                    uint32_t first = std::numeric_limits<uint32_t>::max();
+                    for (uint32_t member = 0; member < block.operands.size(); ++member) {
+                        first = std::min(first, member < block.members.size() ? block.members[member].offset : 0);
+                    }
+                    if (block.operands.empty()) {
+                        first = 0;
+                    }
+
+                    reflection.pushConstantOffset = first;
+                    reflection.pushConstantSize = typeSize(typeIndex) - first;
+                    return;
+                }
+
+                if (storage != STORAGE_UNIFORM_CONSTANT && storage != STORAGE_UNIFORM &&
+                    storage != STORAGE_STORAGE_BUFFER) {
+                    return;
+                }
+
+                if (variable.set == NONE || variable.binding == NONE) {
+                    return;
+                }
+
+                ReflectedBinding binding;
+                binding.set = variable.set;
+                binding.binding = variable.binding;
+
+                // Arrays of descriptors multiply the count, runtime sized ones make it 0
+                while (id(typeIndex).opcode == OP_TYPE_ARRAY || id(typeIndex).opcode == OP_TYPE_RUNTIME_ARRAY) {
+                    const Id& array = id(typeIndex);
+                    binding.count = array.opcode == OP_TYPE_ARRAY ? binding.count * constantValue(array.operands[1])
+                                                                  : 0;
+                    typeIndex = array.operands[0];
+                }
+
+                const Id& type = id(typeIndex);
+                switch (type.opcode) {
+                    case OP_TYPE_SAMPLER:
+                        binding.type = VK_DESCRIPTOR_TYPE_SAMPLER;
+                        break;
+                    case OP_TYPE_SAMPLED_IMAGE:
+                        binding.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+                        break;
+                    case OP_TYPE_IMAGE: {
+                        uint32_t dim = type.operands[1];
+                        uint32_t sampled = type.operands[5];
+                        if (dim == DIM_SUBPASS_DATA) {
+                            binding.type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+                        } else if (dim == DIM_BUFFER) {
+                            binding.type = sampled == 2 ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER
+                                                        : VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+                        } else {
+                            binding.type = sampled == 2 ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE
+                                                        : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+                        }
+                        break;
+                    }
+                    case OP_TYPE_STRUCT:
+                        // Before SPIR-V 1.3 storage buffers were Uniform blocks decorated BufferBlock
+                        binding.type = storage == STORAGE_STORAGE_BUFFER || type.bufferBlock
+                                       ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+                        break;
+                    default:
+                        throw std::runtime_error("Unsupported SPIR-V descriptor type");
+                }
+
+                reflection.bindings.push_back(binding);
+            }
+        };
+    }
+
+    const ReflectedSpecConstant* ShaderReflection::specConstant(const std::string& name) const {
+        for (const auto& constant : specConstants) {
+            if (constant.name == name) {
+                return &constant;
+            }
+        }
+        return nullptr;
+    }
+
+    ShaderReflection ReflectSpirv(const uint32_t* code, size_t codeSize) {
+        if (codeSize % sizeof(uint32_t) != 0) {
+            throw std::runtime_error("Not a SPIR-V module");
+        }
+        return Parser(code, codeSize / sizeof(uint32_t)).parse();
+    }
+} // m4x
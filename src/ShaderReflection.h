@@ -0,0 +1,64 @@
+/** @file */
+
+//
+// Created by m4tex on 17/10/26.
+//
+
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+// std
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace m4x {
+    /**
+     * Descriptor a shader declares
+     */
+    struct ReflectedBinding {
+        uint32_t           set     = 0;
+        uint32_t           binding = 0;
+        VkDescriptorType   type    = VK_DESCRIPTOR_TYPE_MAX_ENUM;
+        // Array size, 0 for a runtime sized array
+        uint32_t           count   = 1;
+        VkShaderStageFlags stages  = 0;
+    };
+
+    /**
+     * Specialization constant a shader declares
+     */
+    struct ReflectedSpecConstant {
+        uint32_t    id           = 0;
+        // Empty if the compiler stripped the names
+        std::string name;
+        // Raw bits of the default value, booleans are 0 or 1
+        uint32_t    defaultValue = 0;
+    };
+
+    /**
+     * Interface of a shader's entry point, everything a pipeline layout and specialization need
+     */
+    struct ShaderReflection {
+        VkShaderStageFlagBits              stage = VK_SHADER_STAGE_ALL;
+        std::vector<ReflectedBinding>      bindings;
+        // Bytes of the push constant block the shader reads, size 0 without one
+        uint32_t                           pushConstantOffset = 0;
+        uint32_t                           pushConstantSize   = 0;
+        std::vector<ReflectedSpecConstant> specConstants;
+
+        /**
+         * @return The constant with the name, nullptr if the shader has none
+         */
+        [[nodiscard]] const ReflectedSpecConstant* specConstant(const std::string& name) const;
+    };
+
+    /**
+     * Reads the interface of the first entry point of a SPIR-V module, throws if the code isn't valid SPIR-V
+     * @param code [in] SPIR-V words
+     * @param codeSize [in] Size of the code in bytes
+     */
+    ShaderReflection ReflectSpirv(const uint32_t* code, size_t codeSize);
+} // m4x
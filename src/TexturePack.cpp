@@ -0,0 +1,253 @@
+//
+// Created by m4tex on 17/10/26.
+//
+
+#include "TexturePack.h"
+
+//std
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+namespace m4x {
+    namespace {
+        const char     PACK_MAGIC[4] = { 'M', '4', 'X', 'T' };
+        const uint32_t PACK_VERSION  = 1;
+
+        // A packet header with this bit set repeats one texel, without it the texels follow as they are
+        const uint32_t RUN_BIT = 0x80000000u;
+        const uint32_t MAX_PACKET = RUN_BIT - 1;
+
+        struct Header {
+            char     magic[4];
+            uint32_t version;
+            uint32_t textureCount;
+            uint32_t levelCount;
+        };
+
+        struct TextureEntry {
+            uint32_t width;
+            uint32_t height;
+            uint32_t levels;
+            uint32_t format;
+        };
+
+        struct LevelEntry {
+            uint64_t offset;
+            uint64_t encodedSize;
+            uint64_t size;
+        };
+
+        std::vector<uint32_t> encode(const std::vector<uint32_t>& texels) {
+            std::vector<uint32_t> encoded;
+            size_t i = 0;
+
+            while (i < texels.size()) {
+                size_t run = 1;
+                while (i + run < texels.size() && run < MAX_PACKET && texels[i + run] == texels[i]) {
+                    run++;
+                }
+
+                // Runs shorter than three texels are cheaper as part of a literal
+                if (run >= 3) {
+                    encoded.push_back(RUN_BIT | static_cast<uint32_t>(run));
+                    encoded.push_back(texels[i]);
+                    i += run;
+                    continue;
+                }
+
+                size_t end = i;
+                while (end < texels.size() && end - i < MAX_PACKET) {
+                    if (end + 2 < texels.size() && texels[end] == texels[end + 1] && texels[end] == texels[end + 2]) {
+                        break;
+                    }
+                    end++;
+                }
+
+                encoded.push_back(static_cast<uint32_t>(end - i));
+                encoded.insert(encoded.end(), texels.begin() + static_cast<ptrdiff_t>(i),
+                               texels.begin() + static_cast<ptrdiff_t>(end));
+                i = end;
+            }
+
+            return encoded;
+        }
+    }
+
+    void TexturePack::Write(const std::filesystem::path& path, const std::vector<TextureSource>& textures) {
+        std::vector<TextureEntry> textureEntries;
+        std::vector<LevelEntry> levelEntries;
+        std::vector<std::vector<uint32_t>> encodedLevels;
+
+        for (const auto& source : textures) {
+            textureEntries.push_back({ source.width, source.height, static_cast<uint32_t>(source.levels.size()),
+                                       static_cast<uint32_t>(VK_FORMAT_R8G8B8A8_UNORM) });
+
+            for (const auto& level : source.levels) {
+                encodedLevels.push_back(encode(level));
+                levelEntries.push_back({ 0, encodedLevels.back().size() * sizeof(uint32_t),
+                                         level.size() * sizeof(uint32_t) });
+            }
+        }
+
+        uint64_t offset = sizeof(Header) + sizeof(TextureEntry) * textureEntries.size() +
+                          sizeof(LevelEntry) * levelEntries.size();
+        for (auto& level : levelEntries) {
+            level.offset = offset;
+            offset += level.encodedSize;
+        }
+
+        Header header{};
+        std::memcpy(header.magic, PACK_MAGIC, sizeof(PACK_MAGIC));
+        header.version = PACK_VERSION;
+        header.textureCount = static_cast<uint32_t>(textureEntries.size());
+        header.levelCount = static_cast<uint32_t>(levelEntries.size());
+
+        if (path.has_parent_path()) {
+            std::filesystem::create_directories(path.parent_path());
+        }
+
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        if (!file) {
+            throw std::runtime_error("Failed to create the texture pack " + path.string());
+        }
+
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(textureEntries.data()),
+                   static_cast<std::streamsize>(sizeof(TextureEntry) * textureEntries.size()));
+        file.write(reinterpret_cast<const char*>(levelEntries.data()),
+                   static_cast<std::streamsize>(sizeof(LevelEntry) * levelEntries.size()));
+        for (const auto& level : encodedLevels) {
+            file.write(reinterpret_cast<const char*>(level.data()),
+                       static_cast<std::streamsize>(level.size() * sizeof(uint32_t)));
+        }
+
+        if (!file) {
+            throw std::runtime_error("Failed to write the texture pack " + path.string());
+        }
+    }
+
+    void TexturePack::open(const std::filesystem::path& path) {
+        close();
+        file.open(path);
+
+        auto fail = [&](const char* reason) {
+            close();
+            throw std::runtime_error("Invalid texture pack " + path.string() + ": " + reason);
+        };
+
+        if (file.size() < sizeof(Header)) {
+            fail("truncated header");
+        }
+
+        Header header{};
+        std::memcpy(&header, file.data(), sizeof(header));
+        if (std::memcmp(header.magic, PACK_MAGIC, sizeof(PACK_MAGIC)) != 0 || header.version != PACK_VERSION) {
+            fail("unknown format");
+        }
+
+        uint64_t tablesEnd = sizeof(Header) + sizeof(TextureEntry) * uint64_t(header.textureCount) +
+                             sizeof(LevelEntry) * uint64_t(header.levelCount);
+        if (tablesEnd > file.size()) {
+            fail("truncated tables");
+        }
+
+        const uint8_t* cursor = file.data() + sizeof(Header);
+        uint32_t levelTotal = 0;
+
+        for (uint32_t i = 0; i < header.textureCount; ++i) {
+            TextureEntry entry{};
+            std::memcpy(&entry, cursor, sizeof(entry));
+            cursor += sizeof(entry);
+
+            if (entry.width == 0 || entry.height == 0 || entry.levels == 0 || entry.levels > 32) {
+                fail("bad texture entry");
+            }
+
+            textures.push_back({ entry.width, entry.height, entry.levels, static_cast<VkFormat>(entry.format) });
+            firstLevels.push_back(levelTotal);
+            levelTotal += entry.levels;
+        }
+
+        if (levelTotal != header.levelCount) {
+            fail("level count mismatch");
+        }
+
+        for (uint32_t i = 0; i < header.levelCount; ++i) {
+            LevelEntry entry{};
+            std::memcpy(&entry, cursor, sizeof(entry));
+            cursor += sizeof(entry);
+
+            if (entry.offset < tablesEnd || entry.offset + entry.encodedSize > file.size()) {
+                fail("level out of bounds");
+            }
+
+            levels.push_back({ entry.offset, entry.encodedSize, entry.size });
+        }
+
+        for (uint32_t texture = 0; texture < textureCount(); ++texture) {
+            for (uint32_t level = 0; level < textures[texture].levels; ++level) {
+                VkExtent2D extent = levelExtent(texture, level);
+                if (levels[firstLevels[texture] + level].size != uint64_t(extent.width) * extent.height * 4) {
+                    fail("level size mismatch");
+                }
+            }
+        }
+    }
+
+    void TexturePack::close() {
+        file.close();
+        textures.clear();
+        firstLevels.clear();
+        levels.clear();
+    }
+
+    VkExtent2D TexturePack::levelExtent(uint32_t texture, uint32_t level) const {
+        const PackedTexture& packed = textures[texture];
+        return { std::max(packed.width >> level, 1u), std::max(packed.height >> level, 1u) };
+    }
+
+    VkDeviceSize TexturePack::levelSize(uint32_t texture, uint32_t level) const {
+        return levels[firstLevels[texture] + level].size;
+    }
+
+    void TexturePack::decode(uint32_t texture, uint32_t level, std::vector<uint8_t>& out) const {
+        const Level& stored = levels[firstLevels[texture] + level];
+
+        out.resize(stored.size);
+        auto* texels = reinterpret_cast<uint32_t*>(out.data());
+        size_t texelCount = stored.size / sizeof(uint32_t);
+
+        const uint8_t* input = file.data() + stored.offset;
+        size_t words = stored.encodedSize / sizeof(uint32_t);
+        size_t written = 0;
+
+        auto read = [&](size_t word) {
+            uint32_t value;
+            std::memcpy(&value, input + word * sizeof(uint32_t), sizeof(value));
+            return value;
+        };
+
+        for (size_t word = 0; word < words;) {
+            uint32_t packet = read(word++);
+            size_t count = packet & MAX_PACKET;
+
+            if (written + count > texelCount || word + ((packet & RUN_BIT) ? 1 : count) > words) {
+                throw std::runtime_error("Corrupt texture pack level");
+            }
+
+            if (packet & RUN_BIT) {
+                std::fill_n(texels + written, count, read(word++));
+            } else {
+                std::memcpy(texels + written, input + word * sizeof(uint32_t), count * sizeof(uint32_t));
+                word += count;
+            }
+            written += count;
+        }
+
+        if (written != texelCount) {
+            throw std::runtime_error("Corrupt texture pack level");
+        }
+    }
+} // m4x
@@ -0,0 +1,93 @@
+/** @file */
+
+//
+// Created by m4tex on 17/10/26.
+//
+
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include "MappedFile.h"
+
+// std
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+namespace m4x {
+    /**
+     * Mip chain of an RGBA8 texture to be written into a pack
+     */
+    struct TextureSource {
+        uint32_t width  = 0;
+        uint32_t height = 0;
+        // Level 0 first, every level half the size of the previous one, rounded down and at least 1
+        std::vector<std::vector<uint32_t>> levels;
+    };
+
+    /**
+     * Texture stored in a pack
+     */
+    struct PackedTexture {
+        uint32_t width  = 0;
+        uint32_t height = 0;
+        uint32_t levels = 0;
+        VkFormat format = VK_FORMAT_UNDEFINED;
+    };
+
+    /**
+     * Container of compressed mip chains, read through a memory mapping.
+     * Every level is compressed on its own with a run length code over whole texels, so any level can be decoded
+     * without touching the others and only the pages of the levels actually loaded get read from disk.
+     */
+    class TexturePack {
+    public:
+        /**
+         * Compresses the textures and writes them into a new pack
+         * @param path [in] File to write, replaced if it exists
+         * @param textures [in] Textures of the pack, their index is their id in the pack
+         */
+        static void Write(const std::filesystem::path& path, const std::vector<TextureSource>& textures);
+
+        /**
+         * Maps a pack and validates its tables, throws if it isn't one
+         */
+        void open(const std::filesystem::path& path);
+
+        void close();
+
+        [[nodiscard]] uint32_t textureCount() const { return static_cast<uint32_t>(textures.size()); }
+
+        [[nodiscard]] const PackedTexture& texture(uint32_t index) const { return textures[index]; }
+
+        [[nodiscard]] VkExtent2D levelExtent(uint32_t texture, uint32_t level) const;
+
+        /**
+         * Bytes of a level once decoded
+         */
+        [[nodiscard]] VkDeviceSize levelSize(uint32_t texture, uint32_t level) const;
+
+        /**
+         * Decompresses a level, safe to call from any thread
+         * @param texture [in] Texture in the pack
+         * @param level [in] Mip level of the texture
+         * @param out [out] Tightly packed texels of the level
+         */
+        void decode(uint32_t texture, uint32_t level, std::vector<uint8_t>& out) const;
+
+    private:
+        struct Level {
+            uint64_t offset;
+            uint64_t encodedSize;
+            uint64_t size;
+        };
+
+        MappedFile file;
+        std::vector<PackedTexture> textures;
+        // Index of the first level of every texture in levels
+        std::vector<uint32_t> firstLevels;
+        std::vector<Level> levels;
+    };
+} // m4x
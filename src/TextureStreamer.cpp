@@ -0,0 +1,398 @@
+//
+// Created by m4tex on 17/10/26.
+//
+
+#include "TextureStreamer.h"
+#include "VkUtils.h"
+#include "CpuTracer.h"
+
+//std
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <stdexcept>
+
+namespace m4x {
+    namespace {
+        // Nothing sampled the texture during the frame
+        const uint32_t NOT_SAMPLED = UINT32_MAX;
+    }
+
+    void TextureStreamer::create(VkPhysicalDevice physicalDevice, VkDevice device, MemoryAllocator& allocator,
+                                 UploadQueue& uploadQueue, DescriptorHeap& heap, DeletionQueue& deletionQueue,
+                                 uint32_t framesInFlight, const std::filesystem::path& pack, bool memoryBudget,
+                                 VkDeviceSize budgetLimit) {
+        this->physicalDevice = physicalDevice;
+        this->device = device;
+        this->allocator = &allocator;
+        this->uploadQueue = &uploadQueue;
+        this->heap = &heap;
+        this->deletionQueue = &deletionQueue;
+        this->framesInFlight = framesInFlight;
+        this->memoryBudget = memoryBudget;
+        this->budgetLimit = budgetLimit;
+        this->pack.open(pack);
+
+        const VkPhysicalDeviceMemoryProperties& memoryProperties = allocator.memoryProperties();
+        for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; ++i) {
+            if ((memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) &&
+                memoryProperties.memoryHeaps[i].size > memoryProperties.memoryHeaps[memoryHeap].size) {
+                memoryHeap = i;
+            }
+        }
+
+        // The tails are small enough to decode right away, so every texture is sampleable from the first frame
+        textures.resize(this->pack.textureCount());
+        for (uint32_t i = 0; i < textureCount(); ++i) {
+            uint32_t firstLevel = tailLevel(i);
+
+            std::vector<std::vector<uint8_t>> levels(this->pack.texture(i).levels - firstLevel);
+            for (uint32_t level = 0; level < levels.size(); ++level) {
+                this->pack.decode(i, firstLevel + level, levels[level]);
+            }
+
+            textures[i].tail = createImage(i, firstLevel, levels);
+            textures[i].wanted = firstLevel;
+            streamingStats.tailBytes += textures[i].tail.memory.size;
+        }
+
+        VkDeviceSize tableSize = std::max<VkDeviceSize>(textureCount(), 1) * 2 * sizeof(uint32_t);
+        VkDeviceSize feedbackSize = std::max<VkDeviceSize>(textureCount(), 1) * sizeof(uint32_t);
+
+        frames.resize(framesInFlight);
+        for (auto& frame : frames) {
+            frame.residency = allocator.createBuffer(tableSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                                     { VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                                       VK_MEMORY_PROPERTY_HOST_COHERENT_BIT });
+            frame.feedback = allocator.createBuffer(feedbackSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                                    { VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                                      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT });
+            std::memset(frame.feedback->allocation.mapped, 0xff, feedbackSize);
+
+            frame.residencyIndex = heap.addBuffer(frame.residency->buffer);
+            frame.feedbackIndex = heap.addBuffer(frame.feedback->buffer);
+        }
+
+        streamingStats.budget = queryBudget();
+        created = Clock::now();
+
+        stopping = false;
+        for (uint32_t i = 0; i < STREAMING_IO_THREADS; ++i) {
+            threads.emplace_back(&TextureStreamer::ioThread, this);
+        }
+    }
+
+    void TextureStreamer::destroy() {
+        {
+            std::lock_guard<std::mutex> lock(requestMutex);
+            stopping = true;
+            requests.clear();
+        }
+        requestAdded.notify_all();
+
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        threads.clear();
+        results.clear();
+
+        for (auto& texture : textures) {
+            destroyImage(texture.detail);
+            destroyImage(texture.tail);
+        }
+        textures.clear();
+
+        for (auto& frame : frames) {
+            heap->release(DescriptorTable::Buffer, frame.residencyIndex);
+            heap->release(DescriptorTable::Buffer, frame.feedbackIndex);
+            allocator->destroyBuffer(frame.residency);
+            allocator->destroyBuffer(frame.feedback);
+        }
+        frames.clear();
+
+        pack.close();
+    }
+
+    void TextureStreamer::update(uint32_t slot, uint64_t frame) {
+        M4X_TRACE_SCOPE("texture streaming");
+
+        // The slot's previous frame completed, so its feedback is complete
+        FrameTables& tables = frames[slot];
+        auto* feedback = static_cast<uint32_t*>(tables.feedback->allocation.mapped);
+        for (uint32_t i = 0; i < textureCount(); ++i) {
+            if (feedback[i] != NOT_SAMPLED) {
+                textures[i].wanted = std::min(feedback[i], tailLevel(i));
+                textures[i].lastUsed = frame;
+            }
+        }
+        std::memset(feedback, 0xff, textureCount() * sizeof(uint32_t));
+
+        // Uploads are capped per frame so a burst of loads doesn't stall the frame behind the staging ring
+        VkDeviceSize installed = 0;
+        while (installed < STREAMING_UPLOAD_BYTES_PER_FRAME) {
+            LoadResult result;
+            {
+                std::lock_guard<std::mutex> lock(resultMutex);
+                if (results.empty()) {
+                    break;
+                }
+                result = std::move(results.front());
+                results.pop_front();
+            }
+
+            installed += textures[result.texture].loadBytes;
+            install(result);
+        }
+
+        if (frame % STREAMING_BUDGET_INTERVAL == 0) {
+            streamingStats.budget = queryBudget();
+        }
+
+        requestLevels();
+
+        auto* residency = static_cast<uint32_t*>(tables.residency->allocation.mapped);
+        for (uint32_t i = 0; i < textureCount(); ++i) {
+            const Image& image = textures[i].detail.image != VK_NULL_HANDLE ? textures[i].detail : textures[i].tail;
+            residency[2 * i] = image.index;
+            residency[2 * i + 1] = image.firstLevel;
+        }
+    }
+
+    StreamingConstants TextureStreamer::constants(uint32_t slot) const {
+        return { frames[slot].residencyIndex, frames[slot].feedbackIndex };
+    }
+
+    void TextureStreamer::printStats(std::ostream& out) const {
+        uint32_t sampledDetail = 0;
+        for (const auto& texture : textures) {
+            const Image& image = texture.detail.image != VK_NULL_HANDLE ? texture.detail : texture.tail;
+            if (image.firstLevel <= texture.wanted) {
+                sampledDetail++;
+            }
+        }
+
+        double seconds = std::chrono::duration<double>(Clock::now() - created).count();
+        double streamed = static_cast<double>(streamingStats.streamedBytes) / 1e6;
+
+        out << "Texture streaming: " << sampledDetail << "/" << textureCount() << " textures at their sampled detail, "
+            << std::fixed << std::setprecision(2) << static_cast<double>(streamingStats.residentBytes) / 1e6
+            << " MB resident of a " << static_cast<double>(streamingStats.budget) / 1e6 << " MB budget (+"
+            << static_cast<double>(streamingStats.tailBytes) / 1e6 << " MB of mip tails), " << streamed
+            << " MB streamed at " << (seconds > 0.0 ? streamed / seconds : 0.0) << " MB/s, "
+            << streamingStats.loads << " loads, " << streamingStats.evictions << " evictions ("
+            << (seconds > 0.0 ? static_cast<double>(streamingStats.evictions) / seconds : 0.0) << "/s), "
+            << streamingStats.deniedLoads << " loads denied by the budget" << std::defaultfloat << std::endl;
+    }
+
+    void TextureStreamer::ioThread() {
+        M4X_TRACE_THREAD("texture streaming");
+
+        while (true) {
+            LoadRequest request{};
+            {
+                std::unique_lock<std::mutex> lock(requestMutex);
+                requestAdded.wait(lock, [&] { return stopping || !requests.empty(); });
+
+                if (stopping) {
+                    return;
+                }
+
+                request = requests.front();
+                requests.pop_front();
+            }
+
+            LoadResult result{ request.texture, request.firstLevel, {}, nullptr };
+            {
+                M4X_TRACE_SCOPE("decode texture");
+                try {
+                    result.levels.resize(pack.texture(request.texture).levels - request.firstLevel);
+                    for (uint32_t level = 0; level < result.levels.size(); ++level) {
+                        pack.decode(request.texture, request.firstLevel + level, result.levels[level]);
+                    }
+                } catch (...) {
+                    result.error = std::current_exception();
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(resultMutex);
+            results.push_back(std::move(result));
+        }
+    }
+
+    uint32_t TextureStreamer::tailLevel(uint32_t texture) const {
+        const PackedTexture& packed = pack.texture(texture);
+
+        uint32_t level = 0;
+        while (level + 1 < packed.levels && std::max(packed.width >> level, packed.height >> level) >
+                                            STREAMING_TAIL_SIZE) {
+            level++;
+        }
+        return level;
+    }
+
+    VkDeviceSize TextureStreamer::chainBytes(uint32_t texture, uint32_t firstLevel) const {
+        VkDeviceSize bytes = 0;
+        for (uint32_t level = firstLevel; level < pack.texture(texture).levels; ++level) {
+            bytes += pack.levelSize(texture, level);
+        }
+        return bytes;
+    }
+
+    VkDeviceSize TextureStreamer::queryBudget() const {
+        VkDeviceSize budget;
+
+        if (memoryBudget) {
+            VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties{};
+            budgetProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+
+            VkPhysicalDeviceMemoryProperties2 memoryProperties{};
+            memoryProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+            memoryProperties.pNext = &budgetProperties;
+            vkGetPhysicalDeviceMemoryProperties2(physicalDevice, &memoryProperties);
+
+            // The usage includes the textures already resident, only what's left on top of them is shared
+            VkDeviceSize heapBudget = budgetProperties.heapBudget[memoryHeap];
+            VkDeviceSize heapUsage = budgetProperties.heapUsage[memoryHeap];
+            VkDeviceSize headroom = heapBudget > heapUsage ? heapBudget - heapUsage : 0;
+            budget = streamingStats.residentBytes + pendingBytes +
+                     static_cast<VkDeviceSize>(static_cast<double>(headroom) * STREAMING_BUDGET_SHARE);
+        } else {
+            budget = allocator->memoryProperties().memoryHeaps[memoryHeap].size / 2;
+        }
+
+        return budgetLimit > 0 ? std::min(budget, budgetLimit) : budget;
+    }
+
+    TextureStreamer::Image TextureStreamer::createImage(uint32_t texture, uint32_t firstLevel,
+                                                        const std::vector<std::vector<uint8_t>>& levels) {
+        const PackedTexture& packed = pack.texture(texture);
+        auto levelCount = static_cast<uint32_t>(levels.size());
+
+        Image image;
+        image.firstLevel = firstLevel;
+        image.image = VkUtils::CreateImage(device, pack.levelExtent(texture, firstLevel), packed.format,
+                                           VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, levelCount);
+        image.memory = allocator->bindImage(image.image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        image.view = VkUtils::CreateImageView(device, image.image, packed.format, levelCount);
+
+        for (uint32_t level = 0; level < levelCount; ++level) {
+            uploadQueue->enqueueImage(image.image, pack.levelExtent(texture, firstLevel + level), level,
+                                      levels[level].data(), levels[level].size());
+            streamingStats.streamedBytes += levels[level].size();
+        }
+
+        image.index = heap->addTexture(image.view);
+        return image;
+    }
+
+    void TextureStreamer::install(LoadResult& result) {
+        Texture& texture = textures[result.texture];
+        texture.loading = false;
+        pendingBytes -= texture.loadBytes;
+
+        if (result.error) {
+            std::rethrow_exception(result.error);
+        }
+
+        // Frames recorded from now on sample the new image, which the frame's upload wait covers
+        retire(texture.detail);
+        texture.detail = createImage(result.texture, result.firstLevel, result.levels);
+        streamingStats.residentBytes += texture.detail.memory.size;
+        streamingStats.loads++;
+    }
+
+    void TextureStreamer::evict(uint32_t texture) {
+        retire(textures[texture].detail);
+        streamingStats.evictions++;
+    }
+
+    void TextureStreamer::requestLevels() {
+        std::vector<uint32_t> candidates;
+        std::vector<uint32_t> victims;
+
+        for (uint32_t i = 0; i < textureCount(); ++i) {
+            const Texture& texture = textures[i];
+            if (texture.detail.image != VK_NULL_HANDLE && !texture.loading) {
+                victims.push_back(i);
+            }
+
+            if (texture.loading || texture.lastUsed == 0) {
+                continue;
+            }
+
+            uint32_t firstLevel = texture.detail.image != VK_NULL_HANDLE ? texture.detail.firstLevel
+                                                                         : texture.tail.firstLevel;
+            if (texture.wanted < firstLevel) {
+                candidates.push_back(i);
+            }
+        }
+
+        // The most recently sampled textures load first, the least recently sampled ones get evicted first
+        std::sort(candidates.begin(), candidates.end(), [&](uint32_t a, uint32_t b) {
+            return textures[a].lastUsed > textures[b].lastUsed;
+        });
+        std::sort(victims.begin(), victims.end(), [&](uint32_t a, uint32_t b) {
+            return textures[a].lastUsed < textures[b].lastUsed;
+        });
+
+        size_t nextVictim = 0;
+        std::vector<LoadRequest> newRequests;
+
+        for (uint32_t candidate : candidates) {
+            Texture& texture = textures[candidate];
+            VkDeviceSize bytes = chainBytes(candidate, texture.wanted);
+
+            // Only textures sampled longer ago than the candidate make room, which keeps a working set larger
+            // than the budget from evicting itself every frame
+            while (streamingStats.residentBytes + pendingBytes + bytes > streamingStats.budget &&
+                   nextVictim < victims.size() && textures[victims[nextVictim]].lastUsed < texture.lastUsed) {
+                evict(victims[nextVictim++]);
+            }
+
+            if (streamingStats.residentBytes + pendingBytes + bytes > streamingStats.budget) {
+                streamingStats.deniedLoads++;
+                continue;
+            }
+
+            texture.loading = true;
+            texture.loadBytes = bytes;
+            pendingBytes += bytes;
+            newRequests.push_back({ candidate, texture.wanted });
+        }
+
+        if (newRequests.empty()) {
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(requestMutex);
+            requests.insert(requests.end(), newRequests.begin(), newRequests.end());
+        }
+        requestAdded.notify_all();
+    }
+
+    void TextureStreamer::retire(Image& image) {
+        if (image.image == VK_NULL_HANDLE) {
+            return;
+        }
+
+        // Frames still in flight may sample it
+        heap->release(DescriptorTable::Texture, image.index);
+        streamingStats.residentBytes -= image.memory.size;
+        deletionQueue->destroyImageView(image.view);
+        deletionQueue->destroyImage(image.image, image.memory);
+        image = Image{};
+    }
+
+    void TextureStreamer::destroyImage(Image& image) {
+        if (image.image == VK_NULL_HANDLE) {
+            return;
+        }
+
+        heap->release(DescriptorTable::Texture, image.index);
+        vkDestroyImageView(device, image.view, nullptr);
+        vkDestroyImage(device, image.image, nullptr);
+        allocator->free(image.memory);
+        image = Image{};
+    }
+} // m4x
@@ -0,0 +1,251 @@
+/** @file */
+
+//
+// Created by m4tex on 17/10/26.
+//
+
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include "MemoryAllocator.h"
+#include "UploadQueue.h"
+#include "DescriptorHeap.h"
+#include "TexturePack.h"
+#include "DeletionQueue.h"
+
+// std
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+namespace m4x {
+    /**
+     * Threads decoding texture levels out of the pack
+     */
+    const uint32_t STREAMING_IO_THREADS = 2;
+
+    /**
+     * Levels no larger than this on either side are loaded up front and never evicted, so every texture always
+     * has something to sample
+     */
+    const uint32_t STREAMING_TAIL_SIZE = 64;
+
+    /**
+     * Decoded bytes handed to the upload queue per frame, at least one load goes through regardless
+     */
+    const VkDeviceSize STREAMING_UPLOAD_BYTES_PER_FRAME = 8ull * 1024 * 1024;
+
+    /**
+     * Share of the free device local memory reported by VK_EXT_memory_budget the textures may grow into
+     */
+    const double STREAMING_BUDGET_SHARE = 0.8;
+
+    /**
+     * Frames between two queries of the memory budget
+     */
+    const uint64_t STREAMING_BUDGET_INTERVAL = 16;
+
+    /**
+     * Fragment push constants of the graphics pipelines, heap buffer indices of the current frame's tables
+     */
+    struct StreamingConstants {
+        uint32_t residency;
+        uint32_t feedback;
+    };
+
+    struct StreamingStats {
+        // Detail levels currently allocated, the always resident tails not included
+        VkDeviceSize residentBytes = 0;
+        VkDeviceSize tailBytes     = 0;
+        VkDeviceSize budget        = 0;
+        // Decoded and uploaded, tails included
+        uint64_t     streamedBytes = 0;
+        uint64_t     loads         = 0;
+        uint64_t     evictions     = 0;
+        // Loads skipped because evicting less recently used textures couldn't make room
+        uint64_t     deniedLoads   = 0;
+    };
+
+    /**
+     * Streams the mip chains of a TexturePack in as the frames sample them.
+     * The fragment shader reports the finest level it would sample of every texture into a per frame feedback
+     * buffer. Once that frame completed, textures lacking the level get it decoded on the I/O threads and
+     * uploaded through the UploadQueue as a new image holding every level from there down. While the new image
+     * is on its way the previous one stays in use, and images that no longer fit the budget are evicted least
+     * recently sampled first, falling back to the mip tail. Shaders look a texture up through the per frame
+     * residency table, which maps its id to its current heap slot and first level.
+     */
+    class TextureStreamer {
+    public:
+        /**
+         * Opens the pack, uploads the mip tail of every texture and starts the I/O threads
+         * @param physicalDevice [in] Device the budget is queried from
+         * @param device [in] Logical device
+         * @param allocator [in] Allocator the images are created from
+         * @param uploadQueue [in] Queue the levels are uploaded through
+         * @param heap [in] Heap the images and the per frame tables are added to
+         * @param deletionQueue [in] Queue evicted images are destroyed through once no frame samples them
+         * @param framesInFlight [in] Depth of the frames in flight ring
+         * @param pack [in] Texture pack to stream from, texture ids are indices into it
+         * @param memoryBudget [in] If VK_EXT_memory_budget is enabled, otherwise half the device local memory is
+         * assumed to be available
+         * @param budgetLimit [in] Upper bound of the bytes streamed textures take, 0 for none
+         */
+        void create(VkPhysicalDevice physicalDevice, VkDevice device, MemoryAllocator& allocator,
+                    UploadQueue& uploadQueue, DescriptorHeap& heap, DeletionQueue& deletionQueue,
+                    uint32_t framesInFlight, const std::filesystem::path& pack, bool memoryBudget,
+                    VkDeviceSize budgetLimit);
+
+        /**
+         * Stops the I/O threads and destroys every image, the device has to be idle
+         */
+        void destroy();
+
+        /**
+         * Reads the feedback the slot's previous frame left, uploads finished loads, evicts and requests levels
+         * and writes the slot's residency table. Call before the frame's UploadQueue::flush(), once the previous
+         * frame of the slot completed.
+         * @param slot [in] Slot of the frames in flight ring being recorded
+         * @param frame [in] Number of the frame being recorded
+         */
+        void update(uint32_t slot, uint64_t frame);
+
+        /**
+         * Push constants of the frames recorded in a slot
+         */
+        [[nodiscard]] StreamingConstants constants(uint32_t slot) const;
+
+        /**
+         * Feedback buffer of a slot, written by the fragment shader and read by the host
+         */
+        [[nodiscard]] VkBuffer feedbackBuffer(uint32_t slot) const { return frames[slot].feedback->buffer; }
+
+        [[nodiscard]] uint32_t textureCount() const { return static_cast<uint32_t>(textures.size()); }
+
+        [[nodiscard]] const StreamingStats& stats() const { return streamingStats; }
+
+        /**
+         * Prints residency, streaming bandwidth and evictions since create()
+         */
+        void printStats(std::ostream& out) const;
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        struct Image {
+            VkImage      image = VK_NULL_HANDLE;
+            VkImageView  view  = VK_NULL_HANDLE;
+            Allocation   memory;
+            uint32_t     index = INVALID_DESCRIPTOR;
+            // Level of the texture the image starts at
+            uint32_t     firstLevel = 0;
+        };
+
+        struct Texture {
+            Image    tail;
+            // Finer levels, no image while only the tail is resident
+            Image    detail;
+            // Finest level the frames sampled
+            uint32_t wanted   = 0;
+            uint64_t lastUsed = 0;
+            bool     loading  = false;
+            // Expected size of the load in flight
+            VkDeviceSize loadBytes = 0;
+        };
+
+        struct LoadRequest {
+            uint32_t texture;
+            uint32_t firstLevel;
+        };
+
+        struct LoadResult {
+            uint32_t texture;
+            uint32_t firstLevel;
+            std::vector<std::vector<uint8_t>> levels;
+            // Set if the pack couldn't be decoded, rethrown on the render thread
+            std::exception_ptr error;
+        };
+
+        struct FrameTables {
+            // Heap slot and first level per texture
+            Buffer*  residency      = nullptr;
+            // Finest sampled level per texture, UINT32_MAX if it wasn't sampled
+            Buffer*  feedback       = nullptr;
+            uint32_t residencyIndex = INVALID_DESCRIPTOR;
+            uint32_t feedbackIndex  = INVALID_DESCRIPTOR;
+        };
+
+        VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+        VkDevice         device         = VK_NULL_HANDLE;
+        MemoryAllocator* allocator      = nullptr;
+        UploadQueue*     uploadQueue    = nullptr;
+        DescriptorHeap*  heap           = nullptr;
+        DeletionQueue*   deletionQueue  = nullptr;
+        uint32_t         framesInFlight = 1;
+        bool             memoryBudget   = false;
+        VkDeviceSize     budgetLimit    = 0;
+        // Device local heap the images live in
+        uint32_t         memoryHeap     = 0;
+
+        TexturePack pack;
+        std::vector<Texture> textures;
+        std::vector<FrameTables> frames;
+        // Expected bytes of the loads in flight
+        VkDeviceSize pendingBytes = 0;
+
+        std::vector<std::thread> threads;
+        std::deque<LoadRequest> requests;
+        std::mutex requestMutex;
+        std::condition_variable requestAdded;
+        bool stopping = false;
+
+        std::deque<LoadResult> results;
+        std::mutex resultMutex;
+
+        StreamingStats streamingStats;
+        Clock::time_point created;
+
+        void ioThread();
+
+        /**
+         * Level the mip tail of a texture starts at
+         */
+        [[nodiscard]] uint32_t tailLevel(uint32_t texture) const;
+
+        /**
+         * Decoded bytes of the levels from firstLevel down
+         */
+        [[nodiscard]] VkDeviceSize chainBytes(uint32_t texture, uint32_t firstLevel) const;
+
+        [[nodiscard]] VkDeviceSize queryBudget() const;
+
+        /**
+         * Creates the image of a loaded chain and schedules its upload
+         */
+        Image createImage(uint32_t texture, uint32_t firstLevel, const std::vector<std::vector<uint8_t>>& levels);
+
+        void install(LoadResult& result);
+
+        void evict(uint32_t texture);
+
+        /**
+         * Requests the wanted levels of the recently sampled textures, evicting others to make room
+         */
+        void requestLevels();
+
+        /**
+         * Hands an image to the deletion queue, frames in flight may still sample it
+         */
+        void retire(Image& image);
+
+        void destroyImage(Image& image);
+    };
+} // m4x
@@ -0,0 +1,407 @@
+//
+// Created by m4tex on 17/10/26.
+//
+
+#include "UploadQueue.h"
+#include "VkUtils.h"
+
+//std
+#include <stdexcept>
+#include <cstring>
+#include <algorithm>
+#include <iomanip>
+#include <map>
+
+namespace m4x {
+    namespace {
+        // Keeps every copy source at an offset any transfer implementation is happy with
+        const VkDeviceSize STAGING_ALIGNMENT = 16;
+    }
+
+    void UploadQueue::create(VkDevice device, MemoryAllocator& allocator, uint32_t transferFamily,
+                             uint32_t graphicsFamily, VkQueue transferQueue, VkDeviceSize capacity) {
+        this->device = device;
+        this->transferFamily = transferFamily;
+        this->graphicsFamily = graphicsFamily;
+        this->transferQueue = transferQueue;
+        this->capacity = capacity;
+
+        VkCommandPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        poolInfo.queueFamilyIndex = transferFamily;
+
+        if (VK_SUCCESS != vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool)) {
+            throw std::runtime_error("Failed to create the upload command pool");
+        }
+
+        ring = allocator.createBuffer(capacity, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                      { VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT });
+
+        timeline = VkUtils::CreateTimelineSemaphore(device);
+        lastValue = 0;
+    }
+
+    void UploadQueue::destroy(MemoryAllocator& allocator) {
+        batches.clear();
+        submitted.clear();
+        pendingCopies.clear();
+        pendingImageCopies.clear();
+        pendingAcquires.clear();
+        pendingImageAcquires.clear();
+        head = tail = 0;
+
+        vkDestroySemaphore(device, timeline, nullptr);
+        timeline = VK_NULL_HANDLE;
+
+        vkDestroyCommandPool(device, commandPool, nullptr);
+
+        allocator.destroyBuffer(ring);
+        ring = nullptr;
+    }
+
+    void UploadQueue::enqueue(Buffer* destination, VkDeviceSize offset, const void* data, VkDeviceSize size,
+                              uint32_t consumerFamily) {
+        if (size == 0) {
+            return;
+        }
+
+        if (consumerFamily == VK_QUEUE_FAMILY_IGNORED) {
+            consumerFamily = graphicsFamily;
+        }
+
+        // Pieces of half the ring can always be staged while the other half is still being copied
+        VkDeviceSize pieceSize = capacity / 2;
+
+        for (VkDeviceSize done = 0; done < size; done += pieceSize) {
+            VkDeviceSize piece = std::min(pieceSize, size - done);
+
+            VkBufferCopy region{};
+            region.srcOffset = stage(static_cast<const char*>(data) + done, piece);
+            region.dstOffset = offset + done;
+            region.size = piece;
+
+            pendingCopies.push_back({ destination, region, consumerFamily });
+        }
+    }
+
+    void UploadQueue::enqueueImage(VkImage image, VkExtent2D extent, uint32_t mipLevel, const void* data,
+                                   VkDeviceSize size) {
+        // A level can't be split across batches, its layout transitions happen in one
+        if (size > capacity / 2) {
+            throw std::runtime_error("Image level too big for the staging ring");
+        }
+
+        VkBufferImageCopy region{};
+        region.bufferOffset = stage(data, size);
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = mipLevel;
+        region.imageSubresource.baseArrayLayer = 0;
+        region.imageSubresource.layerCount = 1;
+        region.imageExtent = { extent.width, extent.height, 1 };
+
+        pendingImageCopies.push_back({ image, region, size });
+    }
+
+    VkDeviceSize UploadQueue::stage(const void* data, VkDeviceSize size) {
+        std::optional<VkDeviceSize> staging;
+        while (!(staging = reserve(size)).has_value()) {
+            // Free up room, first by getting our own pending data going, then by waiting on the oldest batch
+            if (pending()) {
+                submit();
+            } else {
+                retireOldest(true);
+            }
+        }
+
+        std::memcpy(static_cast<char*>(ring->allocation.mapped) + staging.value(), data, size);
+
+        if (!pending()) {
+            firstEnqueue = Clock::now();
+        }
+
+        return staging.value();
+    }
+
+    std::optional<VkDeviceSize> UploadQueue::reserve(VkDeviceSize size) {
+        // An empty ring starts over at a physical offset of 0, so anything up to the capacity fits
+        if (head == tail) {
+            head = tail = (head + capacity - 1) / capacity * capacity;
+        }
+
+        VkDeviceSize position = (head + STAGING_ALIGNMENT - 1) / STAGING_ALIGNMENT * STAGING_ALIGNMENT;
+        VkDeviceSize physical = position % capacity;
+
+        // Copies can't wrap, skip the rest of the ring instead
+        if (physical + size > capacity) {
+            position += capacity - physical;
+            physical = 0;
+        }
+
+        if (position + size - tail > capacity) {
+            return std::nullopt;
+        }
+
+        head = position + size;
+        return physical;
+    }
+
+    size_t UploadQueue::freeBatch() {
+        for (size_t i = 0; i < batches.size(); ++i) {
+            if (!batches[i].inFlight) {
+                return i;
+            }
+        }
+
+        Batch batch{};
+
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = commandPool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = 1;
+
+        if (VK_SUCCESS != vkAllocateCommandBuffers(device, &allocInfo, &batch.commandBuffer)) {
+            throw std::runtime_error("Failed to create an upload batch");
+        }
+
+        batches.push_back(batch);
+        return batches.size() - 1;
+    }
+
+    void UploadQueue::submit() {
+        if (!pending()) {
+            return;
+        }
+
+        size_t index = freeBatch();
+        Batch& batch = batches[index];
+
+        vkResetCommandBuffer(batch.commandBuffer, 0);
+
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+        if (VK_SUCCESS != vkBeginCommandBuffer(batch.commandBuffer, &beginInfo)) {
+            throw std::runtime_error("Failed to begin an upload command buffer");
+        }
+
+        // One copy command per destination, carrying all of its regions
+        std::map<Buffer*, std::vector<VkBufferCopy>> regions;
+        for (const auto& copy : pendingCopies) {
+            regions[copy.destination].push_back(copy.region);
+            uploadStats.bytes += copy.region.size;
+        }
+
+        for (const auto& [destination, copies] : regions) {
+            vkCmdCopyBuffer(batch.commandBuffer, ring->buffer, destination->buffer,
+                            static_cast<uint32_t>(copies.size()), copies.data());
+        }
+
+        // Image levels go through TRANSFER_DST_OPTIMAL, both transitions are batched over all of them
+        std::map<VkImage, std::vector<VkBufferImageCopy>> imageRegions;
+        std::vector<VkImageMemoryBarrier> imageTransitions;
+        std::vector<VkImageMemoryBarrier> imageReleases;
+
+        for (const auto& copy : pendingImageCopies) {
+            imageRegions[copy.image].push_back(copy.region);
+            uploadStats.bytes += copy.size;
+
+            VkImageMemoryBarrier barrier{};
+            barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            barrier.srcAccessMask = 0;
+            barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.image = copy.image;
+            barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, copy.region.imageSubresource.mipLevel, 1, 0, 1 };
+            imageTransitions.push_back(barrier);
+
+            // The release and the acquire both carry the transition to the layout the shaders read
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask = 0;
+            barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+            if (transferFamily != graphicsFamily) {
+                barrier.srcQueueFamilyIndex = transferFamily;
+                barrier.dstQueueFamilyIndex = graphicsFamily;
+            }
+            imageReleases.push_back(barrier);
+
+            if (transferFamily != graphicsFamily) {
+                barrier.srcAccessMask = 0;
+                barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+                pendingImageAcquires.push_back(barrier);
+            }
+        }
+
+        if (!imageTransitions.empty()) {
+            vkCmdPipelineBarrier(batch.commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                                 VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr,
+                                 static_cast<uint32_t>(imageTransitions.size()), imageTransitions.data());
+        }
+
+        for (const auto& [image, copies] : imageRegions) {
+            vkCmdCopyBufferToImage(batch.commandBuffer, ring->buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                   static_cast<uint32_t>(copies.size()), copies.data());
+        }
+
+        std::vector<VkBufferMemoryBarrier> releases;
+
+        for (const auto& copy : pendingCopies) {
+            if (copy.consumerFamily == transferFamily || copy.destination->concurrent()) {
+                continue;
+            }
+
+            VkBufferMemoryBarrier barrier{};
+            barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask = 0;
+            barrier.srcQueueFamilyIndex = transferFamily;
+            barrier.dstQueueFamilyIndex = copy.consumerFamily;
+            barrier.buffer = copy.destination->buffer;
+            barrier.offset = copy.region.dstOffset;
+            barrier.size = copy.region.size;
+            releases.push_back(barrier);
+
+            barrier.srcAccessMask = 0;
+            barrier.dstAccessMask = copy.consumerFamily == graphicsFamily ? UPLOAD_CONSUMER_ACCESS
+                                                                          : UPLOAD_COMPUTE_CONSUMER_ACCESS;
+            pendingAcquires[copy.consumerFamily].push_back(barrier);
+        }
+
+        // Same family buffer uploads need no barrier, the semaphore wait already makes the writes visible.
+        // Images still need their layout transition.
+        if (!releases.empty() || !imageReleases.empty()) {
+            vkCmdPipelineBarrier(batch.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                 VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr,
+                                 static_cast<uint32_t>(releases.size()), releases.data(),
+                                 static_cast<uint32_t>(imageReleases.size()), imageReleases.data());
+        }
+
+        if (VK_SUCCESS != vkEndCommandBuffer(batch.commandBuffer)) {
+            throw std::runtime_error("Failed to record an upload command buffer");
+        }
+
+        batch.value = ++lastValue;
+
+        VkTimelineSemaphoreSubmitInfo timelineInfo{};
+        timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+        timelineInfo.signalSemaphoreValueCount = 1;
+        timelineInfo.pSignalSemaphoreValues = &batch.value;
+
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.pNext = &timelineInfo;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &batch.commandBuffer;
+        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.pSignalSemaphores = &timeline;
+
+        if (VK_SUCCESS != vkQueueSubmit(transferQueue, 1, &submitInfo, VK_NULL_HANDLE)) {
+            throw std::runtime_error("Failed to submit an upload batch");
+        }
+
+        batch.ringEnd = head;
+        batch.firstEnqueue = firstEnqueue;
+        batch.submitted = Clock::now();
+        batch.inFlight = true;
+        submitted.push_back(index);
+
+        uploadStats.uploads += static_cast<uint32_t>(pendingCopies.size() + pendingImageCopies.size());
+        uploadStats.batches++;
+        pendingCopies.clear();
+        pendingImageCopies.clear();
+    }
+
+    bool UploadQueue::retireOldest(bool wait) {
+        if (submitted.empty()) {
+            return false;
+        }
+
+        Batch& batch = batches[submitted.front()];
+
+        if (wait) {
+            VkUtils::WaitTimeline(device, timeline, batch.value);
+        } else {
+            uint64_t completed = 0;
+            vkGetSemaphoreCounterValue(device, timeline, &completed);
+
+            if (completed < batch.value) {
+                return false;
+            }
+        }
+
+        auto now = Clock::now();
+        double latency = std::chrono::duration<double, std::milli>(now - batch.firstEnqueue).count();
+
+        uploadStats.busySeconds += std::chrono::duration<double>(now - batch.submitted).count();
+        uploadStats.totalLatencyMs += latency;
+        uploadStats.maxLatencyMs = std::max(uploadStats.maxLatencyMs, latency);
+
+        tail = batch.ringEnd;
+        batch.inFlight = false;
+        submitted.pop_front();
+
+        // Data enqueued after the last submission keeps its part of the ring
+        if (submitted.empty() && !pending()) {
+            tail = head;
+        }
+
+        return true;
+    }
+
+    void UploadQueue::retireCompleted() {
+        while (retireOldest(false)) {}
+    }
+
+    uint64_t UploadQueue::flush(VkCommandBuffer commandBuffer, uint32_t family) {
+        retireCompleted();
+        submit();
+
+        if (family == VK_QUEUE_FAMILY_IGNORED) {
+            family = graphicsFamily;
+        }
+
+        std::vector<VkBufferMemoryBarrier> bufferAcquires;
+        auto acquires = pendingAcquires.find(family);
+        if (acquires != pendingAcquires.end()) {
+            bufferAcquires = std::move(acquires->second);
+            pendingAcquires.erase(acquires);
+        }
+
+        std::vector<VkImageMemoryBarrier> imageAcquires;
+        if (family == graphicsFamily) {
+            imageAcquires.swap(pendingImageAcquires);
+        }
+
+        if (!bufferAcquires.empty() || !imageAcquires.empty()) {
+            VkPipelineStageFlags stages = family == graphicsFamily ? UPLOAD_CONSUMER_STAGES
+                                                                   : UPLOAD_COMPUTE_CONSUMER_STAGES;
+
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, stages, 0, 0, nullptr,
+                                 static_cast<uint32_t>(bufferAcquires.size()), bufferAcquires.data(),
+                                 static_cast<uint32_t>(imageAcquires.size()), imageAcquires.data());
+        }
+
+        // Waiting on a value that was reached long ago costs nothing, and keeps the copies visible to the consumer
+        return lastValue;
+    }
+
+    void UploadQueue::printStats(std::ostream& out) {
+        retireCompleted();
+
+        double megabytes = static_cast<double>(uploadStats.bytes) / 1e6;
+        double bandwidth = uploadStats.busySeconds > 0.0 ? megabytes / uploadStats.busySeconds : 0.0;
+        double averageLatency = uploadStats.batches > 0 ? uploadStats.totalLatencyMs / uploadStats.batches : 0.0;
+
+        out << "Uploads: " << uploadStats.uploads << " in " << uploadStats.batches << " batches, " << std::fixed
+            << std::setprecision(2) << megabytes << " MB at " << bandwidth << " MB/s, latency avg "
+            << averageLatency << " ms, max " << uploadStats.maxLatencyMs << " ms ("
+            << (dedicatedTransfer() ? "dedicated transfer queue" : "graphics queue") << ")" << std::defaultfloat
+            << std::endl;
+    }
+} // m4x
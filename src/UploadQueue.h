@@ -0,0 +1,208 @@
+/** @file */
+
+//
+// Created by m4tex on 17/10/26.
+//
+
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include "MemoryAllocator.h"
+
+// std
+#include <chrono>
+#include <deque>
+#include <map>
+#include <optional>
+#include <ostream>
+#include <vector>
+
+namespace m4x {
+    /**
+     * Default size of the staging ring uploads are written into
+     */
+    const VkDeviceSize DEFAULT_STAGING_RING_SIZE = 16ull * 1024 * 1024;
+
+    /**
+     * Stages uploads can be read from, frames wait on the upload semaphores there
+     */
+    const VkPipelineStageFlags UPLOAD_CONSUMER_STAGES = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT |
+                                                        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+                                                        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+
+    /**
+     * Ways uploaded buffers get read
+     */
+    const VkAccessFlags UPLOAD_CONSUMER_ACCESS = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT |
+                                                 VK_ACCESS_SHADER_READ_BIT;
+
+    /**
+     * Stage compute submissions wait on the upload semaphore at, and the way they read uploaded buffers
+     */
+    const VkPipelineStageFlags UPLOAD_COMPUTE_CONSUMER_STAGES = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    const VkAccessFlags UPLOAD_COMPUTE_CONSUMER_ACCESS = VK_ACCESS_SHADER_READ_BIT;
+
+    /**
+     * Totals of everything that went through an UploadQueue
+     */
+    struct UploadStats {
+        uint64_t bytes          = 0;
+        uint32_t uploads        = 0;
+        uint32_t batches        = 0;
+        // Time between submitting a batch and noticing its fence signaled
+        double   busySeconds    = 0.0;
+        // Time between the first enqueue of a batch and its completion
+        double   totalLatencyMs = 0.0;
+        double   maxLatencyMs   = 0.0;
+    };
+
+    /**
+     * Gathers small buffer and image uploads into a persistently mapped staging ring and copies them in batches,
+     * one copy command per destination. Batches go to the transfer queue, which is the graphics
+     * queue when the device has no dedicated transfer family, and each signals the next value of a timeline
+     * semaphore. Any number of submissions on any queue can wait on a value, and its completion is read back
+     * without a fence.
+     */
+    class UploadQueue {
+    public:
+        /**
+         * @param device [in] Logical device
+         * @param allocator [in] Allocator the staging ring is created from
+         * @param transferFamily [in] Queue family of transferQueue
+         * @param graphicsFamily [in] Queue family the uploaded buffers are used on
+         * @param transferQueue [in] Queue the copies are submitted to
+         * @param capacity [in] Size of the staging ring in bytes
+         */
+        void create(VkDevice device, MemoryAllocator& allocator, uint32_t transferFamily, uint32_t graphicsFamily,
+                    VkQueue transferQueue, VkDeviceSize capacity = DEFAULT_STAGING_RING_SIZE);
+
+        /**
+         * Destroys the ring and the batches, every submitted batch must have completed
+         */
+        void destroy(MemoryAllocator& allocator);
+
+        /**
+         * Copies the data into the staging ring and schedules the copy into the buffer.
+         * Submits early and waits for older batches when the ring is full, uploads bigger than half the ring
+         * are split up.
+         * The destination range is treated as discarded, it must not be in use by the GPU.
+         * @param destination [in] Buffer created with TRANSFER_DST usage
+         * @param offset [in] Offset into the destination buffer
+         * @param data [in] Bytes to upload
+         * @param size [in] Amount of bytes
+         * @param consumerFamily [in] Family the range is handed over to, VK_QUEUE_FAMILY_IGNORED for the graphics
+         * family. Concurrently shared buffers are never handed over.
+         */
+        void enqueue(Buffer* destination, VkDeviceSize offset, const void* data, VkDeviceSize size,
+                     uint32_t consumerFamily = VK_QUEUE_FAMILY_IGNORED);
+
+        /**
+         * Copies a mip level into the staging ring and schedules the copy into the image, which leaves the level
+         * in SHADER_READ_ONLY_OPTIMAL on the graphics family. The previous contents of the level are discarded,
+         * it must not be in use by the GPU.
+         * @param image [in] Exclusively owned color image created with TRANSFER_DST usage
+         * @param extent [in] Extent of the level
+         * @param mipLevel [in] Level the data is for
+         * @param data [in] Tightly packed texels of the level
+         * @param size [in] Amount of bytes, at most half the staging ring
+         */
+        void enqueueImage(VkImage image, VkExtent2D extent, uint32_t mipLevel, const void* data, VkDeviceSize size);
+
+        /**
+         * Submits the scheduled copies and acquires the ones handed over to the family.
+         * Has to be recorded outside of a render pass, before the uploaded buffers get used.
+         * @param commandBuffer [in] Command buffer of the family the ownership acquires are recorded into
+         * @param family [in] Family of commandBuffer, VK_QUEUE_FAMILY_IGNORED for the graphics family
+         * @return Value of semaphore() the submission of the command buffer has to wait on, at
+         * UPLOAD_CONSUMER_STAGES on the graphics queue and UPLOAD_COMPUTE_CONSUMER_STAGES on a compute queue.
+         * 0 if nothing was ever uploaded.
+         */
+        uint64_t flush(VkCommandBuffer commandBuffer, uint32_t family = VK_QUEUE_FAMILY_IGNORED);
+
+        /**
+         * Timeline semaphore signaled by the batches
+         */
+        [[nodiscard]] VkSemaphore semaphore() const { return timeline; }
+
+        [[nodiscard]] const UploadStats& stats() const { return uploadStats; }
+
+        /**
+         * Prints bandwidth and latency, call when the device is idle so every batch is accounted for
+         */
+        void printStats(std::ostream& out);
+
+        [[nodiscard]] bool dedicatedTransfer() const { return transferFamily != graphicsFamily; }
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        struct Batch {
+            VkCommandBuffer   commandBuffer = VK_NULL_HANDLE;
+            // Timeline value the batch signals
+            uint64_t          value         = 0;
+            // Ring position right after this batch's data, the tail moves there once it completes
+            VkDeviceSize      ringEnd       = 0;
+            Clock::time_point firstEnqueue;
+            Clock::time_point submitted;
+            bool              inFlight      = false;
+        };
+
+        struct PendingCopy {
+            Buffer*      destination;
+            VkBufferCopy region;
+            uint32_t     consumerFamily;
+        };
+
+        struct PendingImageCopy {
+            VkImage           image;
+            VkBufferImageCopy region;
+            VkDeviceSize      size;
+        };
+
+        VkDevice device = VK_NULL_HANDLE;
+        VkQueue  transferQueue = VK_NULL_HANDLE;
+        uint32_t transferFamily = 0;
+        uint32_t graphicsFamily = 0;
+        VkCommandPool commandPool = VK_NULL_HANDLE;
+
+        VkSemaphore timeline = VK_NULL_HANDLE;
+        // Value signaled by the last submitted batch
+        uint64_t lastValue = 0;
+
+        Buffer*      ring     = nullptr;
+        VkDeviceSize capacity = 0;
+        // Positions only ever grow, the physical offset is the position modulo the capacity
+        VkDeviceSize head     = 0;
+        VkDeviceSize tail     = 0;
+
+        std::vector<PendingCopy> pendingCopies;
+        std::vector<PendingImageCopy> pendingImageCopies;
+        Clock::time_point firstEnqueue;
+
+        std::vector<Batch> batches;
+        // In flight batches, oldest first
+        std::deque<size_t> submitted;
+        // Buffer ranges released by the transfer family, waiting for the acquire of their consumer family
+        std::map<uint32_t, std::vector<VkBufferMemoryBarrier>> pendingAcquires;
+        // Image levels released to the graphics family
+        std::vector<VkImageMemoryBarrier> pendingImageAcquires;
+
+        UploadStats uploadStats;
+
+        std::optional<VkDeviceSize> reserve(VkDeviceSize size);
+
+        /**
+         * Reserves room in the ring, submitting and waiting until there is some, and copies the data there
+         * @return Physical offset of the data in the ring
+         */
+        VkDeviceSize stage(const void* data, VkDeviceSize size);
+
+        [[nodiscard]] bool pending() const { return !pendingCopies.empty() || !pendingImageCopies.empty(); }
+        void submit();
+        size_t freeBatch();
+        bool retireOldest(bool wait);
+        void retireCompleted();
+    };
+} // m4x
@@ -12,9 +12,53 @@
 #include <iostream>
 #include <limits>
 #include <algorithm>
-#include <fstream>
+#include <cstdlib>
+#include <cctype>
+#include <map>
+#include <mutex>
 
 namespace m4x {
+    namespace {
+        std::mutex cacheMutex;
+        std::map<VkPhysicalDevice, DeviceCapabilities> capabilitiesCache;
+        // Formats and present modes never change for a surface, unlike its capabilities
+        std::map<std::pair<VkPhysicalDevice, VkSurfaceKHR>, SwapChainSupportDetails> surfaceSupportCache;
+
+        const char* deviceTypeName(VkPhysicalDeviceType type) {
+            switch (type) {
+                case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:   return "discrete";
+                case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: return "integrated";
+                case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:    return "virtual";
+                case VK_PHYSICAL_DEVICE_TYPE_CPU:            return "cpu";
+                default:                                     return "other";
+            }
+        }
+
+        std::string lowercase(std::string text) {
+            std::transform(text.begin(), text.end(), text.begin(),
+                           [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+            return text;
+        }
+
+        void printDevice(const DeviceCapabilities& capabilities, const std::string& reason) {
+            std::cout << "GPU: " << capabilities.properties.deviceName << " ("
+                      << deviceTypeName(capabilities.properties.deviceType) << ", "
+                      << (capabilities.deviceLocalMemory() >> 20) << " MiB device local, " << reason << ")"
+                      << std::endl;
+        }
+    }
+
+    VkDeviceSize DeviceCapabilities::deviceLocalMemory() const {
+        VkDeviceSize largest = 0;
+
+        for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; ++i) {
+            if (memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+                largest = std::max(largest, memoryProperties.memoryHeaps[i].size);
+            }
+        }
+
+        return largest;
+    }
 
     bool VkUtils::validationLayerSupport() {
         uint32_t layerCount;
@@ -38,7 +82,7 @@ namespace m4x {
         return true;
     }
 
-    void VkUtils::CreateVkInstance(VkInstance* instance) {
+    void VkUtils::CreateVkInstance(VkInstance* instance, bool headless) {
         if (enableValidationLayers && !validationLayerSupport()) {
             throw std::runtime_error("Requested validation layers not available.");
         }
@@ -50,7 +94,8 @@ namespace m4x {
         appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
         appInfo.pEngineName = "M4X Engine";
         appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-        appInfo.apiVersion = VK_API_VERSION_1_0;
+        // Timeline semaphores are core since 1.2
+        appInfo.apiVersion = VK_API_VERSION_1_2;
 
         // Create instance creation info
         VkInstanceCreateInfo createInfo{};
@@ -64,11 +109,13 @@ namespace m4x {
             createInfo.enabledLayerCount = 0;
         }
 
-        // Get required extensions
+        // Get required extensions, offscreen rendering doesn't need any window system integration
         uint32_t glfwExtensionCount = 0;
-        const char** glfwExtensions;
+        const char** glfwExtensions = nullptr;
 
-        glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+        if (!headless) {
+            glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+        }
 
         createInfo.enabledExtensionCount = glfwExtensionCount;
         createInfo.ppEnabledExtensionNames = glfwExtensions;
@@ -79,7 +126,8 @@ namespace m4x {
             throw std::runtime_error("VkUtils: failed to create a Vulkan instance");
     }
 
-    void VkUtils::PickPhysicalDevice(VkInstance instance, VkSurfaceKHR surface, VkPhysicalDevice *physicalDevice) {
+    void VkUtils::PickPhysicalDevice(VkInstance instance, VkSurfaceKHR surface, const std::string& preference,
+                                     VkPhysicalDevice *physicalDevice) {
         *physicalDevice = VK_NULL_HANDLE;
         uint32_t deviceCount = 0;
         vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
@@ -91,23 +139,145 @@ namespace m4x {
         std::vector<VkPhysicalDevice> devices(deviceCount);
         vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
 
+        std::string wanted = preference;
+        if (const char* environment = std::getenv("M4X_DEVICE"); wanted.empty() && environment) {
+            wanted = environment;
+        }
+
+        // A device asked for by the user is taken as is, no score can overrule it
+        if (!wanted.empty()) {
+            bool byIndex = std::all_of(wanted.begin(), wanted.end(), [](unsigned char c) { return std::isdigit(c); });
+
+            for (uint32_t i = 0; i < deviceCount; ++i) {
+                const DeviceCapabilities& capabilities = QueryDeviceCapabilities(devices[i]);
+
+                bool matches = byIndex ? std::to_string(i) == wanted
+                                       : lowercase(capabilities.properties.deviceName).find(lowercase(wanted)) !=
+                                         std::string::npos;
+                if (!matches) {
+                    continue;
+                }
+
+                if (!isDeviceSuitable(devices[i], surface)) {
+                    throw std::runtime_error("Requested GPU " + std::string(capabilities.properties.deviceName) +
+                                             " isn't suitable.");
+                }
+
+                *physicalDevice = devices[i];
+                printDevice(capabilities, "requested as " + wanted);
+                return;
+            }
+
+            throw std::runtime_error("No GPU matches " + wanted + ".");
+        }
+
+        uint64_t bestScore = 0;
+
         for (const auto& device : devices) {
-            if(isDeviceSuitable(device, surface)) {
+            if (!isDeviceSuitable(device, surface)) {
+                continue;
+            }
+
+            uint64_t score = scoreDevice(device);
+            if (*physicalDevice == VK_NULL_HANDLE || score > bestScore) {
                 *physicalDevice = device;
-                break;
+                bestScore = score;
             }
         }
 
-        if (physicalDevice == VK_NULL_HANDLE) {
+        if (*physicalDevice == VK_NULL_HANDLE) {
             throw std::runtime_error("No suitable GPU found.");
         }
+
+        printDevice(QueryDeviceCapabilities(*physicalDevice), "score " + std::to_string(bestScore));
+    }
+
+    const DeviceCapabilities& VkUtils::QueryDeviceCapabilities(VkPhysicalDevice physicalDevice) {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+
+        auto cached = capabilitiesCache.find(physicalDevice);
+        if (cached != capabilitiesCache.end()) {
+            return cached->second;
+        }
+
+        DeviceCapabilities capabilities{};
+        vkGetPhysicalDeviceProperties(physicalDevice, &capabilities.properties);
+        vkGetPhysicalDeviceFeatures(physicalDevice, &capabilities.features);
+        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &capabilities.memoryProperties);
+
+        uint32_t queueFamilyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+        capabilities.queueFamilies.resize(queueFamilyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, capabilities.queueFamilies.data());
+
+        uint32_t extensionCount = 0;
+        vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+        capabilities.extensions.resize(extensionCount);
+        vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, capabilities.extensions.data());
+
+        // The 1.2 features can only be asked for on devices that report 1.2
+        if (capabilities.properties.apiVersion >= VK_API_VERSION_1_2) {
+            VkPhysicalDeviceVulkan12Features vulkan12Features{};
+            vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+
+            VkPhysicalDeviceSynchronization2Features synchronization2Features{};
+            synchronization2Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES;
+
+            VkPhysicalDeviceDynamicRenderingFeatures dynamicRenderingFeatures{};
+            dynamicRenderingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES;
+
+            auto hasExtension = [&](const char* name) {
+                return std::any_of(capabilities.extensions.begin(), capabilities.extensions.end(),
+                                   [&](const VkExtensionProperties& extension) {
+                                       return std::strcmp(extension.extensionName, name) == 0;
+                                   });
+            };
+
+            // The extension structures may only be chained when the device knows them
+            bool renderingExtensions = hasExtension(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME) &&
+                                       hasExtension(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME);
+            if (renderingExtensions) {
+                dynamicRenderingFeatures.pNext = &synchronization2Features;
+                vulkan12Features.pNext = &dynamicRenderingFeatures;
+            }
+
+            VkPhysicalDeviceFeatures2 features2{};
+            features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+            features2.pNext = &vulkan12Features;
+            vkGetPhysicalDeviceFeatures2(physicalDevice, &features2);
+
+            capabilities.timelineSemaphore = vulkan12Features.timelineSemaphore;
+            capabilities.descriptorIndexing = capabilities.features.shaderSampledImageArrayDynamicIndexing &&
+                                              capabilities.features.shaderStorageBufferArrayDynamicIndexing &&
+                                              vulkan12Features.runtimeDescriptorArray &&
+                                              vulkan12Features.descriptorBindingPartiallyBound &&
+                                              vulkan12Features.descriptorBindingSampledImageUpdateAfterBind &&
+                                              vulkan12Features.descriptorBindingStorageBufferUpdateAfterBind &&
+                                              vulkan12Features.descriptorBindingUpdateUnusedWhilePending &&
+                                              vulkan12Features.shaderSampledImageArrayNonUniformIndexing;
+            capabilities.dynamicRendering = renderingExtensions && dynamicRenderingFeatures.dynamicRendering &&
+                                            synchronization2Features.synchronization2;
+        }
+
+        return capabilitiesCache.emplace(physicalDevice, std::move(capabilities)).first->second;
     }
 
-    // TODO: make device picking score based or make an implementation that lets the user pick
     bool VkUtils::isDeviceSuitable(VkPhysicalDevice device, VkSurfaceKHR surface) {
+        const DeviceCapabilities& capabilities = QueryDeviceCapabilities(device);
+        // Texture streaming feedback is written with atomics from the fragment shader
+        if (!capabilities.timelineSemaphore || !capabilities.descriptorIndexing ||
+            !capabilities.features.fragmentStoresAndAtomics) {
+            return false;
+        }
+
         QueueFamilyIndices indices = FindQueueFamilies(device, surface);
 
-        bool extensionsSupported = deviceExtensionSupport(device);
+        bool extensionsSupported = deviceExtensionSupport(device, RequiredDeviceExtensions(surface));
+
+        // Nothing gets presented when rendering headless
+        if (surface == VK_NULL_HANDLE) {
+            return indices.graphicsFamily.has_value() && extensionsSupported;
+        }
 
         bool swapChainAdequate = false;
         if (extensionsSupported) {
@@ -118,42 +288,123 @@ namespace m4x {
         return indices.isComplete() && extensionsSupported && swapChainAdequate;
     }
 
+    uint64_t VkUtils::scoreDevice(VkPhysicalDevice device) {
+        const DeviceCapabilities& capabilities = QueryDeviceCapabilities(device);
+
+        // Each type gets its own range, so no amount of memory lifts an integrated GPU or llvmpipe over a discrete one
+        uint64_t typeRank;
+        switch (capabilities.properties.deviceType) {
+            case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:   typeRank = 4; break;
+            case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: typeRank = 3; break;
+            case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:    typeRank = 2; break;
+            case VK_PHYSICAL_DEVICE_TYPE_CPU:            typeRank = 0; break;
+            default:                                     typeRank = 1; break;
+        }
+
+        // One point per MiB of device local memory
+        uint64_t score = (typeRank << 40) + (capabilities.deviceLocalMemory() >> 20);
+
+        // Queues besides the graphics one let uploads and compute overlap rendering, each worth 2 GiB
+        bool dedicatedCompute = false;
+        bool dedicatedTransfer = false;
+
+        for (const auto& family : capabilities.queueFamilies) {
+            if (family.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+                continue;
+            }
+
+            if (family.queueFlags & VK_QUEUE_COMPUTE_BIT) {
+                dedicatedCompute = true;
+            } else if (family.queueFlags & VK_QUEUE_TRANSFER_BIT) {
+                dedicatedTransfer = true;
+            }
+        }
+
+        score += dedicatedCompute ? 2048 : 0;
+        score += dedicatedTransfer ? 2048 : 0;
+
+        // Features the optional paths use and the texture size limit break ties between similar devices
+        const VkPhysicalDeviceFeatures& features = capabilities.features;
+        score += features.multiDrawIndirect ? 512 : 0;
+        score += features.drawIndirectFirstInstance ? 512 : 0;
+        score += features.pipelineStatisticsQuery ? 512 : 0;
+        score += capabilities.properties.limits.maxImageDimension2D / 16;
+
+        return score;
+    }
+
+    const std::vector<const char*>& VkUtils::RequiredDeviceExtensions(VkSurfaceKHR surface) {
+        return surface == VK_NULL_HANDLE ? headlessDeviceExtensions : deviceExtensions;
+    }
+
     QueueFamilyIndices VkUtils::FindQueueFamilies(VkPhysicalDevice device, VkSurfaceKHR surface) {
         QueueFamilyIndices indices;
 
-        uint32_t queueFamilyCount = 0;
-        vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
+        const std::vector<VkQueueFamilyProperties>& queueFamilies = QueryDeviceCapabilities(device).queueFamilies;
+        auto queueFamilyCount = static_cast<uint32_t>(queueFamilies.size());
 
-        std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
-        vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
+        // Transfer only families (the DMA engines) beat ones that can also do compute
+        bool transferOnly = false;
+        // Compute families without transfer support are rare, but the ones with it are what we want
+        bool computeTransfer = false;
 
-        int i = 0;
-        for (const auto& queueFamily : queueFamilies) {
-            if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+        for (uint32_t i = 0; i < queueFamilyCount; ++i) {
+            const auto& queueFamily = queueFamilies[i];
+
+            if ((queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) && !indices.graphicsFamily.has_value()) {
                 indices.graphicsFamily = i;
             }
 
-            VkBool32 presentSupport = false;
-            vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+            if (surface != VK_NULL_HANDLE && !indices.presentFamily.has_value()) {
+                VkBool32 presentSupport = false;
+                vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
 
-            if (presentSupport) {
-                indices.presentFamily = i;
+                if (presentSupport) {
+                    indices.presentFamily = i;
+                }
             }
 
-            if(indices.isComplete()) {
-                break;
+            if ((queueFamily.queueFlags & VK_QUEUE_TRANSFER_BIT) && !(queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)) {
+                bool onlyTransfer = !(queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT);
+
+                if (!indices.transferFamily.has_value() || (onlyTransfer && !transferOnly)) {
+                    indices.transferFamily = i;
+                    transferOnly = onlyTransfer;
+                }
             }
 
-            i++;
+            if ((queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT) && !(queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)) {
+                bool withTransfer = queueFamily.queueFlags & VK_QUEUE_TRANSFER_BIT;
+
+                if (!indices.computeFamily.has_value() || (withTransfer && !computeTransfer)) {
+                    indices.computeFamily = i;
+                    computeTransfer = withTransfer;
+                }
+            }
         }
 
         return indices;
     }
 
-    void VkUtils::CreateLogicalDevice(VkPhysicalDevice physicalDevice, QueueFamilyIndices indices, VkDevice* device) {
+    void VkUtils::CreateLogicalDevice(VkPhysicalDevice physicalDevice, QueueFamilyIndices indices,
+                                      const std::vector<const char*>& extensions,
+                                      const VkPhysicalDeviceFeatures& features, const void* next,
+                                      VkDevice* device) {
         std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
         // In case the queue families overlap, we remove the duplicate indices
-        std::set<uint32_t> uniqueQueueFamilies = { indices.graphicsFamily.value(), indices.presentFamily.value() };
+        std::set<uint32_t> uniqueQueueFamilies = { indices.graphicsFamily.value() };
+
+        if (indices.presentFamily.has_value()) {
+            uniqueQueueFamilies.insert(indices.presentFamily.value());
+        }
+
+        if (indices.transferFamily.has_value()) {
+            uniqueQueueFamilies.insert(indices.transferFamily.value());
+        }
+
+        if (indices.computeFamily.has_value()) {
+            uniqueQueueFamilies.insert(indices.computeFamily.value());
+        }
 
         float queuePriority = 1.0f;
         for (const auto& queueFamily : uniqueQueueFamilies) {
@@ -165,16 +416,14 @@ namespace m4x {
             queueCreateInfos.push_back(queueCreateInfo);
         }
 
-        // All set to VK_FALSE by default
-        VkPhysicalDeviceFeatures deviceFeatures{};
-
         VkDeviceCreateInfo createInfo{};
         createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+        createInfo.pNext = next;
         createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
         createInfo.pQueueCreateInfos = queueCreateInfos.data();
-        createInfo.pEnabledFeatures = &deviceFeatures;
-        createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-        createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+        createInfo.pEnabledFeatures = &features;
+        createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+        createInfo.ppEnabledExtensionNames = extensions.data();
 
         if (enableValidationLayers) {
             createInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
@@ -188,16 +437,14 @@ namespace m4x {
         }
     }
 
-    bool VkUtils::deviceExtensionSupport(VkPhysicalDevice device) {
-        uint32_t extensionCount = 0;
-        vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
-
-        std::vector<VkExtensionProperties> extensionProperties(extensionCount);
-        vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, extensionProperties.data());
+    bool VkUtils::SupportsDeviceExtension(VkPhysicalDevice physicalDevice, const char* extension) {
+        return deviceExtensionSupport(physicalDevice, { extension });
+    }
 
-        std::set<std::string> requiredExtensions(deviceExtensions.begin(), deviceExtensions.end());
+    bool VkUtils::deviceExtensionSupport(VkPhysicalDevice device, const std::vector<const char*>& extensions) {
+        std::set<std::string> requiredExtensions(extensions.begin(), extensions.end());
 
-        for (const auto& extension : extensionProperties) {
+        for (const auto& extension : QueryDeviceCapabilities(device).extensions) {
             requiredExtensions.erase(extension.extensionName);
         }
 
@@ -207,8 +454,21 @@ namespace m4x {
     SwapChainSupportDetails VkUtils::querySwapChainSupport(VkPhysicalDevice device, VkSurfaceKHR surface) {
         SwapChainSupportDetails details;
 
+        {
+            std::lock_guard<std::mutex> lock(cacheMutex);
+
+            auto cached = surfaceSupportCache.find({ device, surface });
+            if (cached != surfaceSupportCache.end()) {
+                details = cached->second;
+            }
+        }
+
         vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, surface, &details.capabilities);
 
+        if (!details.formats.empty()) {
+            return details;
+        }
+
         uint32_t formatCount = 0;
         vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount, nullptr);
 
@@ -225,11 +485,18 @@ namespace m4x {
             vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &presentModeCount, details.presentModes.data());
         }
 
+        // An unusable surface is left uncached, it gets asked again
+        if (!details.formats.empty()) {
+            std::lock_guard<std::mutex> lock(cacheMutex);
+            surfaceSupportCache[{ device, surface }] = details;
+        }
+
         return details;
     }
 
-    // TODO: look into the HDR extension and immediate mode (on windows)
-    SwapChainConfiguration VkUtils::selectSwapChainProperties(const SwapChainSupportDetails& properties, GLFWwindow* window) {
+    // TODO: look into the HDR extension
+    SwapChainConfiguration VkUtils::selectSwapChainProperties(const SwapChainSupportDetails& properties,
+                                                              GLFWwindow* window, VkPresentModeKHR presentMode) {
         SwapChainConfiguration config{};
 
         std::optional<VkSurfaceFormatKHR> format;
@@ -244,7 +511,7 @@ namespace m4x {
         if (!format.has_value()) format = properties.formats[0];
 
         config.surfaceFormat = format.value();
-        config.presentMode = VK_PRESENT_MODE_FIFO_KHR;
+        config.presentMode = selectPresentMode(properties.presentModes, presentMode);
 
         if (properties.capabilities.currentExtent.width != std::numeric_limits<uint32_t>::max()) {
             config.extent = properties.capabilities.currentExtent;
@@ -260,6 +527,8 @@ namespace m4x {
 
             extent.height = std::clamp(extent.height, properties.capabilities.minImageExtent.height,
                                        properties.capabilities.maxImageExtent.height);
+
+            config.extent = extent;
         }
 
         config.capabilities = properties.capabilities;
@@ -274,42 +543,66 @@ namespace m4x {
 
     // Might refactor the code and move all the functionality here
     SwapChainConfiguration
-    VkUtils::RetrieveSwapChainConfig(VkPhysicalDevice device, VkSurfaceKHR surface, GLFWwindow *window) {
-        return selectSwapChainProperties(querySwapChainSupport(device, surface), window);
+    VkUtils::RetrieveSwapChainConfig(VkPhysicalDevice device, VkSurfaceKHR surface, GLFWwindow *window,
+                                     VkPresentModeKHR presentMode) {
+        return selectSwapChainProperties(querySwapChainSupport(device, surface), window, presentMode);
     }
 
-    void VkUtils::CreateImageViews(std::vector<VkImage>& swapChainImages, VkDevice device, VkFormat format, std::vector<VkImageView>& views) {
-        views.resize(swapChainImages.size());
+    VkPresentModeKHR VkUtils::selectPresentMode(const std::vector<VkPresentModeKHR>& available,
+                                                VkPresentModeKHR preferred) {
+        // Uncapped modes fall back to each other before giving up on low latency, relaxed FIFO to plain FIFO
+        std::vector<VkPresentModeKHR> candidates = { preferred };
+        if (preferred == VK_PRESENT_MODE_MAILBOX_KHR) {
+            candidates.push_back(VK_PRESENT_MODE_IMMEDIATE_KHR);
+        } else if (preferred == VK_PRESENT_MODE_IMMEDIATE_KHR) {
+            candidates.push_back(VK_PRESENT_MODE_MAILBOX_KHR);
+        }
 
+        for (auto candidate : candidates) {
+            if (std::find(available.begin(), available.end(), candidate) != available.end()) {
+                return candidate;
+            }
+        }
 
+        return VK_PRESENT_MODE_FIFO_KHR;
     }
 
-    std::vector<char> VkUtils::ReadShader(const std::string &filename) {
-        std::ifstream file(filename, std::ios::ate | std::ios::binary);
+    uint32_t VkUtils::SwapChainImageCount(const SwapChainConfiguration& config) {
+        uint32_t imageCount;
 
-        if (!file.is_open()) {
-            throw std::runtime_error("Failed to open shader file");
+        switch (config.presentMode) {
+            case VK_PRESENT_MODE_MAILBOX_KHR:
+                // One image on screen, one queued and one to render into, or rendering blocks on the queue
+                imageCount = std::max(config.capabilities.minImageCount + 1, 3u);
+                break;
+            case VK_PRESENT_MODE_IMMEDIATE_KHR:
+                // Nothing waits for the blank, more images would only add queued frames
+                imageCount = std::max(config.capabilities.minImageCount, 2u);
+                break;
+            default:
+                // One spare image so the acquire doesn't wait on the presentation engine releasing one
+                imageCount = config.capabilities.minImageCount + 1;
+                break;
         }
 
-        size_t fileSize = file.tellg();
-        std::vector<char> buffer(fileSize);
-        file.seekg(0);
-        file.read(buffer.data(), fileSize);
-        file.close();
+        if (config.capabilities.maxImageCount > 0) {
+            imageCount = std::min(imageCount, config.capabilities.maxImageCount);
+        }
 
-        return buffer;
+        return imageCount;
     }
 
-    void VkUtils::CreateGraphicsPipeline(VkDevice device, VkExtent2D extent, VkFormat format, VkPipelineLayout *layout,
-                                         VkRenderPass *renderPass, VkPipeline *graphicsPipeline) {
+    void VkUtils::CreateImageViews(std::vector<VkImage>& swapChainImages, VkDevice device, VkFormat format, std::vector<VkImageView>& views) {
+        views.resize(swapChainImages.size());
+
 
     }
 
-    VkShaderModule VkUtils::CreateShaderModule(const std::vector<char>& code, VkDevice device) {
+    VkShaderModule VkUtils::CreateShaderModule(const uint32_t* code, size_t codeSize, VkDevice device) {
         VkShaderModuleCreateInfo createInfo{};
         createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-        createInfo.codeSize = code.size();
-        createInfo.pCode = (const uint32_t*)code.data();
+        createInfo.codeSize = codeSize;
+        createInfo.pCode = code;
 
         VkShaderModule shaderModule;
         if (VK_SUCCESS != vkCreateShaderModule(device, &createInfo, nullptr, &shaderModule)) {
@@ -354,4 +647,82 @@ namespace m4x {
         }
     }
 
+    VkImage VkUtils::CreateImage(VkDevice device, VkExtent2D extent, VkFormat format, VkImageUsageFlags usage,
+                                 uint32_t mipLevels) {
+        VkImageCreateInfo imageInfo{};
+        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageInfo.format = format;
+        imageInfo.extent = { extent.width, extent.height, 1 };
+        imageInfo.mipLevels = mipLevels;
+        imageInfo.arrayLayers = 1;
+        imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageInfo.usage = usage;
+        imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+        VkImage image;
+        if (VK_SUCCESS != vkCreateImage(device, &imageInfo, nullptr, &image)) {
+            throw std::runtime_error("Failed to create an image");
+        }
+
+        return image;
+    }
+
+    VkImageView VkUtils::CreateImageView(VkDevice device, VkImage image, VkFormat format, uint32_t mipLevels) {
+        VkImageViewCreateInfo viewInfo{};
+        viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        viewInfo.image = image;
+        viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        viewInfo.format = format;
+        viewInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+        viewInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+        viewInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+        viewInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+
+        viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        viewInfo.subresourceRange.baseMipLevel = 0;
+        viewInfo.subresourceRange.levelCount = mipLevels;
+        viewInfo.subresourceRange.baseArrayLayer = 0;
+        viewInfo.subresourceRange.layerCount = 1;
+
+        VkImageView view;
+        if (VK_SUCCESS != vkCreateImageView(device, &viewInfo, nullptr, &view)) {
+            throw std::runtime_error("Failed to create image views");
+        }
+
+        return view;
+    }
+
+    VkSemaphore VkUtils::CreateTimelineSemaphore(VkDevice device, uint64_t initialValue) {
+        VkSemaphoreTypeCreateInfo typeInfo{};
+        typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+        typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+        typeInfo.initialValue = initialValue;
+
+        VkSemaphoreCreateInfo semaphoreInfo{};
+        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        semaphoreInfo.pNext = &typeInfo;
+
+        VkSemaphore semaphore;
+        if (VK_SUCCESS != vkCreateSemaphore(device, &semaphoreInfo, nullptr, &semaphore)) {
+            throw std::runtime_error("Failed to create a timeline semaphore");
+        }
+
+        return semaphore;
+    }
+
+    void VkUtils::WaitTimeline(VkDevice device, VkSemaphore semaphore, uint64_t value) {
+        VkSemaphoreWaitInfo waitInfo{};
+        waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+        waitInfo.semaphoreCount = 1;
+        waitInfo.pSemaphores = &semaphore;
+        waitInfo.pValues = &value;
+
+        if (VK_SUCCESS != vkWaitSemaphores(device, &waitInfo, UINT64_MAX)) {
+            throw std::runtime_error("Failed to wait on a timeline semaphore");
+        }
+    }
+
 } // m4x
\ No newline at end of file
@@ -30,6 +30,11 @@ const std::vector<const char*> deviceExtensions = {
         VK_KHR_SWAPCHAIN_EXTENSION_NAME,
 };
 
+/**
+ * Extensions used by the engine when rendering offscreen, nothing is presented so no swapchain
+ */
+const std::vector<const char*> headlessDeviceExtensions = {};
+
 // Enable validation layers for debug builds
 
 #ifdef NDEBUG
@@ -45,6 +50,10 @@ namespace m4x {
     struct QueueFamilyIndices {
         std::optional<uint32_t> graphicsFamily;
         std::optional<uint32_t> presentFamily;
+        // A transfer capable family without graphics, empty if the device has none
+        std::optional<uint32_t> transferFamily;
+        // A compute capable family without graphics, empty if the device has none
+        std::optional<uint32_t> computeFamily;
 
         [[nodiscard]] bool isComplete() const {
             return graphicsFamily.has_value() && presentFamily.has_value();
@@ -70,6 +79,30 @@ namespace m4x {
         VkExtent2D          extent;
     };
 
+    /**
+     * Everything about a physical device that doesn't depend on a surface, queried once per device
+     */
+    struct DeviceCapabilities {
+        VkPhysicalDeviceProperties           properties;
+        VkPhysicalDeviceFeatures             features;
+        VkPhysicalDeviceMemoryProperties     memoryProperties;
+        std::vector<VkQueueFamilyProperties> queueFamilies;
+        std::vector<VkExtensionProperties>   extensions;
+        // Vulkan 1.2 feature, cross queue work is ordered with timeline semaphores
+        bool                                 timelineSemaphore = false;
+        // VK_KHR_dynamic_rendering and VK_KHR_synchronization2 with both features, rendering then needs no
+        // render pass or framebuffer objects
+        bool                                 dynamicRendering  = false;
+        // Vulkan 1.2 descriptor indexing features the bindless DescriptorHeap needs: runtime sized arrays that
+        // are partially bound, updatable after binding and indexable by non-uniform values
+        bool                                 descriptorIndexing = false;
+
+        /**
+         * Size of the largest device local heap, shared system memory on integrated GPUs
+         */
+        [[nodiscard]] VkDeviceSize deviceLocalMemory() const;
+    };
+
     /**
      * Vulkan utilities in form of static functions.
      * It will use the engine's defaults as the input parameters.
@@ -80,24 +113,57 @@ namespace m4x {
         /**
          * Creates a Vulkan instance with engine defaults
          * @param instance [out] The created instance
+         * @param headless [in] Skips the window system extensions GLFW asks for
          */
-        static void CreateVkInstance(VkInstance* instance);
+        static void CreateVkInstance(VkInstance* instance, bool headless = false);
 
         /**
-         * Picks a suitable GPU
+         * Picks the suitable GPU with the highest score, unless one is asked for by name or index.
+         * The M4X_DEVICE environment variable is used when preference is empty.
          * @param instance [in] Instance to query
-         * @param surface [in] Surface the device has to be compatible with
+         * @param surface [in] Surface the device has to be compatible with, if VK_NULL_HANDLE presenting isn't required
+         * @param preference [in] Enumeration index or part of the device name, case insensitive, empty to score
          * @param physicalDevice [out] The GPU found
          */
-        static void PickPhysicalDevice(VkInstance instance, VkSurfaceKHR surface, VkPhysicalDevice* physicalDevice);
+        static void PickPhysicalDevice(VkInstance instance, VkSurfaceKHR surface, const std::string& preference,
+                                       VkPhysicalDevice* physicalDevice);
+
+        /**
+         * Queries the properties, features, memory, queue families and extensions of a device on the first call
+         * and returns the cached copy afterwards
+         * @param physicalDevice [in] Device to query
+         * @return Capabilities, valid for the rest of the program
+         */
+        static const DeviceCapabilities& QueryDeviceCapabilities(VkPhysicalDevice physicalDevice);
 
         /**
          * Creates a logical device to interface with
          * @param physicalDevice [in] The physical device to use
-         * @param surface [in] Surface that the device will be working with
+         * @param indices [in] Queue families to create a queue for
+         * @param extensions [in] Device extensions to enable
+         * @param features [in] Device features to enable
+         * @param next [in] Chain of feature structures beyond Vulkan 1.0, may be nullptr
          * @param device [out] The created device
          */
-        static void CreateLogicalDevice(VkPhysicalDevice physicalDevice, QueueFamilyIndices indices, VkDevice* device);
+        static void CreateLogicalDevice(VkPhysicalDevice physicalDevice, QueueFamilyIndices indices,
+                                        const std::vector<const char*>& extensions,
+                                        const VkPhysicalDeviceFeatures& features, const void* next,
+                                        VkDevice* device);
+
+        /**
+         * Checks for an optional device extension
+         * @param physicalDevice [in] Device to query
+         * @param extension [in] Name of the extension
+         * @return If the device supports it
+         */
+        static bool SupportsDeviceExtension(VkPhysicalDevice physicalDevice, const char* extension);
+
+        /**
+         * Selects the device extension list for the surface
+         * @param surface [in] Surface to present to, VK_NULL_HANDLE when rendering headless
+         * @return Extensions the engine requires
+         */
+        static const std::vector<const char*>& RequiredDeviceExtensions(VkSurfaceKHR surface);
 
         /**
          * Finds needed queue families
@@ -112,9 +178,18 @@ namespace m4x {
          * @param device [in] Device for which the swapChain will be created
          * @param surface [in] Surface that the swapChain will be connected to
          * @param window [in] Swapchain's window
+         * @param presentMode [in] Preferred present mode, the closest supported one is picked if it isn't available
          * @return Swapchain configuration
          */
-        static SwapChainConfiguration RetrieveSwapChainConfig(VkPhysicalDevice device, VkSurfaceKHR surface, GLFWwindow* window);
+        static SwapChainConfiguration RetrieveSwapChainConfig(VkPhysicalDevice device, VkSurfaceKHR surface,
+                                                              GLFWwindow* window, VkPresentModeKHR presentMode);
+
+        /**
+         * Picks the amount of swapchain images suited to the configured present mode
+         * @param config [in] Chosen swapchain configuration
+         * @return Image count within the surface's limits
+         */
+        static uint32_t SwapChainImageCount(const SwapChainConfiguration& config);
 
         /**
          * Creates a swapChain
@@ -129,27 +204,66 @@ namespace m4x {
 
         static void CreateImageViews(std::vector<VkImage>& swapChainImages, VkDevice device, VkFormat format, std::vector<VkImageView>& views);
 
-        static std::vector<char> ReadShader(const std::string& filename);
-
-        static void
-        CreateGraphicsPipeline(VkDevice device, VkExtent2D extent, VkFormat format, VkPipelineLayout *layout,
-                               VkRenderPass *renderPass, VkPipeline *graphicsPipeline);
-
-        static VkShaderModule CreateShaderModule(const std::vector<char>& code, VkDevice device);
+        /**
+         * Creates a shader module straight from the code, which has to stay valid for the call only
+         * @param code [in] SPIR-V words, 4 byte aligned as Vulkan requires
+         * @param codeSize [in] Size of the code in bytes
+         * @param device [in] Logical device
+         */
+        static VkShaderModule CreateShaderModule(const uint32_t* code, size_t codeSize, VkDevice device);
 
         static void
         CreateFramebuffers(VkDevice device, std::vector<VkFramebuffer> &framebuffers, VkExtent2D extent,
                            std::vector<VkImageView> &views, VkRenderPass renderPass);
 
         static void CreateCommandPool(VkDevice device, uint32_t graphicsQueueFamilyIndex, VkCommandPool *commandPool);
+
+        /**
+         * Creates a single sampled 2D image with optimal tiling, memory has to be bound by the caller
+         * @param device [in] Logical device
+         * @param extent [in] Size of the image
+         * @param format [in] Format of the image
+         * @param usage [in] Image usage
+         * @param mipLevels [in] Levels of the mip chain, extent being level 0
+         * @return The created image
+         */
+        static VkImage CreateImage(VkDevice device, VkExtent2D extent, VkFormat format, VkImageUsageFlags usage,
+                                   uint32_t mipLevels = 1);
+
+        /**
+         * Creates a 2D color view of the whole image
+         * @param device [in] Logical device
+         * @param image [in] Image to view
+         * @param format [in] Format of the image
+         * @param mipLevels [in] Levels of the image
+         * @return The created view
+         */
+        static VkImageView CreateImageView(VkDevice device, VkImage image, VkFormat format, uint32_t mipLevels = 1);
+
+        /**
+         * Creates a timeline semaphore
+         * @param device [in] Logical device, the timelineSemaphore feature has to be enabled
+         * @param initialValue [in] Value the counter starts at
+         * @return The created semaphore
+         */
+        static VkSemaphore CreateTimelineSemaphore(VkDevice device, uint64_t initialValue = 0);
+
+        /**
+         * Blocks until a timeline semaphore reaches the value
+         * @param device [in] Logical device
+         * @param semaphore [in] Timeline semaphore
+         * @param value [in] Value to wait for
+         */
+        static void WaitTimeline(VkDevice device, VkSemaphore semaphore, uint64_t value);
     private:
 
         /**
          * Checks if the device supports engine extensions
          * @param device [in] Device we want to check on
+         * @param extensions [in] Extensions that are required
          * @return If the device supports the defined extensions
          */
-        static bool deviceExtensionSupport(VkPhysicalDevice device);
+        static bool deviceExtensionSupport(VkPhysicalDevice device, const std::vector<const char*>& extensions);
 
         /**
          * Checks if the defined validation layers are supported
@@ -158,7 +272,9 @@ namespace m4x {
         static bool validationLayerSupport();
 
         /**
-         * Retrieves supported features for the swapChain by the device
+         * Retrieves supported features for the swapChain by the device.
+         * Formats and present modes are cached per device and surface, the capabilities change with the window
+         * and are queried every time.
          * @param device [in] Device to query
          * @param surface [in] Surface to ensure compatibility
          * @return Supported features and other info needed for creation
@@ -169,17 +285,35 @@ namespace m4x {
          * Selects out of available properties for the creation of a swapChain
          * @param properties [in] The available properties
          * @param window [in] The window the swapChain will be created for
+         * @param presentMode [in] Preferred present mode
          * @return A swapChain config that could be used for creation
          */
-        static SwapChainConfiguration selectSwapChainProperties(const SwapChainSupportDetails& properties, GLFWwindow* window);
+        static SwapChainConfiguration selectSwapChainProperties(const SwapChainSupportDetails& properties,
+                                                                GLFWwindow* window, VkPresentModeKHR presentMode);
+
+        /**
+         * Falls back to the nearest supported mode, ending at FIFO which every surface supports
+         * @param available [in] Modes the surface supports
+         * @param preferred [in] Mode asked for
+         * @return Mode to create the swapChain with
+         */
+        static VkPresentModeKHR selectPresentMode(const std::vector<VkPresentModeKHR>& available,
+                                                  VkPresentModeKHR preferred);
 
         /**
          * Checks if the device supports all the required operations
          * @param device [in] Device to check
-         * @param surface [in] Surface to check compatibility with
+         * @param surface [in] Surface to check compatibility with, VK_NULL_HANDLE when rendering headless
          * @return If device is suitable for engine operations
          */
         static bool isDeviceSuitable(VkPhysicalDevice device, VkSurfaceKHR surface);
 
+        /**
+         * Rates a suitable device, the device type outweighs everything else
+         * @param device [in] Device to rate
+         * @return Higher is better
+         */
+        static uint64_t scoreDevice(VkPhysicalDevice device);
+
     };
 } // m4x
@@ -4,10 +4,9 @@
 #include <stdexcept>
 #include <iostream>
 
-int main() {
-    m4x::M4xApp app{};
-
+int main(int argc, char** argv) {
     try {
+        m4x::M4xApp app{m4x::AppConfig::FromArgs(argc, argv)};
         app.run();
     } catch (const std::exception& e){
         std::cerr << e.what() << std::endl;
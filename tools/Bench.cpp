@@ -0,0 +1,38 @@
+//
+// Created by m4tex on 17/10/26.
+//
+
+#include "M4xApp.h"
+
+//std
+#include <stdexcept>
+#include <iostream>
+
+/**
+ * Renders one synthetic scene headless and writes a JSON report of its frame times, GPU passes, startup phases
+ * and memory use. Runs without a window, so it works on software drivers, --device llvmpipe picks lavapipe.
+ * Usage: m4xbench --scene triangles|draws|pipelines|uploads [--scene-size N] [--frames N] [--warmup N]
+ *                 [--report bench.json] [m4xdev options]...
+ */
+int main(int argc, char** argv) {
+    try {
+        m4x::AppConfig config = m4x::AppConfig::FromArgs(argc, argv);
+        if (config.benchScene == m4x::BenchScene::None) {
+            std::cerr << "Usage: " << argv[0] << " --scene triangles|draws|pipelines|uploads [--scene-size N]"
+                      << " [--frames N] [--warmup N] [--report bench.json] [--device llvmpipe]" << std::endl;
+            return EXIT_FAILURE;
+        }
+        config.headless = true;
+        // The report only has the GPU time of the passes, statistics queries would just add to it
+        config.profileGpu = true;
+        config.profileGpuStatistics = false;
+
+        m4x::M4xApp app{config};
+        app.run();
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,54 @@
+//
+// Created by m4tex on 17/10/26.
+//
+
+#include "ShaderArchive.h"
+#include "MappedFile.h"
+
+//std
+#include <cstring>
+#include <stdexcept>
+#include <iostream>
+#include <vector>
+
+/**
+ * Packs compiled shaders into the archive the engine loads them from, reflecting each one.
+ * Usage: m4xshaders <archive> <shader.spv>...
+ * A shader is named after its file without the .spv extension, shader.frag.spv becomes shader.frag.
+ */
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " <archive> <shader.spv>..." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    try {
+        std::vector<m4x::ShaderSource> shaders;
+        size_t codeSize = 0;
+
+        for (int i = 2; i < argc; ++i) {
+            std::filesystem::path path = argv[i];
+
+            m4x::MappedFile file;
+            file.open(path);
+            if (file.size() % sizeof(uint32_t) != 0) {
+                throw std::runtime_error(path.string() + " isn't SPIR-V");
+            }
+
+            m4x::ShaderSource& shader = shaders.emplace_back();
+            shader.name = path.extension() == ".spv" ? path.stem().string() : path.filename().string();
+            shader.code.resize(file.size() / sizeof(uint32_t));
+            std::memcpy(shader.code.data(), file.data(), file.size());
+            codeSize += file.size();
+        }
+
+        m4x::ShaderArchive::Write(argv[1], shaders);
+        std::cout << "Packed " << shaders.size() << " shaders (" << codeSize << " bytes of SPIR-V) into " << argv[1]
+                  << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}